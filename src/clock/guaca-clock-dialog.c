@@ -0,0 +1,719 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-clock-private.h"
+#include "guaca-zone-db.h"
+#include "guaca-zone-index.h"
+#include "guaca-input-latency.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
+#include <glib/gi18n-lib.h>
+
+#include <gmodule.h>
+#include <mex/mex.h>
+
+#ifndef HAVE_MX_COMBO_BOX_POPULATE
+#error You need mx-combo-box-populate.patch from Guacamayo
+#endif
+
+/*
+ * Where the box is, as latitude and longitude in decimal degrees, or in the
+ * ISO 6709 form used by zone.tab; used to suggest the nearest timezone.
+ */
+#define LOCATION_FILE "/etc/guacamayo/location"
+
+static void
+guaca_clock_timezone_helper_cb (GPid pid, gint status, GuacaClock *self)
+{
+  g_spawn_close_pid (pid);
+
+  if (WIFEXITED (status) && !WEXITSTATUS (status))
+    self->priv->queue_tz_refresh (self);
+  else
+    g_warning ("guacamayo-timezone failed with status %d", status);
+}
+
+static long
+guaca_clock_get_rss_kb (void)
+{
+  char          buf[128];
+  unsigned long size, resident;
+  gssize        r;
+  int           fd;
+
+  if ((fd = open ("/proc/self/statm", O_RDONLY | O_CLOEXEC)) < 0)
+    return 0;
+
+  r = read (fd, buf, sizeof (buf) - 1);
+  close (fd);
+
+  if (r <= 0)
+    return 0;
+
+  buf[r] = 0;
+
+  if (sscanf (buf, "%lu %lu", &size, &resident) != 2)
+    return 0;
+
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void
+guaca_clock_release_zone_db (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  long               rss, freed;
+
+  if (!priv->zone_db)
+    return;
+
+  rss = guaca_clock_get_rss_kb ();
+
+  guaca_zone_db_free (priv->zone_db);
+  priv->zone_db = NULL;
+
+  freed = guaca_clock_get_rss_kb ();
+
+#ifdef HAVE_MALLOC_TRIM
+  /*
+   * The freed memory is mostly small chunks below the top of the heap, which
+   * free() alone never gives back.
+   */
+  malloc_trim (0);
+#endif
+
+  /* the unmapped cache goes with the free, the heap with the trim */
+  g_debug ("Released timezone database, RSS %ld kB -> %ld kB freed "
+           "-> %ld kB trimmed", rss, freed, guaca_clock_get_rss_kb ());
+}
+
+static void
+guaca_clock_close_cb (void *dialog, GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+
+  mex_push_focus (MX_FOCUSABLE (priv->button));
+}
+
+/*
+ * Get the timezone string representing the current selection in our
+ * combo boxes.
+ */
+static const char *
+guaca_clock_get_current_zone (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  int                i_p, i_c;
+  const char        *region;
+  GList             *l;
+
+  if ((i_p = mx_combo_box_get_index (MX_COMBO_BOX (priv->regions_combo))) < 0)
+    return NULL;
+
+  i_c = mx_combo_box_get_index (MX_COMBO_BOX (priv->city_combo));
+
+  if (priv->by_country)
+    {
+      const TzCountry *countries;
+      guint            n_countries;
+
+      countries = guaca_zone_db_get_countries (priv->zone_db, &n_countries);
+
+      if (i_p >= n_countries)
+        return NULL;
+
+      /* Countries with a single zone have no city selection */
+      if (countries[i_p].n_zones == 1)
+        return countries[i_p].zones[0]->zone;
+
+      if (i_c < 0 || i_c >= countries[i_p].n_zones)
+        return NULL;
+
+      return countries[i_p].zones[i_c]->zone;
+    }
+
+  if (i_c < 0)
+    return NULL;
+
+  region = mx_combo_box_get_active_text (MX_COMBO_BOX (priv->regions_combo));
+  if ((l = guaca_zone_db_lookup_region (priv->zone_db, region)))
+    {
+      TzEntry *e;
+
+      if ((e = g_list_nth_data (l, i_c)))
+        return e->zone;
+      else
+        g_warning ("No TzEntry for current city selection '%s'",
+                   mx_combo_box_get_active_text (MX_COMBO_BOX (
+                                                          priv->city_combo)));
+    }
+  else
+    g_warning ("No hashtable entry for region '%s'", region);
+
+  return NULL;
+}
+
+static void
+guaca_clock_dialog_mapped_cb (ClutterActor *dialog,
+                              GParamSpec   *pspec,
+                              GuacaClock   *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  ClutterActor      *parent;
+
+  parent = clutter_actor_get_parent (priv->dialog);
+  clutter_actor_remove_child (parent, priv->dialog);
+  priv->dialog = NULL;
+
+  if (priv->low_memory)
+    guaca_clock_release_zone_db (self);
+}
+
+static gboolean
+guaca_clock_close_dialog_cb (MxAction *unused, GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  const char        *zone;
+
+  if ((zone = guaca_clock_get_current_zone (self)) &&
+      g_strcmp0 (zone, priv->orig_zone))
+    {
+      GError *error  = NULL;
+      char   *argv[] = { "guacamayo-timezone", (char *) zone, NULL };
+      GPid    pid;
+
+      /*
+       * Watch the helper, so we can refresh our timezone state as soon as it
+       * is done.
+       */
+      if (!g_spawn_async (NULL, argv, NULL,
+                          G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                          NULL, NULL, &pid, &error))
+        {
+          g_warning ("Failed to execute guacamayo-timezone: %s",
+                     error->message);
+          g_clear_error (&error);
+        }
+      else
+        g_child_watch_add (pid, (GChildWatchFunc)guaca_clock_timezone_helper_cb,
+                           self);
+    }
+
+  /*
+   * Hide the dialog, this will trigger the default transition; once it is
+   * no longer visible, destroy it.
+   *
+   * We have to use the mapped property here; MxDialog runs custom animation
+   * using a timeline and the 'visible' property is set well before the
+   * animation finishes.
+   */
+  g_signal_connect (priv->dialog, "notify::mapped",
+                    G_CALLBACK (guaca_clock_dialog_mapped_cb), self);
+  clutter_actor_hide (priv->dialog);
+  mex_push_focus (MX_FOCUSABLE (priv->button));
+
+  return FALSE;
+}
+
+/*
+ * Returns the index of the zone's region, or country, in the first combo box
+ * and stores the index of the zone in the city combo box in city_idx.
+ */
+static int
+guaca_clock_find_zone (GuacaClock *self, const TzEntry *e, int *city_idx)
+{
+  GuacaClockPrivate *priv = self->priv;
+  int                idx, i;
+
+  *city_idx = -1;
+
+  if (priv->by_country)
+    {
+      const TzCountry *countries;
+      guint            n_countries;
+
+      countries = guaca_zone_db_get_countries (priv->zone_db, &n_countries);
+
+      if ((idx = guaca_zone_db_get_country_index (priv->zone_db,
+                                                  e->country)) < 0)
+        return -1;
+
+      for (i = 0; i < countries[idx].n_zones; i++)
+        if (countries[idx].zones[i] == e)
+          *city_idx = i;
+    }
+  else
+    {
+      GList *l;
+
+      if ((idx = guaca_zone_db_get_region_index (priv->zone_db,
+                                                 e->region)) < 0)
+        return -1;
+
+      l = guaca_zone_db_lookup_region (priv->zone_db, e->region);
+
+      for (i = 0; l; l = l->next, i++)
+        if (l->data == e)
+          *city_idx = i;
+    }
+
+  return idx;
+}
+
+/*
+ * Selects the given zone in the combo boxes.
+ */
+static void
+guaca_clock_select_zone (GuacaClock *self, const TzEntry *e)
+{
+  GuacaClockPrivate *priv = self->priv;
+  int                idx, city_idx;
+
+  if ((idx = guaca_clock_find_zone (self, e, &city_idx)) < 0)
+    return;
+
+  mx_combo_box_set_index (MX_COMBO_BOX (priv->regions_combo), idx);
+
+  if (city_idx >= 0)
+    mx_combo_box_set_index (MX_COMBO_BOX (priv->city_combo), city_idx);
+}
+
+static void
+guaca_clock_suggestion_clicked_cb (MxButton *button, GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+
+  if (priv->suggested)
+    guaca_clock_select_zone (self, priv->suggested);
+}
+
+/*
+ * Reads the location of the box from GUACA_LOCATION, or failing that, from
+ * LOCATION_FILE; both hold the latitude and longitude separated by a space
+ * or a comma, or a single ISO 6709 string.
+ */
+static gboolean
+guaca_clock_read_location (double *latitude, double *longitude)
+{
+  const char *env = g_getenv ("GUACA_LOCATION");
+  char       *contents = NULL;
+  const char *s;
+  char       *end;
+  gboolean    ret = FALSE;
+
+  if (env && *env)
+    s = env;
+  else if (g_file_get_contents (LOCATION_FILE, &contents, NULL, NULL))
+    s = g_strstrip (contents);
+  else
+    return FALSE;
+
+  if (guaca_zone_parse_iso6709 (s, latitude, longitude))
+    ret = TRUE;
+  else
+    {
+      *latitude = g_ascii_strtod (s, &end);
+
+      if (end != s)
+        {
+          s = end;
+
+          while (*s == ' ' || *s == ',')
+            s++;
+
+          *longitude = g_ascii_strtod (s, &end);
+
+          ret = end != s && *latitude >= -90.0 && *latitude <= 90.0 &&
+            *longitude >= -180.0 && *longitude <= 180.0;
+        }
+    }
+
+  if (!ret)
+    g_warning ("Invalid location '%s'", env && *env ? env : contents);
+
+  g_free (contents);
+
+  return ret;
+}
+
+static gboolean
+guaca_clock_key_press_cb (ClutterActor    *actor,
+                          ClutterKeyEvent *event,
+                          GuacaClock      *self)
+{
+  GUACA_INPUT_LATENCY_MARK (actor);
+
+  if (MEX_KEY_BACK (event->keyval))
+    {
+      guaca_clock_close_dialog_cb (NULL, self);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Callback for when the selection in the Region (or Country) combo changes.
+ */
+static void
+guaca_clock_regions_index_cb (MxComboBox *combo,
+                              GParamSpec *pspec,
+                              GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  int                idx, i;
+  const char        *text;
+  const TzEntry     *orig;
+  GList             *l = NULL;
+  GArray            *cities;
+
+  GUACA_INPUT_LATENCY_MARK (CLUTTER_ACTOR (combo));
+
+  if (((idx = mx_combo_box_get_index (combo)) < 0) ||
+      !(text = mx_combo_box_get_active_text (combo)))
+    return;
+
+  orig = guaca_zone_db_lookup_zone (priv->zone_db, priv->orig_zone);
+
+  mx_combo_box_remove_all (MX_COMBO_BOX (priv->city_combo));
+  cities = g_array_sized_new (TRUE, FALSE, sizeof (char *), 150);
+
+  if (priv->by_country)
+    {
+      const TzCountry *countries, *c;
+      guint            n_countries;
+
+      countries = guaca_zone_db_get_countries (priv->zone_db, &n_countries);
+
+      if (idx >= n_countries)
+        {
+          g_array_unref (cities);
+          return;
+        }
+
+      c   = &countries[idx];
+      idx = -1;
+
+      /*
+       * A country with a single zone is selected with the country itself.
+       */
+      if (c->n_zones == 1)
+        {
+          clutter_actor_hide (priv->city_combo);
+          g_array_unref (cities);
+          return;
+        }
+
+      for (i = 0; i < c->n_zones; i++)
+        {
+          const TzEntry *e = c->zones[i];
+          const char    *city = e->city ? e->city : e->zone;
+
+          if (e == orig)
+            idx = i;
+
+          g_array_append_val (cities, city);
+        }
+    }
+  else
+    {
+      if (!(l = guaca_zone_db_lookup_region (priv->zone_db, text)))
+        {
+          g_warning ("No hashtable entry for '%s'", text);
+          g_array_unref (cities);
+          return;
+        }
+
+      idx = -1;
+
+      for (i = 0; l; l = l->next, i++)
+        {
+          TzEntry *e = l->data;
+
+          if (e == orig)
+            idx = i;
+
+          g_array_append_val (cities, e->city);
+        }
+    }
+
+  if (cities->len)
+    mx_combo_box_populate (MX_COMBO_BOX (priv->city_combo),
+                           (const char **)cities->data);
+
+  g_array_unref (cities);
+
+  if (idx >= 0)
+    mx_combo_box_set_index (MX_COMBO_BOX (priv->city_combo), idx);
+  else
+    mx_combo_box_set_index (MX_COMBO_BOX (priv->city_combo), 0);
+
+  clutter_actor_show (priv->city_combo);
+}
+
+#ifdef ENABLE_INPUT_LATENCY
+static void
+guaca_clock_city_index_cb (MxComboBox *combo,
+                           GParamSpec *pspec,
+                           GuacaClock *self)
+{
+  GUACA_INPUT_LATENCY_MARK (CLUTTER_ACTOR (combo));
+}
+#endif
+
+/*
+ * Fills the first combo box with either the regions or the countries, and
+ * selects the one of the current zone.
+ */
+static void
+guaca_clock_populate_regions (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  GArray            *names;
+  const TzEntry     *orig;
+  int                idx = -1, city_idx;
+
+  names = g_array_sized_new (TRUE, FALSE, sizeof (char *), 250);
+
+  if (priv->by_country)
+    {
+      const TzCountry *countries;
+      guint            n_countries, i;
+
+      countries = guaca_zone_db_get_countries (priv->zone_db, &n_countries);
+
+      for (i = 0; i < n_countries; i++)
+        g_array_append_val (names, countries[i].name);
+    }
+  else
+    {
+      GList *keys, *l;
+
+      keys = guaca_zone_db_get_regions (priv->zone_db);
+
+      for (l = keys; l; l = l->next)
+        {
+          const char *region = l->data;
+
+          g_array_append_val (names, region);
+        }
+
+      g_list_free (keys);
+    }
+
+  /*
+   * Populating the combo box must not trigger the city update for the
+   * previous mode; we run it ourselves once everything is in place.
+   */
+  g_signal_handlers_block_by_func (priv->regions_combo,
+                                   guaca_clock_regions_index_cb, self);
+
+  mx_combo_box_remove_all (MX_COMBO_BOX (priv->regions_combo));
+
+  if (names->len)
+    mx_combo_box_populate (MX_COMBO_BOX (priv->regions_combo),
+                           (const char **)names->data);
+
+  g_array_unref (names);
+
+  if ((orig = guaca_zone_db_lookup_zone (priv->zone_db, priv->orig_zone)))
+    idx = guaca_clock_find_zone (self, orig, &city_idx);
+
+  if (idx >= 0)
+    mx_combo_box_set_index (MX_COMBO_BOX (priv->regions_combo), idx);
+
+  g_signal_handlers_unblock_by_func (priv->regions_combo,
+                                     guaca_clock_regions_index_cb, self);
+
+  if (idx >= 0)
+    guaca_clock_regions_index_cb (MX_COMBO_BOX (priv->regions_combo),
+                                  NULL, self);
+  else
+    clutter_actor_hide (priv->city_combo);
+}
+
+static void
+guaca_clock_by_country_cb (ClutterActor *toggle,
+                           GParamSpec   *pspec,
+                           GuacaClock   *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+
+  priv->by_country = mx_toggle_get_active (MX_TOGGLE (toggle));
+
+  guaca_clock_populate_regions (self);
+}
+
+/*
+ * Builds and shows the dialog; called by the plugin each time it is opened.
+ */
+G_MODULE_EXPORT void
+guaca_clock_dialog_open (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  ClutterActor      *dialog, *layout, *label, *toggle;
+  MxAction          *close;
+  char              *text;
+  int                row = 0;
+  FILE              *f;
+  char               buf[512];
+  double             latitude, longitude, distance;
+  const TzEntry     *orig;
+
+  /*
+   * Get the current zone
+   */
+  if ((f = fopen ("/etc/timezone", "r")) &&
+      fgets (buf, sizeof (buf), f))
+    {
+      char *n;
+
+      /* ensure 0-terminated, strip trailing \n */
+      buf[sizeof (buf)-1] = 0;
+
+      if ((n = strchr (buf, '\n')))
+        *n = 0;
+
+      g_free (priv->orig_zone);
+      priv->orig_zone = g_strdup (buf);
+      fclose (f);
+    }
+  else
+    g_warning ("Failed to open /etc/timezone: %s", strerror (errno));
+
+  dialog = mx_dialog_new ();
+  mx_stylable_set_style_class (MX_STYLABLE (dialog), "MexInfoBarDialog");
+
+  close = mx_action_new_full ("close", _("Close"),
+                              G_CALLBACK (guaca_clock_close_dialog_cb), self);
+  mx_dialog_add_action (MX_DIALOG (dialog), close);
+
+  layout = mx_table_new ();
+  mx_table_set_column_spacing (MX_TABLE (layout), 10);
+  mx_table_set_row_spacing (MX_TABLE (layout), 20);
+  mx_bin_set_child (MX_BIN (dialog), layout);
+
+  label = mx_label_new_with_text (_("Clock Settings"));
+  mx_stylable_set_style_class (MX_STYLABLE (label), "DialogHeader");
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 0);
+
+  label = mx_label_new_with_text (_("Timezone:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->regions_combo = mx_combo_box_new ();
+  priv->city_combo = mx_combo_box_new ();
+  clutter_actor_hide (priv->city_combo);
+
+  /*
+   * The database survives closing the dialog, unless we are short of memory.
+   */
+  if (!priv->zone_db)
+    priv->zone_db = guaca_zone_db_new ();
+
+  /*
+   * /etc/timezone can name an alias of a zone.tab zone, or be missing
+   * altogether; from here on we work with the zone.tab name.
+   */
+  if ((orig = guaca_zone_db_resolve_zone (priv->zone_db, priv->orig_zone)))
+    {
+      g_free (priv->orig_zone);
+      priv->orig_zone = g_strdup (orig->zone);
+    }
+
+  g_signal_connect (priv->regions_combo, "notify::index",
+                    G_CALLBACK (guaca_clock_regions_index_cb),
+                    self);
+
+#ifdef ENABLE_INPUT_LATENCY
+  g_signal_connect (priv->city_combo, "notify::index",
+                    G_CALLBACK (guaca_clock_city_index_cb), self);
+#endif
+
+  guaca_clock_populate_regions (self);
+
+  mx_table_insert_actor (MX_TABLE (layout), priv->regions_combo, row++, 1);
+  mx_table_insert_actor (MX_TABLE (layout), priv->city_combo, row++, 1);
+
+  label = mx_label_new_with_text (_("By country:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+  toggle = mx_toggle_new ();
+  mx_toggle_set_active (MX_TOGGLE (toggle), priv->by_country);
+  g_signal_connect (toggle, "notify::active",
+                    G_CALLBACK (guaca_clock_by_country_cb), self);
+  mx_table_insert_actor (MX_TABLE (layout), toggle, row++, 1);
+
+  /*
+   * If we know where we are, offer the nearest zone.
+   */
+  priv->suggested = NULL;
+
+  if (guaca_clock_read_location (&latitude, &longitude) &&
+      guaca_zone_db_nearest (priv->zone_db, latitude, longitude,
+                             &priv->suggested, &distance, 1))
+    {
+      ClutterActor *button;
+
+      label = mx_label_new_with_text (_("Nearest:"));
+      mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+      text = g_strdup_printf (_("%s (%.0f km)"),
+                              priv->suggested->city ?
+                              priv->suggested->city : priv->suggested->region,
+                              distance);
+      button = mx_button_new_with_label (text);
+      g_free (text);
+
+      g_signal_connect (button, "clicked",
+                        G_CALLBACK (guaca_clock_suggestion_clicked_cb), self);
+      mx_table_insert_actor (MX_TABLE (layout), button, row++, 1);
+    }
+
+  mx_dialog_set_transient_parent (MX_DIALOG (dialog), priv->transient_for);
+  g_signal_connect (dialog, "key-press-event",
+                    G_CALLBACK (guaca_clock_key_press_cb), self);
+
+  priv->dialog = dialog;
+
+  clutter_actor_show (dialog);
+  mex_push_focus (MX_FOCUSABLE (dialog));
+}
+
+/*
+ * Called by the plugin as it is disposed of.
+ */
+G_MODULE_EXPORT void
+guaca_clock_dialog_dispose (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+
+  guaca_zone_db_free (priv->zone_db);
+  priv->zone_db = NULL;
+}
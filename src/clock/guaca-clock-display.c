@@ -0,0 +1,477 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-clock-display.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+
+/* Older libc headers do not have this, though the kernel supports it */
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+#endif
+
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+
+#include <gmodule.h>
+#include <mex/mex.h>
+#include <mex/mex-info-bar-component.h>
+
+static void mex_info_bar_component_iface_init (MexInfoBarComponentIface *iface);
+static void guaca_clock_display_dispose (GObject *object);
+static void guaca_clock_display_finalize (GObject *object);
+
+G_DEFINE_TYPE_WITH_CODE (GuacaClockDisplay, guaca_clock_display, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (MEX_TYPE_INFO_BAR_COMPONENT,
+                                            mex_info_bar_component_iface_init));
+
+#define GUACA_CLOCK_DISPLAY_GET_PRIVATE(o) \
+(G_TYPE_INSTANCE_GET_PRIVATE ((o), GUACA_TYPE_CLOCK_DISPLAY, \
+                              GuacaClockDisplayPrivate))
+
+struct _GuacaClockDisplayPrivate
+{
+  ClutterActor *label;
+
+  char          text[64];
+
+  guint         tick_id;
+  guint         jump_id;
+  int           jump_fd;
+
+  GFileMonitor *localtime_monitor;
+  guint         tz_id;
+
+  gint64        last_real;
+  gint64        last_mono;
+
+  guint disposed : 1;
+};
+
+static void guaca_clock_display_schedule (GuacaClockDisplay *self);
+
+static void
+guaca_clock_display_class_init (GuacaClockDisplayClass *klass)
+{
+  GObjectClass *object_class = (GObjectClass *)klass;
+
+  g_type_class_add_private (klass, sizeof (GuacaClockDisplayPrivate));
+
+  object_class->dispose  = guaca_clock_display_dispose;
+  object_class->finalize = guaca_clock_display_finalize;
+}
+
+static void
+guaca_clock_display_init (GuacaClockDisplay *self)
+{
+  self->priv = GUACA_CLOCK_DISPLAY_GET_PRIVATE (self);
+
+  self->priv->jump_fd = -1;
+}
+
+static void
+guaca_clock_display_dispose (GObject *object)
+{
+  GuacaClockDisplay        *self = (GuacaClockDisplay*) object;
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  if (priv->disposed)
+    return;
+
+  priv->disposed = TRUE;
+
+  if (priv->tick_id)
+    {
+      g_source_remove (priv->tick_id);
+      priv->tick_id = 0;
+    }
+
+  if (priv->jump_id)
+    {
+      g_source_remove (priv->jump_id);
+      priv->jump_id = 0;
+    }
+
+  if (priv->localtime_monitor)
+    {
+      g_file_monitor_cancel (priv->localtime_monitor);
+      g_object_unref (priv->localtime_monitor);
+      priv->localtime_monitor = NULL;
+    }
+
+  if (priv->tz_id)
+    {
+      g_source_remove (priv->tz_id);
+      priv->tz_id = 0;
+    }
+
+  G_OBJECT_CLASS (guaca_clock_display_parent_class)->dispose (object);
+}
+
+static void
+guaca_clock_display_finalize (GObject *object)
+{
+  GuacaClockDisplay        *self = (GuacaClockDisplay*) object;
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  if (priv->jump_fd >= 0)
+    close (priv->jump_fd);
+
+  G_OBJECT_CLASS (guaca_clock_display_parent_class)->finalize (object);
+}
+
+static MexInfoBarLocation
+guaca_clock_display_get_location (MexInfoBarComponent *comp)
+{
+  return MEX_INFO_BAR_LOCATION_BUTTONS;
+}
+
+static int
+guaca_clock_display_get_location_index (MexInfoBarComponent *comp)
+{
+  return -1;
+}
+
+/*
+ * Updates the label text from the current wall clock time.
+ */
+static void
+guaca_clock_display_update (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  char                      text[sizeof (priv->text)];
+  time_t                    t;
+  struct tm                 tm;
+
+  /*
+   * Pick up any change of /etc/localtime; glibc only re-reads the zone file
+   * when it actually changed, so this is cheap.
+   */
+  tzset ();
+
+  t = time (NULL);
+  localtime_r (&t, &tm);
+
+  /* Translators: this is the strftime format of the info bar clock */
+  if (!strftime (text, sizeof (text), _("%H:%M"), &tm))
+    return;
+
+  /*
+   * Most updates change a single digit; the label is only touched when the
+   * text changed at all, and ClutterText itself only queues a relayout when
+   * the new text changes the size of the actor, otherwise just a redraw.
+   */
+  if (!strcmp (text, priv->text))
+    return;
+
+  strcpy (priv->text, text);
+  mx_label_set_text (MX_LABEL (priv->label), text);
+}
+
+static gboolean
+guaca_clock_display_tick_cb (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  priv->tick_id = 0;
+
+  guaca_clock_display_update (self);
+  guaca_clock_display_schedule (self);
+
+  return FALSE;
+}
+
+/*
+ * Arms the timer for the next wall clock minute. Using the seconds timeout
+ * lets glib coalesce our wakeup with any other second granularity timers in
+ * the process, at the cost of the update being up to a second or so late.
+ *
+ * glib rounds the expiry of such a timeout to a second of its own, which
+ * can be up to a quarter of a second early; the wait is rounded up with
+ * that margin, so that the tick never lands before the minute.
+ */
+#define SCHEDULE_MARGIN_US (G_USEC_PER_SEC / 4)
+
+static void
+guaca_clock_display_schedule (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  gint64                    now  = g_get_real_time ();
+  gint64                    wait;
+  guint                     secs;
+
+  if (priv->tick_id)
+    g_source_remove (priv->tick_id);
+
+  wait = 60 * G_USEC_PER_SEC - now % (60 * G_USEC_PER_SEC);
+  secs = (wait + SCHEDULE_MARGIN_US + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+
+  priv->last_real = now;
+  priv->last_mono = g_get_monotonic_time ();
+
+  priv->tick_id =
+    g_timeout_add_seconds (secs,
+                           (GSourceFunc) guaca_clock_display_tick_cb, self);
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+/*
+ * The wall clock jumped, either because it was set (e.g., by ntpdate after
+ * boot), or because the box resumed from suspend, during which our monotonic
+ * timeout did not run. Update right away and realign the timer.
+ */
+static gboolean
+guaca_clock_display_jump_cb (GIOChannel        *source,
+                             GIOCondition       condition,
+                             GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  struct itimerspec         its = { { 0, 0 }, { 0, 0 } };
+  uint64_t                  expirations;
+
+  /*
+   * The read fails with ECANCELED when the clock was set; either way we
+   * need to re-arm the timer for it to report the next jump.
+   */
+  if (read (priv->jump_fd, &expirations, sizeof (expirations)) < 0)
+    g_debug ("Wall clock changed");
+
+  its.it_value.tv_sec = G_MAXINT32;
+  timerfd_settime (priv->jump_fd,
+                   TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+
+  /* while not shown there is no timer to realign; mapping updates us */
+  if (!CLUTTER_ACTOR_IS_MAPPED (priv->label))
+    return TRUE;
+
+  guaca_clock_display_update (self);
+  guaca_clock_display_schedule (self);
+
+  return TRUE;
+}
+
+/*
+ * Sets up a realtime timer that never expires, but which the kernel cancels
+ * whenever the wall clock is set or the system resumes; this gives us clock
+ * jump notifications without any wakeups while nothing happens.
+ */
+static void
+guaca_clock_display_watch_jumps (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  struct itimerspec         its = { { 0, 0 }, { 0, 0 } };
+  GIOChannel               *channel;
+
+  if ((priv->jump_fd = timerfd_create (CLOCK_REALTIME,
+                                       TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    return;
+
+  its.it_value.tv_sec = G_MAXINT32;
+
+  if (timerfd_settime (priv->jump_fd,
+                       TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                       &its, NULL) < 0)
+    {
+      close (priv->jump_fd);
+      priv->jump_fd = -1;
+      return;
+    }
+
+  channel = g_io_channel_unix_new (priv->jump_fd);
+  priv->jump_id = g_io_add_watch (channel, G_IO_IN,
+                                  (GIOFunc) guaca_clock_display_jump_cb, self);
+  g_io_channel_unref (channel);
+}
+#endif
+
+static gboolean
+guaca_clock_display_tz_changed_cb (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  priv->tz_id = 0;
+
+  g_debug ("Timezone changed");
+
+  /* while not shown there is nothing to do; mapping updates us */
+  if (!CLUTTER_ACTOR_IS_MAPPED (priv->label))
+    return FALSE;
+
+  guaca_clock_display_update (self);
+  guaca_clock_display_schedule (self);
+
+  return FALSE;
+}
+
+/*
+ * The timezone changed, through the Clock settings or otherwise; show the
+ * new local time right away rather than at the next minute. Replacing the
+ * symlink produces several events, which are coalesced from an idle.
+ */
+static void
+guaca_clock_display_localtime_changed_cb (GFileMonitor      *monitor,
+                                          GFile             *file,
+                                          GFile             *other,
+                                          GFileMonitorEvent  event,
+                                          GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+      if (!priv->tz_id)
+        priv->tz_id =
+          g_idle_add ((GSourceFunc) guaca_clock_display_tz_changed_cb, self);
+      break;
+    default:
+      break;
+    }
+}
+
+static void
+guaca_clock_display_watch_localtime (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  GFile                    *file;
+
+  file = g_file_new_for_path ("/etc/localtime");
+  priv->localtime_monitor =
+    g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (priv->localtime_monitor)
+    g_signal_connect (priv->localtime_monitor, "changed",
+                      G_CALLBACK (guaca_clock_display_localtime_changed_cb),
+                      self);
+}
+
+/*
+ * Without timerfd we are not told about jumps; when the clock is shown again
+ * we check whether the wall clock moved a lot more than the monotonic clock
+ * since we armed the timer, in which case the box was suspended or the clock
+ * was set.
+ */
+static gboolean
+guaca_clock_display_check_jump (GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+  gint64                    real, mono;
+
+  if (priv->jump_fd >= 0 || !priv->last_mono)
+    return FALSE;
+
+  real = g_get_real_time () - priv->last_real;
+  mono = g_get_monotonic_time () - priv->last_mono;
+
+  return ABS (real - mono) > 2 * G_USEC_PER_SEC;
+}
+
+static void
+guaca_clock_display_mapped_cb (ClutterActor      *label,
+                               GParamSpec        *pspec,
+                               GuacaClockDisplay *self)
+{
+  GuacaClockDisplayPrivate *priv = self->priv;
+
+  /*
+   * There is no point in waking up to update a clock no one can see.
+   */
+  if (!CLUTTER_ACTOR_IS_MAPPED (label))
+    {
+      if (priv->tick_id)
+        {
+          g_source_remove (priv->tick_id);
+          priv->tick_id = 0;
+        }
+
+      return;
+    }
+
+  if (!priv->tick_id || guaca_clock_display_check_jump (self))
+    {
+      guaca_clock_display_update (self);
+      guaca_clock_display_schedule (self);
+    }
+}
+
+static ClutterActor *
+guaca_clock_display_create_ui (MexInfoBarComponent *comp,
+                               ClutterActor        *transient_for)
+{
+  GuacaClockDisplay        *self;
+  GuacaClockDisplayPrivate *priv;
+
+  g_return_val_if_fail (GUACA_IS_CLOCK_DISPLAY (comp), NULL);
+
+  self = GUACA_CLOCK_DISPLAY (comp);
+  priv = self->priv;
+
+  priv->label = mx_label_new ();
+  mx_stylable_set_style_class (MX_STYLABLE (priv->label),
+                               "GuacaClockDisplay");
+
+  g_signal_connect (priv->label, "notify::mapped",
+                    G_CALLBACK (guaca_clock_display_mapped_cb), self);
+
+#ifdef HAVE_SYS_TIMERFD_H
+  if (priv->jump_fd < 0)
+    guaca_clock_display_watch_jumps (self);
+#endif
+
+  if (!priv->localtime_monitor)
+    guaca_clock_display_watch_localtime (self);
+
+  guaca_clock_display_update (self);
+
+  return priv->label;
+}
+
+static void
+mex_info_bar_component_iface_init (MexInfoBarComponentIface *iface)
+{
+  iface->get_location       = guaca_clock_display_get_location;
+  iface->get_location_index = guaca_clock_display_get_location_index;
+  iface->create_ui          = guaca_clock_display_create_ui;
+}
+
+static GType
+guaca_clock_display_plugin_get_type (void)
+{
+  return GUACA_TYPE_CLOCK_DISPLAY;
+}
+
+MEX_DEFINE_PLUGIN ("Clock Display",
+		   "Info bar clock",
+		   PACKAGE_VERSION,
+		   "LGPLv2.1+",
+                   "Tomas Frydrych <tomas@sleepfive.com>",
+		   MEX_API_MAJOR, MEX_API_MINOR,
+		   guaca_clock_display_plugin_get_type,
+		   MEX_PLUGIN_PRIORITY_NORMAL)
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Guacamayo info bar clock Mex plugin */
+
+#ifndef __GUACA_CLOCK_DISPLAY_H__
+#define __GUACA_CLOCK_DISPLAY_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GUACA_TYPE_CLOCK_DISPLAY (guaca_clock_display_get_type())
+#define GUACA_CLOCK_DISPLAY(obj)                                \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj),                           \
+                               GUACA_TYPE_CLOCK_DISPLAY,        \
+                               GuacaClockDisplay))
+#define GUACA_CLOCK_DISPLAY_CLASS(klass)                        \
+  (G_TYPE_CHECK_CLASS_CAST ((klass),                            \
+                            GUACA_TYPE_CLOCK_DISPLAY,           \
+                            GuacaClockDisplayClass))
+#define GUACA_IS_CLOCK_DISPLAY(obj)                             \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj),                           \
+                               GUACA_TYPE_CLOCK_DISPLAY))
+#define GUACA_IS_CLOCK_DISPLAY_CLASS(klass)                     \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass),                            \
+                            GUACA_TYPE_CLOCK_DISPLAY))
+#define GUACA_CLOCK_DISPLAY_GET_CLASS(obj)                      \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj),                            \
+                              GUACA_TYPE_CLOCK_DISPLAY,         \
+                              GuacaClockDisplayClass))
+
+typedef struct _GuacaClockDisplay        GuacaClockDisplay;
+typedef struct _GuacaClockDisplayClass   GuacaClockDisplayClass;
+typedef struct _GuacaClockDisplayPrivate GuacaClockDisplayPrivate;
+
+struct _GuacaClockDisplayClass
+{
+  GObjectClass parent_class;
+};
+
+struct _GuacaClockDisplay
+{
+  GObject parent;
+
+  /*<private>*/
+  GuacaClockDisplayPrivate *priv;
+};
+
+GType guaca_clock_display_get_type (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* __GUACA_CLOCK_DISPLAY_H__ */
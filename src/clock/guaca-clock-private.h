@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+/*
+ * What the Clock plugin shares with its dialog module, which is loaded when
+ * the dialog is first opened.
+ */
+
+#ifndef __GUACA_CLOCK_PRIVATE_H__
+#define __GUACA_CLOCK_PRIVATE_H__
+
+#include "guaca-clock.h"
+#include "guaca-zone-db.h"
+
+#include <sys/types.h>
+#include <gio/gio.h>
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+struct _GuacaClockPrivate
+{
+  ClutterActor *button;
+  ClutterActor *dialog;
+  ClutterActor *transient_for;
+  ClutterActor *regions_combo;
+  ClutterActor *city_combo;
+
+  char         *orig_zone;
+
+  GuacaZoneDb   *zone_db;
+  const TzEntry *suggested;
+
+  GFileMonitor *localtime_monitor;
+  guint         tz_refresh_id;
+  dev_t         tz_dev;
+  ino_t         tz_ino;
+  time_t        tz_mtime;
+
+  /* the entry points of the dialog module, once it is loaded */
+  void          (*dialog_open)    (GuacaClock *self);
+  void          (*dialog_dispose) (GuacaClock *self);
+
+  /* and of the plugin, for the module, which is not linked against it */
+  void          (*queue_tz_refresh) (GuacaClock *self);
+
+  guint disposed   : 1;
+  guint low_memory : 1;
+  guint by_country : 1;
+};
+
+/* in the dialog module */
+void guaca_clock_dialog_open      (GuacaClock *self);
+void guaca_clock_dialog_dispose   (GuacaClock *self);
+
+G_END_DECLS
+
+#endif /* __GUACA_CLOCK_PRIVATE_H__ */
@@ -19,25 +19,21 @@
 #include "config.h"
 #endif
 
-#include "guaca-clock.h"
+#include "guaca-clock-private.h"
+#include "guaca-dialog-module.h"
 
-#include <unistd.h>
-#include <errno.h>
-#include <string.h>
+#include <stdlib.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <sys/types.h>
-#include <fcntl.h>
+#include <sys/sysinfo.h>
 
 #include <glib/gi18n-lib.h>
+#include <gio/gio.h>
 
 #include <gmodule.h>
 #include <mex/mex.h>
 #include <mex/mex-info-bar-component.h>
 
-#ifndef HAVE_MX_COMBO_BOX_POPULATE
-#error You need mx-combo-box-populate.patch from Guacamayo
-#endif
-
 static void mex_info_bar_component_iface_init (MexInfoBarComponentIface *iface);
 static void guaca_clock_dispose (GObject *object);
 static void guaca_clock_finalize (GObject *object);
@@ -49,183 +45,172 @@ G_DEFINE_TYPE_WITH_CODE (GuacaClock, guaca_clock, G_TYPE_OBJECT,
 #define GUACA_CLOCK_GET_PRIVATE(o) \
 (G_TYPE_INSTANCE_GET_PRIVATE ((o), GUACA_TYPE_CLOCK, GuacaClockPrivate))
 
-typedef struct TzEntry
-{
-  char       *country;
-  char       *zone;
-  char       *region;
-  char       *city;
-} TzEntry;
-
-static TzEntry *
-tz_entry_new (const char *country, const char *zone)
+enum
 {
-  TzEntry     *t;
-  char        *p, *region, *path;
-  struct stat  st;
+  TIMEZONE_CHANGED,
 
-  /*
-   * Make sure we have the actual zone info here, since Poky prunes the data
-   * without prooning the zones.tab
-   */
-  path = g_build_filename ("/usr/share/zoneinfo", zone, NULL);
+  LAST_SIGNAL
+};
 
-  if (stat (path, &st) < 0)
-    {
-      g_free (path);
-      return NULL;
-    }
+static guint signals[LAST_SIGNAL] = { 0, };
 
-  g_free (path);
+/* Total memory at or below which the plugin runs in low memory mode */
+#define LOW_MEMORY_THRESHOLD (512 * 1024 * 1024ULL)
 
-  t = g_slice_new0 (TzEntry);
+static void
+guaca_clock_class_init (GuacaClockClass *klass)
+{
+  GObjectClass *object_class = (GObjectClass *)klass;
 
-  t->country = g_strdup (country);
-  t->zone    = g_strdup (zone);
+  g_type_class_add_private (klass, sizeof (GuacaClockPrivate));
 
-  region = g_strdup (zone);
+  object_class->dispose  = guaca_clock_dispose;
+  object_class->finalize = guaca_clock_finalize;
 
-  /* replace underscores with spaces */
-  for (p = region; *p; p++)
-    if (*p == '_')
-      *p = ' ';
+  /*
+   * Emitted, from the main loop, after the system timezone changed and the
+   * process timezone state was refreshed; anything caching local times
+   * should recompute them.
+   */
+  signals[TIMEZONE_CHANGED] =
+    g_signal_new ("timezone-changed",
+                  G_OBJECT_CLASS_TYPE (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+}
 
-  if ((p = strchr (region, '/')))
-    {
-      *p = 0;
-      t->city = g_strdup (_(p+1));
-    }
+/*
+ * Records the identity of the zone file /etc/localtime resolves to; returns
+ * TRUE if it differs from the one recorded previously.
+ */
+static gboolean
+guaca_clock_update_tz_identity (GuacaClock *self)
+{
+  GuacaClockPrivate *priv = self->priv;
+  struct stat        st;
+  gboolean           changed;
+
+  if (stat ("/etc/localtime", &st) < 0)
+    return FALSE;
 
-  t->region = g_strdup (_(region));
+  changed = (st.st_dev   != priv->tz_dev ||
+             st.st_ino   != priv->tz_ino ||
+             st.st_mtime != priv->tz_mtime);
 
-  g_free (region);
+  priv->tz_dev   = st.st_dev;
+  priv->tz_ino   = st.st_ino;
+  priv->tz_mtime = st.st_mtime;
 
-  return t;
+  return changed;
 }
 
-static void
-tz_entry_free (TzEntry *t)
+static gboolean
+guaca_clock_tz_refresh_cb (GuacaClock *self)
 {
-  g_free (t->country);
-  g_free (t->zone);
-  g_free (t->region);
-  g_free (t->city);
+  GuacaClockPrivate *priv = self->priv;
 
-  g_slice_free (TzEntry, t);
-}
+  priv->tz_refresh_id = 0;
 
-static int
-tz_entry_cmp (TzEntry *e1, TzEntry *e2)
-{
-  return g_strcmp0 (e1->zone, e2->zone);
-}
+  if (!guaca_clock_update_tz_identity (self))
+    return FALSE;
 
-struct _GuacaClockPrivate
-{
-  ClutterActor *button;
-  ClutterActor *dialog;
-  ClutterActor *transient_for;
-  ClutterActor *regions_combo;
-  ClutterActor *city_combo;
+  /*
+   * Make libc re-read the zone, so that localtime() and friends in this
+   * process reflect the change; if TZ is set in the environment the process
+   * never followed /etc/localtime in the first place.
+   */
+  if (!g_getenv ("TZ"))
+    tzset ();
 
-  char         *orig_zone;
+  g_debug ("Timezone changed, now %s/%s", tzname[0], tzname[1]);
 
-  GHashTable   *regions;
+  g_signal_emit (self, signals[TIMEZONE_CHANGED], 0);
 
-  guint disposed : 1;
-};
+  return FALSE;
+}
 
+/*
+ * Both the helper exiting and the file monitor end up here, and replacing
+ * the symlink produces several monitor events; coalesce them all into a
+ * single refresh from an idle.
+ */
 static void
-guaca_clock_get_zones (GuacaClock *self)
+guaca_clock_queue_tz_refresh (GuacaClock *self)
 {
   GuacaClockPrivate *priv = self->priv;
-  FILE              *f;
-  char               buf[512];
-  GList             *regions;
-  GList             *l;
 
-  if (!(f = fopen ("/usr/share/zoneinfo/zone.tab", "r")))
-    {
-      g_warning ("Failed to open zone.tab: %s", strerror (errno));
-      return;
-    }
-
-  while (fgets (buf, sizeof (buf), f))
-    {
-      char    *code, *coords, *zone;
-      TzEntry *e;
-
-      if (buf[0] == '#')
-        continue;
-
-      buf[sizeof (buf)-1] = 0;
-
-      if (! (code = strtok (buf, "\t\n")))
-        continue;
-      if (! (coords = strtok (NULL, "\t\n")))
-        continue;
-      if (! (zone = strtok (NULL, "\t\n")))
-        continue;
-
-      /*
-       * Push this into a hash table keyed by region (the MxComboBox is too
-       * inefficient to manage big lists, and it would be user unfriendly anyway
-       */
-      if (!(e = tz_entry_new (code, zone)))
-        continue;
-
-      l = g_hash_table_lookup (priv->regions, e->region);
-      l = g_list_prepend (l, e);
-      g_hash_table_insert (priv->regions, e->region, l);
-    }
+  if (priv->tz_refresh_id)
+    return;
 
-  fclose (f);
+  priv->tz_refresh_id =
+    g_idle_add ((GSourceFunc) guaca_clock_tz_refresh_cb, self);
+}
 
-  /*
-   * Now sort out the individual sublists
-   */
-  regions = g_hash_table_get_values (priv->regions);
-  for (l = regions; l; l = l->next)
+static void
+guaca_clock_localtime_changed_cb (GFileMonitor      *monitor,
+                                  GFile             *file,
+                                  GFile             *other,
+                                  GFileMonitorEvent  event,
+                                  GuacaClock        *self)
+{
+  switch (event)
     {
-      GList   *k = l->data;
-      TzEntry *e = k->data;
-
-      k = g_list_sort (k, (GCompareFunc)tz_entry_cmp);
-      g_hash_table_insert (priv->regions, e->region, k);
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+      guaca_clock_queue_tz_refresh (self);
+      break;
+    default:
+      break;
     }
-  g_list_free (regions);
 }
 
-static void
-guaca_clock_class_init (GuacaClockClass *klass)
+/*
+ * Boxes with little memory drop the timezone database whenever the dialog is
+ * closed, trading a reload from the cache on the next open for the memory.
+ * GUACA_CLOCK_LOW_MEMORY=0/1 overrides the automatic choice.
+ */
+static gboolean
+guaca_clock_want_low_memory (void)
 {
-  GObjectClass *object_class = (GObjectClass *)klass;
+  const char     *env = g_getenv ("GUACA_CLOCK_LOW_MEMORY");
+  struct sysinfo  si;
 
-  g_type_class_add_private (klass, sizeof (GuacaClockPrivate));
+  if (env && *env)
+    return atoi (env) != 0;
 
-  object_class->dispose  = guaca_clock_dispose;
-  object_class->finalize = guaca_clock_finalize;
-}
+  if (sysinfo (&si) < 0)
+    return FALSE;
 
-static void
-free_hash_list (GList *l)
-{
-  g_list_free_full (l, (GDestroyNotify) tz_entry_free);
+  return (guint64) si.totalram * si.mem_unit <= LOW_MEMORY_THRESHOLD;
 }
 
 static void
 guaca_clock_init (GuacaClock *self)
 {
+  GFile *file;
+
   self->priv = GUACA_CLOCK_GET_PRIVATE (self);
 
+  self->priv->low_memory       = guaca_clock_want_low_memory ();
+  self->priv->queue_tz_refresh = guaca_clock_queue_tz_refresh;
+
   /*
-   * region-keyed hashtable holding GList's of TzEntries.
-   * We can supply destroy functions here because (a) the key itself is stored
-   * inside one of the TzEntries, and (b) we need to be able to replace the
-   * data for each key without destroying the list when we are generating the
-   * whole TZ database.
+   * Watch for the timezone changing, be it through our own helper or
+   * anything else.
    */
-  self->priv->regions = g_hash_table_new (g_str_hash, g_str_equal);
+  guaca_clock_update_tz_identity (self);
+
+  file = g_file_new_for_path ("/etc/localtime");
+  self->priv->localtime_monitor =
+    g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (self->priv->localtime_monitor)
+    g_signal_connect (self->priv->localtime_monitor, "changed",
+                      G_CALLBACK (guaca_clock_localtime_changed_cb), self);
 }
 
 static void
@@ -239,6 +224,22 @@ guaca_clock_dispose (GObject *object)
 
   priv->disposed = TRUE;
 
+  if (priv->localtime_monitor)
+    {
+      g_file_monitor_cancel (priv->localtime_monitor);
+      g_object_unref (priv->localtime_monitor);
+      priv->localtime_monitor = NULL;
+    }
+
+  if (priv->tz_refresh_id)
+    {
+      g_source_remove (priv->tz_refresh_id);
+      priv->tz_refresh_id = 0;
+    }
+
+  if (priv->dialog_dispose)
+    priv->dialog_dispose (self);
+
   G_OBJECT_CLASS (guaca_clock_parent_class)->dispose (object);
 }
 
@@ -247,17 +248,9 @@ guaca_clock_finalize (GObject *object)
 {
   GuacaClock        *self = (GuacaClock*) object;
   GuacaClockPrivate *priv = self->priv;
-  GList             *values;
 
   g_free (priv->orig_zone);
 
-  /*
-   * Manually destroy the hash table contents; see comment in _init() why.
-   */
-  values = g_hash_table_get_values (priv->regions);
-  g_list_free_full (values, (GDestroyNotify)free_hash_list);
-  g_hash_table_destroy (priv->regions);
-
   G_OBJECT_CLASS (guaca_clock_parent_class)->finalize (object);
 }
 
@@ -273,314 +266,29 @@ guaca_clock_get_location_index (MexInfoBarComponent *comp)
   return -1;
 }
 
-static void
-guaca_clock_close_cb (void *dialog, GuacaClock *self)
-{
-  GuacaClockPrivate *priv = self->priv;
-
-  mex_push_focus (MX_FOCUSABLE (priv->button));
-}
-
 /*
- * Get the timezone string representing the current selection in our
- * combo boxes.
+ * The dialog, and the timezone database behind it, live in a module of
+ * their own, which is only loaded the first time the dialog is opened.
  */
-static const char *
-guaca_clock_get_current_zone (GuacaClock *self)
-{
-  GuacaClockPrivate *priv = self->priv;
-  TzEntry           *e;
-  int                i_c;
-  const char        *region;
-  GList             *l;
-
-  if ((i_c = mx_combo_box_get_index (MX_COMBO_BOX (priv->city_combo))) < 0)
-    return NULL;
-
-  if (mx_combo_box_get_index (MX_COMBO_BOX (priv->city_combo)) < 0)
-    return NULL;
-
-  region = mx_combo_box_get_active_text (MX_COMBO_BOX (priv->regions_combo));
-  if ((l = g_hash_table_lookup (priv->regions, region)))
-    {
-      TzEntry *e;
-
-      if ((e = g_list_nth_data (l, i_c)))
-        return e->zone;
-      else
-        g_warning ("No TzEntry for current city selection '%s'",
-                   mx_combo_box_get_active_text (MX_COMBO_BOX (
-                                                          priv->city_combo)));
-    }
-  else
-    g_warning ("No hashtable entry for region '%s'", region);
-
-  return NULL;
-}
-
-static void
-guaca_clock_dialog_mapped_cb (ClutterActor *dialog,
-                              GParamSpec   *pspec,
-                              GuacaClock   *self)
-{
-  GuacaClockPrivate *priv = self->priv;
-  ClutterActor      *parent;
-
-  parent = clutter_actor_get_parent (priv->dialog);
-  clutter_actor_remove_child (parent, priv->dialog);
-  priv->dialog = NULL;
-}
-
-static gboolean
-guaca_clock_close_dialog_cb (MxAction *unused, GuacaClock *self)
-{
-  GuacaClockPrivate *priv = self->priv;
-  const char        *zone;
-
-  if ((zone = guaca_clock_get_current_zone (self)) &&
-      g_strcmp0 (zone, priv->orig_zone))
-    {
-      GError *error = NULL;
-      char   *cmd   = g_strdup_printf ("guacamayo-timezone %s", zone);
-
-      if (!g_spawn_command_line_async (cmd, &error))
-        {
-          g_warning ("Failed to execute '%s': %s", cmd, error->message);
-          g_clear_error (&error);
-        }
-
-      g_free (cmd);
-    }
-
-  /*
-   * Hide the dialog, this will trigger the default transition; once it is
-   * no longer visible, destroy it.
-   *
-   * We have to use the mapped property here; MxDialog runs custom animation
-   * using a timeline and the 'visible' property is set well before the
-   * animation finishes.
-   */
-  g_signal_connect (priv->dialog, "notify::mapped",
-                    G_CALLBACK (guaca_clock_dialog_mapped_cb), self);
-  clutter_actor_hide (priv->dialog);
-  mex_push_focus (MX_FOCUSABLE (priv->button));
-
-  return FALSE;
-}
-
-static gboolean
-guaca_clock_key_press_cb (ClutterActor    *actor,
-                          ClutterKeyEvent *event,
-                          GuacaClock      *self)
-{
-  if (MEX_KEY_BACK (event->keyval))
-    {
-      guaca_clock_close_dialog_cb (NULL, self);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-/*
- * Callback for when the selection in the Region combo changes.
- */
-static void
-guaca_clock_regions_index_cb (MxComboBox *combo,
-                              GParamSpec *pspec,
-                              GuacaClock *self)
-{
-  GuacaClockPrivate *priv = self->priv;
-  int                idx, i;
-  const char        *text;
-  GList             *l;
-  char              *region;
-  const char        *city = NULL;
-  gboolean           orig_region = FALSE;
-  GArray            *cities;
-
-  if (((idx = mx_combo_box_get_index (combo)) < 0) ||
-      !(text = mx_combo_box_get_active_text (combo)))
-    return;
-
-  if (!(l = g_hash_table_lookup (priv->regions, text)))
-    {
-      g_warning ("No hashtable entry for '%s'", text);
-      return;
-    }
-
-  if (priv->orig_zone)
-    {
-      char *p;
-
-      region = g_strdup (priv->orig_zone);
-      if ((p = strchr (region, '/')))
-        {
-          *p = 0;
-          city = p + 1;
-        }
-
-      if (!g_strcmp0 (region, text))
-        orig_region = TRUE;
-    }
-
-  mx_combo_box_remove_all (MX_COMBO_BOX (priv->city_combo));
-  idx = -1;
-
-  cities = g_array_sized_new (TRUE, FALSE, sizeof (char *), 150);
-
-  for (i = 0; l; l = l->next, i++)
-    {
-      TzEntry *e = l->data;
-
-      if (orig_region && !g_strcmp0 (e->city, city))
-        idx = i;
-
-      g_array_append_val (cities, e->city);
-    }
-
-  if (cities->len)
-    mx_combo_box_populate (MX_COMBO_BOX (priv->city_combo),
-                           (const char **)cities->data);
-
-  g_array_unref (cities);
-
-  if (idx >= 0)
-    mx_combo_box_set_index (MX_COMBO_BOX (priv->city_combo), idx);
-  else
-    mx_combo_box_set_index (MX_COMBO_BOX (priv->city_combo), 0);
-
-  clutter_actor_show (priv->city_combo);
-  g_free (region);
-}
-
 static void
 guaca_clock_activated_cb (MxAction *action, GuacaClock *self)
 {
   GuacaClockPrivate *priv = self->priv;
-  ClutterActor      *dialog, *layout, *label;
-  MxAction          *close;
-  char              *text;
-  int                row = 0;
-  GList             *l, *keys;
-  GArray            *regions;
-  FILE              *f;
-  char               buf[512];
+  gpointer           open, dispose;
 
-  /*
-   * Get the current zone
-   */
-  if ((f = fopen ("/etc/timezone", "r")) &&
-      fgets (buf, sizeof (buf), f))
+  if (!priv->dialog_open)
     {
-      char *n;
-
-      /* ensure 0-terminated, strip trailing \n */
-      buf[sizeof (buf)-1] = 0;
-
-      if ((n = strchr (buf, '\n')))
-        *n = 0;
-
-      g_free (priv->orig_zone);
-      priv->orig_zone = g_strdup (buf);
-      fclose (f);
+      if (!guaca_dialog_module_load ("guaca-clock-dialog",
+                                     "guaca_clock_dialog_open", &open,
+                                     "guaca_clock_dialog_dispose", &dispose,
+                                     NULL))
+        return;
+
+      priv->dialog_open    = open;
+      priv->dialog_dispose = dispose;
     }
-  else
-    g_warning ("Failed to open /etc/timezone: %s", strerror (errno));
-
-  dialog = mx_dialog_new ();
-  mx_stylable_set_style_class (MX_STYLABLE (dialog), "MexInfoBarDialog");
-
-  close = mx_action_new_full ("close", _("Close"),
-                              G_CALLBACK (guaca_clock_close_dialog_cb), self);
-  mx_dialog_add_action (MX_DIALOG (dialog), close);
-
-  layout = mx_table_new ();
-  mx_table_set_column_spacing (MX_TABLE (layout), 10);
-  mx_table_set_row_spacing (MX_TABLE (layout), 20);
-  mx_bin_set_child (MX_BIN (dialog), layout);
-
-  label = mx_label_new_with_text (_("Clock Settings"));
-  mx_stylable_set_style_class (MX_STYLABLE (label), "DialogHeader");
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 0);
-
-  label = mx_label_new_with_text (_("Timezone:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  priv->regions_combo = mx_combo_box_new ();
-  priv->city_combo = mx_combo_box_new ();
-  clutter_actor_hide (priv->city_combo);
-
-  guaca_clock_get_zones (self);
-  keys = g_hash_table_get_keys (priv->regions);
-  keys = g_list_sort (keys, g_strcmp0);
-
-  regions = g_array_sized_new (TRUE, FALSE, sizeof (char *), 15);
-
-  for (l = keys; l; l = l->next)
-    {
-      const char *region = l->data;
-
-      g_array_append_val (regions, region);
-    }
-
-  if (regions->len)
-    mx_combo_box_populate (MX_COMBO_BOX (priv->regions_combo),
-                           (const char **)regions->data);
-
-  g_array_unref (regions);
-
-  /*
-   * Only now that the regions combo is populated we connect to the index
-   * notification.
-   */
-  g_signal_connect (priv->regions_combo, "notify::index",
-                    G_CALLBACK (guaca_clock_regions_index_cb),
-                    self);
-
-  /*
-   * Select the current region in the Regions combo (this in turn will
-   * trigger the city combo callback).
-   */
-  if (priv->orig_zone)
-    {
-      GList *l;
-      int    i;
-      char   *region = g_strdup (priv->orig_zone);
-      char   *p, *city;
-
-      if ((p = strchr (region, '/')))
-        {
-          *p = 0;
-          city = p + 1;
-        }
-
-      for (l = keys, i = 0; l; l = l->next, i++)
-        {
-          const char *r = l->data;
-
-          if (!g_strcmp0 (r, region))
-            {
-              mx_combo_box_set_index (MX_COMBO_BOX (priv->regions_combo), i);
-              break;
-            }
-        }
-
-      g_free (region);
-    }
-
-  g_list_free (keys);
-
-  mx_table_insert_actor (MX_TABLE (layout), priv->regions_combo, row++, 1);
-  mx_table_insert_actor (MX_TABLE (layout), priv->city_combo, row++, 1);
-
-  mx_dialog_set_transient_parent (MX_DIALOG (dialog), priv->transient_for);
-  g_signal_connect (dialog, "key-press-event",
-                    G_CALLBACK (guaca_clock_key_press_cb), self);
-
-  priv->dialog = dialog;
 
-  clutter_actor_show (dialog);
-  mex_push_focus (MX_FOCUSABLE (dialog));
+  priv->dialog_open (self);
 }
 
 static ClutterActor *
@@ -0,0 +1,779 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-zone-db.h"
+#include "guaca-zone-index.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib/gi18n-lib.h>
+
+#define ZONEINFO_DIR       "/usr/share/zoneinfo"
+#define ZONE_TAB           ZONEINFO_DIR "/zone.tab"
+#define ISO3166_TAB        ZONEINFO_DIR "/iso3166.tab"
+
+#define ZONE_CACHE_MAGIC   0x42445a47 /* "GZDB" */
+#define ZONE_CACHE_VERSION 3
+#define ZONE_CACHE_NONE    G_MAXUINT32
+
+/*
+ * The compact form of the database, which we keep in a cache file and map
+ * when the database is needed. All strings are stored untranslated in a
+ * single blob following the entries, and are referenced by their offset in
+ * it; region and country strings are shared by all their entries. The entries
+ * are sorted by zone, and carry the zone.tab coordinates in seconds of arc
+ * and the inode of the zone file, so that aliases of the zone can be
+ * resolved to it.
+ */
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  gint64  tab_mtime;
+  gint64  tab_size;
+  guint32 n_entries;
+  guint32 strings_size;
+} ZoneCacheHeader;
+
+typedef struct
+{
+  guint32 country;
+  guint32 zone;
+  guint32 region;
+  guint32 city;
+  gint32  latitude;
+  gint32  longitude;
+  guint64 ino;
+} ZoneCacheEntry;
+
+struct _GuacaZoneDb
+{
+  GMappedFile *mapped;
+  char        *data;      /* used when the cache could not be written */
+
+  TzEntry     *entries;
+  guint64     *inos;
+  guint        n_entries;
+
+  /*
+   * region-keyed hashtable holding GList's of TzEntries; the keys are
+   * owned by the entries.
+   */
+  GHashTable  *regions;
+
+  /* region -> position in the sorted list of regions, plus one */
+  GHashTable  *region_pos;
+
+  /* built when first needed */
+  GuacaZoneIndex *index;
+  GHashTable     *by_ino;
+
+  TzCountry      *countries;
+  guint           n_countries;
+  const TzEntry **country_zones;
+  char           *country_names;
+  GHashTable     *country_pos;
+};
+
+typedef struct
+{
+  char   *country;
+  char   *zone;
+  double  latitude;
+  double  longitude;
+  guint64 ino;
+} ZoneTabLine;
+
+static int
+zone_tab_line_cmp (gconstpointer a, gconstpointer b)
+{
+  const ZoneTabLine *l1 = *(const ZoneTabLine **) a;
+  const ZoneTabLine *l2 = *(const ZoneTabLine **) b;
+
+  return strcmp (l1->zone, l2->zone);
+}
+
+static void
+zone_tab_line_free (ZoneTabLine *l)
+{
+  g_free (l->country);
+  g_free (l->zone);
+  g_slice_free (ZoneTabLine, l);
+}
+
+/*
+ * Appends a string to the blob, returning its offset; if interned is given,
+ * identical strings are only stored once.
+ */
+static guint32
+blob_add (GString *blob, GHashTable *interned, const char *str)
+{
+  gpointer off;
+
+  if (interned && g_hash_table_lookup_extended (interned, str, NULL, &off))
+    return GPOINTER_TO_UINT (off);
+
+  off = GUINT_TO_POINTER (blob->len);
+  g_string_append_len (blob, str, strlen (str) + 1);
+
+  if (interned)
+    g_hash_table_insert (interned, g_strdup (str), off);
+
+  return GPOINTER_TO_UINT (off);
+}
+
+static void
+replace_underscores (char *s)
+{
+  for (; *s; s++)
+    if (*s == '_')
+      *s = ' ';
+}
+
+/*
+ * Parses zone.tab into the compact form.
+ */
+static GString *
+guaca_zone_db_build (const struct stat *tab_st)
+{
+  FILE            *f;
+  char             buf[512];
+  GPtrArray       *lines;
+  GString         *entries, *blob;
+  GHashTable      *interned;
+  ZoneCacheHeader  header = { 0, };
+  guint            i;
+
+  if (!(f = fopen (ZONE_TAB, "r")))
+    {
+      g_warning ("Failed to open zone.tab: %s", strerror (errno));
+      return NULL;
+    }
+
+  lines = g_ptr_array_new_with_free_func ((GDestroyNotify) zone_tab_line_free);
+
+  while (fgets (buf, sizeof (buf), f))
+    {
+      char        *code, *coords, *zone, *path;
+      ZoneTabLine *l;
+      struct stat  st;
+
+      if (buf[0] == '#')
+        continue;
+
+      buf[sizeof (buf)-1] = 0;
+
+      if (! (code = strtok (buf, "\t\n")))
+        continue;
+      if (! (coords = strtok (NULL, "\t\n")))
+        continue;
+      if (! (zone = strtok (NULL, "\t\n")))
+        continue;
+
+      /*
+       * Make sure we have the actual zone info here, since Poky prunes the
+       * data without prooning the zones.tab
+       */
+      path = g_build_filename (ZONEINFO_DIR, zone, NULL);
+
+      if (stat (path, &st) < 0)
+        {
+          g_free (path);
+          continue;
+        }
+
+      g_free (path);
+
+      l = g_slice_new0 (ZoneTabLine);
+      l->country = g_strdup (code);
+      l->zone    = g_strdup (zone);
+      l->ino     = st.st_ino;
+
+      if (!guaca_zone_parse_iso6709 (coords, &l->latitude, &l->longitude))
+        g_warning ("Invalid coordinates '%s' for zone %s", coords, zone);
+
+      g_ptr_array_add (lines, l);
+    }
+
+  fclose (f);
+
+  g_ptr_array_sort (lines, zone_tab_line_cmp);
+
+  entries  = g_string_sized_new (lines->len * sizeof (ZoneCacheEntry));
+  blob     = g_string_sized_new (lines->len * 32);
+  interned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < lines->len; i++)
+    {
+      ZoneTabLine    *l = g_ptr_array_index (lines, i);
+      ZoneCacheEntry  e;
+      char           *region, *p;
+
+      region = g_strdup (l->zone);
+      replace_underscores (region);
+
+      e.city = ZONE_CACHE_NONE;
+
+      if ((p = strchr (region, '/')))
+        {
+          *p = 0;
+          e.city = blob_add (blob, NULL, p + 1);
+        }
+
+      e.country = blob_add (blob, interned, l->country);
+      e.zone    = blob_add (blob, NULL, l->zone);
+      e.region  = blob_add (blob, interned, region);
+
+      e.latitude  = (gint32) (l->latitude * 3600.0);
+      e.longitude = (gint32) (l->longitude * 3600.0);
+      e.ino       = l->ino;
+
+      g_free (region);
+
+      g_string_append_len (entries, (const char *) &e, sizeof (e));
+    }
+
+  header.magic        = ZONE_CACHE_MAGIC;
+  header.version      = ZONE_CACHE_VERSION;
+  header.tab_mtime    = tab_st->st_mtime;
+  header.tab_size     = tab_st->st_size;
+  header.n_entries    = lines->len;
+  header.strings_size = blob->len;
+
+  g_string_prepend_len (entries, (const char *) &header, sizeof (header));
+  g_string_append_len (entries, blob->str, blob->len);
+
+  g_string_free (blob, TRUE);
+  g_hash_table_destroy (interned);
+  g_ptr_array_unref (lines);
+
+  return entries;
+}
+
+/*
+ * Sets up the entries and the region index over the compact form; this is
+ * cheap, no strings are copied.
+ */
+static gboolean
+guaca_zone_db_load (GuacaZoneDb       *db,
+                    const char        *data,
+                    gsize              len,
+                    const struct stat *tab_st)
+{
+  const ZoneCacheHeader *header = (const ZoneCacheHeader *) data;
+  const ZoneCacheEntry  *entries;
+  const char            *strings;
+  int                    i;
+
+  if (len < sizeof (ZoneCacheHeader)                  ||
+      header->magic     != ZONE_CACHE_MAGIC          ||
+      header->version   != ZONE_CACHE_VERSION        ||
+      header->tab_mtime != tab_st->st_mtime          ||
+      header->tab_size  != tab_st->st_size           ||
+      len != sizeof (ZoneCacheHeader) +
+             (gsize) header->n_entries * sizeof (ZoneCacheEntry) +
+             header->strings_size                    ||
+      !header->strings_size                          ||
+      data[len - 1])
+    return FALSE;
+
+  entries = (const ZoneCacheEntry *)(header + 1);
+  strings = (const char *)(entries + header->n_entries);
+
+  for (i = 0; i < header->n_entries; i++)
+    if (entries[i].country >= header->strings_size ||
+        entries[i].zone    >= header->strings_size ||
+        entries[i].region  >= header->strings_size ||
+        (entries[i].city   >= header->strings_size &&
+         entries[i].city   != ZONE_CACHE_NONE))
+      return FALSE;
+
+  db->n_entries = header->n_entries;
+  db->entries   = g_new (TzEntry, db->n_entries);
+  db->inos      = g_new (guint64, db->n_entries);
+
+  /*
+   * Push this into a hash table keyed by region (the MxComboBox is too
+   * inefficient to manage big lists, and it would be user unfriendly anyway);
+   * we walk the entries backwards so that the lists come out sorted.
+   */
+  for (i = db->n_entries - 1; i >= 0; i--)
+    {
+      TzEntry *t = &db->entries[i];
+      GList   *l;
+
+      t->country = strings + entries[i].country;
+      t->zone    = strings + entries[i].zone;
+      t->region  = _(strings + entries[i].region);
+      t->city    = entries[i].city == ZONE_CACHE_NONE ? NULL :
+                   _(strings + entries[i].city);
+
+      t->latitude  = entries[i].latitude / 3600.0;
+      t->longitude = entries[i].longitude / 3600.0;
+      db->inos[i]  = entries[i].ino;
+
+      l = g_hash_table_lookup (db->regions, t->region);
+      l = g_list_prepend (l, t);
+      g_hash_table_insert (db->regions, (gpointer) t->region, l);
+    }
+
+  return TRUE;
+}
+
+static char *
+guaca_zone_db_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "guacamayo",
+                           "zones.cache", NULL);
+}
+
+/*
+ * Loads the timezone database, from the cache file if it is up to date,
+ * otherwise from zone.tab, refreshing the cache.
+ */
+GuacaZoneDb *
+guaca_zone_db_new (void)
+{
+  GuacaZoneDb *db = g_slice_new0 (GuacaZoneDb);
+  GString     *built;
+  char        *path, *dir;
+  struct stat  tab_st;
+
+  db->regions = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (stat (ZONE_TAB, &tab_st) < 0)
+    {
+      g_warning ("Failed to stat zone.tab: %s", strerror (errno));
+      return db;
+    }
+
+  path = guaca_zone_db_cache_path ();
+
+  if ((db->mapped = g_mapped_file_new (path, FALSE, NULL)))
+    {
+      if (guaca_zone_db_load (db, g_mapped_file_get_contents (db->mapped),
+                              g_mapped_file_get_length (db->mapped),
+                              &tab_st))
+        goto done;
+
+      g_mapped_file_unref (db->mapped);
+      db->mapped = NULL;
+    }
+
+  if (!(built = guaca_zone_db_build (&tab_st)))
+    goto done;
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  if (g_file_set_contents (path, built->str, built->len, NULL) &&
+      (db->mapped = g_mapped_file_new (path, FALSE, NULL)) &&
+      guaca_zone_db_load (db, g_mapped_file_get_contents (db->mapped),
+                          g_mapped_file_get_length (db->mapped), &tab_st))
+    {
+      g_string_free (built, TRUE);
+      goto done;
+    }
+
+  /*
+   * The cache is not usable, so work from the copy in memory.
+   */
+  if (db->mapped)
+    {
+      g_mapped_file_unref (db->mapped);
+      db->mapped = NULL;
+    }
+
+  g_free (db->entries);
+  g_free (db->inos);
+  db->entries = NULL;
+  db->inos    = NULL;
+  g_hash_table_remove_all (db->regions);
+
+  db->data = g_string_free (built, FALSE);
+
+  if (!guaca_zone_db_load (db, db->data,
+                           sizeof (ZoneCacheHeader) +
+                           ((ZoneCacheHeader *) db->data)->n_entries *
+                           sizeof (ZoneCacheEntry) +
+                           ((ZoneCacheHeader *) db->data)->strings_size,
+                           &tab_st))
+    g_warning ("Failed to load timezone database");
+
+ done:
+  g_free (path);
+
+  return db;
+}
+
+static void
+free_hash_list (gpointer key, GList *l, gpointer data)
+{
+  g_list_free (l);
+}
+
+void
+guaca_zone_db_free (GuacaZoneDb *db)
+{
+  if (!db)
+    return;
+
+  g_hash_table_foreach (db->regions, (GHFunc) free_hash_list, NULL);
+  g_hash_table_destroy (db->regions);
+
+  guaca_zone_index_free (db->index);
+
+  if (db->region_pos)
+    g_hash_table_destroy (db->region_pos);
+
+  if (db->by_ino)
+    g_hash_table_destroy (db->by_ino);
+
+  if (db->country_pos)
+    g_hash_table_destroy (db->country_pos);
+
+  g_free (db->inos);
+  g_free (db->countries);
+  g_free (db->country_zones);
+  g_free (db->country_names);
+  g_free (db->entries);
+
+  if (db->mapped)
+    g_mapped_file_unref (db->mapped);
+
+  g_free (db->data);
+
+  g_slice_free (GuacaZoneDb, db);
+}
+
+/*
+ * Returns the sorted list of regions; free with g_list_free().
+ */
+GList *
+guaca_zone_db_get_regions (GuacaZoneDb *db)
+{
+  GList *keys = g_hash_table_get_keys (db->regions);
+
+  return g_list_sort (keys, (GCompareFunc) g_strcmp0);
+}
+
+/*
+ * Returns the position of the region in the list returned by
+ * guaca_zone_db_get_regions(), or -1.
+ */
+int
+guaca_zone_db_get_region_index (GuacaZoneDb *db, const char *region)
+{
+  if (!region)
+    return -1;
+
+  if (!db->region_pos)
+    {
+      GList *keys, *l;
+      guint  i;
+
+      db->region_pos = g_hash_table_new (g_str_hash, g_str_equal);
+      keys = guaca_zone_db_get_regions (db);
+
+      for (l = keys, i = 1; l; l = l->next, i++)
+        g_hash_table_insert (db->region_pos, l->data, GUINT_TO_POINTER (i));
+
+      g_list_free (keys);
+    }
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (db->region_pos, region)) - 1;
+}
+
+/*
+ * Returns the entries for the region, sorted by zone; the list is owned by
+ * the database.
+ */
+GList *
+guaca_zone_db_lookup_region (GuacaZoneDb *db, const char *region)
+{
+  return g_hash_table_lookup (db->regions, region);
+}
+
+/*
+ * Finds up to n_matches zones nearest to the given location, nearest first,
+ * optionally with their distances in km; returns the number found.
+ */
+guint
+guaca_zone_db_nearest (GuacaZoneDb    *db,
+                       double          latitude,
+                       double          longitude,
+                       const TzEntry **matches,
+                       double         *distances,
+                       guint           n_matches)
+{
+  guint indices[n_matches ? n_matches : 1];
+  guint i, n;
+
+  if (!db->n_entries)
+    return 0;
+
+  if (!db->index)
+    db->index = guaca_zone_index_new (db->entries, db->n_entries);
+
+  n = guaca_zone_index_nearest (db->index, latitude, longitude,
+                                indices, distances, n_matches);
+
+  for (i = 0; i < n; i++)
+    matches[i] = &db->entries[indices[i]];
+
+  return n;
+}
+
+static int
+tz_entry_zone_cmp (const void *key, const void *e)
+{
+  return strcmp (key, ((const TzEntry *) e)->zone);
+}
+
+/*
+ * Returns the entry for the given zone, e.g., "Europe/London", or NULL.
+ */
+const TzEntry *
+guaca_zone_db_lookup_zone (GuacaZoneDb *db, const char *zone)
+{
+  if (!zone || !db->n_entries)
+    return NULL;
+
+  return bsearch (zone, db->entries, db->n_entries, sizeof (TzEntry),
+                  tz_entry_zone_cmp);
+}
+
+/*
+ * Returns the entry whose zone file is the given file, comparing the inodes
+ * we recorded when the database was built.
+ */
+static const TzEntry *
+guaca_zone_db_lookup_file (GuacaZoneDb *db, const char *path)
+{
+  struct stat st, dir_st;
+  guint64     ino;
+
+  if (stat (path, &st) < 0 || stat (ZONEINFO_DIR, &dir_st) < 0 ||
+      st.st_dev != dir_st.st_dev)
+    return NULL;
+
+  if (!db->by_ino)
+    {
+      guint i;
+
+      db->by_ino = g_hash_table_new (g_int64_hash, g_int64_equal);
+
+      /*
+       * Where zone.tab lists zones that are links to each other, the
+       * alphabetically first one wins.
+       */
+      for (i = 0; i < db->n_entries; i++)
+        if (!g_hash_table_lookup (db->by_ino, &db->inos[i]))
+          g_hash_table_insert (db->by_ino, &db->inos[i], &db->entries[i]);
+    }
+
+  ino = st.st_ino;
+
+  return g_hash_table_lookup (db->by_ino, &ino);
+}
+
+/*
+ * Like guaca_zone_db_lookup_zone(), but also resolves zones not listed in
+ * zone.tab, such as backward compatible aliases (e.g., "GB" or
+ * "US/Eastern"), to the listed zone whose file is the same file; distros
+ * ship the aliases as hard or symbolic links. If zone is NULL, or cannot be
+ * resolved, the zone /etc/localtime is, is returned.
+ */
+const TzEntry *
+guaca_zone_db_resolve_zone (GuacaZoneDb *db, const char *zone)
+{
+  const TzEntry *e;
+
+  if (!db->n_entries)
+    return NULL;
+
+  if ((e = guaca_zone_db_lookup_zone (db, zone)))
+    return e;
+
+  if (zone)
+    {
+      char *path = g_build_filename (ZONEINFO_DIR, zone, NULL);
+
+      e = guaca_zone_db_lookup_file (db, path);
+      g_free (path);
+
+      if (e)
+        return e;
+    }
+
+  return guaca_zone_db_lookup_file (db, "/etc/localtime");
+}
+
+static gint
+tz_entry_country_cmp (gconstpointer a, gconstpointer b)
+{
+  const TzEntry *e1 = *(const TzEntry **) a;
+  const TzEntry *e2 = *(const TzEntry **) b;
+  int            r;
+
+  if ((r = strcmp (e1->country, e2->country)))
+    return r;
+
+  return strcmp (e1->zone, e2->zone);
+}
+
+static gint
+tz_country_name_cmp (gconstpointer a, gconstpointer b)
+{
+  return g_utf8_collate (((const TzCountry *) a)->name,
+                         ((const TzCountry *) b)->name);
+}
+
+/*
+ * Reads the country names from iso3166.tab into a code-keyed hash table;
+ * the strings point into db->country_names.
+ */
+static GHashTable *
+guaca_zone_db_read_country_names (GuacaZoneDb *db)
+{
+  GHashTable *names = g_hash_table_new (g_str_hash, g_str_equal);
+  char       *line, *next;
+
+  if (!g_file_get_contents (ISO3166_TAB, &db->country_names, NULL, NULL))
+    {
+      g_warning ("Failed to read iso3166.tab");
+      return names;
+    }
+
+  for (line = db->country_names; line && *line; line = next)
+    {
+      char *tab;
+
+      if ((next = strchr (line, '\n')))
+        *next++ = 0;
+
+      if (*line == '#' || !(tab = strchr (line, '\t')))
+        continue;
+
+      *tab = 0;
+      g_hash_table_insert (names, line, tab + 1);
+    }
+
+  return names;
+}
+
+/*
+ * Returns the countries sorted by name; the country index is only built the
+ * first time it is asked for, so the region based browsing does not pay for
+ * it.
+ */
+const TzCountry *
+guaca_zone_db_get_countries (GuacaZoneDb *db, guint *n_countries)
+{
+  GHashTable *names;
+  gint64      start;
+  guint       i, first;
+
+  if (db->countries || !db->n_entries)
+    {
+      *n_countries = db->n_countries;
+      return db->countries;
+    }
+
+  start = g_get_monotonic_time ();
+
+  /*
+   * A single array of the entries sorted by country, then zone; each country
+   * is a slice of it.
+   */
+  db->country_zones = g_new (const TzEntry *, db->n_entries);
+
+  for (i = 0; i < db->n_entries; i++)
+    db->country_zones[i] = &db->entries[i];
+
+  qsort (db->country_zones, db->n_entries, sizeof (const TzEntry *),
+         tz_entry_country_cmp);
+
+  db->countries = g_new0 (TzCountry, db->n_entries);
+  names         = guaca_zone_db_read_country_names (db);
+
+  for (i = 0, first = 0; i <= db->n_entries; i++)
+    {
+      TzCountry  *c;
+      const char *name;
+
+      if (i < db->n_entries &&
+          !strcmp (db->country_zones[i]->country,
+                   db->country_zones[first]->country))
+        continue;
+
+      c = &db->countries[db->n_countries++];
+
+      c->code    = db->country_zones[first]->country;
+      c->zones   = &db->country_zones[first];
+      c->n_zones = i - first;
+
+      if ((name = g_hash_table_lookup (names, c->code)))
+        c->name = dgettext ("iso_3166", name);
+      else
+        c->name = c->code;
+
+      first = i;
+    }
+
+  g_hash_table_destroy (names);
+
+  qsort (db->countries, db->n_countries, sizeof (TzCountry),
+         tz_country_name_cmp);
+
+  db->country_pos = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < db->n_countries; i++)
+    g_hash_table_insert (db->country_pos, (gpointer) db->countries[i].code,
+                         GUINT_TO_POINTER (i + 1));
+
+  g_debug ("Country index over %u countries built in %" G_GINT64_FORMAT " us",
+           db->n_countries, g_get_monotonic_time () - start);
+
+  *n_countries = db->n_countries;
+  return db->countries;
+}
+
+/*
+ * Returns the position of the country with the given code in the array
+ * returned by guaca_zone_db_get_countries(), or -1.
+ */
+int
+guaca_zone_db_get_country_index (GuacaZoneDb *db, const char *code)
+{
+  guint n_countries;
+
+  if (!code || !guaca_zone_db_get_countries (db, &n_countries))
+    return -1;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (db->country_pos, code)) - 1;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Timezone database used by the Clock Settings plugin */
+
+#ifndef __GUACA_ZONE_DB_H__
+#define __GUACA_ZONE_DB_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The strings are owned by the database; region and city are translated and
+ * have underscores replaced by spaces.
+ */
+typedef struct TzEntry
+{
+  const char *country;
+  const char *zone;
+  const char *region;
+  const char *city;
+
+  double      latitude;         /* degrees, north positive */
+  double      longitude;        /* degrees, east positive */
+} TzEntry;
+
+/*
+ * A country with its zones, sorted by zone; the name is translated.
+ */
+typedef struct TzCountry
+{
+  const char     *code;
+  const char     *name;
+
+  const TzEntry **zones;
+  guint           n_zones;
+} TzCountry;
+
+typedef struct _GuacaZoneDb GuacaZoneDb;
+
+GuacaZoneDb *guaca_zone_db_new           (void);
+void         guaca_zone_db_free          (GuacaZoneDb *db);
+
+GList       *guaca_zone_db_get_regions   (GuacaZoneDb *db);
+GList       *guaca_zone_db_lookup_region (GuacaZoneDb *db,
+                                          const char  *region);
+int          guaca_zone_db_get_region_index (GuacaZoneDb *db,
+                                             const char  *region);
+
+const TzEntry *
+             guaca_zone_db_lookup_zone   (GuacaZoneDb *db,
+                                          const char  *zone);
+const TzEntry *
+             guaca_zone_db_resolve_zone  (GuacaZoneDb *db,
+                                          const char  *zone);
+
+const TzCountry *
+             guaca_zone_db_get_countries (GuacaZoneDb *db,
+                                          guint       *n_countries);
+int          guaca_zone_db_get_country_index (GuacaZoneDb *db,
+                                              const char  *code);
+
+guint        guaca_zone_db_nearest       (GuacaZoneDb     *db,
+                                          double           latitude,
+                                          double           longitude,
+                                          const TzEntry  **matches,
+                                          double          *distances,
+                                          guint            n_matches);
+
+G_END_DECLS
+
+#endif /* __GUACA_ZONE_DB_H__ */
@@ -0,0 +1,301 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-zone-index.h"
+
+#include <math.h>
+#include <string.h>
+
+#define EARTH_RADIUS_KM 6371.0
+
+/*
+ * The zones are indexed as points on the unit sphere, rather than by their
+ * latitude and longitude, so that plain euclidean distances work across the
+ * poles and the date line; the chord length grows monotonically with the
+ * great circle distance, so the nearest point is the same either way.
+ *
+ * The tree is stored implicitly: the node of the range [lo, hi) is at its
+ * middle, (lo + hi) / 2, with the left and right subtrees in the two halves,
+ * and the splitting axis is the depth modulo 3.
+ */
+typedef struct
+{
+  float x[3];
+  guint entry;
+} ZoneNode;
+
+struct _GuacaZoneIndex
+{
+  ZoneNode *nodes;
+  guint     n_nodes;
+};
+
+/*
+ * The state of a query; best holds the n_best nearest nodes found so far,
+ * ordered by increasing distance.
+ */
+typedef struct
+{
+  float  x[3];
+
+  guint *best;
+  float *best_d2;
+  guint  n_best;
+  guint  max_best;
+} ZoneQuery;
+
+static void
+to_unit_vector (double latitude, double longitude, float *x)
+{
+  double phi    = latitude * G_PI / 180.0;
+  double lambda = longitude * G_PI / 180.0;
+
+  x[0] = cos (phi) * cos (lambda);
+  x[1] = cos (phi) * sin (lambda);
+  x[2] = sin (phi);
+}
+
+static gint
+zone_node_cmp (gconstpointer a, gconstpointer b, gpointer data)
+{
+  guint axis = GPOINTER_TO_UINT (data);
+  float d    = ((const ZoneNode *) a)->x[axis] -
+               ((const ZoneNode *) b)->x[axis];
+
+  return d < 0.0f ? -1 : d > 0.0f ? 1 : 0;
+}
+
+/*
+ * Builds the subtree over nodes [lo, hi); sorting each range is O(n log^2 n)
+ * in total, which for the few hundred zones there are is not worth doing
+ * anything cleverer about.
+ */
+static void
+guaca_zone_index_build (ZoneNode *nodes, guint lo, guint hi, guint depth)
+{
+  guint mid;
+
+  if (hi - lo < 2)
+    return;
+
+  mid = (lo + hi) / 2;
+
+  g_qsort_with_data (nodes + lo, hi - lo, sizeof (ZoneNode),
+                     zone_node_cmp, GUINT_TO_POINTER (depth % 3));
+
+  guaca_zone_index_build (nodes, lo, mid, depth + 1);
+  guaca_zone_index_build (nodes, mid + 1, hi, depth + 1);
+}
+
+GuacaZoneIndex *
+guaca_zone_index_new (const TzEntry *entries, guint n_entries)
+{
+  GuacaZoneIndex *index = g_slice_new0 (GuacaZoneIndex);
+  gint64          start = g_get_monotonic_time ();
+  guint           i;
+
+  index->n_nodes = n_entries;
+  index->nodes   = g_new (ZoneNode, n_entries);
+
+  for (i = 0; i < n_entries; i++)
+    {
+      to_unit_vector (entries[i].latitude, entries[i].longitude,
+                      index->nodes[i].x);
+      index->nodes[i].entry = i;
+    }
+
+  guaca_zone_index_build (index->nodes, 0, n_entries, 0);
+
+  g_debug ("Zone index over %u zones built in %" G_GINT64_FORMAT " us",
+           n_entries, g_get_monotonic_time () - start);
+
+  return index;
+}
+
+void
+guaca_zone_index_free (GuacaZoneIndex *index)
+{
+  if (!index)
+    return;
+
+  g_free (index->nodes);
+  g_slice_free (GuacaZoneIndex, index);
+}
+
+static void
+zone_query_offer (ZoneQuery *q, const ZoneNode *node)
+{
+  float d2 = 0.0f;
+  guint i, j;
+
+  for (i = 0; i < 3; i++)
+    d2 += (node->x[i] - q->x[i]) * (node->x[i] - q->x[i]);
+
+  if (q->n_best == q->max_best && d2 >= q->best_d2[q->n_best - 1])
+    return;
+
+  for (i = MIN (q->n_best, q->max_best - 1); i > 0; i--)
+    if (q->best_d2[i - 1] <= d2)
+      break;
+
+  for (j = MIN (q->n_best, q->max_best - 1); j > i; j--)
+    {
+      q->best[j]    = q->best[j - 1];
+      q->best_d2[j] = q->best_d2[j - 1];
+    }
+
+  q->best[i]    = node->entry;
+  q->best_d2[i] = d2;
+
+  if (q->n_best < q->max_best)
+    q->n_best++;
+}
+
+static void
+guaca_zone_index_search (GuacaZoneIndex *index,
+                         ZoneQuery      *q,
+                         guint           lo,
+                         guint           hi,
+                         guint           depth)
+{
+  const ZoneNode *node;
+  guint           mid, axis;
+  float           diff;
+
+  if (lo >= hi)
+    return;
+
+  mid  = (lo + hi) / 2;
+  node = &index->nodes[mid];
+  axis = depth % 3;
+  diff = q->x[axis] - node->x[axis];
+
+  zone_query_offer (q, node);
+
+  /*
+   * Descend into the half containing the query point first, and only visit
+   * the other one if the splitting plane is closer than the worst match we
+   * have.
+   */
+  if (diff < 0.0f)
+    guaca_zone_index_search (index, q, lo, mid, depth + 1);
+  else
+    guaca_zone_index_search (index, q, mid + 1, hi, depth + 1);
+
+  if (q->n_best < q->max_best || diff * diff < q->best_d2[q->n_best - 1])
+    {
+      if (diff < 0.0f)
+        guaca_zone_index_search (index, q, mid + 1, hi, depth + 1);
+      else
+        guaca_zone_index_search (index, q, lo, mid, depth + 1);
+    }
+}
+
+/*
+ * Finds up to n_matches zones nearest to the given location, storing their
+ * indices into the entries the index was built from in matches, nearest
+ * first, and, if distances is not NULL, their great circle distances in km.
+ * Returns the number of matches found.
+ */
+guint
+guaca_zone_index_nearest (GuacaZoneIndex *index,
+                          double          latitude,
+                          double          longitude,
+                          guint          *matches,
+                          double         *distances,
+                          guint           n_matches)
+{
+  ZoneQuery q;
+  float     d2[n_matches ? n_matches : 1];
+  guint     i;
+
+  if (!index || !n_matches)
+    return 0;
+
+  to_unit_vector (latitude, longitude, q.x);
+
+  q.best     = matches;
+  q.best_d2  = d2;
+  q.n_best   = 0;
+  q.max_best = n_matches;
+
+  guaca_zone_index_search (index, &q, 0, index->n_nodes, 0);
+
+  if (distances)
+    for (i = 0; i < q.n_best; i++)
+      distances[i] = 2.0 * EARTH_RADIUS_KM *
+        asin (MIN (1.0, sqrt (d2[i]) / 2.0));
+
+  return q.n_best;
+}
+
+/*
+ * Parses one ISO 6709 component of sign, int_digits of degrees, and then
+ * either two or four digits of minutes and seconds.
+ */
+static const char *
+parse_iso6709_component (const char *s, guint int_digits, double *value)
+{
+  double sign, v = 0.0;
+  guint  i, n;
+
+  if (*s == '+')
+    sign = 1.0;
+  else if (*s == '-')
+    sign = -1.0;
+  else
+    return NULL;
+
+  s++;
+
+  for (n = 0; g_ascii_isdigit (s[n]); n++)
+    ;
+
+  if (n != int_digits + 2 && n != int_digits + 4)
+    return NULL;
+
+  for (i = 0; i < int_digits; i++)
+    v = v * 10 + (s[i] - '0');
+
+  v += ((s[i] - '0') * 10 + (s[i + 1] - '0')) / 60.0;
+
+  if (n == int_digits + 4)
+    v += ((s[i + 2] - '0') * 10 + (s[i + 3] - '0')) / 3600.0;
+
+  *value = sign * v;
+
+  return s + n;
+}
+
+/*
+ * Parses the coordinates column of zone.tab, which is in the ISO 6709
+ * +-DDMM+-DDDMM or +-DDMMSS+-DDDMMSS form.
+ */
+gboolean
+guaca_zone_parse_iso6709 (const char *str, double *latitude, double *longitude)
+{
+  const char *s;
+
+  if (!(s = parse_iso6709_component (str, 2, latitude)) ||
+      !(s = parse_iso6709_component (s, 3, longitude)))
+    return FALSE;
+
+  return *s == 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Spatial index for finding the timezones nearest to a location */
+
+#ifndef __GUACA_ZONE_INDEX_H__
+#define __GUACA_ZONE_INDEX_H__
+
+#include <glib.h>
+
+#include "guaca-zone-db.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaZoneIndex GuacaZoneIndex;
+
+GuacaZoneIndex *guaca_zone_index_new     (const TzEntry  *entries,
+                                          guint           n_entries);
+void            guaca_zone_index_free    (GuacaZoneIndex *index);
+
+guint           guaca_zone_index_nearest (GuacaZoneIndex *index,
+                                          double          latitude,
+                                          double          longitude,
+                                          guint          *matches,
+                                          double         *distances,
+                                          guint           n_matches);
+
+gboolean        guaca_zone_parse_iso6709 (const char     *str,
+                                          double         *latitude,
+                                          double         *longitude);
+
+G_END_DECLS
+
+#endif /* __GUACA_ZONE_INDEX_H__ */
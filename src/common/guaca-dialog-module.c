@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-dialog-module.h"
+
+#include <stdarg.h>
+
+#include <gmodule.h>
+
+/*
+ * Loads the dialog module name from DIALOGSDIR, or GUACA_DIALOGS_DIR when
+ * running from the build tree, and looks up the NULL terminated list of
+ * symbol names and locations to store them in; returns FALSE on failure.
+ * The module stays loaded for the life time of the process.
+ *
+ * A module links libguaca-common, and carries its own copy of anything else
+ * it needs, so it does not need the symbols of the plugin that loads it.
+ */
+gboolean
+guaca_dialog_module_load (const char *name, const char *first_symbol, ...)
+{
+  const char *dir = g_getenv ("GUACA_DIALOGS_DIR");
+  const char *symbol;
+  char       *file, *path;
+  GModule    *module;
+  gint64      start = g_get_monotonic_time ();
+  gboolean    ret = TRUE;
+  va_list     args;
+
+  file = g_strconcat (name, ".", G_MODULE_SUFFIX, NULL);
+  path = g_build_filename (dir && *dir ? dir : DIALOGSDIR, file, NULL);
+
+  if (!(module = g_module_open (path,
+                                G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL)))
+    {
+      g_warning ("Failed to load '%s': %s", path, g_module_error ());
+      ret = FALSE;
+      goto out;
+    }
+
+  g_module_make_resident (module);
+
+  va_start (args, first_symbol);
+
+  for (symbol = first_symbol; symbol; symbol = va_arg (args, const char *))
+    {
+      gpointer *func = va_arg (args, gpointer *);
+
+      if (!g_module_symbol (module, symbol, func))
+        {
+          g_warning ("Failed to load '%s': %s", path, g_module_error ());
+          ret = FALSE;
+          break;
+        }
+    }
+
+  va_end (args);
+
+  g_debug ("Loaded '%s' in %" G_GINT64_FORMAT " us",
+           path, g_get_monotonic_time () - start);
+
+ out:
+  g_free (path);
+  g_free (file);
+
+  return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/*
+ * The dialogs of the plugins live in modules of their own, loaded when a
+ * dialog is first opened, so that the code of a dialog, and what it pulls
+ * in, is not mapped and relocated at startup in sessions that never open
+ * it.
+ */
+
+#ifndef __GUACA_DIALOG_MODULE_H__
+#define __GUACA_DIALOG_MODULE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean guaca_dialog_module_load (const char *name,
+                                   const char *first_symbol,
+                                   ...) G_GNUC_NULL_TERMINATED;
+
+G_END_DECLS
+
+#endif /* __GUACA_DIALOG_MODULE_H__ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-histogram.h"
+
+#include <string.h>
+
+static guint
+bucket_index (guint64 value)
+{
+  guint shift;
+  guint idx;
+
+  if (value < GUACA_HISTOGRAM_SUB_COUNT)
+    return value;
+
+  shift = g_bit_storage (value) - 1 - GUACA_HISTOGRAM_SUB_BITS;
+  idx   = (shift + 1) * GUACA_HISTOGRAM_SUB_COUNT +
+    (guint)((value >> shift) - GUACA_HISTOGRAM_SUB_COUNT);
+
+  return MIN (idx, GUACA_HISTOGRAM_BUCKETS - 1);
+}
+
+/*
+ * The value we report for a bucket is its upper bound.
+ */
+static guint64
+bucket_value (guint idx)
+{
+  guint shift, sub;
+
+  if (idx < GUACA_HISTOGRAM_SUB_COUNT)
+    return idx;
+
+  shift = idx / GUACA_HISTOGRAM_SUB_COUNT - 1;
+  sub   = idx % GUACA_HISTOGRAM_SUB_COUNT;
+
+  return (((guint64) GUACA_HISTOGRAM_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void
+guaca_histogram_reset (GuacaHistogram *h)
+{
+  memset (h, 0, sizeof (GuacaHistogram));
+}
+
+/*
+ * Records a single value; this does not allocate and is cheap enough to be
+ * called from the paint cycle.
+ */
+void
+guaca_histogram_add (GuacaHistogram *h, guint64 value)
+{
+  h->counts[bucket_index (value)]++;
+  h->total++;
+
+  if (value > h->max)
+    h->max = value;
+}
+
+guint64
+guaca_histogram_percentile (const GuacaHistogram *h, double percentile)
+{
+  guint64 target, seen = 0;
+  guint   i;
+
+  if (!h->total)
+    return 0;
+
+  target = (guint64)(h->total * percentile / 100.0 + 0.5);
+
+  if (target < 1)
+    target = 1;
+
+  for (i = 0; i < GUACA_HISTOGRAM_BUCKETS; i++)
+    {
+      seen += h->counts[i];
+
+      if (seen >= target)
+        return MIN (bucket_value (i), h->max);
+    }
+
+  return h->max;
+}
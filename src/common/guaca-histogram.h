@@ -0,0 +1,51 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Fixed size log-linear (HDR style) histogram of microsecond durations */
+
+#ifndef __GUACA_HISTOGRAM_H__
+#define __GUACA_HISTOGRAM_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Each power of two is split into 2^GUACA_HISTOGRAM_SUB_BITS linear buckets,
+ * giving a relative error of about 6%; values of
+ * 2^(GUACA_HISTOGRAM_MAGNITUDES + GUACA_HISTOGRAM_SUB_BITS) us (~16.8 s) and
+ * above end up in the last bucket.
+ */
+#define GUACA_HISTOGRAM_SUB_BITS   4
+#define GUACA_HISTOGRAM_SUB_COUNT  (1 << GUACA_HISTOGRAM_SUB_BITS)
+#define GUACA_HISTOGRAM_MAGNITUDES 20
+#define GUACA_HISTOGRAM_BUCKETS    ((GUACA_HISTOGRAM_MAGNITUDES + 1) * \
+                                    GUACA_HISTOGRAM_SUB_COUNT)
+
+typedef struct
+{
+  guint32 counts[GUACA_HISTOGRAM_BUCKETS];
+  guint64 total;
+  guint64 max;
+} GuacaHistogram;
+
+void    guaca_histogram_reset      (GuacaHistogram *h);
+void    guaca_histogram_add        (GuacaHistogram *h, guint64 value);
+guint64 guaca_histogram_percentile (const GuacaHistogram *h, double percentile);
+
+G_END_DECLS
+
+#endif /* __GUACA_HISTOGRAM_H__ */
@@ -0,0 +1,265 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-input-latency.h"
+#include "guaca-sampler.h"
+
+#ifdef ENABLE_INPUT_LATENCY
+
+/*
+ * The tracker is attached to the stage, so that all the plugins, each of
+ * which is a separate module, feed the same histogram.
+ */
+#define TRACKER_KEY "guaca-input-latency"
+
+/*
+ * An input that is not followed by a paint within this time did not change
+ * anything on the screen; it is dropped rather than matched with whatever
+ * paints next.
+ */
+#define MAX_LATENCY_US (2 * G_USEC_PER_SEC)
+
+/*
+ * How often the histogram is copied for the metrics thread; this is done
+ * on the sampler wakeups, rather than on a timer of its own.
+ */
+#define PUBLISH_INTERVAL_MS 5000
+
+typedef struct
+{
+  gint64          pending;      /* time of the oldest unpainted input */
+
+  GuacaHistogram  histogram;
+} GuacaInputLatency;
+
+/*
+ * The metrics thread cannot look at the stage, nor the tracker, which goes
+ * with the stage; it only reads a copy of the histogram, published from the
+ * main loop.
+ *
+ * The copy is handed over with an atomic swap. The metrics thread takes it
+ * out of the slot while it reads it, and puts it back unless a newer one
+ * was published in the meantime, so the main loop never frees a copy that
+ * is being read.
+ */
+struct _GuacaInputLatencyExport
+{
+  ClutterActor   *actor;
+  GuacaSamplerSub *publish_sub;
+  guint64         published_total;
+
+  GuacaHistogram *published;
+};
+
+static void
+guaca_input_latency_paint_cb (ClutterActor *stage, GuacaInputLatency *tracker)
+{
+  gint64 latency;
+
+  if (!tracker->pending)
+    return;
+
+  latency = g_get_monotonic_time () - tracker->pending;
+  tracker->pending = 0;
+
+  if (latency > MAX_LATENCY_US)
+    return;
+
+  guaca_histogram_add (&tracker->histogram, latency);
+
+  g_debug ("Input latency %" G_GINT64_FORMAT " us", latency);
+}
+
+static void
+guaca_input_latency_free (GuacaInputLatency *tracker)
+{
+  g_slice_free (GuacaInputLatency, tracker);
+}
+
+gboolean
+guaca_input_latency_enabled (void)
+{
+  static int enabled = -1;
+
+  if (G_UNLIKELY (enabled < 0))
+    enabled = g_getenv ("GUACA_INPUT_LATENCY") != NULL;
+
+  return enabled;
+}
+
+static GuacaInputLatency *
+guaca_input_latency_get (ClutterActor *actor, gboolean create)
+{
+  GuacaInputLatency *tracker;
+  ClutterActor      *stage;
+
+  if (!actor || !(stage = clutter_actor_get_stage (actor)))
+    return NULL;
+
+  if ((tracker = g_object_get_data (G_OBJECT (stage), TRACKER_KEY)) ||
+      !create)
+    return tracker;
+
+  tracker = g_slice_new0 (GuacaInputLatency);
+
+  /*
+   * As with the frame timing, prefer after-paint so the latency includes the
+   * whole of the paint.
+   */
+  if (g_signal_lookup ("after-paint", G_OBJECT_TYPE (stage)))
+    g_signal_connect (stage, "after-paint",
+                      G_CALLBACK (guaca_input_latency_paint_cb), tracker);
+  else
+    g_signal_connect_after (stage, "paint",
+                            G_CALLBACK (guaca_input_latency_paint_cb),
+                            tracker);
+
+  g_object_set_data_full (G_OBJECT (stage), TRACKER_KEY, tracker,
+                          (GDestroyNotify) guaca_input_latency_free);
+
+  return tracker;
+}
+
+/*
+ * Records an input handled by actor; the latency is measured from here to
+ * the end of the next paint of the stage the actor is on. The time the
+ * event spent queued before it was dispatched to us is not included, the
+ * event timestamps are not on a clock we can compare with.
+ *
+ * Of several inputs handled before a paint only the first one counts, which
+ * is the one the user waited for the longest.
+ */
+void
+guaca_input_latency_mark (ClutterActor *actor)
+{
+  GuacaInputLatency *tracker;
+  gint64             now;
+
+  if (!guaca_input_latency_enabled () ||
+      !(tracker = guaca_input_latency_get (actor, TRUE)))
+    return;
+
+  now = g_get_monotonic_time ();
+
+  if (!tracker->pending || now - tracker->pending > MAX_LATENCY_US)
+    tracker->pending = now;
+}
+
+/*
+ * Returns the histogram for the stage the actor is on, or NULL if no input
+ * has been recorded there.
+ */
+const GuacaHistogram *
+guaca_input_latency_get_histogram (ClutterActor *actor)
+{
+  GuacaInputLatency *tracker = guaca_input_latency_get (actor, FALSE);
+
+  return tracker ? &tracker->histogram : NULL;
+}
+
+static void
+guaca_input_latency_publish_cb (gpointer data)
+{
+  GuacaInputLatencyExport *export = data;
+  const GuacaHistogram    *h;
+  GuacaHistogram          *copy;
+
+  if (!(h = guaca_input_latency_get_histogram (export->actor)) ||
+      h->total == export->published_total)
+    return;
+
+  copy = g_memdup (h, sizeof (GuacaHistogram));
+  export->published_total = h->total;
+
+  g_free (__atomic_exchange_n (&export->published, copy, __ATOMIC_ACQ_REL));
+}
+
+/*
+ * Publishes the histogram for the stage the actor is on to the metrics
+ * thread every few seconds; the export is to be freed after the metrics
+ * thread is stopped.
+ */
+GuacaInputLatencyExport *
+guaca_input_latency_export_new (ClutterActor *actor)
+{
+  GuacaInputLatencyExport *export = g_slice_new0 (GuacaInputLatencyExport);
+
+  export->actor = actor;
+  export->publish_sub =
+    guaca_sampler_subscribe_main (PUBLISH_INTERVAL_MS,
+                                  guaca_input_latency_publish_cb, export);
+
+  return export;
+}
+
+void
+guaca_input_latency_export_free (GuacaInputLatencyExport *export)
+{
+  if (!export)
+    return;
+
+  guaca_sampler_unsubscribe (export->publish_sub);
+  g_free (export->published);
+
+  g_slice_free (GuacaInputLatencyExport, export);
+}
+
+/*
+ * GuacaMetricsFunc exporting the input latency; data is the
+ * GuacaInputLatencyExport.
+ */
+void
+guaca_input_latency_write_metrics (GString *out, gpointer data)
+{
+  GuacaInputLatencyExport *export = data;
+  GuacaHistogram          *hp, *expected = NULL;
+  const double             q[] = { 0.5, 0.95, 0.99 };
+  GuacaHistogram           h;
+  guint                    i;
+
+  if (!(hp = __atomic_exchange_n (&export->published, NULL,
+                                  __ATOMIC_ACQ_REL)))
+    return;
+
+  h = *hp;
+
+  if (!__atomic_compare_exchange_n (&export->published, &expected, hp,
+                                    FALSE, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+    g_free (hp);
+
+  g_string_append (out,
+                   "# HELP guacamayo_input_latency_seconds "
+                   "Time from remote control input to the next paint.\n"
+                   "# TYPE guacamayo_input_latency_seconds summary\n");
+
+  for (i = 0; i < G_N_ELEMENTS (q); i++)
+    g_string_append_printf (out,
+                            "guacamayo_input_latency_seconds"
+                            "{quantile=\"%.2f\"} %.6f\n",
+                            q[i],
+                            guaca_histogram_percentile (&h, q[i] * 100.0) /
+                            (double) G_USEC_PER_SEC);
+
+  g_string_append_printf (out, "guacamayo_input_latency_seconds_count %"
+                          G_GUINT64_FORMAT "\n", h.total);
+}
+
+#endif /* ENABLE_INPUT_LATENCY */
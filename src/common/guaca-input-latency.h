@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Latency from remote control input to the next stage paint */
+
+#ifndef __GUACA_INPUT_LATENCY_H__
+#define __GUACA_INPUT_LATENCY_H__
+
+#include <glib.h>
+#include <clutter/clutter.h>
+
+#include "guaca-histogram.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The instrumentation is only compiled in with --enable-input-latency, and
+ * then only active when GUACA_INPUT_LATENCY is set in the environment;
+ * otherwise GUACA_INPUT_LATENCY_MARK() compiles to nothing.
+ */
+#ifdef ENABLE_INPUT_LATENCY
+
+#define GUACA_INPUT_LATENCY_MARK(actor) guaca_input_latency_mark (actor)
+
+typedef struct _GuacaInputLatencyExport GuacaInputLatencyExport;
+
+void                  guaca_input_latency_mark          (ClutterActor *actor);
+gboolean              guaca_input_latency_enabled       (void);
+
+const GuacaHistogram *guaca_input_latency_get_histogram (ClutterActor *actor);
+
+GuacaInputLatencyExport *
+                      guaca_input_latency_export_new    (ClutterActor *actor);
+void                  guaca_input_latency_export_free
+                                        (GuacaInputLatencyExport *export);
+
+void                  guaca_input_latency_write_metrics (GString      *out,
+                                                         gpointer      data);
+
+#else
+
+#define GUACA_INPUT_LATENCY_MARK(actor) G_STMT_START { } G_STMT_END
+
+#endif
+
+G_END_DECLS
+
+#endif /* __GUACA_INPUT_LATENCY_H__ */
@@ -0,0 +1,361 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-metrics.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+/*
+ * How long we wait for a client to send a request before we assume it is
+ * not speaking HTTP and just wants the raw exposition text.
+ */
+#define REQUEST_TIMEOUT_US (200 * 1000)
+
+typedef struct
+{
+  GuacaMetricsFunc func;
+  gpointer         data;
+} MetricsSource;
+
+struct _GuacaMetrics
+{
+  char         *path;
+  guint         interval;
+
+  GArray       *sources;
+
+  GSocket      *socket;
+  GCancellable *cancellable;
+  GThread      *thread;
+
+  /*
+   * Only ever touched from the metrics thread.
+   */
+  GString      *snapshot;
+  gint64        snapshot_time;
+};
+
+char *
+guaca_metrics_default_socket (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (),
+                           "guacamayo-metrics.sock", NULL);
+}
+
+GuacaMetrics *
+guaca_metrics_new (const char *socket_path, guint interval)
+{
+  GuacaMetrics *metrics = g_slice_new0 (GuacaMetrics);
+
+  metrics->path        = g_strdup (socket_path);
+  metrics->interval    = MAX (interval, 1);
+  metrics->sources     = g_array_new (FALSE, FALSE, sizeof (MetricsSource));
+  metrics->cancellable = g_cancellable_new ();
+  metrics->snapshot    = g_string_sized_new (4096);
+
+  return metrics;
+}
+
+/*
+ * Sources can only be added before the server is started.
+ */
+void
+guaca_metrics_add_source (GuacaMetrics     *metrics,
+                          GuacaMetricsFunc  func,
+                          gpointer          data)
+{
+  MetricsSource s = { func, data };
+
+  g_return_if_fail (!metrics->thread);
+
+  g_array_append_val (metrics->sources, s);
+}
+
+static void
+write_escaped (GString *out, const char *value)
+{
+  const char *p;
+
+  for (p = value ? value : ""; *p; p++)
+    {
+      if (*p == '\\' || *p == '"')
+        g_string_append_c (out, '\\');
+      else if (*p == '\n')
+        {
+          g_string_append (out, "\\n");
+          continue;
+        }
+
+      g_string_append_c (out, *p);
+    }
+}
+
+void
+guaca_metrics_write (GString    *out,
+                     const char *name,
+                     const char *type,
+                     const char *help,
+                     double      value)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n%s %s\n",
+                          name, help, name, type, name,
+                          g_ascii_dtostr (buf, sizeof (buf), value));
+}
+
+/*
+ * Writes an info style metric, a gauge with a constant value of 1 carrying
+ * its payload in the labels; labels is a NULL terminated list of name, value
+ * pairs.
+ */
+void
+guaca_metrics_write_info (GString     *out,
+                          const char  *name,
+                          const char  *help,
+                          const char **labels)
+{
+  int i;
+
+  g_string_append_printf (out, "# HELP %s %s\n# TYPE %s gauge\n%s{",
+                          name, help, name, name);
+
+  for (i = 0; labels[i] && labels[i + 1]; i += 2)
+    {
+      g_string_append_printf (out, "%s%s=\"", i ? "," : "", labels[i]);
+      write_escaped (out, labels[i + 1]);
+      g_string_append_c (out, '"');
+    }
+
+  g_string_append (out, "} 1\n");
+}
+
+/*
+ * Rebuilds the snapshot if it is older than the interval; however many
+ * clients connect, the sources run at most once per interval.
+ */
+static void
+guaca_metrics_update_snapshot (GuacaMetrics *metrics)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint  i;
+
+  if (metrics->snapshot_time &&
+      now - metrics->snapshot_time < metrics->interval * G_USEC_PER_SEC)
+    return;
+
+  g_string_truncate (metrics->snapshot, 0);
+
+  for (i = 0; i < metrics->sources->len; i++)
+    {
+      MetricsSource *s = &g_array_index (metrics->sources, MetricsSource, i);
+
+      s->func (metrics->snapshot, s->data);
+    }
+
+  metrics->snapshot_time = g_get_monotonic_time ();
+
+  guaca_metrics_write (metrics->snapshot,
+                       "guacamayo_metrics_collect_seconds", "gauge",
+                       "Time spent collecting the metrics snapshot.",
+                       (double)(metrics->snapshot_time - now) /
+                       G_USEC_PER_SEC);
+}
+
+static void
+guaca_metrics_serve (GuacaMetrics *metrics, GSocket *client)
+{
+  char      buf[1024];
+  gssize    r = 0;
+  gboolean  http = FALSE;
+  GString  *reply;
+  gsize     sent;
+
+  /* the client may close without sending anything */
+  buf[0] = 0;
+
+  /*
+   * A scraper speaking HTTP sends its request first; something like socat
+   * just wants the text. Drain the request headers, but do not wait long for
+   * them.
+   */
+  if (g_socket_condition_timed_wait (client, G_IO_IN, REQUEST_TIMEOUT_US,
+                                     metrics->cancellable, NULL))
+    {
+      gsize len = 0;
+
+      while (len < sizeof (buf) - 1 &&
+             (r = g_socket_receive (client, buf + len, sizeof (buf) - 1 - len,
+                                    metrics->cancellable, NULL)) > 0)
+        {
+          len += r;
+          buf[len] = 0;
+
+          if (strstr (buf, "\r\n\r\n") || strstr (buf, "\n\n"))
+            break;
+        }
+
+      http = !strncmp (buf, "GET ", 4);
+    }
+
+  guaca_metrics_update_snapshot (metrics);
+
+  reply = g_string_sized_new (metrics->snapshot->len + 128);
+
+  if (http)
+    g_string_append_printf (reply,
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                            "Connection: close\r\n\r\n",
+                            metrics->snapshot->len);
+
+  g_string_append_len (reply, metrics->snapshot->str, metrics->snapshot->len);
+
+  for (sent = 0; sent < reply->len; sent += r)
+    if ((r = g_socket_send (client, reply->str + sent, reply->len - sent,
+                            metrics->cancellable, NULL)) <= 0)
+      {
+        g_debug ("Failed to send metrics to client");
+        break;
+      }
+
+  g_string_free (reply, TRUE);
+}
+
+/*
+ * The metrics thread; clients are served one at a time, each with a short
+ * timeout, which is plenty for a handful of local scrapers and keeps all of
+ * the work off the main loop.
+ */
+static gpointer
+guaca_metrics_thread (gpointer data)
+{
+  GuacaMetrics *metrics = data;
+
+  for (;;)
+    {
+      GSocket *client;
+      GError  *error = NULL;
+
+      if (!(client = g_socket_accept (metrics->socket, metrics->cancellable,
+                                      &error)))
+        {
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            {
+              g_error_free (error);
+              break;
+            }
+
+          g_warning ("Failed to accept metrics connection: %s",
+                     error->message);
+          g_clear_error (&error);
+          continue;
+        }
+
+      g_socket_set_timeout (client, 2);
+      guaca_metrics_serve (metrics, client);
+      g_socket_close (client, NULL);
+      g_object_unref (client);
+    }
+
+  return NULL;
+}
+
+gboolean
+guaca_metrics_start (GuacaMetrics *metrics, GError **error)
+{
+  GSocketAddress *address;
+  char           *dir;
+  struct stat     st;
+
+  g_return_val_if_fail (!metrics->thread, FALSE);
+
+  dir = g_path_get_dirname (metrics->path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  /*
+   * A stale socket from a previous run would make the bind fail; anything
+   * else at the path is not ours to remove.
+   */
+  if (!lstat (metrics->path, &st) && S_ISSOCK (st.st_mode))
+    unlink (metrics->path);
+
+  if (!(metrics->socket = g_socket_new (G_SOCKET_FAMILY_UNIX,
+                                        G_SOCKET_TYPE_STREAM,
+                                        G_SOCKET_PROTOCOL_DEFAULT, error)))
+    return FALSE;
+
+  address = g_unix_socket_address_new (metrics->path);
+
+  if (!g_socket_bind (metrics->socket, address, FALSE, error) ||
+      !g_socket_listen (metrics->socket, error))
+    {
+      g_object_unref (address);
+      g_clear_object (&metrics->socket);
+      return FALSE;
+    }
+
+  g_object_unref (address);
+
+  if (!(metrics->thread = g_thread_try_new ("guaca-metrics",
+                                            guaca_metrics_thread, metrics,
+                                            error)))
+    {
+      g_clear_object (&metrics->socket);
+      unlink (metrics->path);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+void
+guaca_metrics_free (GuacaMetrics *metrics)
+{
+  if (!metrics)
+    return;
+
+  if (metrics->thread)
+    {
+      g_cancellable_cancel (metrics->cancellable);
+      g_thread_join (metrics->thread);
+      unlink (metrics->path);
+    }
+
+  if (metrics->socket)
+    {
+      g_socket_close (metrics->socket, NULL);
+      g_object_unref (metrics->socket);
+    }
+
+  g_object_unref (metrics->cancellable);
+  g_array_free (metrics->sources, TRUE);
+  g_string_free (metrics->snapshot, TRUE);
+  g_free (metrics->path);
+
+  g_slice_free (GuacaMetrics, metrics);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Prometheus text format export of system metrics over a Unix socket */
+
+#ifndef __GUACA_METRICS_H__
+#define __GUACA_METRICS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaMetrics GuacaMetrics;
+
+/*
+ * A metrics source appends its metrics to out; sources are invoked from the
+ * metrics thread, so they must be thread safe.
+ */
+typedef void (*GuacaMetricsFunc) (GString *out, gpointer data);
+
+GuacaMetrics *guaca_metrics_new        (const char       *socket_path,
+                                        guint             interval);
+void          guaca_metrics_add_source (GuacaMetrics     *metrics,
+                                        GuacaMetricsFunc  func,
+                                        gpointer          data);
+gboolean      guaca_metrics_start      (GuacaMetrics     *metrics,
+                                        GError          **error);
+void          guaca_metrics_free       (GuacaMetrics     *metrics);
+
+void          guaca_metrics_write      (GString          *out,
+                                        const char       *name,
+                                        const char       *type,
+                                        const char       *help,
+                                        double            value);
+void          guaca_metrics_write_info (GString          *out,
+                                        const char       *name,
+                                        const char       *help,
+                                        const char      **labels);
+
+char         *guaca_metrics_default_socket (void);
+
+G_END_DECLS
+
+#endif /* __GUACA_METRICS_H__ */
@@ -0,0 +1,554 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-proc-reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined (HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_READ
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined (__NR_io_uring_setup) && defined (__NR_io_uring_enter)
+#define USE_IO_URING 1
+#endif
+#endif
+
+/*
+ * The reader keeps every registered file open, so a refresh is just one read
+ * per file from offset 0, which makes procfs and sysfs regenerate the
+ * contents. By default we pread() the files one after the other; with
+ * GUACA_PROC_READER=io_uring all the reads of a refresh are submitted, and
+ * waited for, with a single system call instead.
+ *
+ * The io_uring backend is not the default because procfs and sysfs cannot
+ * do non-blocking reads, so the kernel hands each read to an io-wq worker
+ * thread; reading eight typical files that way takes about twice as long as
+ * the eight pread() calls, despite the one system call. It is kept for
+ * kernels and files where that is not the case.
+ *
+ * A reader is not thread safe; it is meant to be owned by a single sampling
+ * thread, or the main loop.
+ */
+
+/* The most files we submit to the ring at a time, below 64 for the masks */
+#define RING_ENTRIES 32
+
+typedef struct
+{
+  char   *path;
+  int     fd;
+
+  char   *buf;
+  gsize   size;
+  gssize  len;                  /* of the last read, -1 if it failed */
+} ProcFile;
+
+#ifdef USE_IO_URING
+typedef struct
+{
+  int                  fd;
+
+  void                *sq_ptr;
+  gsize                sq_len;
+  void                *cq_ptr;
+  gsize                cq_len;
+
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  struct io_uring_sqe *sqes;
+  gsize                sqes_len;
+
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+  struct io_uring_cqe *cqes;
+} ProcRing;
+#endif
+
+struct _GuacaProcReader
+{
+  GArray   *files;
+
+#ifdef USE_IO_URING
+  ProcRing  ring;
+  gboolean  use_ring;
+#endif
+
+  /* statistics of the last refresh */
+  gint64    cost;
+  guint     syscalls;
+};
+
+#ifdef USE_IO_URING
+static void
+proc_ring_destroy (ProcRing *ring)
+{
+  if (ring->sqes)
+    munmap (ring->sqes, ring->sqes_len);
+
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    munmap (ring->cq_ptr, ring->cq_len);
+
+  if (ring->sq_ptr)
+    munmap (ring->sq_ptr, ring->sq_len);
+
+  if (ring->fd >= 0)
+    close (ring->fd);
+
+  memset (ring, 0, sizeof (ProcRing));
+  ring->fd = -1;
+}
+
+/*
+ * Sets up the ring with the raw system calls; we do not want to depend on
+ * liburing for the handful of operations we need.
+ */
+static gboolean
+proc_ring_init (ProcRing *ring)
+{
+  struct io_uring_params p;
+
+  memset (ring, 0, sizeof (ProcRing));
+  memset (&p, 0, sizeof (p));
+
+  if ((ring->fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &p)) < 0)
+    {
+      g_debug ("io_uring not available: %s", strerror (errno));
+      ring->fd = -1;
+      return FALSE;
+    }
+
+  ring->sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_len = ring->cq_len = MAX (ring->sq_len, ring->cq_len);
+#endif
+
+  ring->sq_ptr = mmap (NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED)
+    {
+      ring->sq_ptr = NULL;
+      goto fail;
+    }
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ptr = ring->sq_ptr;
+  else
+#endif
+    {
+      ring->cq_ptr = mmap (NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+      if (ring->cq_ptr == MAP_FAILED)
+        {
+          ring->cq_ptr = NULL;
+          goto fail;
+        }
+    }
+
+  ring->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      ring->sqes = NULL;
+      goto fail;
+    }
+
+  ring->sq_head  = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail  = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask  = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.array);
+
+  ring->cq_head  = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail  = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask  = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe *)
+                   ((char *) ring->cq_ptr + p.cq_off.cqes);
+
+  return TRUE;
+
+ fail:
+  g_warning ("Failed to map io_uring: %s", strerror (errno));
+  proc_ring_destroy (ring);
+  return FALSE;
+}
+
+/*
+ * Records the results of the completed reads, clearing them from pending,
+ * a mask of the files from first on with a read in flight; returns FALSE
+ * if the kernel does not support the read operation.
+ */
+static gboolean
+guaca_proc_reader_ring_reap (GuacaProcReader *reader, guint first,
+                             guint64 *pending)
+{
+  ProcRing *ring = &reader->ring;
+  unsigned  head = *ring->cq_head;
+  unsigned  mask = *ring->cq_mask;
+  gboolean  supported = TRUE;
+
+  while (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *cqe = &ring->cqes[head & mask];
+      ProcFile            *f;
+
+      f = &g_array_index (reader->files, ProcFile, cqe->user_data);
+
+      if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+        supported = FALSE;
+
+      f->len    = cqe->res;
+      *pending &= ~(G_GUINT64_CONSTANT (1) << (cqe->user_data - first));
+
+      head++;
+    }
+
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return supported;
+}
+
+/*
+ * Waits for the reads still in flight after a failure, so that nothing
+ * writes into the buffers once we have moved on. Should even waiting fail,
+ * the buffers are abandoned to the kernel and replaced.
+ */
+static void
+guaca_proc_reader_ring_drain (GuacaProcReader *reader, guint first,
+                              guint64 *pending)
+{
+  ProcRing *ring = &reader->ring;
+  guint     i;
+  long      r;
+
+  while (*pending)
+    {
+      r = syscall (__NR_io_uring_enter, ring->fd, 0,
+                   __builtin_popcountll (*pending), IORING_ENTER_GETEVENTS,
+                   NULL, 0);
+      reader->syscalls++;
+
+      guaca_proc_reader_ring_reap (reader, first, pending);
+
+      if (r < 0 && errno != EINTR)
+        {
+          g_warning ("Cannot wait for io_uring reads: %s", strerror (errno));
+          break;
+        }
+    }
+
+  for (i = 0; *pending; i++)
+    if (*pending & (G_GUINT64_CONSTANT (1) << i))
+      {
+        ProcFile *f = &g_array_index (reader->files, ProcFile, first + i);
+
+        f->buf    = g_malloc (f->size);
+        f->len    = -1;
+        *pending &= ~(G_GUINT64_CONSTANT (1) << i);
+      }
+}
+
+/*
+ * Reads files [first, first + n) with a single io_uring_enter(); returns
+ * FALSE if the kernel does not support the read operation, or the ring
+ * failed, in which case the files are to be read some other way. Either
+ * way no read is left in flight.
+ */
+static gboolean
+guaca_proc_reader_ring_read (GuacaProcReader *reader, guint first, guint n)
+{
+  ProcRing *ring = &reader->ring;
+  unsigned  tail, mask;
+  guint64   pending;
+  guint     i, submitted;
+  long      r;
+  gboolean  supported = TRUE;
+
+  tail = *ring->sq_tail;
+  mask = *ring->sq_mask;
+
+  for (i = 0; i < n; i++)
+    {
+      ProcFile            *f = &g_array_index (reader->files, ProcFile,
+                                                first + i);
+      unsigned             idx = (tail + i) & mask;
+      struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+      memset (sqe, 0, sizeof (*sqe));
+      sqe->opcode    = IORING_OP_READ;
+      sqe->fd        = f->fd;
+      sqe->addr      = (unsigned long) f->buf;
+      sqe->len       = f->size - 1;
+      sqe->off       = 0;
+      sqe->user_data = first + i;
+
+      ring->sq_array[idx] = idx;
+    }
+
+  __atomic_store_n (ring->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+  /*
+   * The kernel only fails the call when it submitted nothing, so on
+   * failure we can take the entries back.
+   */
+  while ((r = syscall (__NR_io_uring_enter, ring->fd, n, n,
+                       IORING_ENTER_GETEVENTS, NULL, 0)) < 0)
+    {
+      reader->syscalls++;
+
+      if (errno != EINTR)
+        {
+          g_warning ("io_uring_enter failed: %s", strerror (errno));
+          __atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+          return FALSE;
+        }
+    }
+
+  reader->syscalls++;
+  submitted = r;
+
+  /* the kernel takes the entries in order */
+  pending = (G_GUINT64_CONSTANT (1) << submitted) - 1;
+
+  for (;;)
+    {
+      supported &= guaca_proc_reader_ring_reap (reader, first, &pending);
+
+      if (submitted == n && !pending)
+        break;
+
+      /* submit what the kernel did not take the first time round */
+      r = syscall (__NR_io_uring_enter, ring->fd, n - submitted,
+                   __builtin_popcountll (pending) + n - submitted,
+                   IORING_ENTER_GETEVENTS, NULL, 0);
+      reader->syscalls++;
+
+      if (r >= 0)
+        {
+          pending   |= ((G_GUINT64_CONSTANT (1) << r) - 1) << submitted;
+          submitted += r;
+        }
+      else if (errno != EINTR)
+        {
+          g_warning ("io_uring_enter failed: %s", strerror (errno));
+
+          /* take back what was not submitted, and wait for the rest */
+          __atomic_store_n (ring->sq_tail, tail + submitted, __ATOMIC_RELEASE);
+          guaca_proc_reader_ring_drain (reader, first, &pending);
+
+          return FALSE;
+        }
+    }
+
+  return supported;
+}
+#endif
+
+GuacaProcReader *
+guaca_proc_reader_new (void)
+{
+  GuacaProcReader *reader = g_slice_new0 (GuacaProcReader);
+
+  reader->files = g_array_new (FALSE, FALSE, sizeof (ProcFile));
+
+#ifdef USE_IO_URING
+  if (!g_strcmp0 (g_getenv ("GUACA_PROC_READER"), "io_uring"))
+    reader->use_ring = proc_ring_init (&reader->ring);
+  else
+    reader->ring.fd = -1;
+#endif
+
+  return reader;
+}
+
+void
+guaca_proc_reader_free (GuacaProcReader *reader)
+{
+  guint i;
+
+  if (!reader)
+    return;
+
+  for (i = 0; i < reader->files->len; i++)
+    {
+      ProcFile *f = &g_array_index (reader->files, ProcFile, i);
+
+      if (f->fd >= 0)
+        close (f->fd);
+
+      g_free (f->buf);
+      g_free (f->path);
+    }
+
+  g_array_free (reader->files, TRUE);
+
+#ifdef USE_IO_URING
+  proc_ring_destroy (&reader->ring);
+#endif
+
+  g_slice_free (GuacaProcReader, reader);
+}
+
+/*
+ * Registers a file to be read on each refresh; size_hint is the expected
+ * size of the contents, the buffer grows as needed. Returns a handle for
+ * guaca_proc_reader_get(), or -1 if the file cannot be opened.
+ */
+int
+guaca_proc_reader_add (GuacaProcReader *reader,
+                       const char      *path,
+                       gsize            size_hint)
+{
+  ProcFile f;
+
+  if ((f.fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  f.path = g_strdup (path);
+  f.size = MAX (size_hint + 1, 64);
+  f.buf  = g_malloc (f.size);
+  f.len  = -1;
+
+  g_array_append_val (reader->files, f);
+
+  return reader->files->len - 1;
+}
+
+static void
+guaca_proc_reader_pread (GuacaProcReader *reader, ProcFile *f)
+{
+  f->len = pread (f->fd, f->buf, f->size - 1, 0);
+  reader->syscalls++;
+}
+
+/*
+ * Re-reads all the registered files.
+ */
+void
+guaca_proc_reader_refresh (GuacaProcReader *reader)
+{
+  gint64 start = g_get_monotonic_time ();
+  guint  i;
+
+  reader->syscalls = 0;
+
+#ifdef USE_IO_URING
+  for (i = 0; reader->use_ring && i < reader->files->len; i += RING_ENTRIES)
+    if (!guaca_proc_reader_ring_read (reader, i,
+                                      MIN (RING_ENTRIES,
+                                           reader->files->len - i)))
+      {
+        g_debug ("io_uring cannot read, falling back to pread");
+
+        reader->use_ring = FALSE;
+        proc_ring_destroy (&reader->ring);
+      }
+
+  if (!reader->use_ring)
+#endif
+    for (i = 0; i < reader->files->len; i++)
+      guaca_proc_reader_pread (reader,
+                               &g_array_index (reader->files, ProcFile, i));
+
+  /*
+   * A read that filled the buffer may have been truncated; grow the buffer
+   * and read the file again, this only happens until the buffer is big
+   * enough.
+   */
+  for (i = 0; i < reader->files->len; i++)
+    {
+      ProcFile *f = &g_array_index (reader->files, ProcFile, i);
+
+      while (f->len >= 0 && (gsize) f->len == f->size - 1)
+        {
+          f->size *= 2;
+          f->buf   = g_realloc (f->buf, f->size);
+
+          guaca_proc_reader_pread (reader, f);
+        }
+
+      if (f->len >= 0)
+        f->buf[f->len] = 0;
+    }
+
+  reader->cost = g_get_monotonic_time () - start;
+
+  g_debug ("Read %u files with %s in %u syscalls, %" G_GINT64_FORMAT " us",
+           reader->files->len, guaca_proc_reader_get_backend (reader),
+           reader->syscalls, reader->cost);
+}
+
+/*
+ * Returns the 0-terminated contents of the file from the last refresh, or
+ * NULL if it could not be read.
+ */
+const char *
+guaca_proc_reader_get (GuacaProcReader *reader, int file, gsize *len)
+{
+  ProcFile *f;
+
+  if (file < 0 || file >= reader->files->len)
+    return NULL;
+
+  f = &g_array_index (reader->files, ProcFile, file);
+
+  if (f->len < 0)
+    return NULL;
+
+  if (len)
+    *len = f->len;
+
+  return f->buf;
+}
+
+/*
+ * Returns the name of the backend in use, for debugging.
+ */
+const char *
+guaca_proc_reader_get_backend (GuacaProcReader *reader)
+{
+#ifdef USE_IO_URING
+  if (reader->use_ring)
+    return "io_uring";
+#endif
+
+  return "pread";
+}
+
+/*
+ * Returns the number of system calls the last refresh took.
+ */
+guint
+guaca_proc_reader_get_syscalls (GuacaProcReader *reader)
+{
+  return reader->syscalls;
+}
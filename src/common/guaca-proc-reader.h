@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Batched reader of small procfs and sysfs files */
+
+#ifndef __GUACA_PROC_READER_H__
+#define __GUACA_PROC_READER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaProcReader GuacaProcReader;
+
+GuacaProcReader *guaca_proc_reader_new     (void);
+void             guaca_proc_reader_free    (GuacaProcReader *reader);
+
+int              guaca_proc_reader_add     (GuacaProcReader *reader,
+                                            const char      *path,
+                                            gsize            size_hint);
+
+void             guaca_proc_reader_refresh (GuacaProcReader *reader);
+
+const char      *guaca_proc_reader_get     (GuacaProcReader *reader,
+                                            int              file,
+                                            gsize           *len);
+
+const char      *guaca_proc_reader_get_backend (GuacaProcReader *reader);
+guint            guaca_proc_reader_get_syscalls (GuacaProcReader *reader);
+
+G_END_DECLS
+
+#endif /* __GUACA_PROC_READER_H__ */
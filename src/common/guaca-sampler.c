@@ -0,0 +1,416 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sampler.h"
+#include "guaca-metrics.h"
+
+/*
+ * Each probe having its own timer would wake an idle box once per probe;
+ * here all of them share the one thread. The deadlines of every probe are
+ * multiples of its interval from a common epoch, so a 1 s and a 2 s probe
+ * run together every other second, and anything due within SLACK_US of
+ * the wakeup runs in it too.
+ *
+ * The snapshots are swapped in atomically for the main loop to read, and
+ * the ones they replace are freed from the main loop, where nothing can
+ * be holding on to them any more.
+ *
+ * Work that has to happen on the main loop is subscribed with
+ * guaca_sampler_subscribe_main(), on the same grid; the thread queues it
+ * after running the probes of the wakeup, so it sees their snapshots, and
+ * there is no timer of its own to wake the box.
+ */
+#define SLACK_US 20000
+
+struct _GuacaSamplerSub
+{
+  gint64            interval;
+  gint64            next;
+
+  GuacaSamplerFunc      func;
+  GuacaSamplerMainFunc  main_func;
+  gpointer              data;
+  GDestroyNotify        snapshot_free;
+
+  gpointer          snapshot;
+};
+
+typedef struct
+{
+  gpointer          snapshot;
+  GDestroyNotify    snapshot_free;
+} Retired;
+
+/*
+ * lock protects everything but the wakeup count and the snapshots; the
+ * thread holds run_lock while the probes run, so once a probe has been
+ * removed and run_lock taken, it is not running and never will again.
+ * pending holds the main loop subscriptions due to run.
+ */
+static GMutex   lock;
+static GMutex   run_lock;
+static GCond    cond;
+static GList   *subs;
+static GThread *thread;
+static gint64   epoch;
+static GSList  *retired;
+static guint    retire_id;
+static GList   *pending;
+static guint    dispatch_id;
+static guint64  wakeups;
+
+/* the first deadline of the sub after now on its grid */
+static gint64
+next_deadline (GuacaSamplerSub *sub, gint64 now)
+{
+  return epoch + (now - epoch + sub->interval - 1) / sub->interval *
+    sub->interval;
+}
+
+static gboolean
+guaca_sampler_retire_cb (gpointer data)
+{
+  GSList *l, *list;
+
+  g_mutex_lock (&lock);
+  list      = retired;
+  retired   = NULL;
+  retire_id = 0;
+  g_mutex_unlock (&lock);
+
+  for (l = list; l; l = l->next)
+    {
+      Retired *r = l->data;
+
+      r->snapshot_free (r->snapshot);
+      g_slice_free (Retired, r);
+    }
+
+  g_slist_free (list);
+
+  return FALSE;
+}
+
+/*
+ * Runs the main loop subscriptions that are due, one at a time, as each
+ * may unsubscribe others.
+ */
+static gboolean
+guaca_sampler_dispatch_cb (gpointer data)
+{
+  for (;;)
+    {
+      GuacaSamplerSub *sub;
+
+      g_mutex_lock (&lock);
+
+      if (!pending)
+        {
+          dispatch_id = 0;
+          g_mutex_unlock (&lock);
+          break;
+        }
+
+      sub     = pending->data;
+      pending = g_list_delete_link (pending, pending);
+
+      g_mutex_unlock (&lock);
+
+      sub->main_func (sub->data);
+    }
+
+  return FALSE;
+}
+
+/*
+ * Queues the main loop subscriptions among due that are still there, with
+ * lock held.
+ */
+static void
+guaca_sampler_queue_main (GList *due)
+{
+  GList *l;
+
+  for (l = due; l; l = l->next)
+    {
+      GuacaSamplerSub *sub = l->data;
+
+      if (!g_list_find (subs, sub) || !sub->main_func ||
+          g_list_find (pending, sub))
+        continue;
+
+      pending = g_list_append (pending, sub);
+
+      if (!dispatch_id)
+        dispatch_id = g_idle_add_full (G_PRIORITY_DEFAULT,
+                                       guaca_sampler_dispatch_cb, NULL, NULL);
+    }
+}
+
+/*
+ * Runs the probes and swaps in their snapshots; returns the replaced ones
+ * to be freed.
+ */
+static GSList *
+guaca_sampler_run (GList *due)
+{
+  GSList *old = NULL;
+  GList  *l;
+
+  for (l = due; l; l = l->next)
+    {
+      GuacaSamplerSub *sub = l->data;
+      gpointer         snapshot;
+
+      if (!sub->func || !(snapshot = sub->func (sub->data)))
+        continue;
+
+      snapshot = __atomic_exchange_n (&sub->snapshot, snapshot,
+                                      __ATOMIC_ACQ_REL);
+
+      if (snapshot)
+        {
+          Retired *r = g_slice_new (Retired);
+
+          r->snapshot      = snapshot;
+          r->snapshot_free = sub->snapshot_free;
+          old = g_slist_prepend (old, r);
+        }
+    }
+
+  return old;
+}
+
+static gpointer
+guaca_sampler_thread (gpointer data)
+{
+  GThread *self = g_thread_self ();
+
+  g_mutex_lock (&lock);
+
+  /* we are replaced by a new thread, or none, when told to stop */
+  while (thread == self)
+    {
+      gint64  now = g_get_monotonic_time ();
+      gint64  first = G_MAXINT64;
+      GList  *l, *due = NULL;
+      GSList *old;
+
+      for (l = subs; l; l = l->next)
+        first = MIN (first, ((GuacaSamplerSub *) l->data)->next);
+
+      if (first > now)
+        {
+          g_cond_wait_until (&cond, &lock, first);
+          continue;
+        }
+
+      __atomic_add_fetch (&wakeups, 1, __ATOMIC_RELAXED);
+
+      for (l = subs; l; l = l->next)
+        {
+          GuacaSamplerSub *sub = l->data;
+
+          if (sub->next > now + SLACK_US)
+            continue;
+
+          /* do not try to catch up after the box was suspended */
+          sub->next += sub->interval;
+          if (sub->next <= now)
+            sub->next = next_deadline (sub, now + 1);
+
+          due = g_list_prepend (due, sub);
+        }
+
+      g_mutex_lock (&run_lock);
+      g_mutex_unlock (&lock);
+
+      old = guaca_sampler_run (due);
+
+      /*
+       * The subscriptions cannot be freed before run_lock is released,
+       * and once lock is taken, those that were removed are no longer in
+       * the list.
+       */
+      g_mutex_lock (&lock);
+      g_mutex_unlock (&run_lock);
+
+      guaca_sampler_queue_main (due);
+      g_list_free (due);
+
+      if (old)
+        {
+          retired = g_slist_concat (old, retired);
+
+          if (!retire_id)
+            retire_id = g_idle_add (guaca_sampler_retire_cb, NULL);
+        }
+    }
+
+  g_mutex_unlock (&lock);
+
+  return NULL;
+}
+
+static GuacaSamplerSub *
+guaca_sampler_add (GuacaSamplerSub *sub)
+{
+  gint64  now = g_get_monotonic_time ();
+  GError *error = NULL;
+
+  g_mutex_lock (&lock);
+
+  if (!thread)
+    {
+      epoch = now;
+
+      if (!(thread = g_thread_try_new ("guaca-sampler", guaca_sampler_thread,
+                                       NULL, &error)))
+        {
+          g_warning ("Failed to start the sampler: %s", error->message);
+          g_clear_error (&error);
+        }
+    }
+
+  sub->next = next_deadline (sub, now);
+  subs      = g_list_prepend (subs, sub);
+
+  g_cond_signal (&cond);
+  g_mutex_unlock (&lock);
+
+  return sub;
+}
+
+/*
+ * Runs func every interval_ms on the sampler thread, starting it if this is
+ * the first subscription; the first run is at the next multiple of the
+ * interval since the thread started, so straight away for the first one.
+ * snapshot_free frees the snapshots func returns.
+ *
+ * The probe must not subscribe or unsubscribe from func.
+ */
+GuacaSamplerSub *
+guaca_sampler_subscribe (guint             interval_ms,
+                         GuacaSamplerFunc  func,
+                         gpointer          data,
+                         GDestroyNotify    snapshot_free)
+{
+  GuacaSamplerSub *sub;
+
+  g_return_val_if_fail (interval_ms > 0 && func, NULL);
+
+  sub = g_slice_new0 (GuacaSamplerSub);
+  sub->interval      = interval_ms * (gint64) 1000;
+  sub->func          = func;
+  sub->data          = data;
+  sub->snapshot_free = snapshot_free ? snapshot_free : g_free;
+
+  return guaca_sampler_add (sub);
+}
+
+/*
+ * Runs func every interval_ms on the main loop, woken up by the sampler
+ * thread along with the probes rather than by a timer; func may subscribe
+ * and unsubscribe, itself included.
+ */
+GuacaSamplerSub *
+guaca_sampler_subscribe_main (guint                interval_ms,
+                              GuacaSamplerMainFunc func,
+                              gpointer             data)
+{
+  GuacaSamplerSub *sub;
+
+  g_return_val_if_fail (interval_ms > 0 && func, NULL);
+
+  sub = g_slice_new0 (GuacaSamplerSub);
+  sub->interval  = interval_ms * (gint64) 1000;
+  sub->main_func = func;
+  sub->data      = data;
+
+  return guaca_sampler_add (sub);
+}
+
+/*
+ * Stops running the probe, and frees its snapshot; once the last probe is
+ * gone, so is the thread.
+ */
+void
+guaca_sampler_unsubscribe (GuacaSamplerSub *sub)
+{
+  GThread *stopped = NULL;
+
+  if (!sub)
+    return;
+
+  g_mutex_lock (&lock);
+
+  subs    = g_list_remove (subs, sub);
+  pending = g_list_remove (pending, sub);
+
+  if (!subs)
+    {
+      stopped = thread;
+      thread  = NULL;
+    }
+
+  g_cond_signal (&cond);
+  g_mutex_unlock (&lock);
+
+  /* wait out the run the probe might be in */
+  g_mutex_lock (&run_lock);
+  g_mutex_unlock (&run_lock);
+
+  if (stopped)
+    g_thread_join (stopped);
+
+  if (sub->snapshot)
+    sub->snapshot_free (sub->snapshot);
+
+  g_slice_free (GuacaSamplerSub, sub);
+}
+
+/*
+ * Returns the latest snapshot of the probe, or NULL before its first run,
+ * and for main loop subscriptions.
+ * Only to be called from the main loop; the snapshot stays valid until the
+ * main loop is next idle.
+ */
+gconstpointer
+guaca_sampler_peek (GuacaSamplerSub *sub)
+{
+  return __atomic_load_n (&sub->snapshot, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns the number of times the thread has woken up to run probes.
+ */
+guint64
+guaca_sampler_get_wakeups (void)
+{
+  return __atomic_load_n (&wakeups, __ATOMIC_RELAXED);
+}
+
+void
+guaca_sampler_write_metrics (GString *out, gpointer data)
+{
+  guaca_metrics_write (out, "guacamayo_sampler_wakeups_total", "counter",
+                       "Wakeups of the sampler thread.",
+                       guaca_sampler_get_wakeups ());
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* One thread that runs the periodic system probes */
+
+#ifndef __GUACA_SAMPLER_H__
+#define __GUACA_SAMPLER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaSamplerSub GuacaSamplerSub;
+
+/*
+ * A probe runs on the sampler thread and returns its new snapshot, which
+ * must not be changed once returned, or NULL to keep the previous one.
+ */
+typedef gpointer (*GuacaSamplerFunc) (gpointer data);
+
+/*
+ * Runs on the main loop, after the probes due at the same time have run;
+ * for periodic work that has to be done there, e.g., refreshing the UI
+ * from the snapshots.
+ */
+typedef void     (*GuacaSamplerMainFunc) (gpointer data);
+
+GuacaSamplerSub *guaca_sampler_subscribe     (guint             interval_ms,
+                                              GuacaSamplerFunc  func,
+                                              gpointer          data,
+                                              GDestroyNotify    snapshot_free);
+void             guaca_sampler_unsubscribe   (GuacaSamplerSub  *sub);
+
+GuacaSamplerSub *guaca_sampler_subscribe_main (guint                interval_ms,
+                                               GuacaSamplerMainFunc func,
+                                               gpointer             data);
+
+gconstpointer    guaca_sampler_peek          (GuacaSamplerSub  *sub);
+
+guint64          guaca_sampler_get_wakeups   (void);
+void             guaca_sampler_write_metrics (GString          *out,
+                                              gpointer          data);
+
+G_END_DECLS
+
+#endif /* __GUACA_SAMPLER_H__ */
@@ -0,0 +1,320 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-startup.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <clutter/clutter.h>
+
+/* the boots kept in the history, enough to span a few releases */
+#define HISTORY_MAX 20
+
+/*
+ * There is only the one startup per process, so the timeline is global;
+ * the plugin load is marked before there is any object to keep it in.
+ */
+static GuacaStartupTimeline timeline;
+static gboolean             have_proc_marks;
+static guint                paint_id;
+
+/*
+ * CLOCK_BOOTTIME is what /proc/uptime reads, and, unlike the monotonic
+ * clock, counts from boot on all kernels.
+ */
+static double
+boot_time_now (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_BOOTTIME, &ts) < 0)
+    return 0.0;
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns the start time of the process since boot, from the 22nd field of
+ * its stat, or 0 on failure.
+ */
+static double
+process_start_time (const char *path)
+{
+  char               *contents, *e;
+  unsigned long long  start;
+  double              t = 0.0;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return 0.0;
+
+  /* the fields after comm, which may contain anything, from state on */
+  if ((e = strrchr (contents, ')')) &&
+      sscanf (e + 2,
+              "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u "
+              "%*d %*d %*d %*d %*d %*d %llu", &start) == 1)
+    t = (double) start / sysconf (_SC_CLK_TCK);
+
+  g_free (contents);
+
+  return t;
+}
+
+static void
+read_boot_id (char *buf, gsize len)
+{
+  char *boot_id;
+
+  if (g_file_get_contents ("/proc/sys/kernel/random/boot_id",
+                           &boot_id, NULL, NULL))
+    {
+      g_strlcpy (buf, g_strstrip (boot_id), len);
+      g_free (boot_id);
+    }
+}
+
+/*
+ * Records the time of the mark, unless it has been recorded already; the
+ * kernel keeps the times of the first two, so they need no marking.
+ */
+void
+guaca_startup_mark (GuacaStartupMark mark)
+{
+  g_return_if_fail (mark < GUACA_STARTUP_N_MARKS);
+
+  if (!timeline.marks[mark])
+    timeline.marks[mark] = boot_time_now ();
+}
+
+const GuacaStartupTimeline *
+guaca_startup_get_timeline (void)
+{
+  if (!have_proc_marks)
+    {
+      timeline.marks[GUACA_STARTUP_INIT] =
+        process_start_time ("/proc/1/stat");
+      timeline.marks[GUACA_STARTUP_PROCESS] =
+        process_start_time ("/proc/self/stat");
+
+      read_boot_id (timeline.boot_id, sizeof (timeline.boot_id));
+
+      have_proc_marks = TRUE;
+    }
+
+  return &timeline;
+}
+
+static char *
+history_file (void)
+{
+  return g_build_filename (g_get_user_data_dir (), "guacamayo",
+                           "startup-history", NULL);
+}
+
+/*
+ * Each line is the boot id, the marks in ms, the RSS at the first paint as
+ * rss=KB, and the version, which goes last as it may contain spaces; the
+ * lines of older versions have no RSS.
+ */
+static gboolean
+parse_line (const char *line, GuacaStartupTimeline *t)
+{
+  unsigned int       ms[GUACA_STARTUP_N_MARKS];
+  unsigned long long rss;
+  int                n = 0, m = 0, i;
+
+  memset (t, 0, sizeof (*t));
+
+  if (sscanf (line, "%39s %u %u %u %u %u %n", t->boot_id,
+              &ms[0], &ms[1], &ms[2], &ms[3], &ms[4], &n) != 6 || !n)
+    return FALSE;
+
+  for (i = 0; i < GUACA_STARTUP_N_MARKS; i++)
+    t->marks[i] = ms[i] / 1000.0;
+
+  if (sscanf (line + n, "rss=%llu %n", &rss, &m) == 1 && m)
+    {
+      t->rss_kb = rss;
+      n += m;
+    }
+
+  g_strlcpy (t->version, line + n, sizeof (t->version));
+
+  return TRUE;
+}
+
+/*
+ * Returns the timelines of the previous boots, oldest first, and of this
+ * one once it has been painted; free with g_free().
+ */
+GuacaStartupTimeline *
+guaca_startup_load_history (int *n)
+{
+  GuacaStartupTimeline *history;
+  char                 *file = history_file ();
+  char                 *contents = NULL, **lines, **l;
+
+  history = g_new0 (GuacaStartupTimeline, HISTORY_MAX);
+  *n      = 0;
+
+  if (g_file_get_contents (file, &contents, NULL, NULL))
+    {
+      lines = g_strsplit (contents, "\n", -1);
+
+      for (l = lines; *l; l++)
+        {
+          /* keep the newest, should the file have grown */
+          if (*n == HISTORY_MAX)
+            memmove (history, history + 1,
+                     --(*n) * sizeof (GuacaStartupTimeline));
+
+          if (parse_line (*l, &history[*n]))
+            (*n)++;
+        }
+
+      g_strfreev (lines);
+      g_free (contents);
+    }
+
+  g_free (file);
+
+  return history;
+}
+
+/*
+ * Appends the timeline to the history, once per boot; restarts of
+ * media-explorer would only measure the restart, not the boot.
+ */
+static void
+save_timeline (const GuacaStartupTimeline *t)
+{
+  GuacaStartupTimeline *history;
+  GString              *str;
+  char                 *file, *dir;
+  int                   n, i, j;
+  GError               *error = NULL;
+
+  if (!*t->boot_id)
+    return;
+
+  history = guaca_startup_load_history (&n);
+
+  for (i = 0; i < n; i++)
+    if (!strcmp (history[i].boot_id, t->boot_id))
+      {
+        g_free (history);
+        return;
+      }
+
+  str = g_string_new (NULL);
+
+  /* drop the oldest, to make room */
+  for (i = n < HISTORY_MAX ? 0 : 1; i <= n; i++)
+    {
+      const GuacaStartupTimeline *h = i < n ? &history[i] : t;
+
+      g_string_append (str, h->boot_id);
+
+      for (j = 0; j < GUACA_STARTUP_N_MARKS; j++)
+        g_string_append_printf (str, " %u",
+                                (unsigned int) (h->marks[j] * 1000.0 + 0.5));
+
+      if (h->rss_kb)
+        g_string_append_printf (str, " rss=%" G_GUINT64_FORMAT, h->rss_kb);
+
+      g_string_append_printf (str, " %s\n", h->version);
+    }
+
+  file = history_file ();
+  dir  = g_path_get_dirname (file);
+  g_mkdir_with_parents (dir, 0755);
+
+  if (!g_file_set_contents (file, str->str, str->len, &error))
+    {
+      g_warning ("Failed to save the startup timeline: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (dir);
+  g_free (file);
+  g_string_free (str, TRUE);
+  g_free (history);
+}
+
+static guint64
+read_rss_kb (void)
+{
+  char          *statm;
+  unsigned long  size, resident;
+  guint64        rss = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &statm, NULL, NULL))
+    return 0;
+
+  if (sscanf (statm, "%lu %lu", &size, &resident) == 2)
+    rss = (guint64) resident * (sysconf (_SC_PAGESIZE) / 1024);
+
+  g_free (statm);
+
+  return rss;
+}
+
+static gboolean
+guaca_startup_paint_cb (gpointer data)
+{
+  GuacaStartupTimeline *t;
+
+  paint_id = 0;
+  guaca_startup_mark (GUACA_STARTUP_PAINT);
+
+  t = (GuacaStartupTimeline *) guaca_startup_get_timeline ();
+  t->rss_kb = read_rss_kb ();
+
+  g_debug ("Startup: init at %.2f s, process at %.2f s, plugin at %.2f s, "
+           "UI at %.2f s, painted at %.2f s with %" G_GUINT64_FORMAT " KB "
+           "resident",
+           t->marks[GUACA_STARTUP_INIT], t->marks[GUACA_STARTUP_PROCESS],
+           t->marks[GUACA_STARTUP_PLUGIN], t->marks[GUACA_STARTUP_UI],
+           t->marks[GUACA_STARTUP_PAINT], t->rss_kb);
+
+  save_timeline (t);
+
+  return FALSE;
+}
+
+/*
+ * Marks the end of the first paint after now, and saves the timeline to
+ * the history with the version of the software. The plugins are loaded
+ * before the stage is shown, so this is the first frame of the UI.
+ */
+void
+guaca_startup_watch_paint (const char *version)
+{
+  if (paint_id || timeline.marks[GUACA_STARTUP_PAINT])
+    return;
+
+  g_strlcpy (timeline.version, version, sizeof (timeline.version));
+
+  paint_id =
+    clutter_threads_add_repaint_func_full (CLUTTER_REPAINT_FLAGS_POST_PAINT,
+                                           guaca_startup_paint_cb, NULL, NULL);
+}
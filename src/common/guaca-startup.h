@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Startup timeline, from boot to the first paint of the UI */
+
+#ifndef __GUACA_STARTUP_H__
+#define __GUACA_STARTUP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  GUACA_STARTUP_INIT,           /* the kernel started init */
+  GUACA_STARTUP_PROCESS,        /* media-explorer was started */
+  GUACA_STARTUP_PLUGIN,         /* our plugin was loaded */
+  GUACA_STARTUP_UI,             /* our UI was created */
+  GUACA_STARTUP_PAINT,          /* the stage was first painted with it */
+
+  GUACA_STARTUP_N_MARKS
+} GuacaStartupMark;
+
+/*
+ * Times since boot, in seconds, on the clock of /proc/uptime; 0 for the
+ * marks not reached.
+ */
+typedef struct
+{
+  char    boot_id[40];
+  char    version[64];
+  double  marks[GUACA_STARTUP_N_MARKS];
+
+  guint64 rss_kb;               /* at the first paint, 0 if not known */
+} GuacaStartupTimeline;
+
+void                        guaca_startup_mark         (GuacaStartupMark mark);
+void                        guaca_startup_watch_paint  (const char      *version);
+const GuacaStartupTimeline *guaca_startup_get_timeline (void);
+
+GuacaStartupTimeline       *guaca_startup_load_history (int             *n);
+
+G_END_DECLS
+
+#endif /* __GUACA_STARTUP_H__ */
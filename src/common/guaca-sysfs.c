@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sysfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *root = "";
+
+/*
+ * GUACA_HELPER_ROOT makes the helper work on a fake tree, e.g., a copy of
+ * sysfs. This is for testing only, and is ignored when we are running suid,
+ * or anyone could make us write anywhere.
+ */
+void
+guaca_sysfs_init (void)
+{
+  const char *r;
+
+  if (getuid () != geteuid () || getgid () != getegid ())
+    return;
+
+  if ((r = getenv ("GUACA_HELPER_ROOT")) && *r)
+    root = r;
+}
+
+/*
+ * Formats an absolute path into buf, relative to the helper root. A path
+ * that does not fit is not truncated, as that could name some other file;
+ * buf is left empty instead, which fails to open.
+ */
+const char *
+guaca_sysfs_path (char *buf, size_t len, const char *fmt, ...)
+{
+  va_list args;
+  int     n, m;
+
+  n = snprintf (buf, len, "%s", root);
+
+  if (n < 0 || (size_t) n >= len)
+    goto too_long;
+
+  va_start (args, fmt);
+  m = vsnprintf (buf + n, len - n, fmt, args);
+  va_end (args);
+
+  if (m < 0 || (size_t) m >= len - n)
+    goto too_long;
+
+  return buf;
+
+ too_long:
+  if (len)
+    *buf = 0;
+
+  return buf;
+}
+
+/*
+ * Reads a sysfs attribute into buf, dropping the trailing newline; returns
+ * the length, or -1 on failure.
+ */
+int
+guaca_sysfs_read (const char *path, char *buf, size_t len)
+{
+  int     fd;
+  ssize_t r;
+
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  r = read (fd, buf, len - 1);
+  close (fd);
+
+  if (r < 0)
+    return -1;
+
+  while (r > 0 && (buf[r - 1] == '\n' || buf[r - 1] == ' '))
+    r--;
+
+  buf[r] = 0;
+  return r;
+}
+
+int
+guaca_sysfs_read_ulong (const char *path, unsigned long *value)
+{
+  char  buf[32];
+  char *end;
+
+  if (guaca_sysfs_read (path, buf, sizeof (buf)) <= 0)
+    return -1;
+
+  *value = strtoul (buf, &end, 10);
+
+  return *end ? -1 : 0;
+}
+
+/*
+ * Writes the value to a sysfs attribute in a single write, which is what the
+ * kernel expects; returns 0 on success, -1 with errno set otherwise.
+ */
+int
+guaca_sysfs_write (const char *path, const char *value)
+{
+  size_t  len = strlen (value);
+  ssize_t r;
+  int     fd, saved;
+
+  if ((fd = open (path, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0)
+    return -1;
+
+  r     = write (fd, value, len);
+  saved = errno;
+  close (fd);
+
+  if (r != (ssize_t) len)
+    {
+      errno = r < 0 ? saved : EIO;
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * Whether word is one of the space separated words in list, as in the
+ * scaling_available_governors and similar attributes.
+ */
+int
+guaca_sysfs_has_word (const char *list, const char *word)
+{
+  size_t      len = strlen (word);
+  const char *p   = list;
+
+  while ((p = strstr (p, word)))
+    {
+      if ((p == list || p[-1] == ' ') && (!p[len] || p[len] == ' '))
+        return 1;
+
+      p += len;
+    }
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/*
+ * sysfs access for the suid helpers; these are kept small and do not link
+ * against glib.
+ */
+
+#ifndef __GUACA_SYSFS_H__
+#define __GUACA_SYSFS_H__
+
+#include <stddef.h>
+
+void        guaca_sysfs_init       (void);
+
+const char *guaca_sysfs_path       (char       *buf,
+                                    size_t      len,
+                                    const char *fmt,
+                                    ...) __attribute__ ((format (printf, 3, 4)));
+
+int         guaca_sysfs_read       (const char *path,
+                                    char       *buf,
+                                    size_t      len);
+int         guaca_sysfs_read_ulong (const char    *path,
+                                    unsigned long *value);
+
+int         guaca_sysfs_write      (const char *path,
+                                    const char *value);
+
+int         guaca_sysfs_has_word   (const char *list,
+                                    const char *word);
+
+#endif /* __GUACA_SYSFS_H__ */
@@ -0,0 +1,428 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__) || defined (__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+/*
+ * The bandwidth buffers need to be well beyond the caches of the boxes, but
+ * not so large as to push anything out on a 256 MB one; the SIMD buffers
+ * are to stay in L1, so the kernel rather than the memory is measured.
+ */
+#define STREAM_SIZE (8 * 1024 * 1024)
+#define SIMD_SIZE   (8 * 1024)
+
+/* per test; the three of them stay under a second */
+#define TEST_US     250000
+
+typedef void (*AvgFunc) (guint8       *dst,
+                         const guint8 *a,
+                         const guint8 *b,
+                         gsize         n);
+
+/*
+ * The kernel is the rounding average of two rows of pixels, the inner loop
+ * of bidirectional motion compensation, which all of the codecs have.
+ */
+static void
+avg_scalar (guint8 *dst, const guint8 *a, const guint8 *b, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = (a[i] + b[i] + 1) >> 1;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__ ((target ("sse2")))
+static void
+avg_sse2 (guint8 *dst, const guint8 *a, const guint8 *b, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i += 16)
+    _mm_storeu_si128 ((__m128i *) (dst + i),
+                      _mm_avg_epu8 (_mm_loadu_si128 ((__m128i *) (a + i)),
+                                    _mm_loadu_si128 ((__m128i *) (b + i))));
+}
+
+__attribute__ ((target ("avx2")))
+static void
+avg_avx2 (guint8 *dst, const guint8 *a, const guint8 *b, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i += 32)
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+                         _mm256_avg_epu8 (
+                           _mm256_loadu_si256 ((__m256i *) (a + i)),
+                           _mm256_loadu_si256 ((__m256i *) (b + i))));
+}
+
+static gboolean
+have_sse2 (void)
+{
+  return __builtin_cpu_supports ("sse2");
+}
+
+static gboolean
+have_avx2 (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static void
+avg_neon (guint8 *dst, const guint8 *a, const guint8 *b, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i += 16)
+    vst1q_u8 (dst + i, vrhaddq_u8 (vld1q_u8 (a + i), vld1q_u8 (b + i)));
+}
+
+/* only built when the compiler targets NEON, so the CPU has it */
+static gboolean
+have_neon (void)
+{
+  return TRUE;
+}
+#endif
+
+static gboolean
+have_scalar (void)
+{
+  return TRUE;
+}
+
+/* best first; SIMD_SIZE is a multiple of all the vector widths */
+static const struct
+{
+  const char *name;
+  AvgFunc     func;
+  gboolean  (*supported) (void);
+} kernels[] =
+  {
+#ifdef HAVE_X86_KERNELS
+    { "AVX2",   avg_avx2,   have_avx2 },
+    { "SSE2",   avg_sse2,   have_sse2 },
+#endif
+#ifdef HAVE_NEON_KERNEL
+    { "NEON",   avg_neon,   have_neon },
+#endif
+    { "scalar", avg_scalar, have_scalar },
+  };
+
+struct _GuacaBench
+{
+  GuacaBenchFunc    func;
+  gpointer          data;
+
+  GThread          *thread;
+  volatile gint     cancelled;
+
+  GMutex            lock;
+  guint             idle_id;
+
+  GuacaBenchResult  result;
+};
+
+/*
+ * Runs the test over and over for TEST_US and returns the best rate, in
+ * MB/s of the bytes moved per pass; the best pass is the one least
+ * disturbed by everything else running.
+ */
+#define RUN_TEST(bench, bytes, body)                                    \
+  ({                                                                    \
+    gint64 _start = g_get_monotonic_time (), _now = _start;             \
+    double _best = 0.0;                                                 \
+                                                                        \
+    while (_now - _start < TEST_US &&                                   \
+           !g_atomic_int_get (&(bench)->cancelled))                     \
+      {                                                                 \
+        gint64 _t = _now;                                               \
+                                                                        \
+        body;                                                           \
+        /* the results are never read, keep the stores */               \
+        __asm__ __volatile__ ("" : : : "memory");                       \
+                                                                        \
+        _now = g_get_monotonic_time ();                                 \
+        if (_now > _t)                                                  \
+          _best = MAX (_best, (bytes) / (double) (_now - _t));          \
+      }                                                                 \
+                                                                        \
+    _best;                                                              \
+  })
+
+static void
+bench_stream (GuacaBench *bench)
+{
+  const gsize n = STREAM_SIZE / sizeof (double);
+  double     *a, *b, *c;
+  gsize       i;
+
+  a = g_new (double, n);
+  b = g_new (double, n);
+  c = g_new (double, n);
+
+  /* touch the pages, so page faults are not measured */
+  for (i = 0; i < n; i++)
+    {
+      a[i] = 0.0;
+      b[i] = 1.0;
+      c[i] = 2.0;
+    }
+
+  bench->result.copy_mbs =
+    RUN_TEST (bench, 2.0 * STREAM_SIZE, memcpy (a, b, STREAM_SIZE));
+
+  bench->result.triad_mbs =
+    RUN_TEST (bench, 3.0 * STREAM_SIZE,
+              for (i = 0; i < n; i++) a[i] = b[i] + 3.0 * c[i]);
+
+  g_free (a);
+  g_free (b);
+  g_free (c);
+}
+
+static void
+bench_simd (GuacaBench *bench)
+{
+  guint8 *buf, *dst, *a, *b;
+  int     i, k;
+
+  for (k = 0; !kernels[k].supported (); k++)
+    ;
+
+  buf = g_malloc (3 * SIMD_SIZE);
+  dst = buf;
+  a   = buf + SIMD_SIZE;
+  b   = buf + 2 * SIMD_SIZE;
+
+  for (i = 0; i < SIMD_SIZE; i++)
+    {
+      a[i] = i;
+      b[i] = i * 7;
+    }
+
+  /* enough rows per pass for the clock to resolve */
+  bench->result.simd     = kernels[k].name;
+  bench->result.simd_mbs =
+    RUN_TEST (bench, 64.0 * SIMD_SIZE,
+              for (i = 0; i < 64; i++)
+                kernels[k].func (dst, a, b, SIMD_SIZE));
+
+  g_free (buf);
+}
+
+static char *
+read_boot_id (void)
+{
+  char *boot_id = NULL;
+
+  if (g_file_get_contents ("/proc/sys/kernel/random/boot_id",
+                           &boot_id, NULL, NULL))
+    g_strstrip (boot_id);
+
+  return boot_id;
+}
+
+static char *
+cache_file (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "guacamayo", "bench",
+                           NULL);
+}
+
+/*
+ * The results only change with the hardware or the kernel, so are kept
+ * for the boot; measuring again each time the dialog is opened would only
+ * add noise.
+ */
+static void
+save_result (const GuacaBenchResult *r)
+{
+  GKeyFile *kf = g_key_file_new ();
+  char     *file = cache_file ();
+  char     *boot_id, *dir, *data;
+  gsize     len;
+  GError   *error = NULL;
+
+  if (!(boot_id = read_boot_id ()))
+    goto out;
+
+  g_key_file_set_string (kf, "bench", "boot_id", boot_id);
+  g_key_file_set_double (kf, "bench", "copy_mbs", r->copy_mbs);
+  g_key_file_set_double (kf, "bench", "triad_mbs", r->triad_mbs);
+  g_key_file_set_string (kf, "bench", "simd", r->simd);
+  g_key_file_set_double (kf, "bench", "simd_mbs", r->simd_mbs);
+
+  dir = g_path_get_dirname (file);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  data = g_key_file_to_data (kf, &len, NULL);
+
+  if (!g_file_set_contents (file, data, len, &error))
+    {
+      g_warning ("Failed to save benchmark results: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (data);
+  g_free (boot_id);
+
+ out:
+  g_free (file);
+  g_key_file_free (kf);
+}
+
+/*
+ * Looks up the results measured since the last boot; returns FALSE if
+ * there are none.
+ */
+gboolean
+guaca_bench_lookup (GuacaBenchResult *result)
+{
+  GKeyFile *kf = g_key_file_new ();
+  char     *file = cache_file ();
+  char     *boot_id = read_boot_id ();
+  char     *saved_id = NULL, *simd = NULL;
+  gboolean  found = FALSE;
+  int       k;
+
+  if (boot_id &&
+      g_key_file_load_from_file (kf, file, G_KEY_FILE_NONE, NULL) &&
+      (saved_id = g_key_file_get_string (kf, "bench", "boot_id", NULL)) &&
+      !strcmp (saved_id, boot_id) &&
+      (simd = g_key_file_get_string (kf, "bench", "simd", NULL)))
+    {
+      for (k = 0; k < G_N_ELEMENTS (kernels); k++)
+        if (!strcmp (simd, kernels[k].name))
+          {
+            result->simd     = kernels[k].name;
+            result->simd_mbs = g_key_file_get_double (kf, "bench",
+                                                      "simd_mbs", NULL);
+            found = TRUE;
+          }
+
+      result->copy_mbs  = g_key_file_get_double (kf, "bench", "copy_mbs",
+                                                  NULL);
+      result->triad_mbs = g_key_file_get_double (kf, "bench", "triad_mbs",
+                                                  NULL);
+    }
+
+  g_free (simd);
+  g_free (saved_id);
+  g_free (boot_id);
+  g_free (file);
+  g_key_file_free (kf);
+
+  return found;
+}
+
+static gboolean
+guaca_bench_done_cb (GuacaBench *bench)
+{
+  g_mutex_lock (&bench->lock);
+  bench->idle_id = 0;
+  g_mutex_unlock (&bench->lock);
+
+  save_result (&bench->result);
+
+  bench->func (&bench->result, bench->data);
+
+  return FALSE;
+}
+
+static gpointer
+guaca_bench_thread (gpointer data)
+{
+  GuacaBench *bench = data;
+
+  bench_stream (bench);
+  bench_simd (bench);
+
+  g_debug ("Copy %.0f MB/s, triad %.0f MB/s, %s %.0f MB/s",
+           bench->result.copy_mbs, bench->result.triad_mbs,
+           bench->result.simd, bench->result.simd_mbs);
+
+  g_mutex_lock (&bench->lock);
+
+  if (!g_atomic_int_get (&bench->cancelled))
+    bench->idle_id = g_idle_add ((GSourceFunc) guaca_bench_done_cb, bench);
+
+  g_mutex_unlock (&bench->lock);
+
+  return NULL;
+}
+
+/*
+ * Starts the benchmarks in a worker thread; func is called from the main
+ * loop when they are done, unless the benchmark is freed first.
+ */
+GuacaBench *
+guaca_bench_start (GuacaBenchFunc func, gpointer data)
+{
+  GuacaBench *bench = g_slice_new0 (GuacaBench);
+
+  bench->func = func;
+  bench->data = data;
+
+  g_mutex_init (&bench->lock);
+
+  bench->thread = g_thread_new ("guaca-bench", guaca_bench_thread, bench);
+
+  return bench;
+}
+
+/*
+ * Frees the benchmark, cancelling it if it is still running.
+ */
+void
+guaca_bench_free (GuacaBench *bench)
+{
+  if (!bench)
+    return;
+
+  g_atomic_int_set (&bench->cancelled, 1);
+
+  g_thread_join (bench->thread);
+
+  if (bench->idle_id)
+    g_source_remove (bench->idle_id);
+
+  g_mutex_clear (&bench->lock);
+
+  g_slice_free (GuacaBench, bench);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Memory bandwidth and SIMD throughput, as bearing on software decode */
+
+#ifndef __GUACA_BENCH_H__
+#define __GUACA_BENCH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  double      copy_mbs;         /* memcpy, bytes read and written, MB/s */
+  double      triad_mbs;        /* STREAM triad, MB/s */
+
+  const char *simd;             /* name of the fastest kernel the CPU has */
+  double      simd_mbs;         /* its output, from cache, MB/s */
+} GuacaBenchResult;
+
+typedef struct _GuacaBench GuacaBench;
+
+typedef void (*GuacaBenchFunc) (const GuacaBenchResult *result,
+                                gpointer                data);
+
+GuacaBench *guaca_bench_start  (GuacaBenchFunc    func,
+                                gpointer          data);
+void        guaca_bench_free   (GuacaBench       *bench);
+
+gboolean    guaca_bench_lookup (GuacaBenchResult *result);
+
+G_END_DECLS
+
+#endif /* __GUACA_BENCH_H__ */
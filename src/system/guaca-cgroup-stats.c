@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-cgroup-stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static gssize
+read_file_at (int dirfd, const char *path, char *buf, gsize len)
+{
+  int     fd;
+  gssize  r;
+
+  if ((fd = openat (dirfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  r = read (fd, buf, len - 1);
+  close (fd);
+
+  if (r < 0)
+    return -1;
+
+  buf[r] = 0;
+  return r;
+}
+
+/*
+ * Returns the avg10 of the "some" line of a pressure file:
+ *
+ *   some avg10=1.23 avg60=0.50 avg300=0.10 total=123456
+ *   full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ */
+static double
+read_pressure (int dirfd, const char *path)
+{
+  char        buf[256];
+  const char *p;
+
+  if (read_file_at (dirfd, path, buf, sizeof (buf)) <= 0 ||
+      strncmp (buf, "some ", 5) ||
+      !(p = strstr (buf, "avg10=")))
+    return -1.0;
+
+  return g_ascii_strtod (p + strlen ("avg10="), NULL);
+}
+
+/*
+ * Reads the pressure of up to n_groups of the groups in dir into groups;
+ * returns the number read. This is a handful of small reads per group, and
+ * keeps no state.
+ */
+guint
+guaca_cgroup_stats_get (const char      *dir,
+                        GuacaCgroupInfo *groups,
+                        guint            n_groups)
+{
+  DIR           *d;
+  struct dirent *e;
+  guint          n = 0;
+
+  if (!(d = opendir (dir)))
+    return 0;
+
+  while (n < n_groups && (e = readdir (d)))
+    {
+      GuacaCgroupInfo *g = &groups[n];
+      char             buf[32];
+      int              gfd;
+
+      if (e->d_name[0] == '.' ||
+          (gfd = openat (dirfd (d), e->d_name,
+                         O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        continue;
+
+      memset (g, 0, sizeof (GuacaCgroupInfo));
+      g_strlcpy (g->name, e->d_name, sizeof (g->name));
+
+      g->cpu_some    = read_pressure (gfd, "cpu.pressure");
+      g->io_some     = read_pressure (gfd, "io.pressure");
+      g->memory_some = read_pressure (gfd, "memory.pressure");
+
+      if (read_file_at (gfd, "memory.current", buf, sizeof (buf)) > 0)
+        g->memory_current = g_ascii_strtoull (buf, NULL, 10);
+
+      close (gfd);
+      n++;
+    }
+
+  closedir (d);
+
+  return n;
+}
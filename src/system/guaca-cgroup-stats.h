@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Pressure stall information of the guacamayo cgroups */
+
+#ifndef __GUACA_CGROUP_STATS_H__
+#define __GUACA_CGROUP_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GUACA_CGROUP_DIR "/sys/fs/cgroup/guacamayo"
+
+typedef struct
+{
+  char    name[32];
+
+  /*
+   * The share of the last 10 seconds some of the tasks in the group were
+   * stalled on the resource, in %, or -1 if the kernel does not say.
+   */
+  double  cpu_some;
+  double  io_some;
+  double  memory_some;
+
+  guint64 memory_current;       /* bytes, 0 if not known */
+} GuacaCgroupInfo;
+
+guint guaca_cgroup_stats_get (const char      *dir,
+                              GuacaCgroupInfo *groups,
+                              guint            n_groups);
+
+G_END_DECLS
+
+#endif /* __GUACA_CGROUP_STATS_H__ */
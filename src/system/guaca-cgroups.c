@@ -0,0 +1,532 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sysfs.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CGROUP_ROOT  "/sys/fs/cgroup"
+#define CGROUP_DIR   CGROUP_ROOT "/guacamayo"
+#define CONFIG_FILE  "/etc/guacamayo/cgroups.conf"
+#define MANAGER_FILE "/run/systemd/system"
+
+#define MAX_GROUPS   8
+#define MAX_SERVICES 16
+
+/*
+ * A group and the processes that belong in it; the media group is special
+ * in that it gets the process that runs us, i.e., media-explorer.
+ */
+typedef struct
+{
+  char name[32];
+  char cpu_weight[16];
+  char io_weight[16];
+  char memory_high[32];
+
+  char services[MAX_SERVICES][16];
+  int  n_services;
+} Group;
+
+static Group groups[MAX_GROUPS];
+static int   n_groups;
+
+/*
+ * Used without a configuration file; the weights are relative, the default
+ * being 100, so the media process gets 25 times the CPU and IO of the
+ * background work when both compete.
+ */
+static void
+default_groups (void)
+{
+  static const char *services[] =
+    { "tracker-miner-f", "tracker-extract", "tumblerd", "opkg" };
+  int i;
+
+  memset (groups, 0, sizeof (groups));
+
+  strcpy (groups[0].name, "media");
+  strcpy (groups[0].cpu_weight, "500");
+  strcpy (groups[0].io_weight, "500");
+  strcpy (groups[0].memory_high, "max");
+
+  strcpy (groups[1].name, "background");
+  strcpy (groups[1].cpu_weight, "20");
+  strcpy (groups[1].io_weight, "20");
+  strcpy (groups[1].memory_high, "max");
+
+  for (i = 0; i < sizeof (services) / sizeof (services[0]); i++)
+    strcpy (groups[1].services[i], services[i]);
+
+  groups[1].n_services = i;
+
+  n_groups = 2;
+}
+
+static int
+valid_name (const char *name)
+{
+  const char *p;
+
+  for (p = name; *p; p++)
+    if (!isalnum ((unsigned char) *p) && *p != '-' && *p != '_')
+      return 0;
+
+  return p != name;
+}
+
+static char *
+strip (char *s)
+{
+  char *e;
+
+  while (isspace ((unsigned char) *s))
+    s++;
+
+  for (e = s + strlen (s); e > s && isspace ((unsigned char) e[-1]); e--)
+    ;
+
+  *e = 0;
+
+  return s;
+}
+
+/*
+ * memory.high takes a byte count or max; allow the K, M and G suffixes in
+ * the configuration, as in the kernel command line.
+ */
+static int
+parse_memory (const char *value, char *buf, size_t len)
+{
+  unsigned long long v;
+  char              *end;
+
+  if (!strcmp (value, "max"))
+    {
+      snprintf (buf, len, "max");
+      return 0;
+    }
+
+  v = strtoull (value, &end, 10);
+
+  switch (toupper ((unsigned char) *end))
+    {
+    case 'G': v <<= 10; /* fall through */
+    case 'M': v <<= 10; /* fall through */
+    case 'K': v <<= 10; end++; break;
+    default: break;
+    }
+
+  if (end == value || *end)
+    return -1;
+
+  snprintf (buf, len, "%llu", v);
+  return 0;
+}
+
+/*
+ * cpu.weight and io.weight take 1 to 10000; the kernel would refuse
+ * anything else, after we had moved the processes in.
+ */
+static int
+parse_weight (const char *value, char *buf, size_t len)
+{
+  unsigned long v;
+  char         *end;
+
+  if (!isdigit ((unsigned char) *value))
+    return -1;
+
+  errno = 0;
+  v     = strtoul (value, &end, 10);
+
+  if (*end || errno || v < 1 || v > 10000)
+    return -1;
+
+  snprintf (buf, len, "%lu", v);
+  return 0;
+}
+
+/*
+ * Reads the groups from the configuration, a key file with a section per
+ * group:
+ *
+ *   [background]
+ *   cpu.weight=20
+ *   io.weight=20
+ *   memory.high=64M
+ *   services=tumblerd;opkg
+ */
+static int
+load_config (void)
+{
+  char   path[PATH_MAX];
+  char   line[512];
+  FILE  *f;
+  Group *g = NULL;
+  int    lineno = 0;
+
+  if (!(f = fopen (guaca_sysfs_path (path, sizeof (path), CONFIG_FILE), "r")))
+    return errno == ENOENT ? 0 : -1;
+
+  memset (groups, 0, sizeof (groups));
+  n_groups = 0;
+
+  while (fgets (line, sizeof (line), f))
+    {
+      char *s = strip (line), *key, *value;
+
+      lineno++;
+
+      if (!*s || *s == '#')
+        continue;
+
+      if (*s == '[')
+        {
+          char *e = strchr (s, ']');
+
+          if (!e || n_groups == MAX_GROUPS)
+            goto bad;
+
+          *e = 0;
+
+          if (!valid_name (s + 1))
+            goto bad;
+
+          g = &groups[n_groups++];
+          snprintf (g->name, sizeof (g->name), "%s", s + 1);
+          continue;
+        }
+
+      if (!g || !(value = strchr (s, '=')))
+        goto bad;
+
+      *value++ = 0;
+      key      = strip (s);
+      value    = strip (value);
+
+      if (!strcmp (key, "cpu.weight"))
+        {
+          if (parse_weight (value, g->cpu_weight, sizeof (g->cpu_weight)))
+            goto bad;
+        }
+      else if (!strcmp (key, "io.weight"))
+        {
+          if (parse_weight (value, g->io_weight, sizeof (g->io_weight)))
+            goto bad;
+        }
+      else if (!strcmp (key, "memory.high"))
+        {
+          if (parse_memory (value, g->memory_high, sizeof (g->memory_high)))
+            goto bad;
+        }
+      else if (!strcmp (key, "services"))
+        {
+          char *name, *save = NULL;
+
+          for (name = strtok_r (value, ";", &save);
+               name && g->n_services < MAX_SERVICES;
+               name = strtok_r (NULL, ";", &save))
+            snprintf (g->services[g->n_services++], sizeof (g->services[0]),
+                      "%s", strip (name));
+        }
+      else
+        goto bad;
+    }
+
+  fclose (f);
+  return 0;
+
+ bad:
+  fprintf (stderr, "%s:%d: invalid line\n", CONFIG_FILE, lineno);
+  fclose (f);
+  return -1;
+}
+
+static int
+write_attr (const char *group, const char *attr, const char *value)
+{
+  char path[PATH_MAX];
+
+  if (group)
+    guaca_sysfs_path (path, sizeof (path), CGROUP_DIR "/%s/%s", group, attr);
+  else
+    guaca_sysfs_path (path, sizeof (path), CGROUP_DIR "/%s", attr);
+
+  if (guaca_sysfs_write (path, value) < 0)
+    {
+      fprintf (stderr, "Failed to write '%s' to %s: %s\n",
+               value, path, strerror (errno));
+      return -1;
+    }
+
+  return 0;
+}
+
+static void
+add_controller (char *control, const char *name)
+{
+  strcat (control, *control ? " +" : "+");
+  strcat (control, name);
+}
+
+/*
+ * Enables the cpu, io and memory controllers, those of them the kernel has,
+ * for our groups; returns -1 if cgroup v2 is not mounted.
+ *
+ * Where an init system manages the hierarchy, the root subtree_control is
+ * its business, and we only use the controllers it has already enabled.
+ */
+static int
+enable_controllers (void)
+{
+  static const char *wanted[] = { "cpu", "io", "memory" };
+  char               path[PATH_MAX];
+  char               available[256];
+  char               enabled[256] = "";
+  char               root_control[64] = "";
+  char               control[64] = "";
+  int                managed, i;
+
+  if (guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                          CGROUP_ROOT "/cgroup.controllers"),
+                        available, sizeof (available)) < 0)
+    return -1;
+
+  guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                      CGROUP_ROOT "/cgroup.subtree_control"),
+                    enabled, sizeof (enabled));
+
+  managed = !access (guaca_sysfs_path (path, sizeof (path), MANAGER_FILE),
+                     F_OK);
+
+  for (i = 0; i < sizeof (wanted) / sizeof (wanted[0]); i++)
+    {
+      if (!guaca_sysfs_has_word (available, wanted[i]))
+        continue;
+
+      if (!guaca_sysfs_has_word (enabled, wanted[i]))
+        {
+          if (managed)
+            {
+              fprintf (stderr, "The %s controller is not delegated to us\n",
+                       wanted[i]);
+              continue;
+            }
+
+          add_controller (root_control, wanted[i]);
+        }
+
+      add_controller (control, wanted[i]);
+    }
+
+  mkdir (guaca_sysfs_path (path, sizeof (path), CGROUP_DIR), 0755);
+
+  if (*root_control &&
+      guaca_sysfs_write (guaca_sysfs_path (path, sizeof (path),
+                                           CGROUP_ROOT
+                                           "/cgroup.subtree_control"),
+                         root_control) < 0)
+    return -2;
+
+  if (!*control)
+    return 0;
+
+  return write_attr (NULL, "cgroup.subtree_control", control) < 0 ? -2 : 0;
+}
+
+static int
+setup_group (const Group *g)
+{
+  char path[PATH_MAX];
+  int  retval = 0;
+
+  if (mkdir (guaca_sysfs_path (path, sizeof (path), CGROUP_DIR "/%s", g->name),
+             0755) < 0 && errno != EEXIST)
+    {
+      fprintf (stderr, "Failed to create group %s: %s\n",
+               g->name, strerror (errno));
+      return -1;
+    }
+
+  if (*g->cpu_weight && write_attr (g->name, "cpu.weight", g->cpu_weight) < 0)
+    retval = -1;
+
+  if (*g->io_weight && write_attr (g->name, "io.weight", g->io_weight) < 0)
+    retval = -1;
+
+  if (*g->memory_high &&
+      write_attr (g->name, "memory.high", g->memory_high) < 0)
+    retval = -1;
+
+  return retval;
+}
+
+static int
+move_pid (const Group *g, pid_t pid)
+{
+  char value[16];
+
+  snprintf (value, sizeof (value), "%d", (int) pid);
+
+  return write_attr (g->name, "cgroup.procs", value);
+}
+
+/*
+ * Moves the running processes of the named services into their groups; the
+ * services are matched on their comm, which the kernel truncates to 15
+ * characters.
+ */
+static int
+move_services (void)
+{
+  char           path[PATH_MAX];
+  char           comm[32];
+  DIR           *dir;
+  struct dirent *d;
+  int            i, j, retval = 0;
+
+  if (!(dir = opendir (guaca_sysfs_path (path, sizeof (path), "/proc"))))
+    return -1;
+
+  while ((d = readdir (dir)))
+    {
+      pid_t pid = atoi (d->d_name);
+
+      if (pid <= 0 ||
+          guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                              "/proc/%d/comm", (int) pid),
+                            comm, sizeof (comm)) <= 0)
+        continue;
+
+      for (i = 0; i < n_groups; i++)
+        for (j = 0; j < groups[i].n_services; j++)
+          if (!strcmp (comm, groups[i].services[j]))
+            {
+              if (move_pid (&groups[i], pid) < 0)
+                retval = -1;
+              else
+                printf ("%s (%d) -> %s\n", comm, (int) pid, groups[i].name);
+            }
+    }
+
+  closedir (dir);
+
+  return retval;
+}
+
+/*
+ * Whether the parent is media-explorer, run by the user that runs us; as
+ * we are suid, anyone could run us otherwise and have the hierarchy of the
+ * box rearranged. Only the installed binary, MEDIA_EXPLORER_PATH from
+ * configure, will do, not any program of the same name; the link in /proc
+ * has the symbolic links resolved, so the installed path is resolved too.
+ */
+static int
+parent_is_media_explorer (pid_t ppid)
+{
+  char        path[PATH_MAX];
+  char        exe[PATH_MAX];
+  char        installed[PATH_MAX];
+  struct stat st;
+  ssize_t     n;
+
+  if (stat (guaca_sysfs_path (path, sizeof (path), "/proc/%d", (int) ppid),
+            &st) < 0 || st.st_uid != getuid ())
+    return 0;
+
+  if ((n = readlink (guaca_sysfs_path (path, sizeof (path),
+                                       "/proc/%d/exe", (int) ppid),
+                     exe, sizeof (exe) - 1)) < 0)
+    return 0;
+
+  exe[n] = 0;
+
+  if (!realpath (MEDIA_EXPLORER_PATH, installed))
+    snprintf (installed, sizeof (installed), "%s", MEDIA_EXPLORER_PATH);
+
+  return !strcmp (exe, installed);
+}
+
+/*
+ * cgroup setter for guacamayo system settings mex plugin; places the
+ * calling process in the media group, and the configured background
+ * services in theirs. Only the parent can be moved, and only to the media
+ * group, so that this cannot be used to move arbitrary processes about;
+ * and only media-explorer may run us at all.
+ *
+ * This program needs to be installed suid root
+ */
+int
+main (int argc, char **argv)
+{
+  pid_t ppid = getppid ();
+  int   i, r, retval = 0;
+
+  if (argc != 1)
+    return 1;
+
+  guaca_sysfs_init ();
+
+  if (!parent_is_media_explorer (ppid))
+    {
+      fprintf (stderr, "Not run by " MEDIA_EXPLORER_PATH "\n");
+      return 1;
+    }
+
+  default_groups ();
+
+  if (load_config () < 0)
+    return 1;
+
+  if ((r = enable_controllers ()) == -1)
+    {
+      fprintf (stderr, "No cgroup v2 hierarchy at " CGROUP_ROOT "\n");
+      return 2;
+    }
+  else if (r < 0)
+    retval = 3;
+
+  for (i = 0; i < n_groups; i++)
+    {
+      if (setup_group (&groups[i]) < 0)
+        {
+          retval = 3;
+          continue;
+        }
+
+      if (!strcmp (groups[i].name, "media") &&
+          move_pid (&groups[i], ppid) < 0)
+        retval = 3;
+    }
+
+  if (move_services () < 0)
+    retval = 3;
+
+  return retval;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sysfs.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CPUFREQ_DIR  "/sys/devices/system/cpu/cpufreq"
+#define PROFILE_FILE "/etc/guacamayo/cpu-profile"
+
+/*
+ * The settings of each profile. Which governors and energy performance
+ * preferences exist depends on the cpufreq driver, so each lists its
+ * choices in order of preference, and we use the first one the policy
+ * offers; the minimum frequency is a percentage of the hardware range.
+ */
+typedef struct
+{
+  const char *name;
+  const char *governors[4];
+  const char *epps[3];
+  int         min_percent;
+} Profile;
+
+static const Profile profiles[] =
+  {
+    { "playback",
+      { "performance", "schedutil", "ondemand", NULL },
+      { "performance", NULL },
+      50 },
+    { "balanced",
+      { "schedutil", "ondemand", "powersave", NULL },
+      { "balance_performance", "default", NULL },
+      0 },
+    { "powersave",
+      { "conservative", "powersave", NULL },
+      { "power", "balance_power", NULL },
+      0 },
+  };
+
+static const Profile *
+find_profile (const char *name)
+{
+  int i;
+
+  for (i = 0; i < sizeof (profiles) / sizeof (profiles[0]); i++)
+    if (!strcmp (profiles[i].name, name))
+      return &profiles[i];
+
+  return NULL;
+}
+
+static const char *
+pick (const char * const *choices, const char *available)
+{
+  int i;
+
+  for (i = 0; choices[i]; i++)
+    if (guaca_sysfs_has_word (available, choices[i]))
+      return choices[i];
+
+  return NULL;
+}
+
+/*
+ * Writes the attribute of the policy and reads it back; the kernel accepts
+ * some values it then does not apply, e.g., a minimum frequency above a
+ * limit imposed by the platform.
+ */
+static int
+set_attr (const char *policy, const char *attr, const char *value)
+{
+  char path[PATH_MAX];
+  char buf[128] = "";
+
+  guaca_sysfs_path (path, sizeof (path), CPUFREQ_DIR "/%s/%s", policy, attr);
+
+  if (guaca_sysfs_write (path, value) < 0)
+    {
+      fprintf (stderr, "Failed to set %s of %s to '%s': %s\n",
+               attr, policy, value, strerror (errno));
+      return -1;
+    }
+
+  if (guaca_sysfs_read (path, buf, sizeof (buf)) < 0 || strcmp (buf, value))
+    {
+      fprintf (stderr, "%s of %s is '%s' rather than '%s'\n",
+               attr, policy, buf, value);
+      return -1;
+    }
+
+  return 0;
+}
+
+static int
+read_attr (const char *policy, const char *attr, char *buf, size_t len)
+{
+  char path[PATH_MAX];
+
+  guaca_sysfs_path (path, sizeof (path), CPUFREQ_DIR "/%s/%s", policy, attr);
+
+  return guaca_sysfs_read (path, buf, len);
+}
+
+static int
+read_freq (const char *policy, const char *attr, unsigned long *freq)
+{
+  char path[PATH_MAX];
+
+  guaca_sysfs_path (path, sizeof (path), CPUFREQ_DIR "/%s/%s", policy, attr);
+
+  return guaca_sysfs_read_ulong (path, freq);
+}
+
+/*
+ * Returns the lowest of the available frequencies that is at least freq;
+ * drivers without a frequency table take any value in the range.
+ */
+static unsigned long
+snap_freq (const char *policy, unsigned long freq)
+{
+  char          buf[1024];
+  char         *p, *end;
+  unsigned long best = ULONG_MAX;
+
+  if (read_attr (policy, "scaling_available_frequencies",
+                 buf, sizeof (buf)) <= 0)
+    return freq;
+
+  for (p = buf; *p; p = end)
+    {
+      unsigned long f = strtoul (p, &end, 10);
+
+      if (end == p)
+        break;
+
+      if (f >= freq && f < best)
+        best = f;
+    }
+
+  return best != ULONG_MAX ? best : freq;
+}
+
+static int
+apply_policy (const char *policy, const Profile *profile)
+{
+  char          buf[1024];
+  char          value[32];
+  const char   *governor, *epp;
+  unsigned long cpu_min, cpu_max, min;
+  int           retval = 0;
+
+  if (read_attr (policy, "scaling_available_governors",
+                 buf, sizeof (buf)) <= 0 ||
+      !(governor = pick (profile->governors, buf)))
+    {
+      fprintf (stderr, "%s has none of the governors of '%s'\n",
+               policy, profile->name);
+      return -1;
+    }
+
+  if (set_attr (policy, "scaling_governor", governor) < 0)
+    return -1;
+
+  /*
+   * Only intel_pstate and amd-pstate have the preference; in active mode
+   * with the performance governor it is pinned to performance already.
+   */
+  if (read_attr (policy, "energy_performance_available_preferences",
+                 buf, sizeof (buf)) > 0 &&
+      (epp = pick (profile->epps, buf)) &&
+      set_attr (policy, "energy_performance_preference", epp) < 0 &&
+      strcmp (governor, "performance"))
+    retval = -1;
+
+  if (read_freq (policy, "cpuinfo_min_freq", &cpu_min) < 0 ||
+      read_freq (policy, "cpuinfo_max_freq", &cpu_max) < 0 ||
+      cpu_max < cpu_min)
+    {
+      fprintf (stderr, "Failed to read the frequency range of %s\n", policy);
+      return -1;
+    }
+
+  /*
+   * Lift any cap left behind by hand tuning first; the minimum cannot be set
+   * above the current maximum.
+   */
+  snprintf (value, sizeof (value), "%lu", cpu_max);
+  if (set_attr (policy, "scaling_max_freq", value) < 0)
+    retval = -1;
+
+  min = snap_freq (policy,
+                   cpu_min + (cpu_max - cpu_min) / 100 * profile->min_percent);
+
+  snprintf (value, sizeof (value), "%lu", min);
+  if (set_attr (policy, "scaling_min_freq", value) < 0)
+    retval = -1;
+
+  if (!retval)
+    printf ("%s: %s, minimum %lu kHz\n", policy, governor, min);
+
+  return retval;
+}
+
+static int
+save_profile (const Profile *profile)
+{
+  char  path[PATH_MAX];
+  FILE *f;
+
+  mkdir (guaca_sysfs_path (path, sizeof (path), "/etc/guacamayo"), 0755);
+
+  if (!(f = fopen (guaca_sysfs_path (path, sizeof (path), PROFILE_FILE), "w")))
+    {
+      fprintf (stderr, "Failed to save profile: %s\n", strerror (errno));
+      return -1;
+    }
+
+  fprintf (f, "%s\n", profile->name);
+
+  if (fclose (f))
+    {
+      fprintf (stderr, "Failed to save profile: %s\n", strerror (errno));
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+ * CPU performance profile setter for guacamayo system settings mex plugin;
+ * applies the given profile to all cpufreq policies and saves it, or without
+ * arguments, re-applies the saved profile (e.g., at boot).
+ *
+ * This program needs to be installed suid root
+ */
+int
+main (int argc, char **argv)
+{
+  const Profile *profile;
+  char           path[PATH_MAX];
+  char           name[32];
+  DIR           *dir;
+  struct dirent *d;
+  int            n = 0, retval = 0;
+
+  if (argc > 2)
+    return 1;
+
+  guaca_sysfs_init ();
+
+  if (argc == 2)
+    snprintf (name, sizeof (name), "%s", argv[1]);
+  else if (guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                               PROFILE_FILE),
+                             name, sizeof (name)) <= 0)
+    return 0;
+
+  if (!(profile = find_profile (name)))
+    {
+      fprintf (stderr, "Unknown profile '%s'\n", name);
+      return 1;
+    }
+
+  if (!(dir = opendir (guaca_sysfs_path (path, sizeof (path), CPUFREQ_DIR))))
+    {
+      fprintf (stderr, "No cpufreq support: %s\n", strerror (errno));
+      return 2;
+    }
+
+  while ((d = readdir (dir)))
+    {
+      if (strncmp (d->d_name, "policy", 6))
+        continue;
+
+      if (apply_policy (d->d_name, profile) < 0)
+        retval = 3;
+
+      n++;
+    }
+
+  closedir (dir);
+
+  if (!n)
+    {
+      fprintf (stderr, "No cpufreq policies\n");
+      return 2;
+    }
+
+  if (argc == 2 && save_profile (profile) < 0 && !retval)
+    retval = 4;
+
+  return retval;
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-cpuidle.h"
+#include "guaca-proc-reader.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * On fanless boxes the deep idle states keep the heat down, but their exit
+ * latency can make audio underrun; the residency of each state, with the
+ * latency limit set through PM QoS, shows which way a box leans.
+ *
+ * The states are the same on all the CPUs, and are summed over them. The
+ * time and usage counters of every state of every CPU are registered with
+ * a reader, which keeps them open, so a sample is one read per file.
+ */
+#define MAX_CPUS   32
+#define MAX_STATES 10
+
+/* what the kernel reports when no one asked for a limit, 2000 s */
+#define QOS_DEFAULT 2000000000
+
+#define CPU_DIR   "/sys/devices/system/cpu"
+#define QOS_FILE  "/dev/cpu_dma_latency"
+
+struct _GuacaCpuidle
+{
+  GuacaProcReader   *reader;
+  int                qos_file;
+
+  gint64             timestamp;
+  gboolean           have_rates;
+
+  guint              n_cpus;
+  guint              n_states;
+  GuacaCpuidleState  states[MAX_STATES];
+
+  /* n_cpus rows of n_states */
+  int                time_files[MAX_CPUS * MAX_STATES];
+  int                usage_files[MAX_CPUS * MAX_STATES];
+  guint64            time[MAX_CPUS * MAX_STATES];
+  guint64            usage[MAX_CPUS * MAX_STATES];
+};
+
+/*
+ * GUACA_PROBE_ROOT points us at a fake sysfs and /dev, for testing.
+ */
+static char *
+root_path (const char *path)
+{
+  const char *root = g_getenv ("GUACA_PROBE_ROOT");
+
+  return g_strconcat (root ? root : "", path, NULL);
+}
+
+static char *
+read_attr (const char *dir, guint state, const char *attr)
+{
+  char *path, *contents = NULL;
+
+  path = g_strdup_printf ("%s/state%u/%s", dir, state, attr);
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    g_strstrip (contents);
+
+  g_free (path);
+
+  return contents;
+}
+
+static int
+add_counter (GuacaProcReader *reader, const char *dir, guint state,
+             const char *attr)
+{
+  char *path = g_strdup_printf ("%s/state%u/%s", dir, state, attr);
+  int   file = guaca_proc_reader_add (reader, path, 24);
+
+  g_free (path);
+
+  return file;
+}
+
+/*
+ * Registers the counters of the states of the CPU; the names and latencies
+ * are taken from the first CPU. CPUs without cpuidle, or with fewer states
+ * than the first one, are skipped.
+ */
+static void
+add_cpu (GuacaCpuidle *idle, const char *cpu_dir)
+{
+  char  *dir = g_strdup_printf ("%s/cpuidle", cpu_dir);
+  guint  row = idle->n_cpus * MAX_STATES;
+  guint  s;
+
+  for (s = 0; s < MAX_STATES; s++)
+    {
+      char *name, *latency;
+
+      if (!(name = read_attr (dir, s, "name")))
+        break;
+
+      if (!idle->n_cpus)
+        {
+          latency = read_attr (dir, s, "latency");
+
+          g_strlcpy (idle->states[s].name, name,
+                     sizeof (idle->states[s].name));
+          idle->states[s].latency = latency ? atoi (latency) : 0;
+          g_free (latency);
+        }
+
+      g_free (name);
+    }
+
+  if (!idle->n_cpus)
+    idle->n_states = s;
+
+  if (idle->n_states && s >= idle->n_states)
+    {
+      for (s = 0; s < idle->n_states; s++)
+        {
+          idle->time_files[row + s]  =
+            add_counter (idle->reader, dir, s, "time");
+          idle->usage_files[row + s] =
+            add_counter (idle->reader, dir, s, "usage");
+        }
+
+      idle->n_cpus++;
+    }
+
+  g_free (dir);
+}
+
+GuacaCpuidle *
+guaca_cpuidle_new (void)
+{
+  GuacaCpuidle  *idle = g_slice_new0 (GuacaCpuidle);
+  char          *dir, *path;
+  DIR           *d;
+  struct dirent *e;
+
+  idle->reader = guaca_proc_reader_new ();
+
+  dir = root_path (CPU_DIR);
+
+  if ((d = opendir (dir)))
+    {
+      while (idle->n_cpus < MAX_CPUS && (e = readdir (d)))
+        {
+          char *cpu_dir;
+
+          if (strncmp (e->d_name, "cpu", 3) ||
+              !g_ascii_isdigit (e->d_name[3]))
+            continue;
+
+          cpu_dir = g_build_filename (dir, e->d_name, NULL);
+          add_cpu (idle, cpu_dir);
+          g_free (cpu_dir);
+        }
+
+      closedir (d);
+    }
+
+  g_free (dir);
+
+  /*
+   * Opening this adds a request that does not limit anything, which goes
+   * when we close it; reading it gives the strictest limit requested. It
+   * is normally only readable by root.
+   */
+  path = root_path (QOS_FILE);
+  idle->qos_file = guaca_proc_reader_add (idle->reader, path, 8);
+  g_free (path);
+
+  return idle;
+}
+
+void
+guaca_cpuidle_free (GuacaCpuidle *idle)
+{
+  if (!idle)
+    return;
+
+  guaca_proc_reader_free (idle->reader);
+
+  g_slice_free (GuacaCpuidle, idle);
+}
+
+static guint64
+read_counter (GuacaProcReader *reader, int file)
+{
+  const char *s = guaca_proc_reader_get (reader, file, NULL);
+
+  return s ? g_ascii_strtoull (s, NULL, 10) : 0;
+}
+
+/*
+ * Takes a sample of the counters, computing the residencies and rates over
+ * the time since the previous sample.
+ */
+void
+guaca_cpuidle_sample (GuacaCpuidle *idle)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 elapsed = idle->timestamp ? now - idle->timestamp : 0;
+  guint  c, s;
+
+  guaca_proc_reader_refresh (idle->reader);
+
+  for (s = 0; s < idle->n_states; s++)
+    {
+      guint64 time = 0, usage = 0;
+
+      for (c = 0; c < idle->n_cpus; c++)
+        {
+          guint   i = c * MAX_STATES + s;
+          guint64 t = read_counter (idle->reader, idle->time_files[i]);
+          guint64 u = read_counter (idle->reader, idle->usage_files[i]);
+
+          /* the counters only go back if the CPU went offline */
+          if (t >= idle->time[i] && u >= idle->usage[i])
+            {
+              time  += t - idle->time[i];
+              usage += u - idle->usage[i];
+            }
+
+          idle->time[i]  = t;
+          idle->usage[i] = u;
+        }
+
+      if (elapsed > 0)
+        {
+          /* time is in us, as is elapsed */
+          idle->states[s].residency = 100.0 * time /
+            ((double) elapsed * idle->n_cpus);
+          idle->states[s].rate = usage * (double) G_USEC_PER_SEC / elapsed;
+        }
+    }
+
+  idle->timestamp  = now;
+  idle->have_rates = elapsed > 0;
+}
+
+/*
+ * Returns the number of idle states, 0 if there is no cpuidle.
+ */
+guint
+guaca_cpuidle_get_n_states (GuacaCpuidle *idle)
+{
+  return idle->n_cpus ? idle->n_states : 0;
+}
+
+/*
+ * Copies the up to n_states states, shallowest first, into states; returns
+ * the number copied, 0 until there are two samples.
+ */
+guint
+guaca_cpuidle_get_states (GuacaCpuidle      *idle,
+                          GuacaCpuidleState *states,
+                          guint              n_states)
+{
+  guint n = MIN (n_states, idle->n_states);
+
+  if (!idle->n_cpus || !idle->have_rates)
+    return 0;
+
+  memcpy (states, idle->states, n * sizeof (GuacaCpuidleState));
+
+  return n;
+}
+
+/*
+ * Returns the strictest CPU latency limit requested through PM QoS, in us,
+ * or -1 if there is none, or we cannot tell.
+ */
+int
+guaca_cpuidle_get_qos_latency (GuacaCpuidle *idle)
+{
+  const char *buf;
+  gsize       len;
+  gint32      value;
+
+  if (!(buf = guaca_proc_reader_get (idle->reader, idle->qos_file, &len)) ||
+      len < sizeof (value))
+    return -1;
+
+  /* the value is binary, in host byte order */
+  memcpy (&value, buf, sizeof (value));
+
+  return value >= 0 && value < QOS_DEFAULT ? value : -1;
+}
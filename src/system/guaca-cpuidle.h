@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* CPU idle state residency, and the PM QoS latency limit on it */
+
+#ifndef __GUACA_CPUIDLE_H__
+#define __GUACA_CPUIDLE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  char   name[16];              /* "POLL", "C1", "WFI", ... */
+  guint  latency;               /* exit latency, in us */
+
+  double residency;             /* % of the time of all the CPUs */
+  double rate;                  /* entries per second, over all the CPUs */
+} GuacaCpuidleState;
+
+typedef struct _GuacaCpuidle GuacaCpuidle;
+
+GuacaCpuidle *guaca_cpuidle_new             (void);
+void          guaca_cpuidle_free            (GuacaCpuidle      *idle);
+
+void          guaca_cpuidle_sample          (GuacaCpuidle      *idle);
+
+guint         guaca_cpuidle_get_n_states    (GuacaCpuidle      *idle);
+guint         guaca_cpuidle_get_states      (GuacaCpuidle      *idle,
+                                             GuacaCpuidleState *states,
+                                             guint              n_states);
+int           guaca_cpuidle_get_qos_latency (GuacaCpuidle      *idle);
+
+G_END_DECLS
+
+#endif /* __GUACA_CPUIDLE_H__ */
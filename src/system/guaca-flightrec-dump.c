@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "guaca-flightrec-format.h"
+
+static void
+usage (const char *argv0)
+{
+  fprintf (stderr,
+           "Usage: %s [-f FILE] [-s START] [-e END]\n"
+           "\n"
+           "Dumps the flight recorder samples between START and END as CSV.\n"
+           "Times are seconds since the epoch, or, when negative, seconds\n"
+           "relative to now; the default is the whole recording.\n",
+           argv0);
+}
+
+static int64_t
+parse_time (const char *s, int64_t now)
+{
+  long long t = strtoll (s, NULL, 10);
+
+  if (t < 0)
+    return now + t * 1000000LL;
+
+  return t * 1000000LL;
+}
+
+/*
+ * Falls back on the per-user location the plugin uses when it cannot write
+ * to /var/cache.
+ */
+static const char *
+default_file (char *buf, size_t len)
+{
+  const char *cache = getenv ("XDG_CACHE_HOME");
+  const char *home  = getenv ("HOME");
+
+  if (!access (GUACA_FLIGHTREC_FILE, R_OK))
+    return GUACA_FLIGHTREC_FILE;
+
+  if (cache && *cache)
+    snprintf (buf, len, "%s/guacamayo/flightrec", cache);
+  else
+    snprintf (buf, len, "%s/.cache/guacamayo/flightrec", home ? home : "");
+
+  return buf;
+}
+
+/*
+ * Flight recorder dump utility
+ */
+int
+main (int argc, char **argv)
+{
+  const char           *file = NULL;
+  char                  path[PATH_MAX];
+  int64_t               start = INT64_MIN, end = INT64_MAX, now;
+  uint64_t              head, seq, first;
+  GuacaFlightrecHeader *header;
+  struct stat           st;
+  struct timespec       ts;
+  int                   fd, c;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+  while ((c = getopt (argc, argv, "f:s:e:h")) != -1)
+    {
+      switch (c)
+        {
+        case 'f':
+          file = optarg;
+          break;
+        case 's':
+          start = parse_time (optarg, now);
+          break;
+        case 'e':
+          end = parse_time (optarg, now);
+          break;
+        default:
+          usage (argv[0]);
+          return 1;
+        }
+    }
+
+  if (!file)
+    file = default_file (path, sizeof (path));
+
+  if ((fd = open (file, O_RDONLY)) < 0 || fstat (fd, &st) < 0)
+    {
+      fprintf (stderr, "Failed to open '%s': %s\n", file, strerror (errno));
+      return 2;
+    }
+
+  if (st.st_size < sizeof (GuacaFlightrecHeader) ||
+      (header = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+      MAP_FAILED)
+    {
+      fprintf (stderr, "Failed to map '%s'\n", file);
+      return 2;
+    }
+
+  close (fd);
+
+  if (header->magic != GUACA_FLIGHTREC_MAGIC ||
+      header->version != GUACA_FLIGHTREC_VERSION ||
+      header->record_size != sizeof (GuacaFlightrecSample) ||
+      !header->n_records ||
+      st.st_size < GUACA_FLIGHTREC_SIZE (header->n_records))
+    {
+      fprintf (stderr, "'%s' is not a flight recorder file\n", file);
+      return 3;
+    }
+
+  head  = __atomic_load_n (&header->head, __ATOMIC_ACQUIRE);
+  first = head > header->n_records ? head - header->n_records : 0;
+
+  printf ("time,cpu_busy,cpu_iowait,temp_c,mem_available_kb,swap_used_kb,"
+          "io_read_kbs,io_write_kbs\n");
+
+  for (seq = first; seq < head; seq++)
+    {
+      GuacaFlightrecSample *slot = guaca_flightrec_slot (header, seq);
+      GuacaFlightrecSample  s;
+      uint64_t              s1, s2;
+
+      /*
+       * The recorder may be overwriting the oldest records while we read;
+       * skip any record that changed under us.
+       */
+      s1 = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+      memcpy (&s, slot, sizeof (s));
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      s2 = __atomic_load_n (&slot->seq, __ATOMIC_RELAXED);
+
+      if (s1 != seq + 1 || s1 != s2)
+        continue;
+
+      if (s.time_us < start || s.time_us > end)
+        continue;
+
+      printf ("%lld.%03lld,%.1f,%.1f,",
+              (long long)(s.time_us / 1000000),
+              (long long)(s.time_us % 1000000) / 1000,
+              s.cpu_busy / 10.0, s.cpu_iowait / 10.0);
+
+      if (s.temp_mc != GUACA_FLIGHTREC_NO_TEMP)
+        printf ("%.1f", s.temp_mc / 1000.0);
+
+      printf (",%u,%u,%u,%u\n",
+              s.mem_available_kb, s.swap_used_kb,
+              s.io_read_kbs, s.io_write_kbs);
+    }
+
+  munmap (header, st.st_size);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/*
+ * Flight recorder ring file format
+ *
+ * This is shared between the System plugin, which writes the file, and the
+ * guacamayo-flightrec dump utility, so it must not depend on glib.
+ */
+
+#ifndef __GUACA_FLIGHTREC_FORMAT_H__
+#define __GUACA_FLIGHTREC_FORMAT_H__
+
+#include <stdint.h>
+
+#define GUACA_FLIGHTREC_MAGIC    0x524c4647 /* "GFLR" */
+#define GUACA_FLIGHTREC_VERSION  1
+
+#define GUACA_FLIGHTREC_FILE     "/var/cache/guacamayo/flightrec"
+
+#define GUACA_FLIGHTREC_NO_TEMP  INT32_MIN
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t n_records;
+  uint32_t interval_ms;
+  uint32_t reserved;
+
+  /*
+   * Number of samples ever written; the next sample goes to slot
+   * head % n_records.
+   */
+  uint64_t head;
+
+  uint8_t  padding[32];
+} GuacaFlightrecHeader;
+
+/*
+ * A single sample; rates are computed over the preceding sampling interval.
+ *
+ * The seq field is the sample number plus one and is written last (and
+ * cleared first), so a reader can detect a record it raced with the writer
+ * on by reading it before and after copying the record.
+ */
+typedef struct
+{
+  uint64_t seq;
+  int64_t  time_us;             /* CLOCK_REALTIME */
+
+  uint16_t cpu_busy;            /* per mille of all cores */
+  uint16_t cpu_iowait;          /* per mille of all cores */
+  int32_t  temp_mc;             /* millidegrees Celsius */
+
+  uint32_t mem_available_kb;
+  uint32_t swap_used_kb;
+
+  uint32_t io_read_kbs;         /* KB/s paged in */
+  uint32_t io_write_kbs;        /* KB/s paged out */
+} GuacaFlightrecSample;
+
+#define GUACA_FLIGHTREC_SIZE(n) \
+  (sizeof (GuacaFlightrecHeader) + (n) * sizeof (GuacaFlightrecSample))
+
+static inline GuacaFlightrecSample *
+guaca_flightrec_slot (GuacaFlightrecHeader *header, uint64_t seq)
+{
+  GuacaFlightrecSample *samples = (GuacaFlightrecSample *)(header + 1);
+
+  return &samples[seq % header->n_records];
+}
+
+#endif /* __GUACA_FLIGHTREC_FORMAT_H__ */
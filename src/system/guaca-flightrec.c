@@ -0,0 +1,332 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-flightrec.h"
+#include "guaca-flightrec-format.h"
+#include "guaca-proc-reader.h"
+#include "guaca-sampler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum
+{
+  SOURCE_STAT = 0,
+  SOURCE_MEMINFO,
+  SOURCE_VMSTAT,
+  SOURCE_THERMAL,
+  N_SOURCES
+};
+
+static const struct
+{
+  const char *path;
+  gsize       size;
+} sources[N_SOURCES] =
+  {
+    { "/proc/stat",                            2048 },
+    { "/proc/meminfo",                         2048 },
+    { "/proc/vmstat",                          8192 },
+    { "/sys/class/thermal/thermal_zone0/temp", 16 },
+  };
+
+struct _GuacaFlightrec
+{
+  GuacaFlightrecHeader *header;
+  gsize                 size;
+
+  guint                 interval_ms;
+  GuacaProcReader      *reader;
+  int                   files[N_SOURCES];
+
+  /*
+   * Counters from the previous sample, for the rates.
+   */
+  guint64               cpu_total;
+  guint64               cpu_idle;
+  guint64               cpu_iowait;
+  guint64               pgpgin;
+  guint64               pgpgout;
+  gint64                last_time;
+
+  GuacaSamplerSub      *sub;
+};
+
+/*
+ * Returns the contents of the source from the current sample, or NULL.
+ */
+static const char *
+guaca_flightrec_get (GuacaFlightrec *rec, int source)
+{
+  return guaca_proc_reader_get (rec->reader, rec->files[source], NULL);
+}
+
+static guint64
+find_value (const char *buf, const char *key)
+{
+  const char *p = buf;
+  gsize       len = strlen (key);
+
+  while (p)
+    {
+      if (!strncmp (p, key, len))
+        return g_ascii_strtoull (p + len, NULL, 10);
+
+      if ((p = strchr (p, '\n')))
+        p++;
+    }
+
+  return 0;
+}
+
+static void
+guaca_flightrec_sample (GuacaFlightrec *rec, GuacaFlightrecSample *s)
+{
+  gint64  now = g_get_monotonic_time ();
+  double  secs = (now - rec->last_time) / (double) G_USEC_PER_SEC;
+  gboolean first = !rec->last_time;
+  const char *buf;
+
+  s->time_us = g_get_real_time ();
+  s->temp_mc = GUACA_FLIGHTREC_NO_TEMP;
+
+  guaca_proc_reader_refresh (rec->reader);
+
+  if ((buf = guaca_flightrec_get (rec, SOURCE_STAT)))
+    {
+      unsigned long long v[8] = { 0, };
+      guint64            total = 0, idle, iowait;
+      int                i;
+
+      sscanf (buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+              &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+
+      for (i = 0; i < G_N_ELEMENTS (v); i++)
+        total += v[i];
+
+      idle   = v[3] + v[4];
+      iowait = v[4];
+
+      if (!first && total > rec->cpu_total)
+        {
+          guint64 dt = total - rec->cpu_total;
+
+          s->cpu_busy   = 1000 * (dt - MIN (dt, idle - rec->cpu_idle)) / dt;
+          s->cpu_iowait = 1000 * MIN (dt, iowait - rec->cpu_iowait) / dt;
+        }
+
+      rec->cpu_total  = total;
+      rec->cpu_idle   = idle;
+      rec->cpu_iowait = iowait;
+    }
+
+  if ((buf = guaca_flightrec_get (rec, SOURCE_MEMINFO)))
+    {
+      s->mem_available_kb = find_value (buf, "MemAvailable:");
+      s->swap_used_kb     = find_value (buf, "SwapTotal:") -
+                            find_value (buf, "SwapFree:");
+    }
+
+  if ((buf = guaca_flightrec_get (rec, SOURCE_VMSTAT)))
+    {
+      guint64 in  = find_value (buf, "pgpgin ");
+      guint64 out = find_value (buf, "pgpgout ");
+
+      if (!first && secs > 0.0)
+        {
+          s->io_read_kbs  = (in - MIN (in, rec->pgpgin)) / secs;
+          s->io_write_kbs = (out - MIN (out, rec->pgpgout)) / secs;
+        }
+
+      rec->pgpgin  = in;
+      rec->pgpgout = out;
+    }
+
+  if ((buf = guaca_flightrec_get (rec, SOURCE_THERMAL)) && *buf)
+    s->temp_mc = strtol (buf, NULL, 10);
+
+  rec->last_time = now;
+}
+
+/*
+ * Appends a sample to the ring. There is only ever one writer, the sampler
+ * thread, and readers detect torn records through the seq field, so this
+ * needs no locking. We never sync the mapping; the kernel writes the pages
+ * back in its own time, and they survive a crash of the process.
+ */
+static void
+guaca_flightrec_append (GuacaFlightrec *rec, const GuacaFlightrecSample *s)
+{
+  GuacaFlightrecHeader *header = rec->header;
+  GuacaFlightrecSample *slot;
+  guint64               seq;
+
+  seq  = header->head;
+  slot = guaca_flightrec_slot (header, seq);
+
+  __atomic_store_n (&slot->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  memcpy ((char *) slot + sizeof (slot->seq),
+          (const char *) s + sizeof (s->seq),
+          sizeof (GuacaFlightrecSample) - sizeof (s->seq));
+
+  __atomic_store_n (&slot->seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n (&header->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The sampler keeps the ticks on a fixed grid, so the samples do not drift;
+ * the ring is all we publish.
+ */
+static gpointer
+guaca_flightrec_tick (gpointer data)
+{
+  GuacaFlightrec       *rec = data;
+  GuacaFlightrecSample  s = { 0, };
+
+  guaca_flightrec_sample (rec, &s);
+  guaca_flightrec_append (rec, &s);
+
+  return NULL;
+}
+
+/*
+ * Maps the ring file, creating or resizing it as required; if the file
+ * already holds a compatible ring we keep appending to it, so the history
+ * survives restarts of media-explorer.
+ */
+static gboolean
+guaca_flightrec_map (GuacaFlightrec *rec,
+                     const char     *path,
+                     guint           n_records,
+                     GError        **error)
+{
+  GuacaFlightrecHeader *header;
+  struct stat           st;
+  char                 *dir;
+  int                   fd;
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  rec->size = GUACA_FLIGHTREC_SIZE (n_records);
+
+  if ((fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ||
+      fstat (fd, &st) < 0 ||
+      (st.st_size != rec->size && ftruncate (fd, rec->size) < 0))
+    goto fail;
+
+  header = mmap (NULL, rec->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED)
+    goto fail;
+
+  close (fd);
+
+  if (st.st_size != rec->size                          ||
+      header->magic       != GUACA_FLIGHTREC_MAGIC     ||
+      header->version     != GUACA_FLIGHTREC_VERSION   ||
+      header->record_size != sizeof (GuacaFlightrecSample) ||
+      header->n_records   != n_records)
+    {
+      memset (header, 0, rec->size);
+
+      header->magic       = GUACA_FLIGHTREC_MAGIC;
+      header->version     = GUACA_FLIGHTREC_VERSION;
+      header->record_size = sizeof (GuacaFlightrecSample);
+      header->n_records   = n_records;
+    }
+
+  header->interval_ms = rec->interval_ms;
+  rec->header         = header;
+
+  return TRUE;
+
+ fail:
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+               "Failed to map '%s': %s", path, strerror (errno));
+
+  if (fd >= 0)
+    close (fd);
+
+  return FALSE;
+}
+
+/*
+ * Starts recording a sample every interval_ms into a ring of n_records
+ * samples stored in path.
+ */
+GuacaFlightrec *
+guaca_flightrec_new (const char  *path,
+                     guint        n_records,
+                     guint        interval_ms,
+                     GError     **error)
+{
+  GuacaFlightrec *rec = g_slice_new0 (GuacaFlightrec);
+  int             i;
+
+  g_return_val_if_fail (n_records > 0 && interval_ms > 0, NULL);
+
+  rec->interval_ms = interval_ms;
+
+  /*
+   * The sources are kept open for the life time of the recorder, and read
+   * in one batch per sample.
+   */
+  rec->reader = guaca_proc_reader_new ();
+
+  for (i = 0; i < N_SOURCES; i++)
+    rec->files[i] = guaca_proc_reader_add (rec->reader, sources[i].path,
+                                           sources[i].size);
+
+  if (!guaca_flightrec_map (rec, path, n_records, error))
+    {
+      guaca_flightrec_free (rec);
+      return NULL;
+    }
+
+  rec->sub = guaca_sampler_subscribe (interval_ms, guaca_flightrec_tick, rec,
+                                      NULL);
+
+  return rec;
+}
+
+void
+guaca_flightrec_free (GuacaFlightrec *rec)
+{
+  if (!rec)
+    return;
+
+  guaca_sampler_unsubscribe (rec->sub);
+
+  if (rec->header)
+    munmap (rec->header, rec->size);
+
+  guaca_proc_reader_free (rec->reader);
+
+  g_slice_free (GuacaFlightrec, rec);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Flight recorder of system samples for post-mortem stutter analysis */
+
+#ifndef __GUACA_FLIGHTREC_H__
+#define __GUACA_FLIGHTREC_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaFlightrec GuacaFlightrec;
+
+GuacaFlightrec *guaca_flightrec_new  (const char      *path,
+                                      guint            n_records,
+                                      guint            interval_ms,
+                                      GError         **error);
+void            guaca_flightrec_free (GuacaFlightrec  *rec);
+
+G_END_DECLS
+
+#endif /* __GUACA_FLIGHTREC_H__ */
@@ -0,0 +1,347 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-frame-stats.h"
+#include "guaca-metrics.h"
+#include "guaca-sampler.h"
+
+/*
+ * We assume a 60Hz output; a frame is over budget once it takes longer than
+ * one and half refresh periods, at which point at least one vblank was
+ * missed.
+ */
+#define FRAME_PERIOD_US  16667
+#define FRAME_BUDGET_US  (FRAME_PERIOD_US * 3 / 2)
+
+/*
+ * Clutter only paints when something changes, so a long gap between two
+ * paints can mean the stage was idle rather than that we stuttered. The
+ * time the first redraw after a paint was queued tells the two apart; only
+ * when it is not known, a gap this long is taken for idle.
+ */
+#define FRAME_IDLE_US    (250 * 1000)
+
+/*
+ * How often the counters are copied for the metrics thread, on the sampler
+ * wakeups.
+ */
+#define PUBLISH_INTERVAL_MS 5000
+
+typedef struct
+{
+  GuacaHistogram  histogram;
+  guint64         dropped;
+  gboolean        enabled;
+} Snapshot;
+
+/*
+ * The metrics thread does not read the counters, which the paint cycle
+ * updates, but a snapshot of them published from the main loop; it is
+ * handed over as the input latency one is, see guaca-input-latency.c.
+ */
+struct _GuacaFrameStats
+{
+  ClutterActor   *actor;
+  ClutterActor   *stage;
+  gulong          handler;
+  gulong          queue_handler;
+
+  gint64          last_paint;
+  gint64          queued;
+  guint64         dropped;
+
+  GuacaHistogram  histogram;
+
+  GuacaSamplerSub *publish_sub;
+  guint64         published_total;
+  gboolean        published_enabled;
+  Snapshot       *published;
+};
+
+/*
+ * Runs for every redraw queued anywhere on the stage; only the first one
+ * after a paint matters.
+ */
+static void
+guaca_frame_stats_queue_redraw_cb (ClutterActor    *stage,
+                                   ClutterActor    *origin,
+                                   GuacaFrameStats *stats)
+{
+  if (!stats->queued)
+    stats->queued = g_get_monotonic_time ();
+}
+
+/*
+ * Runs once per frame; must not allocate.
+ */
+static void
+guaca_frame_stats_paint_cb (ClutterActor *stage, GuacaFrameStats *stats)
+{
+  gint64 now    = g_get_monotonic_time ();
+  gint64 last   = stats->last_paint;
+  gint64 queued = stats->queued;
+  gint64 interval;
+
+  stats->last_paint = now;
+  stats->queued     = 0;
+
+  if (!last)
+    return;
+
+  if (queued && queued - last > FRAME_PERIOD_US)
+    {
+      /*
+       * The stage was idle until the redraw was queued; the frame is late
+       * if it took too long from there, but otherwise the time is not a
+       * frame interval.
+       */
+      if ((interval = now - queued) <= FRAME_BUDGET_US)
+        return;
+    }
+  else
+    {
+      /* a redraw was pending since the last paint, however long ago */
+      interval = now - last;
+
+      if (interval <= 0 || (!queued && interval >= FRAME_IDLE_US))
+        return;
+    }
+
+  guaca_histogram_add (&stats->histogram, interval);
+
+  if (interval > FRAME_BUDGET_US)
+    stats->dropped += (interval + FRAME_PERIOD_US / 2) / FRAME_PERIOD_US - 1;
+}
+
+static void
+guaca_frame_stats_publish (GuacaFrameStats *stats)
+{
+  gboolean  enabled = guaca_frame_stats_get_enabled (stats);
+  Snapshot *snapshot;
+
+  if (stats->published_total == stats->histogram.total &&
+      stats->published_enabled == enabled && stats->published)
+    return;
+
+  snapshot = g_slice_new (Snapshot);
+  snapshot->histogram = stats->histogram;
+  snapshot->dropped   = stats->dropped;
+  snapshot->enabled   = enabled;
+
+  stats->published_total   = stats->histogram.total;
+  stats->published_enabled = enabled;
+
+  snapshot = __atomic_exchange_n (&stats->published, snapshot,
+                                  __ATOMIC_ACQ_REL);
+
+  if (snapshot)
+    g_slice_free (Snapshot, snapshot);
+}
+
+static void
+guaca_frame_stats_publish_cb (gpointer data)
+{
+  guaca_frame_stats_publish (data);
+}
+
+/*
+ * The actor is any actor that is (or will be) on the stage we want to
+ * monitor; we resolve the stage only once the collector is enabled.
+ */
+GuacaFrameStats *
+guaca_frame_stats_new (ClutterActor *actor)
+{
+  GuacaFrameStats *stats = g_slice_new0 (GuacaFrameStats);
+
+  stats->actor = actor;
+
+  return stats;
+}
+
+void
+guaca_frame_stats_free (GuacaFrameStats *stats)
+{
+  if (!stats)
+    return;
+
+  guaca_frame_stats_set_enabled (stats, FALSE);
+
+  if (stats->published)
+    g_slice_free (Snapshot, stats->published);
+
+  g_slice_free (GuacaFrameStats, stats);
+}
+
+/*
+ * Connects to, or disconnects from, the stage paint cycle; while disabled
+ * the collector costs nothing at all. Returns FALSE if the collector could
+ * not be enabled because the actor is not on a stage yet.
+ *
+ * The counters are published while enabled, and once more on disabling.
+ */
+gboolean
+guaca_frame_stats_set_enabled (GuacaFrameStats *stats, gboolean enabled)
+{
+  /* the stage may have gone without us being disabled */
+  if (enabled == guaca_frame_stats_get_enabled (stats) &&
+      (enabled || !stats->publish_sub))
+    return TRUE;
+
+  if (!enabled)
+    {
+      if (stats->stage)
+        {
+          g_signal_handler_disconnect (stats->stage, stats->handler);
+          g_signal_handler_disconnect (stats->stage, stats->queue_handler);
+          g_object_remove_weak_pointer (G_OBJECT (stats->stage),
+                                        (gpointer *)&stats->stage);
+        }
+
+      stats->handler       = 0;
+      stats->queue_handler = 0;
+      stats->stage         = NULL;
+
+      guaca_sampler_unsubscribe (stats->publish_sub);
+      stats->publish_sub = NULL;
+
+      guaca_frame_stats_publish (stats);
+
+      return TRUE;
+    }
+
+  if (!(stats->stage = clutter_actor_get_stage (stats->actor)))
+    return FALSE;
+
+  g_object_add_weak_pointer (G_OBJECT (stats->stage),
+                             (gpointer *)&stats->stage);
+
+  stats->last_paint = 0;
+  stats->queued     = 0;
+
+  stats->queue_handler =
+    g_signal_connect (stats->stage, "queue-redraw",
+                      G_CALLBACK (guaca_frame_stats_queue_redraw_cb), stats);
+
+  /*
+   * Prefer the after-paint signal where the stage has it (Clutter >= 1.20),
+   * so that the time includes the whole of the paint.
+   */
+  if (g_signal_lookup ("after-paint", G_OBJECT_TYPE (stats->stage)))
+    stats->handler =
+      g_signal_connect (stats->stage, "after-paint",
+                        G_CALLBACK (guaca_frame_stats_paint_cb), stats);
+  else
+    stats->handler =
+      g_signal_connect_after (stats->stage, "paint",
+                              G_CALLBACK (guaca_frame_stats_paint_cb), stats);
+
+  if (!stats->publish_sub)
+    stats->publish_sub =
+      guaca_sampler_subscribe_main (PUBLISH_INTERVAL_MS,
+                                    guaca_frame_stats_publish_cb, stats);
+  guaca_frame_stats_publish (stats);
+
+  return TRUE;
+}
+
+gboolean
+guaca_frame_stats_get_enabled (GuacaFrameStats *stats)
+{
+  return stats->handler && stats->stage;
+}
+
+void
+guaca_frame_stats_reset (GuacaFrameStats *stats)
+{
+  guaca_histogram_reset (&stats->histogram);
+  stats->dropped    = 0;
+  stats->last_paint = 0;
+  stats->queued     = 0;
+
+  guaca_frame_stats_publish (stats);
+}
+
+const GuacaHistogram *
+guaca_frame_stats_get_histogram (GuacaFrameStats *stats)
+{
+  return &stats->histogram;
+}
+
+guint64
+guaca_frame_stats_get_dropped (GuacaFrameStats *stats)
+{
+  return stats->dropped;
+}
+
+/*
+ * GuacaMetricsFunc exporting the frame timing; the data argument is the
+ * GuacaFrameStats, which is to be freed after the metrics thread is
+ * stopped.
+ *
+ * The snapshot is taken out of its slot while it is read, and put back
+ * unless a newer one was published meanwhile.
+ */
+void
+guaca_frame_stats_write_metrics (GString *out, gpointer data)
+{
+  GuacaFrameStats *stats = data;
+  Snapshot        *sp, *expected = NULL;
+  const double     q[]   = { 0.5, 0.95, 0.99 };
+  GuacaHistogram   h;
+  guint64          dropped;
+  gboolean         enabled;
+  guint            i;
+
+  if (!(sp = __atomic_exchange_n (&stats->published, NULL,
+                                  __ATOMIC_ACQ_REL)))
+    return;
+
+  h       = sp->histogram;
+  dropped = sp->dropped;
+  enabled = sp->enabled;
+
+  if (!__atomic_compare_exchange_n (&stats->published, &expected, sp,
+                                    FALSE, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+    g_slice_free (Snapshot, sp);
+
+  if (!enabled && !h.total)
+    return;
+
+  g_string_append (out,
+                   "# HELP guacamayo_frame_time_seconds "
+                   "Interval between stage paints.\n"
+                   "# TYPE guacamayo_frame_time_seconds summary\n");
+
+  for (i = 0; i < G_N_ELEMENTS (q); i++)
+    g_string_append_printf (out,
+                            "guacamayo_frame_time_seconds{quantile=\"%.2f\"} "
+                            "%.6f\n",
+                            q[i],
+                            guaca_histogram_percentile (&h, q[i] * 100.0) /
+                            (double) G_USEC_PER_SEC);
+
+  g_string_append_printf (out, "guacamayo_frame_time_seconds_count %"
+                          G_GUINT64_FORMAT "\n", h.total);
+
+  guaca_metrics_write (out, "guacamayo_frames_dropped_total", "counter",
+                       "Frames that missed the refresh budget.",
+                       dropped);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Opt-in frame timing collector for the Clutter stage */
+
+#ifndef __GUACA_FRAME_STATS_H__
+#define __GUACA_FRAME_STATS_H__
+
+#include <clutter/clutter.h>
+
+#include "guaca-histogram.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GuacaFrameStats GuacaFrameStats;
+
+GuacaFrameStats *guaca_frame_stats_new         (ClutterActor    *actor);
+void             guaca_frame_stats_free        (GuacaFrameStats *stats);
+
+gboolean         guaca_frame_stats_set_enabled (GuacaFrameStats *stats,
+                                                gboolean         enabled);
+gboolean         guaca_frame_stats_get_enabled (GuacaFrameStats *stats);
+void             guaca_frame_stats_reset       (GuacaFrameStats *stats);
+
+const GuacaHistogram *
+                 guaca_frame_stats_get_histogram (GuacaFrameStats *stats);
+guint64          guaca_frame_stats_get_dropped   (GuacaFrameStats *stats);
+
+void             guaca_frame_stats_write_metrics (GString  *out,
+                                                  gpointer  data);
+
+G_END_DECLS
+
+#endif /* __GUACA_FRAME_STATS_H__ */
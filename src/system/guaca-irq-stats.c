@@ -0,0 +1,411 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-irq-stats.h"
+#include "guaca-proc-reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A flaky IR receiver and a NIC in an interrupt storm both look like a laggy
+ * remote to the user; the interrupt rates tell the two apart.
+ *
+ * Both /proc/interrupts and /proc/softirqs are tables with a column per CPU,
+ * which on big machines makes for very long lines. The tables are parsed in
+ * place, straight out of the reader buffers, and the counters kept in flat
+ * arrays of a row per source; these only grow when a new source or CPU
+ * shows up, so in the steady state sampling does not allocate.
+ */
+struct _GuacaIrqStats
+{
+  GuacaProcReader *reader;
+  int              interrupts_file;
+  int              softirqs_file;
+
+  gint64           timestamp;
+
+  guint            n_cpus;
+  guint            n_sources;
+  guint            n_alloc;
+
+  GuacaIrqSource  *sources;
+  guint64         *counts;      /* n_alloc rows of n_cpus */
+  double          *rates;
+
+  /* the CPU of each column of the table being parsed */
+  guint           *columns;
+  guint            n_columns_alloc;
+};
+
+GuacaIrqStats *
+guaca_irq_stats_new (void)
+{
+  GuacaIrqStats *stats = g_slice_new0 (GuacaIrqStats);
+
+  stats->reader = guaca_proc_reader_new ();
+
+  stats->interrupts_file =
+    guaca_proc_reader_add (stats->reader, "/proc/interrupts", 16384);
+  stats->softirqs_file =
+    guaca_proc_reader_add (stats->reader, "/proc/softirqs", 4096);
+
+  if (stats->interrupts_file < 0)
+    g_warning ("Failed to open /proc/interrupts");
+
+  return stats;
+}
+
+void
+guaca_irq_stats_free (GuacaIrqStats *stats)
+{
+  if (!stats)
+    return;
+
+  guaca_proc_reader_free (stats->reader);
+
+  g_free (stats->sources);
+  g_free (stats->counts);
+  g_free (stats->rates);
+  g_free (stats->columns);
+
+  g_slice_free (GuacaIrqStats, stats);
+}
+
+/*
+ * Makes room for n_sources rows of n_cpus; if the number of CPUs changed all
+ * the counters are dropped, and the rates start again with the next sample.
+ */
+static void
+guaca_irq_stats_resize (GuacaIrqStats *stats, guint n_sources, guint n_cpus)
+{
+  guint n_alloc = MAX (stats->n_alloc, 32);
+
+  if (n_cpus != stats->n_cpus)
+    {
+      stats->n_cpus    = n_cpus;
+      stats->n_sources = 0;
+      stats->n_alloc   = 0;
+    }
+
+  if (n_sources <= stats->n_alloc)
+    return;
+
+  while (n_alloc < n_sources)
+    n_alloc *= 2;
+
+  stats->sources = g_renew (GuacaIrqSource, stats->sources, n_alloc);
+  stats->counts  = g_renew (guint64, stats->counts, n_alloc * n_cpus);
+  stats->rates   = g_renew (double, stats->rates, n_alloc * n_cpus);
+
+  memset (stats->sources + stats->n_alloc, 0,
+          (n_alloc - stats->n_alloc) * sizeof (GuacaIrqSource));
+
+  stats->n_alloc = n_alloc;
+}
+
+/*
+ * Parses the header line, "CPU0 CPU1 ...", into the column to CPU map; the
+ * interrupts only list the online CPUs and the softirqs all the possible
+ * ones, so the columns need not be the same in both tables. Returns the
+ * number of columns, and raises n_cpus to cover all of them.
+ */
+static guint
+guaca_irq_stats_parse_header (GuacaIrqStats  *stats,
+                              const char     *buf,
+                              guint          *n_cpus)
+{
+  const char *p = buf, *eol;
+  guint       n = 0;
+
+  if (!buf || !(eol = strchr (buf, '\n')))
+    return 0;
+
+  while ((p = strstr (p, "CPU")) && p < eol)
+    {
+      guint cpu = strtoul (p + 3, (char **) &p, 10);
+
+      if (n == stats->n_columns_alloc)
+        {
+          stats->n_columns_alloc = MAX (64, 2 * n);
+          stats->columns = g_renew (guint, stats->columns,
+                                    stats->n_columns_alloc);
+        }
+
+      stats->columns[n++] = cpu;
+      *n_cpus = MAX (*n_cpus, cpu + 1);
+    }
+
+  return n;
+}
+
+/*
+ * The devices of a hardware interrupt follow the chip and handler names, and
+ * are separated from them by two spaces.
+ */
+static void
+copy_desc (char *desc, gsize len, const char *p, const char *eol)
+{
+  const char *s = p;
+  gsize       n;
+
+  for (; p + 1 < eol; p++)
+    if (p[0] == ' ' && p[1] == ' ')
+      s = p + 2;
+
+  while (s < eol && *s == ' ')
+    s++;
+
+  n = MIN ((gsize)(eol - s), len - 1);
+  memcpy (desc, s, n);
+  desc[n] = 0;
+}
+
+/*
+ * Parses one table into the rows from first on, computing the rates over
+ * secs; returns the index of the row after the last one parsed.
+ */
+static guint
+guaca_irq_stats_parse (GuacaIrqStats *stats,
+                       const char    *buf,
+                       gboolean       softirq,
+                       guint          first,
+                       double         secs)
+{
+  const char *p = buf, *eol;
+  guint       n_columns, n_cpus = stats->n_cpus;
+  guint       k = first;
+
+  if (!buf || !(eol = strchr (p, '\n')))
+    return first;
+
+  n_columns = guaca_irq_stats_parse_header (stats, buf, &n_cpus);
+
+  for (p = eol + 1; *p; p = *eol ? eol + 1 : eol)
+    {
+      GuacaIrqSource *s;
+      const char     *name;
+      guint64        *counts;
+      double         *rates;
+      gboolean        fresh;
+      guint           c, n;
+
+      if (!(eol = strchr (p, '\n')))
+        eol = p + strlen (p);
+
+      while (*p == ' ')
+        p++;
+
+      for (name = p; p < eol && *p != ':'; p++)
+        ;
+
+      if (p == eol || p == name)
+        continue;
+
+      n = MIN ((gsize)(p - name), sizeof (s->name) - 1);
+      p++;
+
+      guaca_irq_stats_resize (stats, k + 1, stats->n_cpus);
+
+      s      = &stats->sources[k];
+      counts = stats->counts + k * stats->n_cpus;
+      rates  = stats->rates + k * stats->n_cpus;
+
+      /*
+       * The sources normally stay in the same rows from one sample to the
+       * next; when they do not, the row starts over.
+       */
+      fresh = k >= stats->n_sources || s->softirq != softirq ||
+              strncmp (s->name, name, n) || s->name[n];
+
+      if (fresh)
+        {
+          memcpy (s->name, name, n);
+          s->name[n] = 0;
+          s->desc[0] = 0;
+          s->softirq = softirq;
+
+          memset (counts, 0, stats->n_cpus * sizeof (guint64));
+        }
+
+      memset (rates, 0, stats->n_cpus * sizeof (double));
+
+      s->rate         = 0.0;
+      s->max_cpu_rate = 0.0;
+      s->max_cpu      = 0;
+
+      /*
+       * Some rows, e.g., ERR and MIS, have a single total rather than a
+       * column per CPU; we must not run into the next line looking for more.
+       */
+      for (c = 0; c < n_columns; c++)
+        {
+          guint64 v;
+          guint   cpu = stats->columns[c];
+
+          while (*p == ' ')
+            p++;
+
+          if (!g_ascii_isdigit (*p))
+            break;
+
+          v = g_ascii_strtoull (p, (char **) &p, 10);
+
+          if (cpu >= stats->n_cpus)
+            continue;
+
+          if (!fresh && secs > 0.0)
+            {
+              rates[cpu] = (v - MIN (v, counts[cpu])) / secs;
+              s->rate   += rates[cpu];
+
+              if (rates[cpu] > s->max_cpu_rate)
+                {
+                  s->max_cpu_rate = rates[cpu];
+                  s->max_cpu      = cpu;
+                }
+            }
+
+          counts[cpu] = v;
+        }
+
+      if (!softirq)
+        copy_desc (s->desc, sizeof (s->desc), p, eol);
+
+      s->valid = !fresh && secs > 0.0;
+
+      k++;
+    }
+
+  return k;
+}
+
+/*
+ * Takes a sample of both tables, computing the rates over the time since the
+ * previous sample.
+ */
+void
+guaca_irq_stats_sample (GuacaIrqStats *stats)
+{
+  gint64      now = g_get_monotonic_time ();
+  const char *interrupts, *softirqs;
+  double      secs;
+  guint       k, n_cpus;
+
+  secs = stats->timestamp ?
+    (now - stats->timestamp) / (double) G_USEC_PER_SEC : 0.0;
+
+  guaca_proc_reader_refresh (stats->reader);
+
+  interrupts = guaca_proc_reader_get (stats->reader, stats->interrupts_file,
+                                      NULL);
+  softirqs   = guaca_proc_reader_get (stats->reader, stats->softirqs_file,
+                                      NULL);
+
+  /*
+   * The rows are as wide as the highest CPU in either table; they never
+   * shrink, so CPUs going offline do not cost us the counters.
+   */
+  n_cpus = stats->n_cpus;
+  guaca_irq_stats_parse_header (stats, interrupts, &n_cpus);
+  guaca_irq_stats_parse_header (stats, softirqs, &n_cpus);
+
+  if (n_cpus != stats->n_cpus)
+    guaca_irq_stats_resize (stats, stats->n_alloc, n_cpus);
+
+  k = guaca_irq_stats_parse (stats, interrupts, FALSE, 0, secs);
+  k = guaca_irq_stats_parse (stats, softirqs, TRUE, k, secs);
+
+  stats->n_sources = k;
+  stats->timestamp = now;
+
+  g_debug ("Interrupt stats for %u sources on %u CPUs sampled in %"
+           G_GINT64_FORMAT " us",
+           stats->n_sources, stats->n_cpus, g_get_monotonic_time () - now);
+}
+
+guint
+guaca_irq_stats_get_n_cpus (GuacaIrqStats *stats)
+{
+  return stats->n_cpus;
+}
+
+/*
+ * Returns the per second rates of the source on each of the CPUs, indexed
+ * by the CPU number, or NULL if there is no such source or it has no rates
+ * yet.
+ */
+const double *
+guaca_irq_stats_get_cpu_rates (GuacaIrqStats *stats,
+                               const char    *name,
+                               gboolean       softirq)
+{
+  guint i;
+
+  for (i = 0; i < stats->n_sources; i++)
+    {
+      const GuacaIrqSource *s = &stats->sources[i];
+
+      if (s->valid && !s->softirq == !softirq && !strcmp (s->name, name))
+        return stats->rates + i * stats->n_cpus;
+    }
+
+  return NULL;
+}
+
+/*
+ * Copies the up to n_sources sources with the highest rates in the last
+ * window into sources, busiest first; returns the number copied.
+ */
+guint
+guaca_irq_stats_get_top (GuacaIrqStats  *stats,
+                         GuacaIrqSource *sources,
+                         guint           n_sources)
+{
+  guint n = 0, i, j;
+
+  for (i = 0; i < stats->n_sources; i++)
+    {
+      const GuacaIrqSource *s = &stats->sources[i];
+
+      if (!s->valid || s->rate <= 0.0)
+        continue;
+
+      /* insertion into the sorted output */
+      for (j = n; j > 0; j--)
+        {
+          if (sources[j - 1].rate >= s->rate)
+            break;
+
+          if (j < n_sources)
+            sources[j] = sources[j - 1];
+        }
+
+      if (j < n_sources)
+        {
+          sources[j] = *s;
+
+          if (n < n_sources)
+            n++;
+        }
+    }
+
+  return n;
+}
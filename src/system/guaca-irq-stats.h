@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Interrupt and softirq rates, per source and CPU */
+
+#ifndef __GUACA_IRQ_STATS_H__
+#define __GUACA_IRQ_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  char    name[16];             /* "16", "NMI", "NET_RX", ... */
+  char    desc[48];             /* the devices, for hardware interrupts */
+
+  double  rate;                 /* per second, over all CPUs */
+  double  max_cpu_rate;         /* of the CPU handling the most */
+  guint   max_cpu;
+
+  guint   softirq : 1;
+  guint   valid   : 1;          /* has rates, i.e., seen in two samples */
+} GuacaIrqSource;
+
+typedef struct _GuacaIrqStats GuacaIrqStats;
+
+GuacaIrqStats *guaca_irq_stats_new           (void);
+void           guaca_irq_stats_free          (GuacaIrqStats *stats);
+
+void           guaca_irq_stats_sample        (GuacaIrqStats *stats);
+
+guint          guaca_irq_stats_get_n_cpus    (GuacaIrqStats *stats);
+const double  *guaca_irq_stats_get_cpu_rates (GuacaIrqStats *stats,
+                                              const char    *name,
+                                              gboolean       softirq);
+
+guint          guaca_irq_stats_get_top       (GuacaIrqStats  *stats,
+                                              GuacaIrqSource *sources,
+                                              guint           n_sources);
+
+G_END_DECLS
+
+#endif /* __GUACA_IRQ_STATS_H__ */
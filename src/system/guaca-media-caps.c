@@ -0,0 +1,793 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-media-caps.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+/*
+ * The stateless formats are spelt out, as older kernel headers lack them;
+ * the stateless decoders take the same codecs, parsed in user space.
+ */
+static const struct
+{
+  guint32     fourcc;
+  const char *name;
+} codec_names[] =
+  {
+    { v4l2_fourcc ('H', '2', '6', '4'), "H.264" },
+    { v4l2_fourcc ('S', '2', '6', '4'), "H.264" },
+    { v4l2_fourcc ('H', 'E', 'V', 'C'), "HEVC" },
+    { v4l2_fourcc ('S', '2', '6', '5'), "HEVC" },
+    { v4l2_fourcc ('V', 'P', '8', '0'), "VP8" },
+    { v4l2_fourcc ('V', 'P', '8', 'F'), "VP8" },
+    { v4l2_fourcc ('V', 'P', '9', '0'), "VP9" },
+    { v4l2_fourcc ('V', 'P', '9', 'F'), "VP9" },
+    { v4l2_fourcc ('A', 'V', '1', 'F'), "AV1" },
+    { v4l2_fourcc ('M', 'P', 'G', '2'), "MPEG-2" },
+    { v4l2_fourcc ('M', 'G', '2', 'S'), "MPEG-2" },
+    { v4l2_fourcc ('M', 'P', 'G', '4'), "MPEG-4" },
+    { v4l2_fourcc ('V', 'C', '1', 'G'), "VC-1" },
+    { v4l2_fourcc ('M', 'J', 'P', 'G'), "MJPEG" },
+  };
+
+/*
+ * The CEA-861 video codes of the modes that matter for judder, i.e., those
+ * at film and broadcast rates; the rest are of no interest here.
+ */
+static const struct
+{
+  guint8 vic;
+  guint  width;
+  guint  height;
+  double refresh;
+} cea_modes[] =
+  {
+    {  4, 1280,  720, 60.0 },
+    { 16, 1920, 1080, 60.0 },
+    { 19, 1280,  720, 50.0 },
+    { 31, 1920, 1080, 50.0 },
+    { 32, 1920, 1080, 24.0 },
+    { 33, 1920, 1080, 25.0 },
+    { 34, 1920, 1080, 30.0 },
+    { 60, 1280,  720, 24.0 },
+    { 93, 3840, 2160, 24.0 },
+    { 94, 3840, 2160, 25.0 },
+    { 95, 3840, 2160, 30.0 },
+    { 96, 3840, 2160, 50.0 },
+    { 97, 3840, 2160, 60.0 },
+    { 98, 4096, 2160, 24.0 },
+  };
+
+struct _GuacaMediaProbe
+{
+  GuacaMediaProbeFunc  func;
+  gpointer             data;
+
+  GThread             *thread;
+
+  /* lock protects the flags and idle_id */
+  GMutex               lock;
+  gboolean             running;
+  gboolean             cancelled;
+  guint                idle_id;
+
+  GuacaMediaCaps       caps;
+};
+
+/*
+ * GUACA_PROBE_ROOT points the probe at a fake /dev and /sys, for testing;
+ * the results of such a probe are not cached.
+ */
+static const char *
+probe_root (void)
+{
+  const char *root = g_getenv ("GUACA_PROBE_ROOT");
+
+  return root ? root : "";
+}
+
+static void
+codec_name (guint32 fourcc, char *buf, gsize len)
+{
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS (codec_names); i++)
+    if (codec_names[i].fourcc == fourcc)
+      {
+        g_strlcpy (buf, codec_names[i].name, len);
+        return;
+      }
+
+  g_snprintf (buf, len, "%c%c%c%c",
+              fourcc & 0xff, (fourcc >> 8) & 0xff,
+              (fourcc >> 16) & 0xff, (fourcc >> 24) & 0x7f);
+  g_strchomp (buf);
+}
+
+static void
+max_frame_size (int fd, guint32 fourcc, guint *width, guint *height)
+{
+  struct v4l2_frmsizeenum fs;
+
+  memset (&fs, 0, sizeof (fs));
+  fs.pixel_format = fourcc;
+
+  for (; !ioctl (fd, VIDIOC_ENUM_FRAMESIZES, &fs); fs.index++)
+    {
+      if (fs.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+          *width  = fs.stepwise.max_width;
+          *height = fs.stepwise.max_height;
+          return;
+        }
+
+      if (fs.discrete.width * fs.discrete.height > *width * *height)
+        {
+          *width  = fs.discrete.width;
+          *height = fs.discrete.height;
+        }
+    }
+}
+
+/*
+ * Adds the device if it is a memory to memory decoder, i.e., one taking
+ * compressed formats on its output queue; encoders take raw ones there.
+ */
+static void
+probe_decoder (GuacaMediaCaps *caps, const char *path, const char *name)
+{
+  struct v4l2_capability  cap;
+  struct v4l2_fmtdesc     fmt;
+  GuacaMediaDecoder      *dec = &caps->decoders[caps->n_decoders];
+  guint32                 dev_caps;
+  int                     fd;
+
+  if ((fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    return;
+
+  memset (&cap, 0, sizeof (cap));
+  memset (&fmt, 0, sizeof (fmt));
+
+  if (ioctl (fd, VIDIOC_QUERYCAP, &cap) < 0)
+    goto out;
+
+  dev_caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+    cap.device_caps : cap.capabilities;
+
+  if (dev_caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  else if (dev_caps & V4L2_CAP_VIDEO_M2M)
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  else
+    goto out;
+
+  memset (dec, 0, sizeof (*dec));
+  g_strlcpy (dec->device, name, sizeof (dec->device));
+  g_strlcpy (dec->card, (const char *) cap.card, sizeof (dec->card));
+
+  for (; dec->n_codecs < GUACA_MEDIA_MAX_CODECS &&
+         !ioctl (fd, VIDIOC_ENUM_FMT, &fmt); fmt.index++)
+    {
+      GuacaMediaCodec *codec;
+
+      if (!(fmt.flags & V4L2_FMT_FLAG_COMPRESSED))
+        continue;
+
+      codec = &dec->codecs[dec->n_codecs++];
+      codec_name (fmt.pixelformat, codec->name, sizeof (codec->name));
+      max_frame_size (fd, fmt.pixelformat,
+                      &codec->max_width, &codec->max_height);
+    }
+
+  if (dec->n_codecs)
+    caps->n_decoders++;
+
+ out:
+  close (fd);
+}
+
+static void
+probe_decoders (GuacaMediaCaps *caps)
+{
+  DIR           *d;
+  struct dirent *e;
+  char          *dir = g_strconcat (probe_root (), "/dev", NULL);
+
+  if ((d = opendir (dir)))
+    {
+      while (caps->n_decoders < GUACA_MEDIA_MAX_DECODERS && (e = readdir (d)))
+        if (g_str_has_prefix (e->d_name, "video"))
+          {
+            char *path = g_build_filename (dir, e->d_name, NULL);
+
+            probe_decoder (caps, path, e->d_name);
+            g_free (path);
+          }
+
+      closedir (d);
+    }
+
+  g_free (dir);
+}
+
+static void
+add_mode (GuacaMediaDisplay *display, guint width, guint height,
+          double refresh)
+{
+  GuacaMediaMode *m;
+  int             i;
+
+  for (i = 0; i < display->n_modes; i++)
+    if (display->modes[i].width == width &&
+        display->modes[i].height == height &&
+        ABS (display->modes[i].refresh - refresh) < 0.01)
+      return;
+
+  if (display->n_modes == GUACA_MEDIA_MAX_MODES)
+    return;
+
+  m = &display->modes[display->n_modes++];
+  m->width   = width;
+  m->height  = height;
+  m->refresh = refresh;
+}
+
+/*
+ * Parses an 18 byte detailed timing descriptor; returns FALSE if it is a
+ * display descriptor instead.
+ */
+static gboolean
+parse_dtd (const guint8 *b, GuacaMediaMode *mode)
+{
+  guint clock = b[0] | b[1] << 8;
+  guint hactive, hblank, vactive, vblank;
+
+  if (!clock)
+    return FALSE;
+
+  hactive = b[2] | (b[4] & 0xf0) << 4;
+  hblank  = b[3] | (b[4] & 0x0f) << 8;
+  vactive = b[5] | (b[7] & 0xf0) << 4;
+  vblank  = b[6] | (b[7] & 0x0f) << 8;
+
+  if (!hactive || !vactive)
+    return FALSE;
+
+  mode->width   = hactive;
+  mode->height  = vactive;
+  /* the clock is in 10 kHz units */
+  mode->refresh = clock * 10000.0 / ((hactive + hblank) * (vactive + vblank));
+
+  /*
+   * Interlaced, the lines are those of a field, and so is the rate, which
+   * is what 1080i60 gives as well
+   */
+  if (b[17] & 0x80)
+    mode->height *= 2;
+
+  return TRUE;
+}
+
+static void
+parse_cea_block (GuacaMediaDisplay *display, const guint8 *b)
+{
+  GuacaMediaMode mode;
+  guint          dtd_offset = b[2];
+  guint          i, j;
+
+  if (b[0] != 0x02 || dtd_offset > 127)
+    return;
+
+  /* the data blocks, for the short video descriptors */
+  for (i = 4; dtd_offset >= 4 && i < dtd_offset; i += 1 + (b[i] & 0x1f))
+    {
+      guint len = b[i] & 0x1f;
+
+      if (b[i] >> 5 != 2)
+        continue;
+
+      for (j = i + 1; j <= i + len && j < dtd_offset; j++)
+        {
+          guint vic = (b[j] >= 129 && b[j] <= 192) ? b[j] & 0x7f : b[j];
+          guint k;
+
+          for (k = 0; k < G_N_ELEMENTS (cea_modes); k++)
+            if (cea_modes[k].vic == vic)
+              add_mode (display, cea_modes[k].width, cea_modes[k].height,
+                        cea_modes[k].refresh);
+        }
+    }
+
+  for (i = dtd_offset; dtd_offset >= 4 && i + 18 <= 127; i += 18)
+    if (parse_dtd (b + i, &mode))
+      add_mode (display, mode.width, mode.height, mode.refresh);
+}
+
+/*
+ * Reads the modes with their refresh rates from the EDID; the sysfs modes
+ * file lacks the rates, which are what decides whether films judder.
+ */
+static gboolean
+parse_edid (GuacaMediaDisplay *display, const guint8 *edid, gsize len)
+{
+  static const guint8 header[] = { 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0 };
+  GuacaMediaMode      mode;
+  guint               i, n_ext;
+
+  if (len < 128 || memcmp (edid, header, sizeof (header)))
+    return FALSE;
+
+  /* the first descriptor is the preferred timing */
+  for (i = 54; i < 126; i += 18)
+    if (parse_dtd (edid + i, &mode))
+      {
+        if (!display->n_modes)
+          display->preferred = mode;
+
+        add_mode (display, mode.width, mode.height, mode.refresh);
+      }
+
+  n_ext = edid[126];
+
+  for (i = 1; i <= n_ext && (i + 1) * 128 <= len; i++)
+    parse_cea_block (display, edid + i * 128);
+
+  return TRUE;
+}
+
+static void
+probe_display (GuacaMediaCaps *caps, const char *dir, const char *name)
+{
+  GuacaMediaDisplay *display = &caps->displays[caps->n_displays];
+  char              *path, *contents = NULL, **lines, **l;
+  gsize              len;
+  gboolean           have_edid = FALSE;
+
+  path = g_build_filename (dir, name, "status", NULL);
+  g_file_get_contents (path, &contents, NULL, NULL);
+  g_free (path);
+
+  if (!contents || strncmp (contents, "connected", 9))
+    {
+      g_free (contents);
+      return;
+    }
+
+  g_free (contents);
+
+  memset (display, 0, sizeof (*display));
+  /* card0-HDMI-A-1 */
+  g_strlcpy (display->connector, strchr (name, '-') + 1,
+             sizeof (display->connector));
+
+  path = g_build_filename (dir, name, "edid", NULL);
+
+  if (g_file_get_contents (path, &contents, &len, NULL))
+    {
+      have_edid = parse_edid (display, (const guint8 *) contents, len);
+      g_free (contents);
+    }
+
+  g_free (path);
+
+  /* without an EDID, e.g., on a composite output, settle for the sizes */
+  path = g_build_filename (dir, name, "modes", NULL);
+
+  if (!have_edid && g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      lines = g_strsplit (contents, "\n", -1);
+
+      for (l = lines; *l; l++)
+        {
+          guint width, height;
+
+          if (sscanf (*l, "%ux%u", &width, &height) != 2)
+            continue;
+
+          if (!display->n_modes)
+            {
+              display->preferred.width  = width;
+              display->preferred.height = height;
+            }
+
+          add_mode (display, width, height, 0.0);
+        }
+
+      g_strfreev (lines);
+      g_free (contents);
+    }
+
+  g_free (path);
+
+  caps->n_displays++;
+}
+
+static void
+probe_displays (GuacaMediaCaps *caps)
+{
+  DIR           *d;
+  struct dirent *e;
+  char          *dir = g_strconcat (probe_root (), "/sys/class/drm", NULL);
+
+  if ((d = opendir (dir)))
+    {
+      while (caps->n_displays < GUACA_MEDIA_MAX_DISPLAYS && (e = readdir (d)))
+        if (g_str_has_prefix (e->d_name, "card") && strchr (e->d_name, '-'))
+          probe_display (caps, dir, e->d_name);
+
+      closedir (d);
+    }
+
+  g_free (dir);
+}
+
+/*
+ * Probes the decoders and displays, synchronously.
+ */
+void
+guaca_media_caps_probe (GuacaMediaCaps *caps)
+{
+  memset (caps, 0, sizeof (*caps));
+
+  probe_decoders (caps);
+  probe_displays (caps);
+}
+
+/*
+ * Whether the display has a mode at the refresh rate, at its preferred
+ * size; 23.976 Hz counts as 24 Hz, as TVs show either without judder.
+ */
+gboolean
+guaca_media_display_has_refresh (const GuacaMediaDisplay *display, double hz)
+{
+  int i;
+
+  for (i = 0; i < display->n_modes; i++)
+    if (display->modes[i].width == display->preferred.width &&
+        display->modes[i].height == display->preferred.height &&
+        ABS (display->modes[i].refresh - hz) < hz * 0.002)
+      return TRUE;
+
+  return FALSE;
+}
+
+static char *
+read_boot_id (void)
+{
+  char *boot_id = NULL;
+
+  if (g_file_get_contents ("/proc/sys/kernel/random/boot_id",
+                           &boot_id, NULL, NULL))
+    g_strstrip (boot_id);
+
+  return boot_id;
+}
+
+/*
+ * The devices do not change without a reboot, short of hotplugging a TV,
+ * so the results are kept for the boot; the runtime directory goes with
+ * it, but without XDG_RUNTIME_DIR glib falls back to the cache directory,
+ * so the boot id is checked as well.
+ */
+static char *
+cache_file (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (),
+                           "guacamayo-media-caps", NULL);
+}
+
+/* the refresh rate in mHz, so the file does not depend on the locale */
+static char *
+format_mode (const GuacaMediaMode *mode)
+{
+  return g_strdup_printf ("%ux%u@%u", mode->width, mode->height,
+                          (guint) (mode->refresh * 1000.0 + 0.5));
+}
+
+static void
+save_caps (const GuacaMediaCaps *caps)
+{
+  GKeyFile *kf;
+  char     *file, *data, *group, **list, *boot_id;
+  gsize     len;
+  int       i, j;
+  GError   *error = NULL;
+
+  if (*probe_root () || !(boot_id = read_boot_id ()))
+    return;
+
+  kf = g_key_file_new ();
+
+  /* so that finding nothing is cached too */
+  g_key_file_set_integer (kf, "probe", "version", 1);
+  g_key_file_set_string (kf, "probe", "boot_id", boot_id);
+  g_free (boot_id);
+
+  for (i = 0; i < caps->n_decoders; i++)
+    {
+      const GuacaMediaDecoder *dec = &caps->decoders[i];
+
+      group = g_strdup_printf ("decoder %s", dec->device);
+      list  = g_new0 (char *, dec->n_codecs + 1);
+
+      for (j = 0; j < dec->n_codecs; j++)
+        list[j] = g_strdup_printf ("%s:%ux%u", dec->codecs[j].name,
+                                   dec->codecs[j].max_width,
+                                   dec->codecs[j].max_height);
+
+      g_key_file_set_string (kf, group, "card", dec->card);
+      g_key_file_set_string_list (kf, group, "codecs",
+                                  (const char * const *) list, j);
+      g_strfreev (list);
+      g_free (group);
+    }
+
+  for (i = 0; i < caps->n_displays; i++)
+    {
+      const GuacaMediaDisplay *display = &caps->displays[i];
+      char                    *preferred;
+
+      group = g_strdup_printf ("display %s", display->connector);
+      list  = g_new0 (char *, display->n_modes + 1);
+
+      for (j = 0; j < display->n_modes; j++)
+        list[j] = format_mode (&display->modes[j]);
+
+      preferred = format_mode (&display->preferred);
+
+      g_key_file_set_string (kf, group, "preferred", preferred);
+      g_key_file_set_string_list (kf, group, "modes",
+                                  (const char * const *) list, j);
+      g_free (preferred);
+      g_strfreev (list);
+      g_free (group);
+    }
+
+  file = cache_file ();
+  data = g_key_file_to_data (kf, &len, NULL);
+
+  if (!g_file_set_contents (file, data, len, &error))
+    {
+      g_warning ("Failed to save media capabilities: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (data);
+  g_free (file);
+  g_key_file_free (kf);
+}
+
+static gboolean
+parse_mode (const char *s, GuacaMediaMode *mode)
+{
+  guint mhz;
+
+  if (sscanf (s, "%ux%u@%u", &mode->width, &mode->height, &mhz) != 3)
+    return FALSE;
+
+  mode->refresh = mhz / 1000.0;
+
+  return TRUE;
+}
+
+/*
+ * Looks up the results of the probe done since the last boot; returns
+ * FALSE if there are none.
+ */
+gboolean
+guaca_media_caps_lookup (GuacaMediaCaps *caps)
+{
+  GKeyFile  *kf;
+  char      *file, **groups, **g;
+  char      *boot_id, *saved_id = NULL;
+  gboolean   found = FALSE;
+
+  if (*probe_root () || !(boot_id = read_boot_id ()))
+    return FALSE;
+
+  kf   = g_key_file_new ();
+  file = cache_file ();
+
+  if (!g_key_file_load_from_file (kf, file, G_KEY_FILE_NONE, NULL) ||
+      !(saved_id = g_key_file_get_string (kf, "probe", "boot_id", NULL)) ||
+      strcmp (saved_id, boot_id))
+    goto out;
+
+  memset (caps, 0, sizeof (*caps));
+  groups = g_key_file_get_groups (kf, NULL);
+
+  for (g = groups; *g; g++)
+    {
+      char **list, **l;
+
+      if (g_str_has_prefix (*g, "decoder ") &&
+          caps->n_decoders < GUACA_MEDIA_MAX_DECODERS)
+        {
+          GuacaMediaDecoder *dec = &caps->decoders[caps->n_decoders++];
+          char              *card;
+
+          g_strlcpy (dec->device, *g + 8, sizeof (dec->device));
+
+          if ((card = g_key_file_get_string (kf, *g, "card", NULL)))
+            g_strlcpy (dec->card, card, sizeof (dec->card));
+
+          g_free (card);
+
+          list = g_key_file_get_string_list (kf, *g, "codecs", NULL, NULL);
+
+          for (l = list; l && *l && dec->n_codecs < GUACA_MEDIA_MAX_CODECS;
+               l++)
+            {
+              GuacaMediaCodec *codec = &dec->codecs[dec->n_codecs];
+
+              if (sscanf (*l, "%15[^:]:%ux%u", codec->name,
+                          &codec->max_width, &codec->max_height) == 3)
+                dec->n_codecs++;
+            }
+
+          g_strfreev (list);
+        }
+      else if (g_str_has_prefix (*g, "display ") &&
+               caps->n_displays < GUACA_MEDIA_MAX_DISPLAYS)
+        {
+          GuacaMediaDisplay *display = &caps->displays[caps->n_displays++];
+          char              *preferred;
+
+          g_strlcpy (display->connector, *g + 8, sizeof (display->connector));
+
+          if ((preferred = g_key_file_get_string (kf, *g, "preferred", NULL)))
+            parse_mode (preferred, &display->preferred);
+
+          g_free (preferred);
+
+          list = g_key_file_get_string_list (kf, *g, "modes", NULL, NULL);
+
+          for (l = list; l && *l && display->n_modes < GUACA_MEDIA_MAX_MODES;
+               l++)
+            if (parse_mode (*l, &display->modes[display->n_modes]))
+              display->n_modes++;
+
+          g_strfreev (list);
+        }
+    }
+
+  g_strfreev (groups);
+  found = TRUE;
+
+ out:
+  g_free (saved_id);
+  g_free (boot_id);
+  g_free (file);
+  g_key_file_free (kf);
+
+  return found;
+}
+
+static gboolean
+guaca_media_probe_done_cb (GuacaMediaProbe *probe)
+{
+  g_mutex_lock (&probe->lock);
+  probe->idle_id = 0;
+  g_mutex_unlock (&probe->lock);
+
+  save_caps (&probe->caps);
+
+  probe->func (&probe->caps, probe->data);
+
+  return FALSE;
+}
+
+static void
+guaca_media_probe_destroy (GuacaMediaProbe *probe)
+{
+  g_mutex_clear (&probe->lock);
+
+  g_slice_free (GuacaMediaProbe, probe);
+}
+
+static gpointer
+guaca_media_probe_thread (gpointer data)
+{
+  GuacaMediaProbe *probe = data;
+  gboolean         cancelled;
+
+  /* opening a decoder can take a while, as it may load firmware */
+  guaca_media_caps_probe (&probe->caps);
+
+  g_debug ("Found %d hardware decoders and %d connected displays",
+           probe->caps.n_decoders, probe->caps.n_displays);
+
+  g_mutex_lock (&probe->lock);
+
+  probe->running = FALSE;
+
+  if (!(cancelled = probe->cancelled))
+    probe->idle_id = g_idle_add ((GSourceFunc) guaca_media_probe_done_cb,
+                                 probe);
+
+  g_mutex_unlock (&probe->lock);
+
+  /* freed while we were probing, it is ours to free */
+  if (cancelled)
+    guaca_media_probe_destroy (probe);
+
+  return NULL;
+}
+
+/*
+ * Starts probing in a worker thread; func is called from the main loop when
+ * done, unless the probe is freed first.
+ */
+GuacaMediaProbe *
+guaca_media_probe_start (GuacaMediaProbeFunc func, gpointer data)
+{
+  GuacaMediaProbe *probe = g_slice_new0 (GuacaMediaProbe);
+
+  probe->func = func;
+  probe->data = data;
+
+  g_mutex_init (&probe->lock);
+  probe->running = TRUE;
+
+  probe->thread = g_thread_new ("guaca-media-probe",
+                                guaca_media_probe_thread, probe);
+
+  return probe;
+}
+
+/*
+ * Frees the probe, without waiting for it: probing cannot be interrupted,
+ * so a probe that is still running is left to free itself when done, and
+ * func is not called.
+ */
+void
+guaca_media_probe_free (GuacaMediaProbe *probe)
+{
+  gboolean running;
+
+  if (!probe)
+    return;
+
+  g_mutex_lock (&probe->lock);
+
+  probe->cancelled = TRUE;
+  running          = probe->running;
+
+  if (probe->idle_id)
+    {
+      g_source_remove (probe->idle_id);
+      probe->idle_id = 0;
+    }
+
+  g_mutex_unlock (&probe->lock);
+
+  /* the thread keeps a reference of its own while it runs */
+  g_thread_unref (probe->thread);
+
+  if (!running)
+    guaca_media_probe_destroy (probe);
+}
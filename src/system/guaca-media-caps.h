@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Hardware video decoders and display modes, as bearing on playback */
+
+#ifndef __GUACA_MEDIA_CAPS_H__
+#define __GUACA_MEDIA_CAPS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GUACA_MEDIA_MAX_DECODERS 4
+#define GUACA_MEDIA_MAX_CODECS   16
+#define GUACA_MEDIA_MAX_DISPLAYS 4
+#define GUACA_MEDIA_MAX_MODES    48
+
+typedef struct
+{
+  char  name[16];               /* "H.264", or the fourcc if unknown */
+  guint max_width;
+  guint max_height;
+} GuacaMediaCodec;
+
+typedef struct
+{
+  char            device[16];   /* "video0" */
+  char            card[32];     /* as the driver names it */
+  GuacaMediaCodec codecs[GUACA_MEDIA_MAX_CODECS];
+  int             n_codecs;
+} GuacaMediaDecoder;
+
+typedef struct
+{
+  guint  width;
+  guint  height;
+  double refresh;               /* Hz, 0 if only known from sysfs */
+} GuacaMediaMode;
+
+typedef struct
+{
+  char           connector[32]; /* "HDMI-A-1" */
+  GuacaMediaMode preferred;
+  GuacaMediaMode modes[GUACA_MEDIA_MAX_MODES];
+  int            n_modes;
+} GuacaMediaDisplay;
+
+typedef struct
+{
+  GuacaMediaDecoder decoders[GUACA_MEDIA_MAX_DECODERS];
+  int               n_decoders;
+  GuacaMediaDisplay displays[GUACA_MEDIA_MAX_DISPLAYS];
+  int               n_displays;
+} GuacaMediaCaps;
+
+typedef struct _GuacaMediaProbe GuacaMediaProbe;
+
+typedef void (*GuacaMediaProbeFunc) (const GuacaMediaCaps *caps,
+                                     gpointer              data);
+
+GuacaMediaProbe *guaca_media_probe_start  (GuacaMediaProbeFunc  func,
+                                           gpointer             data);
+void             guaca_media_probe_free   (GuacaMediaProbe     *probe);
+
+gboolean         guaca_media_caps_lookup  (GuacaMediaCaps      *caps);
+void             guaca_media_caps_probe   (GuacaMediaCaps      *caps);
+
+gboolean         guaca_media_display_has_refresh (const GuacaMediaDisplay *display,
+                                                  double                   hz);
+
+G_END_DECLS
+
+#endif /* __GUACA_MEDIA_CAPS_H__ */
@@ -0,0 +1,434 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-proc-top.h"
+#include "guaca-sampler.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* How many processes we publish for each order */
+#define N_TOP        10
+
+/*
+ * The most stat files we keep open between ticks; processes beyond that are
+ * opened on each tick, so we do not eat into the fd limit of the host.
+ */
+#define MAX_OPEN_FDS 256
+
+/*
+ * The state we keep for each process between ticks. The stat file is kept
+ * open, which spares us the path lookup on every tick, and also protects us
+ * from pid reuse: once the process is gone, reading the old fd fails rather
+ * than returning the stat of a new process with the same pid.
+ */
+typedef struct
+{
+  int      pid;
+  int      fd;
+  guint    generation;
+
+  guint32  hash;                /* of the stat contents at the last tick */
+  gboolean parsed;
+
+  char     comm[16];
+  guint64  ticks;
+  guint64  rss_pages;
+  double   cpu;
+} ProcEntry;
+
+/* What a tick publishes; never changed once published */
+typedef struct
+{
+  GuacaProcInfo  top[GUACA_PROC_TOP_N_ORDERS][N_TOP];
+  guint          n_top;
+
+  guint          n_procs;
+  gint64         cost;          /* of the tick, in us */
+} Snapshot;
+
+struct _GuacaProcTop
+{
+  /* owned by the sampler thread */
+  DIR             *proc_dir;
+  GHashTable      *procs;
+  guint            generation;
+  guint            n_open;
+  gint64           last_time;
+  char             buf[1024];
+
+  GuacaSamplerSub *sub;
+};
+
+static void
+proc_entry_free (ProcEntry *e)
+{
+  if (e->fd >= 0)
+    close (e->fd);
+
+  g_slice_free (ProcEntry, e);
+}
+
+/*
+ * FNV-1a; we only need to tell whether the contents changed since the last
+ * tick.
+ */
+static guint32
+hash_bytes (const char *buf, gssize len)
+{
+  guint32 h = 2166136261u;
+  gssize  i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ (guchar) buf[i]) * 16777619u;
+
+  return h;
+}
+
+static gssize
+guaca_proc_top_read (GuacaProcTop *top, ProcEntry *e)
+{
+  char   path[32];
+  gssize r;
+  int    fd;
+
+  if (e->fd >= 0)
+    r = pread (e->fd, top->buf, sizeof (top->buf) - 1, 0);
+  else
+    {
+      snprintf (path, sizeof (path), "%d/stat", e->pid);
+
+      if ((fd = openat (dirfd (top->proc_dir), path,
+                        O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+      r = read (fd, top->buf, sizeof (top->buf) - 1);
+      close (fd);
+    }
+
+  if (r >= 0)
+    top->buf[r] = 0;
+
+  return r;
+}
+
+/*
+ * Parses comm, utime + stime, and rss out of the stat contents; see
+ * proc(5) for the layout.
+ */
+static gboolean
+guaca_proc_top_parse (const char *buf, ProcEntry *e)
+{
+  const char         *s, *p;
+  unsigned long long  utime, stime;
+  long long           rss;
+  gsize               n;
+
+  if (!(s = strchr (buf, '(')) || !(p = strrchr (buf, ')')))
+    return FALSE;
+
+  n = MIN ((gsize)(p - s - 1), sizeof (e->comm) - 1);
+  memcpy (e->comm, s + 1, n);
+  e->comm[n] = 0;
+
+  if (sscanf (p + 2,
+              "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+              "%*d %*d %*d %*d %*d %*d %*u %*u %lld",
+              &utime, &stime, &rss) != 3)
+    return FALSE;
+
+  e->ticks     = utime + stime;
+  e->rss_pages = MAX (rss, 0);
+
+  return TRUE;
+}
+
+/*
+ * Picks up new processes; the /proc directory stream is reused between
+ * ticks.
+ */
+static void
+guaca_proc_top_scan (GuacaProcTop *top)
+{
+  struct dirent *d;
+
+  rewinddir (top->proc_dir);
+
+  while ((d = readdir (top->proc_dir)))
+    {
+      ProcEntry *e;
+      int        pid;
+
+      if (d->d_name[0] < '1' || d->d_name[0] > '9')
+        continue;
+
+      pid = atoi (d->d_name);
+
+      if (!(e = g_hash_table_lookup (top->procs, GINT_TO_POINTER (pid))))
+        {
+          char path[32];
+
+          e = g_slice_new0 (ProcEntry);
+          e->pid = pid;
+          e->fd  = -1;
+
+          if (top->n_open < MAX_OPEN_FDS)
+            {
+              snprintf (path, sizeof (path), "%d/stat", pid);
+
+              if ((e->fd = openat (dirfd (top->proc_dir), path,
+                                   O_RDONLY | O_CLOEXEC)) >= 0)
+                top->n_open++;
+            }
+
+          g_hash_table_insert (top->procs, GINT_TO_POINTER (pid), e);
+        }
+
+      e->generation = top->generation;
+    }
+}
+
+static int
+proc_cpu_cmp (gconstpointer a, gconstpointer b)
+{
+  const ProcEntry *e1 = *(const ProcEntry **) a;
+  const ProcEntry *e2 = *(const ProcEntry **) b;
+
+  if (e1->cpu != e2->cpu)
+    return e1->cpu < e2->cpu ? 1 : -1;
+
+  if (e1->rss_pages == e2->rss_pages)
+    return 0;
+
+  return e1->rss_pages < e2->rss_pages ? 1 : -1;
+}
+
+static int
+proc_rss_cmp (gconstpointer a, gconstpointer b)
+{
+  const ProcEntry *e1 = *(const ProcEntry **) a;
+  const ProcEntry *e2 = *(const ProcEntry **) b;
+
+  if (e1->rss_pages == e2->rss_pages)
+    return 0;
+
+  return e1->rss_pages < e2->rss_pages ? 1 : -1;
+}
+
+static void
+snapshot_free (gpointer data)
+{
+  g_slice_free (Snapshot, data);
+}
+
+static Snapshot *
+guaca_proc_top_publish (GuacaProcTop *top, GPtrArray *live)
+{
+  GCompareFunc  cmp[GUACA_PROC_TOP_N_ORDERS] = { proc_cpu_cmp, proc_rss_cmp };
+  guint         page_kb = sysconf (_SC_PAGESIZE) / 1024;
+  guint         order, i, n = MIN (live->len, N_TOP);
+  Snapshot     *snapshot = g_slice_new (Snapshot);
+
+  for (order = 0; order < GUACA_PROC_TOP_N_ORDERS; order++)
+    {
+      g_ptr_array_sort (live, cmp[order]);
+
+      for (i = 0; i < n; i++)
+        {
+          const ProcEntry *e = g_ptr_array_index (live, i);
+          GuacaProcInfo   *p = &snapshot->top[order][i];
+
+          p->pid    = e->pid;
+          p->cpu    = e->cpu;
+          p->rss_kb = e->rss_pages * page_kb;
+          memcpy (p->comm, e->comm, sizeof (p->comm));
+        }
+    }
+
+  snapshot->n_top   = n;
+  snapshot->n_procs = live->len;
+
+  return snapshot;
+}
+
+static gpointer
+guaca_proc_top_tick (gpointer data)
+{
+  GuacaProcTop   *top = data;
+  Snapshot       *snapshot;
+  GHashTableIter  iter;
+  ProcEntry      *e;
+  GPtrArray      *live;
+  gint64          now = g_get_monotonic_time ();
+  double          hz  = sysconf (_SC_CLK_TCK);
+  double          secs;
+  guint           parsed = 0;
+
+  secs = top->last_time ? (now - top->last_time) / (double) G_USEC_PER_SEC : 0;
+
+  top->generation++;
+  guaca_proc_top_scan (top);
+
+  live = g_ptr_array_sized_new (g_hash_table_size (top->procs));
+
+  g_hash_table_iter_init (&iter, top->procs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &e))
+    {
+      guint64 ticks = e->ticks;
+      gssize  len;
+      guint32 hash;
+
+      if (e->generation != top->generation ||
+          (len = guaca_proc_top_read (top, e)) <= 0)
+        {
+          if (e->fd >= 0)
+            top->n_open--;
+
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      /*
+       * Unchanged contents mean no CPU time was used; only parse the
+       * processes that did something.
+       */
+      hash = hash_bytes (top->buf, len);
+
+      if (e->parsed && hash == e->hash)
+        e->cpu = 0.0;
+      else
+        {
+          gboolean first = !e->parsed;
+
+          if (!(e->parsed = guaca_proc_top_parse (top->buf, e)))
+            continue;
+
+          parsed++;
+
+          e->cpu = !first && secs > 0.0 && e->ticks >= ticks ?
+            100.0 * (e->ticks - ticks) / hz / secs : 0.0;
+        }
+
+      e->hash = hash;
+      g_ptr_array_add (live, e);
+    }
+
+  snapshot = guaca_proc_top_publish (top, live);
+  snapshot->cost = g_get_monotonic_time () - now;
+
+  g_debug ("Process tick over %u processes (%u parsed, %u fds) "
+           "in %" G_GINT64_FORMAT " us",
+           live->len, parsed, top->n_open, snapshot->cost);
+
+  g_ptr_array_free (live, TRUE);
+
+  top->last_time = now;
+
+  return snapshot;
+}
+
+/*
+ * Starts tracking the processes on the system, every interval_ms, on the
+ * sampler thread.
+ */
+GuacaProcTop *
+guaca_proc_top_new (guint interval_ms)
+{
+  GuacaProcTop *top = g_slice_new0 (GuacaProcTop);
+
+  top->procs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                      (GDestroyNotify) proc_entry_free);
+
+  if (!(top->proc_dir = opendir ("/proc")))
+    {
+      g_warning ("Failed to open /proc");
+      guaca_proc_top_free (top);
+      return NULL;
+    }
+
+  top->sub = guaca_sampler_subscribe (interval_ms, guaca_proc_top_tick, top,
+                                      snapshot_free);
+
+  return top;
+}
+
+void
+guaca_proc_top_free (GuacaProcTop *top)
+{
+  if (!top)
+    return;
+
+  guaca_sampler_unsubscribe (top->sub);
+
+  g_hash_table_destroy (top->procs);
+
+  if (top->proc_dir)
+    closedir (top->proc_dir);
+
+  g_slice_free (GuacaProcTop, top);
+}
+
+/*
+ * Copies up to n_procs of the top processes in the given order from the
+ * last tick into procs; returns the number copied. Only to be called from
+ * the main loop.
+ */
+guint
+guaca_proc_top_get (GuacaProcTop      *top,
+                    GuacaProcTopOrder  order,
+                    GuacaProcInfo     *procs,
+                    guint              n_procs)
+{
+  const Snapshot *snapshot;
+  guint           n;
+
+  g_return_val_if_fail (order < GUACA_PROC_TOP_N_ORDERS, 0);
+
+  if (!(snapshot = guaca_sampler_peek (top->sub)))
+    return 0;
+
+  n = MIN (n_procs, snapshot->n_top);
+  memcpy (procs, snapshot->top[order], n * sizeof (GuacaProcInfo));
+
+  return n;
+}
+
+/*
+ * Returns how long the last tick took in us, or -1 before the first one,
+ * and the number of processes it went through in n_procs. Only to be
+ * called from the main loop.
+ */
+gint64
+guaca_proc_top_get_cost (GuacaProcTop *top, guint *n_procs)
+{
+  const Snapshot *snapshot;
+
+  if (!(snapshot = guaca_sampler_peek (top->sub)))
+    return -1;
+
+  if (n_procs)
+    *n_procs = snapshot->n_procs;
+
+  return snapshot->cost;
+}
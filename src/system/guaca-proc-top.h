@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* The processes using the most CPU and memory */
+
+#ifndef __GUACA_PROC_TOP_H__
+#define __GUACA_PROC_TOP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  GUACA_PROC_TOP_BY_CPU = 0,
+  GUACA_PROC_TOP_BY_RSS,
+
+  GUACA_PROC_TOP_N_ORDERS
+} GuacaProcTopOrder;
+
+typedef struct
+{
+  int     pid;
+  char    comm[16];
+  double  cpu;                  /* % of a single core over the last tick */
+  guint64 rss_kb;
+} GuacaProcInfo;
+
+typedef struct _GuacaProcTop GuacaProcTop;
+
+GuacaProcTop *guaca_proc_top_new  (guint              interval_ms);
+void          guaca_proc_top_free (GuacaProcTop      *top);
+
+guint         guaca_proc_top_get  (GuacaProcTop      *top,
+                                   GuacaProcTopOrder  order,
+                                   GuacaProcInfo     *procs,
+                                   guint              n_procs);
+
+gint64        guaca_proc_top_get_cost (GuacaProcTop *top,
+                                       guint        *n_procs);
+
+G_END_DECLS
+
+#endif /* __GUACA_PROC_TOP_H__ */
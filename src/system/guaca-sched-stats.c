@@ -0,0 +1,318 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sched-stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Glitches in playback are more often caused by a thread being runnable but
+ * not getting a CPU than by the CPU usage as such; schedstat gives us the
+ * time spent waiting on the run queue, and sched (or status, on kernels
+ * without CONFIG_SCHED_DEBUG) the context switches.
+ *
+ * The threads are kept in a fixed array of slots and all the files are read
+ * into a single buffer, so once the task directory stream is open, sampling
+ * does not allocate.
+ */
+struct _GuacaSchedStats
+{
+  DIR              *task_dir;
+  gint64            timestamp;
+  guint             generation;
+
+  gboolean          has_wait;
+
+  GuacaSchedThread  threads[GUACA_SCHED_MAX_THREADS];
+  char              buf[4096];
+};
+
+GuacaSchedStats *
+guaca_sched_stats_new (void)
+{
+  GuacaSchedStats *stats = g_slice_new0 (GuacaSchedStats);
+
+  if (!(stats->task_dir = opendir ("/proc/self/task")))
+    g_warning ("Failed to open /proc/self/task");
+
+  return stats;
+}
+
+void
+guaca_sched_stats_free (GuacaSchedStats *stats)
+{
+  if (!stats)
+    return;
+
+  if (stats->task_dir)
+    closedir (stats->task_dir);
+
+  g_slice_free (GuacaSchedStats, stats);
+}
+
+static gssize
+guaca_sched_stats_read (GuacaSchedStats *stats, int tid, const char *name)
+{
+  char   path[48];
+  gssize r;
+  int    fd;
+
+  snprintf (path, sizeof (path), "%d/%s", tid, name);
+
+  if ((fd = openat (dirfd (stats->task_dir), path,
+                    O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  r = read (fd, stats->buf, sizeof (stats->buf) - 1);
+  close (fd);
+
+  if (r < 0)
+    return -1;
+
+  stats->buf[r] = 0;
+  return r;
+}
+
+static guint64
+find_value (const char *buf, const char *key)
+{
+  const char *p;
+
+  if (!(p = strstr (buf, key)))
+    return 0;
+
+  p += strlen (key);
+
+  while (*p == ' ' || *p == '\t' || *p == ':')
+    p++;
+
+  return g_ascii_strtoull (p, NULL, 10);
+}
+
+static GuacaSchedThread *
+guaca_sched_stats_find_slot (GuacaSchedStats *stats, int tid)
+{
+  GuacaSchedThread *free_slot = NULL;
+  int               i;
+
+  for (i = 0; i < GUACA_SCHED_MAX_THREADS; i++)
+    {
+      GuacaSchedThread *t = &stats->threads[i];
+
+      if (t->tid == tid)
+        return t;
+
+      if (!t->tid && !free_slot)
+        free_slot = t;
+    }
+
+  if (free_slot)
+    {
+      memset (free_slot, 0, sizeof (GuacaSchedThread));
+      free_slot->tid = tid;
+    }
+
+  return free_slot;
+}
+
+static void
+guaca_sched_stats_sample_thread (GuacaSchedStats  *stats,
+                                 GuacaSchedThread *t,
+                                 double            secs)
+{
+  GuacaSchedThread  prev = *t;
+  unsigned long long run, wait;
+  char              *nl;
+  gboolean           have_run = FALSE, have_switches = FALSE;
+
+  if (guaca_sched_stats_read (stats, t->tid, "comm") > 0)
+    {
+      if ((nl = strchr (stats->buf, '\n')))
+        *nl = 0;
+
+      g_strlcpy (t->comm, stats->buf, sizeof (t->comm));
+    }
+
+  /*
+   * run time, run queue wait time, and number of time slices, all in ns
+   */
+  if (guaca_sched_stats_read (stats, t->tid, "schedstat") > 0 &&
+      sscanf (stats->buf, "%llu %llu", &run, &wait) == 2)
+    {
+      t->run_ns  = run;
+      t->wait_ns = wait;
+      stats->has_wait = TRUE;
+      have_run = TRUE;
+    }
+
+  if (guaca_sched_stats_read (stats, t->tid, "sched") > 0)
+    {
+      const char *p;
+
+      /* in ms, with a fractional part */
+      if (!have_run &&
+          (p = strstr (stats->buf, "se.sum_exec_runtime")) &&
+          (p = strchr (p, ':')))
+        t->run_ns = g_ascii_strtod (p + 1, NULL) * 1000000.0;
+
+      if (strstr (stats->buf, "nr_voluntary_switches"))
+        {
+          t->nvcsw  = find_value (stats->buf, "nr_voluntary_switches");
+          t->nivcsw = find_value (stats->buf, "nr_involuntary_switches");
+          have_switches = TRUE;
+        }
+    }
+
+  if (!have_switches && guaca_sched_stats_read (stats, t->tid, "status") > 0)
+    {
+      t->nvcsw  = find_value (stats->buf, "\nvoluntary_ctxt_switches");
+      t->nivcsw = find_value (stats->buf, "nonvoluntary_ctxt_switches");
+    }
+
+  if (prev.generation && secs > 0.0)
+    {
+      t->run_ms      = (t->run_ns - MIN (t->run_ns, prev.run_ns)) / 1e6 / secs;
+      t->wait_ms     = (t->wait_ns - MIN (t->wait_ns, prev.wait_ns)) / 1e6 /
+                       secs;
+      t->nvcsw_rate  = (t->nvcsw - MIN (t->nvcsw, prev.nvcsw)) / secs;
+      t->nivcsw_rate = (t->nivcsw - MIN (t->nivcsw, prev.nivcsw)) / secs;
+      t->valid       = TRUE;
+    }
+}
+
+/*
+ * Takes a sample of all the threads, computing the rates over the time
+ * since the previous sample.
+ */
+void
+guaca_sched_stats_sample (GuacaSchedStats *stats)
+{
+  struct dirent *d;
+  gint64         now = g_get_monotonic_time ();
+  double         secs;
+  int            i;
+
+  if (!stats->task_dir)
+    return;
+
+  secs = stats->timestamp ?
+    (now - stats->timestamp) / (double) G_USEC_PER_SEC : 0.0;
+
+  stats->generation++;
+
+  rewinddir (stats->task_dir);
+
+  while ((d = readdir (stats->task_dir)))
+    {
+      GuacaSchedThread *t;
+      int               tid;
+
+      if (d->d_name[0] == '.' || !(tid = atoi (d->d_name)))
+        continue;
+
+      if (!(t = guaca_sched_stats_find_slot (stats, tid)))
+        continue;
+
+      guaca_sched_stats_sample_thread (stats, t, secs);
+      t->generation = stats->generation;
+    }
+
+  /*
+   * Free the slots of the threads that are gone.
+   */
+  for (i = 0; i < GUACA_SCHED_MAX_THREADS; i++)
+    if (stats->threads[i].tid &&
+        stats->threads[i].generation != stats->generation)
+      stats->threads[i].tid = 0;
+
+  stats->timestamp = now;
+
+  g_debug ("Scheduler stats sampled in %" G_GINT64_FORMAT " us",
+           g_get_monotonic_time () - now);
+}
+
+/*
+ * Whether the kernel reports run queue wait times (CONFIG_SCHEDSTATS or
+ * CONFIG_TASK_DELAY_ACCT); if not, the wait_ms of the threads is 0.
+ */
+gboolean
+guaca_sched_stats_has_wait (GuacaSchedStats *stats)
+{
+  return stats->has_wait;
+}
+
+/*
+ * Higher is hotter: the run queue wait, or where that is not available,
+ * the involuntary context switches, i.e., how often the thread was
+ * preempted.
+ */
+static double
+sched_heat (const GuacaSchedThread *t, gboolean has_wait)
+{
+  return has_wait ? t->wait_ms : t->nivcsw_rate;
+}
+
+/*
+ * Copies the up to n_threads threads with the most run queue wait in the
+ * last window into threads, hottest first; returns the number copied.
+ */
+guint
+guaca_sched_stats_get_top (GuacaSchedStats  *stats,
+                           GuacaSchedThread *threads,
+                           guint             n_threads)
+{
+  guint n = 0, i, j;
+
+  for (i = 0; i < GUACA_SCHED_MAX_THREADS; i++)
+    {
+      const GuacaSchedThread *t = &stats->threads[i];
+      double                  heat;
+
+      if (!t->tid || !t->valid)
+        continue;
+
+      heat = sched_heat (t, stats->has_wait);
+
+      /* insertion into the sorted output */
+      for (j = n; j > 0; j--)
+        {
+          if (sched_heat (&threads[j - 1], stats->has_wait) >= heat)
+            break;
+
+          if (j < n_threads)
+            threads[j] = threads[j - 1];
+        }
+
+      if (j < n_threads)
+        {
+          threads[j] = *t;
+
+          if (n < n_threads)
+            n++;
+        }
+    }
+
+  return n;
+}
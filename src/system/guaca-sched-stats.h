@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Scheduler latency of the media-explorer threads */
+
+#ifndef __GUACA_SCHED_STATS_H__
+#define __GUACA_SCHED_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The most threads we track; any beyond that are ignored */
+#define GUACA_SCHED_MAX_THREADS 128
+
+typedef struct
+{
+  int     tid;
+  char    comm[16];
+
+  /* totals from the kernel */
+  guint64 run_ns;
+  guint64 wait_ns;              /* runnable, but waiting for a CPU */
+  guint64 nvcsw;                /* voluntary context switches */
+  guint64 nivcsw;               /* involuntary context switches */
+
+  /* rates over the last sampling window, per second */
+  double  run_ms;
+  double  wait_ms;
+  double  nvcsw_rate;
+  double  nivcsw_rate;
+
+  guint   generation;
+  guint   valid : 1;            /* has rates, i.e., seen in two samples */
+} GuacaSchedThread;
+
+typedef struct _GuacaSchedStats GuacaSchedStats;
+
+GuacaSchedStats *guaca_sched_stats_new      (void);
+void             guaca_sched_stats_free     (GuacaSchedStats *stats);
+
+void             guaca_sched_stats_sample   (GuacaSchedStats *stats);
+
+gboolean         guaca_sched_stats_has_wait (GuacaSchedStats *stats);
+
+guint            guaca_sched_stats_get_top  (GuacaSchedStats   *stats,
+                                             GuacaSchedThread  *threads,
+                                             guint              n_threads);
+
+G_END_DECLS
+
+#endif /* __GUACA_SCHED_STATS_H__ */
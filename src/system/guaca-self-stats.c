@@ -0,0 +1,263 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-self-stats.h"
+#include "guaca-metrics.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Reads a small procfs file relative to dirfd into buf, 0-terminating it.
+ *
+ * We deliberately avoid stdio here; this is called once per thread and the
+ * whole point of the exercise is to be cheap enough to leave on.
+ */
+static gssize
+read_file_at (int dirfd, const char *path, char *buf, gsize len)
+{
+  int     fd;
+  gssize  r;
+
+  if ((fd = openat (dirfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  r = read (fd, buf, len - 1);
+  close (fd);
+
+  if (r < 0)
+    return -1;
+
+  buf[r] = 0;
+  return r;
+}
+
+/*
+ * Parses the comm, utime and stime fields out of a stat file; the comm field
+ * can contain both spaces and parentheses, so we have to anchor the rest of
+ * the parsing on the last ')'.
+ */
+static gboolean
+parse_stat (char *buf, char *comm, gsize comm_len,
+            guint64 *utime, guint64 *stime)
+{
+  char *s, *e;
+  unsigned long long u, k;
+
+  if (!(s = strchr (buf, '(')) || !(e = strrchr (buf, ')')))
+    return FALSE;
+
+  if (comm)
+    {
+      gsize n = MIN ((gsize)(e - s - 1), comm_len - 1);
+
+      memcpy (comm, s + 1, n);
+      comm[n] = 0;
+    }
+
+  /*
+   * state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+   * utime stime
+   */
+  if (sscanf (e + 2,
+              "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+              &u, &k) != 2)
+    return FALSE;
+
+  *utime = u;
+  *stime = k;
+
+  return TRUE;
+}
+
+static void
+collect_memory (GuacaSelfStats *stats)
+{
+  char  buf[1024];
+  char *p;
+
+  if (read_file_at (AT_FDCWD, "/proc/self/smaps_rollup", buf, sizeof (buf)) > 0)
+    {
+      if ((p = strstr (buf, "\nRss:")))
+        stats->rss_kb = g_ascii_strtoull (p + strlen ("\nRss:"), NULL, 10);
+
+      if ((p = strstr (buf, "\nPss:")))
+        stats->pss_kb = g_ascii_strtoull (p + strlen ("\nPss:"), NULL, 10);
+
+      return;
+    }
+
+  /*
+   * Kernels older than 4.14 have no smaps_rollup and walking the full smaps
+   * is far too expensive to do routinely, so make do with RSS only.
+   */
+  if (read_file_at (AT_FDCWD, "/proc/self/statm", buf, sizeof (buf)) > 0)
+    {
+      unsigned long size, resident;
+
+      if (sscanf (buf, "%lu %lu", &size, &resident) == 2)
+        stats->rss_kb = (guint64) resident * (sysconf (_SC_PAGESIZE) / 1024);
+    }
+}
+
+static void
+collect_threads (GuacaSelfStats *stats)
+{
+  GArray        *threads;
+  DIR           *dir;
+  struct dirent *d;
+  char           buf[512];
+  int            dfd;
+
+  if (!(dir = opendir ("/proc/self/task")))
+    return;
+
+  dfd     = dirfd (dir);
+  threads = g_array_sized_new (FALSE, FALSE, sizeof (GuacaThreadStats), 16);
+
+  while ((d = readdir (dir)))
+    {
+      GuacaThreadStats t;
+      guint64          u, k;
+      char             path[32];
+
+      if (d->d_name[0] == '.')
+        continue;
+
+      snprintf (path, sizeof (path), "%s/stat", d->d_name);
+
+      if (read_file_at (dfd, path, buf, sizeof (buf)) <= 0 ||
+          !parse_stat (buf, t.comm, sizeof (t.comm), &u, &k))
+        continue;
+
+      t.tid   = atoi (d->d_name);
+      t.ticks = u + k;
+
+      g_array_append_val (threads, t);
+    }
+
+  closedir (dir);
+
+  stats->n_threads = threads->len;
+  stats->threads   = (GuacaThreadStats *) g_array_free (threads, FALSE);
+}
+
+/*
+ * Takes a snapshot of the resource usage of this process. The cost of doing
+ * so is one read of smaps_rollup and stat, plus one stat read per thread.
+ */
+GuacaSelfStats *
+guaca_self_stats_collect (void)
+{
+  GuacaSelfStats *stats = g_slice_new0 (GuacaSelfStats);
+  char            buf[512];
+
+  stats->timestamp = g_get_monotonic_time ();
+
+  collect_memory (stats);
+
+  if (read_file_at (AT_FDCWD, "/proc/self/stat", buf, sizeof (buf)) > 0)
+    parse_stat (buf, NULL, 0, &stats->utime, &stats->stime);
+
+  collect_threads (stats);
+
+  stats->cost = g_get_monotonic_time () - stats->timestamp;
+
+  g_debug ("Self stats for %u threads collected in %" G_GINT64_FORMAT " us",
+           stats->n_threads, stats->cost);
+
+  return stats;
+}
+
+void
+guaca_self_stats_free (GuacaSelfStats *stats)
+{
+  if (!stats)
+    return;
+
+  g_free (stats->threads);
+  g_slice_free (GuacaSelfStats, stats);
+}
+
+/*
+ * Returns the CPU usage between the two samples as a percentage of a single
+ * core, or -1 if it cannot be computed.
+ */
+double
+guaca_self_stats_cpu_usage (const GuacaSelfStats *prev,
+                            const GuacaSelfStats *now)
+{
+  double  secs;
+  guint64 ticks;
+
+  if (!prev || !now || now->timestamp <= prev->timestamp)
+    return -1.0;
+
+  secs  = (double)(now->timestamp - prev->timestamp) / G_USEC_PER_SEC;
+  ticks = (now->utime + now->stime) - (prev->utime + prev->stime);
+
+  return 100.0 * ticks / sysconf (_SC_CLK_TCK) / secs;
+}
+
+const GuacaThreadStats *
+guaca_self_stats_find_thread (const GuacaSelfStats *stats, int tid)
+{
+  guint i;
+
+  if (!stats)
+    return NULL;
+
+  for (i = 0; i < stats->n_threads; i++)
+    if (stats->threads[i].tid == tid)
+      return &stats->threads[i];
+
+  return NULL;
+}
+
+/*
+ * GuacaMetricsFunc exporting the resource usage of this process.
+ */
+void
+guaca_self_stats_write_metrics (GString *out, gpointer data)
+{
+  GuacaSelfStats *stats = guaca_self_stats_collect ();
+
+  guaca_metrics_write (out, "guacamayo_mex_resident_bytes", "gauge",
+                       "Resident set size of media-explorer.",
+                       stats->rss_kb * 1024.0);
+
+  if (stats->pss_kb)
+    guaca_metrics_write (out, "guacamayo_mex_proportional_bytes", "gauge",
+                         "Proportional set size of media-explorer.",
+                         stats->pss_kb * 1024.0);
+
+  guaca_metrics_write (out, "guacamayo_mex_cpu_seconds_total", "counter",
+                       "CPU time used by media-explorer.",
+                       (double)(stats->utime + stats->stime) /
+                       sysconf (_SC_CLK_TCK));
+  guaca_metrics_write (out, "guacamayo_mex_threads", "gauge",
+                       "Number of media-explorer threads.", stats->n_threads);
+
+  guaca_self_stats_free (stats);
+}
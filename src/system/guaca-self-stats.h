@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Resource usage of the host (media-explorer) process */
+
+#ifndef __GUACA_SELF_STATS_H__
+#define __GUACA_SELF_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  int     tid;
+  char    comm[16];
+  guint64 ticks;                /* utime + stime, in clock ticks */
+} GuacaThreadStats;
+
+typedef struct
+{
+  gint64            timestamp;  /* monotonic time of the sample, in us */
+  gint64            cost;       /* time spent collecting the sample, in us */
+
+  guint64           rss_kb;
+  guint64           pss_kb;     /* 0 if smaps_rollup is not available */
+
+  guint64           utime;      /* clock ticks */
+  guint64           stime;
+
+  guint             n_threads;
+  GuacaThreadStats *threads;
+} GuacaSelfStats;
+
+GuacaSelfStats *guaca_self_stats_collect (void);
+void            guaca_self_stats_free    (GuacaSelfStats *stats);
+
+double          guaca_self_stats_cpu_usage (const GuacaSelfStats *prev,
+                                            const GuacaSelfStats *now);
+
+const GuacaThreadStats *
+                guaca_self_stats_find_thread (const GuacaSelfStats *stats,
+                                              int                   tid);
+
+void            guaca_self_stats_write_metrics (GString  *out,
+                                                gpointer  data);
+
+G_END_DECLS
+
+#endif /* __GUACA_SELF_STATS_H__ */
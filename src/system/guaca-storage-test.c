@@ -0,0 +1,594 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* for O_DIRECT */
+#define _GNU_SOURCE
+
+#include "guaca-storage-test.h"
+#include "guaca-histogram.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <glib/gi18n-lib.h>
+
+/*
+ * We read the largest files on the volume, which on a media volume are the
+ * videos themselves; this needs no privileges, and measures the file system
+ * as the player sees it. The page cache would make a second test look much
+ * better than the first, so the reads bypass it with O_DIRECT, or where the
+ * file system does not support that, the cached pages are dropped first.
+ */
+#define MAX_FILES      4
+#define MIN_FILE_SIZE  (16 * 1024 * 1024)
+#define MAX_DEPTH      4
+#define MAX_ENTRIES    4096
+
+/* players read ahead in large chunks, and seek in smaller ones */
+#define SEQ_BLOCK      (1024 * 1024)
+#define RANDOM_BLOCK   (64 * 1024)
+#define ALIGN          4096
+
+typedef struct
+{
+  char  *path;
+  goffset size;
+  int    fd;
+} TestFile;
+
+struct _GuacaStorageTest
+{
+  char                 *path;
+  guint                 budget_ms;
+  GuacaStorageTestFunc  func;
+  gpointer              data;
+
+  GThread              *thread;
+  volatile gint         cancelled;
+
+  GMutex                lock;
+  guint                 idle_id;
+
+  GuacaStorageResult    result;
+  GError               *error;
+};
+
+/*
+ * Bitrate tiers, best first. A rip peaks well above its average bitrate, so
+ * we want half as much again in hand; a read stalling for longer than
+ * STALL_MS drains the buffers of most players.
+ */
+#define HEADROOM 1.5
+#define STALL_MS 250.0
+
+static const struct
+{
+  const char *label;
+  double      mbit;
+} tiers[] =
+  {
+    { N_("UHD Blu-ray (128 Mbit/s)"), 128.0 },
+    { N_("Blu-ray (40 Mbit/s)"),       40.0 },
+    { N_("HD broadcast (20 Mbit/s)"),  20.0 },
+    { N_("DVD (10 Mbit/s)"),           10.0 },
+  };
+
+/*
+ * Inserts the file into the files sorted by size, keeping the largest.
+ */
+static void
+add_file (TestFile *files, guint *n_files, const char *path, goffset size)
+{
+  guint i;
+
+  if (*n_files == MAX_FILES && files[MAX_FILES - 1].size >= size)
+    return;
+
+  if (*n_files == MAX_FILES)
+    g_free (files[--(*n_files)].path);
+
+  for (i = *n_files; i > 0 && files[i - 1].size < size; i--)
+    files[i] = files[i - 1];
+
+  files[i].path = g_strdup (path);
+  files[i].size = size;
+  files[i].fd   = -1;
+  (*n_files)++;
+}
+
+static void
+find_files (const char *dir,
+            int         depth,
+            guint      *n_entries,
+            TestFile   *files,
+            guint      *n_files)
+{
+  DIR           *d;
+  struct dirent *e;
+
+  if (!(d = opendir (dir)))
+    return;
+
+  while ((e = readdir (d)) && (*n_entries)++ < MAX_ENTRIES)
+    {
+      struct stat st;
+      char       *path;
+
+      if (e->d_name[0] == '.')
+        continue;
+
+      path = g_build_filename (dir, e->d_name, NULL);
+
+      if (!lstat (path, &st))
+        {
+          if (S_ISREG (st.st_mode) && st.st_size >= MIN_FILE_SIZE)
+            add_file (files, n_files, path, st.st_size);
+          else if (S_ISDIR (st.st_mode) && depth < MAX_DEPTH)
+            find_files (path, depth + 1, n_entries, files, n_files);
+        }
+
+      g_free (path);
+    }
+
+  closedir (d);
+}
+
+static void
+drop_cache (GuacaStorageTest *test, TestFile *file)
+{
+  if (!test->result.direct)
+    posix_fadvise (file->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static gboolean
+open_files (GuacaStorageTest *test, TestFile *files, guint n_files)
+{
+  guint i;
+
+  test->result.direct = TRUE;
+
+  for (i = 0; i < n_files; i++)
+    {
+      if (test->result.direct &&
+          (files[i].fd = open (files[i].path,
+                               O_RDONLY | O_DIRECT | O_CLOEXEC)) < 0 &&
+          errno == EINVAL)
+        {
+          g_debug ("No O_DIRECT on %s, dropping the cache instead",
+                   test->path);
+          test->result.direct = FALSE;
+        }
+
+      if (files[i].fd < 0 &&
+          (files[i].fd = open (files[i].path, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+          g_set_error (&test->error, G_FILE_ERROR,
+                       g_file_error_from_errno (errno),
+                       _("Failed to open %s: %s"),
+                       files[i].path, g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+timed_read (GuacaStorageTest *test,
+            TestFile         *file,
+            char             *buf,
+            gsize             len,
+            goffset           offset,
+            GuacaHistogram   *h,
+            guint64          *bytes)
+{
+  gint64  start = g_get_monotonic_time ();
+  gssize  r;
+
+  if ((r = pread (file->fd, buf, len, offset)) < 0)
+    {
+      g_set_error (&test->error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   _("Failed to read %s: %s"), file->path, g_strerror (errno));
+      return FALSE;
+    }
+
+  guaca_histogram_add (h, g_get_monotonic_time () - start);
+  *bytes += r;
+
+  return r > 0;
+}
+
+/*
+ * Reads the files from the start, largest first, until the deadline.
+ */
+static void
+test_sequential (GuacaStorageTest *test,
+                 TestFile         *files,
+                 guint             n_files,
+                 char             *buf,
+                 gint64            deadline)
+{
+  GuacaHistogram h;
+  guint64        bytes = 0;
+  gint64         start = g_get_monotonic_time ();
+  guint          i;
+
+  guaca_histogram_reset (&h);
+
+  for (i = 0; i < n_files && !test->error; i++)
+    {
+      goffset offset = 0;
+
+      drop_cache (test, &files[i]);
+
+      while (g_get_monotonic_time () < deadline &&
+             !g_atomic_int_get (&test->cancelled) &&
+             timed_read (test, &files[i], buf, SEQ_BLOCK, offset, &h, &bytes))
+        offset += SEQ_BLOCK;
+    }
+
+  test->result.seq_mbs    = bytes / (double) (g_get_monotonic_time () - start);
+  test->result.seq_p99_ms = guaca_histogram_percentile (&h, 99.0) / 1000.0;
+  test->result.bytes_read += bytes;
+}
+
+/*
+ * Reads blocks at random offsets of random files until the deadline, as a
+ * player seeking about does.
+ */
+static void
+test_random (GuacaStorageTest *test,
+             TestFile         *files,
+             guint             n_files,
+             char             *buf,
+             gint64            deadline)
+{
+  GuacaHistogram h;
+  guint64        bytes = 0;
+  gint64         start = g_get_monotonic_time ();
+  guint          i;
+
+  guaca_histogram_reset (&h);
+
+  for (i = 0; i < n_files; i++)
+    drop_cache (test, &files[i]);
+
+  while (g_get_monotonic_time () < deadline &&
+         !g_atomic_int_get (&test->cancelled) && !test->error)
+    {
+      TestFile *file = &files[g_random_int_range (0, n_files)];
+      goffset   blocks = (file->size - RANDOM_BLOCK) / ALIGN;
+      goffset   offset = (goffset) (g_random_double () * blocks) * ALIGN;
+
+      timed_read (test, file, buf, RANDOM_BLOCK, offset, &h, &bytes);
+    }
+
+  test->result.random_mbs    = bytes / (double) (g_get_monotonic_time () -
+                                                 start);
+  test->result.random_p99_ms = guaca_histogram_percentile (&h, 99.0) / 1000.0;
+  test->result.bytes_read   += bytes;
+}
+
+static char *
+device_key (const char *path)
+{
+  struct stat    st, dev;
+  DIR           *d;
+  struct dirent *e;
+  char          *key = NULL;
+
+  if (stat (path, &st) < 0)
+    return NULL;
+
+  /*
+   * Prefer the file system UUID, so a USB stick keeps its results whatever
+   * port it is plugged into.
+   */
+  if ((d = opendir ("/dev/disk/by-uuid")))
+    {
+      while (!key && (e = readdir (d)))
+        {
+          char *link = g_build_filename ("/dev/disk/by-uuid", e->d_name, NULL);
+
+          if (e->d_name[0] != '.' && !stat (link, &dev) &&
+              S_ISBLK (dev.st_mode) && dev.st_rdev == st.st_dev)
+            key = g_strdup_printf ("uuid-%s", e->d_name);
+
+          g_free (link);
+        }
+
+      closedir (d);
+    }
+
+  if (!key)
+    key = g_strdup_printf ("dev-%u:%u",
+                           major (st.st_dev), minor (st.st_dev));
+
+  return key;
+}
+
+static char *
+cache_file (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           "guacamayo", "storage-tests", NULL);
+}
+
+static void
+save_result (const char *path, const GuacaStorageResult *r)
+{
+  GKeyFile *kf = g_key_file_new ();
+  char     *file = cache_file ();
+  char     *key, *dir, *data;
+  gsize     len;
+  GError   *error = NULL;
+
+  if (!(key = device_key (path)))
+    goto out;
+
+  g_key_file_load_from_file (kf, file, G_KEY_FILE_NONE, NULL);
+
+  g_key_file_set_string (kf, key, "path", path);
+  g_key_file_set_double (kf, key, "seq_mbs", r->seq_mbs);
+  g_key_file_set_double (kf, key, "seq_p99_ms", r->seq_p99_ms);
+  g_key_file_set_double (kf, key, "random_mbs", r->random_mbs);
+  g_key_file_set_double (kf, key, "random_p99_ms", r->random_p99_ms);
+  g_key_file_set_uint64 (kf, key, "bytes_read", r->bytes_read);
+  g_key_file_set_int64 (kf, key, "timestamp", r->timestamp);
+  g_key_file_set_boolean (kf, key, "direct", r->direct);
+
+  dir = g_path_get_dirname (file);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  data = g_key_file_to_data (kf, &len, NULL);
+
+  if (!g_file_set_contents (file, data, len, &error))
+    {
+      g_warning ("Failed to save storage test results: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_free (data);
+  g_free (key);
+
+ out:
+  g_free (file);
+  g_key_file_free (kf);
+}
+
+/*
+ * Looks up the last result for the device holding path; returns FALSE if
+ * it has not been tested.
+ */
+gboolean
+guaca_storage_test_lookup (const char *path, GuacaStorageResult *result)
+{
+  GKeyFile *kf = g_key_file_new ();
+  char     *file = cache_file ();
+  char     *key = device_key (path);
+  gboolean  found = FALSE;
+
+  if (key &&
+      g_key_file_load_from_file (kf, file, G_KEY_FILE_NONE, NULL) &&
+      g_key_file_has_group (kf, key))
+    {
+      result->seq_mbs       = g_key_file_get_double (kf, key, "seq_mbs", NULL);
+      result->seq_p99_ms    = g_key_file_get_double (kf, key, "seq_p99_ms",
+                                                     NULL);
+      result->random_mbs    = g_key_file_get_double (kf, key, "random_mbs",
+                                                     NULL);
+      result->random_p99_ms = g_key_file_get_double (kf, key, "random_p99_ms",
+                                                     NULL);
+      result->bytes_read    = g_key_file_get_uint64 (kf, key, "bytes_read",
+                                                     NULL);
+      result->timestamp     = g_key_file_get_int64 (kf, key, "timestamp",
+                                                    NULL);
+      result->direct        = g_key_file_get_boolean (kf, key, "direct",
+                                                      NULL);
+      found = TRUE;
+    }
+
+  g_free (key);
+  g_free (file);
+  g_key_file_free (kf);
+
+  return found;
+}
+
+static gboolean
+guaca_storage_test_done_cb (GuacaStorageTest *test)
+{
+  g_mutex_lock (&test->lock);
+  test->idle_id = 0;
+  g_mutex_unlock (&test->lock);
+
+  if (!test->error)
+    save_result (test->path, &test->result);
+
+  test->func (test->path, test->error ? NULL : &test->result, test->error,
+              test->data);
+
+  return FALSE;
+}
+
+static gpointer
+guaca_storage_test_thread (gpointer data)
+{
+  GuacaStorageTest *test = data;
+  TestFile          files[MAX_FILES];
+  guint             n_files = 0, n_entries = 0, i;
+  gint64            start = g_get_monotonic_time ();
+  gint64            budget = test->budget_ms * (gint64) 1000;
+  void             *buf = NULL;
+
+  find_files (test->path, 0, &n_entries, files, &n_files);
+
+  if (!n_files)
+    g_set_error (&test->error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                 _("No files large enough to test on %s"), test->path);
+  else if (posix_memalign (&buf, ALIGN, SEQ_BLOCK))
+    g_set_error (&test->error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                 _("Out of memory"));
+  else if (open_files (test, files, n_files))
+    {
+      test->result.timestamp = g_get_real_time ();
+
+      test_sequential (test, files, n_files, buf, start + budget * 6 / 10);
+
+      if (!test->error)
+        test_random (test, files, n_files, buf, start + budget);
+
+      g_debug ("Storage test of %s: %.1f MB/s sequential (p99 %.1f ms), "
+               "%.1f MB/s random (p99 %.1f ms)",
+               test->path, test->result.seq_mbs, test->result.seq_p99_ms,
+               test->result.random_mbs, test->result.random_p99_ms);
+    }
+
+  for (i = 0; i < n_files; i++)
+    {
+      if (files[i].fd >= 0)
+        close (files[i].fd);
+
+      g_free (files[i].path);
+    }
+
+  free (buf);
+
+  g_mutex_lock (&test->lock);
+
+  if (!g_atomic_int_get (&test->cancelled))
+    test->idle_id = g_idle_add ((GSourceFunc) guaca_storage_test_done_cb,
+                                test);
+
+  g_mutex_unlock (&test->lock);
+
+  return NULL;
+}
+
+/*
+ * Starts testing the volume holding path in a worker thread, spending up to
+ * budget_ms on it; func is called from the main loop when done, unless the
+ * test is freed first.
+ */
+GuacaStorageTest *
+guaca_storage_test_start (const char           *path,
+                          guint                 budget_ms,
+                          GuacaStorageTestFunc  func,
+                          gpointer              data)
+{
+  GuacaStorageTest *test = g_slice_new0 (GuacaStorageTest);
+
+  test->path      = g_strdup (path);
+  test->budget_ms = budget_ms;
+  test->func      = func;
+  test->data      = data;
+
+  g_mutex_init (&test->lock);
+
+  test->thread = g_thread_new ("guaca-storage-test",
+                               guaca_storage_test_thread, test);
+
+  return test;
+}
+
+/*
+ * Frees the test, cancelling it if it is still running.
+ */
+void
+guaca_storage_test_free (GuacaStorageTest *test)
+{
+  if (!test)
+    return;
+
+  g_atomic_int_set (&test->cancelled, 1);
+
+  g_thread_join (test->thread);
+
+  if (test->idle_id)
+    g_source_remove (test->idle_id);
+
+  g_clear_error (&test->error);
+  g_mutex_clear (&test->lock);
+  g_free (test->path);
+
+  g_slice_free (GuacaStorageTest, test);
+}
+
+/*
+ * Returns the best bitrate tier the volume can sustain, or NULL if it
+ * cannot sustain even the lowest.
+ */
+const char *
+guaca_storage_result_get_tier (const GuacaStorageResult *result)
+{
+  int i;
+
+  if (result->seq_p99_ms > STALL_MS)
+    return NULL;
+
+  for (i = 0; i < G_N_ELEMENTS (tiers); i++)
+    if (result->seq_mbs * 8.0 >= tiers[i].mbit * HEADROOM)
+      return _(tiers[i].label);
+
+  return NULL;
+}
+
+/*
+ * Returns the mount points of the removable and network media volumes.
+ */
+char **
+guaca_storage_list_volumes (void)
+{
+  GPtrArray *volumes = g_ptr_array_new ();
+  char      *mounts, **lines, **l;
+
+  if (g_file_get_contents ("/proc/mounts", &mounts, NULL, NULL))
+    {
+      lines = g_strsplit (mounts, "\n", -1);
+
+      for (l = lines; *l; l++)
+        {
+          char **fields = g_strsplit (*l, " ", 3);
+
+          if (fields[0] && fields[1] &&
+              (g_str_has_prefix (fields[1], "/media/") ||
+               g_str_has_prefix (fields[1], "/mnt/") ||
+               g_str_has_prefix (fields[1], "/run/media/")))
+            /* spaces and such are escaped as octal */
+            g_ptr_array_add (volumes, g_strcompress (fields[1]));
+
+          g_strfreev (fields);
+        }
+
+      g_strfreev (lines);
+      g_free (mounts);
+    }
+
+  g_ptr_array_add (volumes, NULL);
+
+  return (char **) g_ptr_array_free (volumes, FALSE);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Whether a media volume can sustain the read rate of a video */
+
+#ifndef __GUACA_STORAGE_TEST_H__
+#define __GUACA_STORAGE_TEST_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  double   seq_mbs;             /* sustained sequential read, MB/s */
+  double   seq_p99_ms;          /* 99th percentile of a sequential read */
+  double   random_mbs;
+  double   random_p99_ms;
+
+  guint64  bytes_read;
+  gint64   timestamp;           /* real time of the test, in us */
+  gboolean direct;              /* O_DIRECT, rather than dropped cache */
+} GuacaStorageResult;
+
+typedef struct _GuacaStorageTest GuacaStorageTest;
+
+typedef void (*GuacaStorageTestFunc) (const char               *path,
+                                      const GuacaStorageResult *result,
+                                      const GError             *error,
+                                      gpointer                  data);
+
+GuacaStorageTest *guaca_storage_test_start (const char           *path,
+                                            guint                 budget_ms,
+                                            GuacaStorageTestFunc  func,
+                                            gpointer              data);
+void              guaca_storage_test_free  (GuacaStorageTest     *test);
+
+gboolean          guaca_storage_test_lookup (const char         *path,
+                                             GuacaStorageResult *result);
+
+const char       *guaca_storage_result_get_tier (const GuacaStorageResult *result);
+
+char            **guaca_storage_list_volumes (void);
+
+G_END_DECLS
+
+#endif /* __GUACA_STORAGE_TEST_H__ */
@@ -0,0 +1,1590 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-system-private.h"
+#include "guaca-system-info.h"
+#include "guaca-vm-profile.h"
+#include "guaca-cgroup-stats.h"
+#include "guaca-startup.h"
+#include "guaca-input-latency.h"
+
+#include <guacamayo-version.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gi18n-lib.h>
+#include <gmodule.h>
+#include <mex/mex.h>
+
+/*
+ * The CPU performance profiles known to guacamayo-cpufreq, which applies
+ * them and saves the last one in CPU_PROFILE_FILE.
+ */
+#define CPU_PROFILE_FILE "/etc/guacamayo/cpu-profile"
+
+static const struct
+{
+  const char *name;
+  const char *label;
+} cpu_profiles[] =
+  {
+    { "playback",  N_("Playback") },
+    { "balanced",  N_("Balanced") },
+    { "powersave", N_("Power save") },
+  };
+
+/*
+ * How often the live parts of the dialog are sampled and updated.
+ */
+#define REFRESH_INTERVAL_MS 1000
+
+/*
+ * The snapshots of the probes of the live parts, taken on the sampler
+ * thread.
+ */
+typedef struct
+{
+  GuacaSchedThread threads[4];
+  guint            n_threads;
+  gboolean         has_wait;
+} SchedSnapshot;
+
+typedef struct
+{
+  GuacaIrqSource sources[4];
+  guint          n_sources;
+} IrqSnapshot;
+
+typedef struct
+{
+  GuacaCgroupInfo groups[8];
+  guint           n_groups;
+} PressureSnapshot;
+
+typedef struct
+{
+  GuacaCpuidleState states[10];
+  guint             n_states;
+  int               qos;
+} CpuidleSnapshot;
+
+/*
+ * Stops the sampling done for the live parts of the dialog.
+ */
+static void
+guaca_system_stop_refresh (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+
+  guaca_sampler_unsubscribe (priv->refresh_sub);
+  priv->refresh_sub = NULL;
+
+  guaca_sampler_unsubscribe (priv->sched_sub);
+  priv->sched_sub = NULL;
+
+  guaca_sampler_unsubscribe (priv->irq_sub);
+  priv->irq_sub = NULL;
+
+  guaca_sampler_unsubscribe (priv->pressure_sub);
+  priv->pressure_sub = NULL;
+
+  guaca_sampler_unsubscribe (priv->cpuidle_sub);
+  priv->cpuidle_sub = NULL;
+
+  guaca_proc_top_free (priv->proc_top);
+  priv->proc_top = NULL;
+
+  guaca_sched_stats_free (priv->sched_stats);
+  priv->sched_stats = NULL;
+
+  guaca_irq_stats_free (priv->irq_stats);
+  priv->irq_stats = NULL;
+
+  guaca_cpuidle_free (priv->cpuidle);
+  priv->cpuidle = NULL;
+
+  guaca_storage_test_free (priv->storage_test);
+  priv->storage_test   = NULL;
+  priv->storage_button = NULL;
+
+  guaca_bench_free (priv->bench);
+  priv->bench = NULL;
+
+  priv->bandwidth_label = NULL;
+  priv->simd_label      = NULL;
+
+  guaca_media_probe_free (priv->media_probe);
+  priv->media_probe = NULL;
+
+  priv->decoders_label = NULL;
+  priv->displays_label = NULL;
+
+  priv->top_cpu_label = NULL;
+  priv->top_rss_label = NULL;
+  priv->sched_label   = NULL;
+  priv->irq_label     = NULL;
+  priv->pressure_label = NULL;
+  priv->cpuidle_label  = NULL;
+}
+
+static void
+guaca_system_close_cb (void *dialog, GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+
+  mex_push_focus (MX_FOCUSABLE (priv->button));
+}
+
+static void
+guaca_system_dialog_mapped_cb (ClutterActor *dialog,
+                               GParamSpec   *pspec,
+                               GuacaSystem  *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *parent;
+
+  guaca_system_stop_refresh (self);
+  priv->profile_combo = NULL;
+  priv->vm_combo      = NULL;
+
+  parent = clutter_actor_get_parent (priv->dialog);
+  clutter_actor_remove_child (parent, priv->dialog);
+  priv->dialog = NULL;
+}
+
+/*
+ * Applies the selected CPU and VM profiles, if they changed; guacamayo-cpufreq
+ * reads the settings back from sysfs, and fails if any of them did not stick,
+ * guacamayo-vmtune rolls back all its changes if any of them fails.
+ */
+static void
+guaca_system_apply_profiles (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  int                 idx;
+
+  if (priv->profile_combo &&
+      (idx = mx_combo_box_get_index (MX_COMBO_BOX (priv->profile_combo))) >= 0 &&
+      idx != priv->profile_idx)
+    guaca_system_run_helper ("guacamayo-cpufreq", cpu_profiles[idx].name);
+
+  if (priv->vm_combo &&
+      (idx = mx_combo_box_get_index (MX_COMBO_BOX (priv->vm_combo))) >= 0 &&
+      idx != priv->vm_idx)
+    guaca_system_run_helper ("guacamayo-vmtune", guaca_vm_profiles[idx].name);
+}
+
+static gboolean
+guaca_system_close_dialog_cb (MxAction *unused, GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  const char         *hostname;
+
+  hostname = mx_entry_get_text (MX_ENTRY (priv->entry));
+  if (hostname && *hostname && g_strcmp0 (hostname, priv->hostname))
+    {
+      GError *error = NULL;
+      char   *cmd   = g_strdup_printf ("guacamayo-hostname %s", hostname);
+
+      /*
+       * Hostname changed, try to set.
+       */
+      if (!g_spawn_command_line_async (cmd, &error))
+        {
+          g_warning ("Failed to execute '%s': %", cmd, error->message);
+          g_clear_error (&error);
+        }
+
+      g_free (cmd);
+    }
+
+  guaca_system_apply_profiles (self);
+
+  /*
+   * Hide the dialog, this will trigger the default transition; once it is
+   * no longer visible, destroy it.
+   *
+   * We have to use the mapped property here; MxDialog runs custom animation
+   * using a timeline and the 'visible' property is set well before the
+   * animation finishes.
+   */
+  g_signal_connect (priv->dialog, "notify::mapped",
+                    G_CALLBACK (guaca_system_dialog_mapped_cb), self);
+  clutter_actor_hide (priv->dialog);
+  mex_push_focus (MX_FOCUSABLE (priv->button));
+
+  return FALSE;
+}
+
+static gboolean
+guaca_system_key_press_cb (ClutterActor    *actor,
+                           ClutterKeyEvent *event,
+                           GuacaSystem     *self)
+{
+  GUACA_INPUT_LATENCY_MARK (actor);
+
+  if (MEX_KEY_BACK (event->keyval))
+    {
+      guaca_system_close_dialog_cb (NULL, self);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static int
+thread_delta_cmp (gconstpointer a, gconstpointer b)
+{
+  const GuacaThreadStats *t1 = a;
+  const GuacaThreadStats *t2 = b;
+
+  if (t1->ticks == t2->ticks)
+    return 0;
+
+  return t1->ticks < t2->ticks ? 1 : -1;
+}
+
+/*
+ * Adds rows describing the resource usage of the media-explorer process
+ * itself, and how it changed since the dialog was last opened.
+ */
+static int
+guaca_system_add_self_stats (GuacaSystem  *self,
+                             ClutterActor *layout,
+                             int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  GuacaSelfStats     *now  = guaca_self_stats_collect ();
+  GuacaSelfStats     *prev = priv->self_last;
+  GuacaThreadStats   *busy;
+  ClutterActor       *label;
+  GString            *str;
+  char               *rss, *pss;
+  double              cpu;
+  guint               i, n;
+
+  str = g_string_new (NULL);
+
+  rss = guaca_format_memory (now->rss_kb);
+  g_string_append_printf (str, _("RSS %s"), rss);
+  g_free (rss);
+
+  if (now->pss_kb)
+    {
+      pss = guaca_format_memory (now->pss_kb);
+      g_string_append_printf (str, _(", PSS %s"), pss);
+      g_free (pss);
+    }
+
+  if (prev)
+    {
+      gint64 d = (gint64) now->rss_kb - (gint64) prev->rss_kb;
+
+      rss = guaca_format_memory (ABS (d));
+      g_string_append_printf (str, _(" (%s%s since last check)"),
+                              d < 0 ? "-" : "+", rss);
+      g_free (rss);
+    }
+
+  if (priv->self_first && priv->self_first != prev)
+    {
+      gint64 d = (gint64) now->rss_kb - (gint64) priv->self_first->rss_kb;
+
+      rss = guaca_format_memory (ABS (d));
+      g_string_append_printf (str, _(" (%s%s since first check)"),
+                              d < 0 ? "-" : "+", rss);
+      g_free (rss);
+    }
+
+  label = mx_label_new_with_text (_("Media Explorer:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (str->str);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  g_string_truncate (str, 0);
+  g_string_append_printf (str, _("%.1f s"),
+                          (double)(now->utime + now->stime) /
+                          sysconf (_SC_CLK_TCK));
+
+  if ((cpu = guaca_self_stats_cpu_usage (prev, now)) >= 0.0)
+    g_string_append_printf (str, _(" (%.1f %% since last check)"), cpu);
+
+  label = mx_label_new_with_text (_("CPU time:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (str->str);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  /*
+   * List the busiest threads; if we have a previous sample this is by the
+   * CPU time used since, otherwise by the total.
+   */
+  busy = g_memdup (now->threads, now->n_threads * sizeof (GuacaThreadStats));
+
+  for (i = 0; prev && i < now->n_threads; i++)
+    {
+      const GuacaThreadStats *t;
+
+      if ((t = guaca_self_stats_find_thread (prev, busy[i].tid)) &&
+          t->ticks <= busy[i].ticks)
+        busy[i].ticks -= t->ticks;
+    }
+
+  qsort (busy, now->n_threads, sizeof (GuacaThreadStats), thread_delta_cmp);
+
+  g_string_truncate (str, 0);
+  g_string_append_printf (str, "%u", now->n_threads);
+
+  for (i = 0, n = 0; i < now->n_threads && n < 3; i++)
+    {
+      if (!busy[i].ticks)
+        break;
+
+      g_string_append_printf (str, n ? ", %s %.1f s" : " (%s %.1f s",
+                              busy[i].comm,
+                              (double) busy[i].ticks / sysconf (_SC_CLK_TCK));
+      n++;
+    }
+
+  if (n)
+    g_string_append_c (str, ')');
+
+  g_free (busy);
+
+  label = mx_label_new_with_text (_("Threads:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (str->str);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  g_string_free (str, TRUE);
+
+  /*
+   * Keep the very first sample around for the long term trend.
+   */
+  if (!priv->self_first)
+    priv->self_first = now;
+  else if (prev != priv->self_first)
+    guaca_self_stats_free (prev);
+
+  priv->self_last = now;
+
+  return row;
+}
+
+static char *
+guaca_system_frame_stats_text (GuacaSystem *self)
+{
+  GuacaSystemPrivate   *priv = self->priv;
+  const GuacaHistogram *h;
+
+  h = guaca_frame_stats_get_histogram (priv->frame_stats);
+
+  if (!h->total)
+    {
+      if (guaca_frame_stats_get_enabled (priv->frame_stats))
+        return g_strdup (_("No frames recorded yet"));
+      else
+        return g_strdup (_("Disabled"));
+    }
+
+  return g_strdup_printf (_("p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, "
+                            "%" G_GUINT64_FORMAT " dropped "
+                            "(%" G_GUINT64_FORMAT " frames)"),
+                          guaca_histogram_percentile (h, 50.0) / 1000.0,
+                          guaca_histogram_percentile (h, 95.0) / 1000.0,
+                          guaca_histogram_percentile (h, 99.0) / 1000.0,
+                          guaca_frame_stats_get_dropped (priv->frame_stats),
+                          h->total);
+}
+
+static void
+guaca_system_frame_toggle_cb (ClutterActor *toggle,
+                              GParamSpec   *pspec,
+                              GuacaSystem  *self)
+{
+  GuacaSystemPrivate *priv   = self->priv;
+  gboolean            active = mx_toggle_get_active (MX_TOGGLE (toggle));
+
+  if (active)
+    guaca_frame_stats_reset (priv->frame_stats);
+
+  if (!guaca_frame_stats_set_enabled (priv->frame_stats, active))
+    g_warning ("Failed to enable frame timing, no stage");
+}
+
+static int
+guaca_system_add_frame_stats (GuacaSystem  *self,
+                              ClutterActor *layout,
+                              int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label, *toggle;
+  char               *text;
+
+  label = mx_label_new_with_text (_("Frame timing:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+  toggle = mx_toggle_new ();
+  mx_toggle_set_active (MX_TOGGLE (toggle),
+                        guaca_frame_stats_get_enabled (priv->frame_stats));
+  g_signal_connect (toggle, "notify::active",
+                    G_CALLBACK (guaca_system_frame_toggle_cb), self);
+  mx_table_insert_actor (MX_TABLE (layout), toggle, row++, 1);
+
+  text = guaca_system_frame_stats_text (self);
+  label = mx_label_new_with_text (text);
+  g_free (text);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  return row;
+}
+
+static char *
+guaca_system_processes_text (GuacaSystem *self, GuacaProcTopOrder order)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  GuacaProcInfo       procs[3];
+  GString            *str = g_string_new (NULL);
+  guint               i, n;
+
+  n = guaca_proc_top_get (priv->proc_top, order, procs, G_N_ELEMENTS (procs));
+
+  for (i = 0; i < n; i++)
+    {
+      char *rss = guaca_format_memory (procs[i].rss_kb);
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      g_string_append_printf (str, _("%s (%d): %.1f %%, %s"),
+                              procs[i].comm, procs[i].pid, procs[i].cpu, rss);
+      g_free (rss);
+    }
+
+  if (!n)
+    g_string_append (str, _("Measuring..."));
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+guaca_system_refresh_processes (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  char               *text;
+
+  if (!priv->proc_top)
+    return;
+
+  text = guaca_system_processes_text (self, GUACA_PROC_TOP_BY_CPU);
+  mx_label_set_text (MX_LABEL (priv->top_cpu_label), text);
+  g_free (text);
+
+  text = guaca_system_processes_text (self, GUACA_PROC_TOP_BY_RSS);
+  mx_label_set_text (MX_LABEL (priv->top_rss_label), text);
+  g_free (text);
+}
+
+static gpointer
+guaca_system_sample_sched (gpointer data)
+{
+  GuacaSchedStats *stats = data;
+  SchedSnapshot   *snapshot = g_new (SchedSnapshot, 1);
+
+  guaca_sched_stats_sample (stats);
+
+  snapshot->n_threads =
+    guaca_sched_stats_get_top (stats, snapshot->threads,
+                               G_N_ELEMENTS (snapshot->threads));
+  snapshot->has_wait  = guaca_sched_stats_has_wait (stats);
+
+  return snapshot;
+}
+
+/*
+ * Lists the media-explorer threads that waited the longest for a CPU over
+ * the last second, with their context switch rates.
+ */
+static void
+guaca_system_refresh_sched (GuacaSystem *self)
+{
+  GuacaSystemPrivate  *priv = self->priv;
+  const SchedSnapshot *snapshot;
+  GString             *str;
+  guint                i, n = 0;
+
+  if (!priv->sched_sub)
+    return;
+
+  if ((snapshot = guaca_sampler_peek (priv->sched_sub)))
+    n = snapshot->n_threads;
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      const GuacaSchedThread *t = &snapshot->threads[i];
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      if (snapshot->has_wait)
+        g_string_append_printf (str, _("%s: waited %.1f ms/s, ran %.1f ms/s, "
+                                       "%.0f/%.0f switches/s"),
+                                t->comm, t->wait_ms, t->run_ms,
+                                t->nvcsw_rate, t->nivcsw_rate);
+      else
+        g_string_append_printf (str, _("%s: ran %.1f ms/s, "
+                                       "%.0f/%.0f switches/s"),
+                                t->comm, t->run_ms, t->nvcsw_rate,
+                                t->nivcsw_rate);
+    }
+
+  if (!n)
+    g_string_append (str, _("Measuring..."));
+
+  mx_label_set_text (MX_LABEL (priv->sched_label), str->str);
+  g_string_free (str, TRUE);
+}
+
+static gpointer
+guaca_system_sample_irqs (gpointer data)
+{
+  GuacaIrqStats *stats = data;
+  IrqSnapshot   *snapshot = g_new (IrqSnapshot, 1);
+
+  guaca_irq_stats_sample (stats);
+
+  snapshot->n_sources =
+    guaca_irq_stats_get_top (stats, snapshot->sources,
+                             G_N_ELEMENTS (snapshot->sources));
+
+  return snapshot;
+}
+
+/*
+ * Lists the busiest interrupt sources over the last second, with the CPU
+ * that handled most of each.
+ */
+static void
+guaca_system_refresh_irqs (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  const IrqSnapshot  *snapshot;
+  GString            *str;
+  guint               i, n = 0;
+
+  if (!priv->irq_sub)
+    return;
+
+  if ((snapshot = guaca_sampler_peek (priv->irq_sub)))
+    n = snapshot->n_sources;
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      const GuacaIrqSource *s = &snapshot->sources[i];
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      if (s->softirq)
+        g_string_append_printf (str, _("%s (softirq): %.0f/s, %.0f/s on "
+                                       "CPU%u"),
+                                s->name, s->rate, s->max_cpu_rate,
+                                s->max_cpu);
+      else
+        g_string_append_printf (str, _("%s: %.0f/s, %.0f/s on CPU%u"),
+                                *s->desc ? s->desc : s->name, s->rate,
+                                s->max_cpu_rate, s->max_cpu);
+    }
+
+  if (!n)
+    g_string_append (str, _("Measuring..."));
+
+  mx_label_set_text (MX_LABEL (priv->irq_label), str->str);
+  g_string_free (str, TRUE);
+}
+
+static gpointer
+guaca_system_sample_pressure (gpointer data)
+{
+  PressureSnapshot *snapshot = g_new (PressureSnapshot, 1);
+
+  snapshot->n_groups =
+    guaca_cgroup_stats_get (GUACA_CGROUP_DIR, snapshot->groups,
+                            G_N_ELEMENTS (snapshot->groups));
+
+  return snapshot;
+}
+
+/*
+ * Lists how much of the last 10 seconds the tasks of each of our cgroups
+ * were stalled waiting for CPU, IO or memory.
+ */
+static void
+guaca_system_refresh_pressure (GuacaSystem *self)
+{
+  GuacaSystemPrivate     *priv = self->priv;
+  const PressureSnapshot *snapshot;
+  GString                *str;
+  guint                   i;
+
+  if (!priv->pressure_sub)
+    return;
+
+  if (!(snapshot = guaca_sampler_peek (priv->pressure_sub)))
+    {
+      mx_label_set_text (MX_LABEL (priv->pressure_label), _("Measuring..."));
+      return;
+    }
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < snapshot->n_groups; i++)
+    {
+      const GuacaCgroupInfo *g = &snapshot->groups[i];
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      if (g->cpu_some < 0.0 && g->io_some < 0.0 && g->memory_some < 0.0)
+        g_string_append_printf (str, _("%s: no pressure information"),
+                                g->name);
+      else
+        g_string_append_printf (str, _("%s: CPU %.1f%%, IO %.1f%%, "
+                                       "memory %.1f%%"),
+                                g->name, MAX (g->cpu_some, 0.0),
+                                MAX (g->io_some, 0.0),
+                                MAX (g->memory_some, 0.0));
+
+      if (g->memory_current)
+        g_string_append_printf (str, _(", using %" G_GUINT64_FORMAT " MB"),
+                                g->memory_current >> 20);
+    }
+
+  mx_label_set_text (MX_LABEL (priv->pressure_label), str->str);
+  g_string_free (str, TRUE);
+}
+
+static gpointer
+guaca_system_sample_cpuidle (gpointer data)
+{
+  GuacaCpuidle    *idle = data;
+  CpuidleSnapshot *snapshot = g_new (CpuidleSnapshot, 1);
+
+  guaca_cpuidle_sample (idle);
+
+  snapshot->n_states =
+    guaca_cpuidle_get_states (idle, snapshot->states,
+                              G_N_ELEMENTS (snapshot->states));
+  snapshot->qos      = guaca_cpuidle_get_qos_latency (idle);
+
+  return snapshot;
+}
+
+/*
+ * Lists the share of the time the CPUs spent in each idle state, and how
+ * often they entered it, with the PM QoS limit on the exit latency.
+ */
+static void
+guaca_system_refresh_cpuidle (GuacaSystem *self)
+{
+  GuacaSystemPrivate    *priv = self->priv;
+  const CpuidleSnapshot *snapshot;
+  GString               *str;
+  guint                  i, n = 0;
+
+  if (!priv->cpuidle_sub)
+    return;
+
+  if ((snapshot = guaca_sampler_peek (priv->cpuidle_sub)))
+    n = snapshot->n_states;
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      const GuacaCpuidleState *s = &snapshot->states[i];
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      g_string_append_printf (str, _("%s (exit %u us): %.1f%%, %.0f/s"),
+                              s->name, s->latency, s->residency, s->rate);
+    }
+
+  if (!n)
+    g_string_append (str, _("Measuring..."));
+
+  if (snapshot && snapshot->qos >= 0)
+    g_string_append_printf (str, _("\nLatency limited to %d us by PM QoS"),
+                            snapshot->qos);
+
+  mx_label_set_text (MX_LABEL (priv->cpuidle_label), str->str);
+  g_string_free (str, TRUE);
+}
+
+/*
+ * Runs on the main loop right after the probes, on the same sampler
+ * wakeup.
+ */
+static void
+guaca_system_refresh_cb (gpointer data)
+{
+  GuacaSystem *self = data;
+
+  guaca_system_refresh_processes (self);
+  guaca_system_refresh_sched (self);
+  guaca_system_refresh_irqs (self);
+  guaca_system_refresh_pressure (self);
+  guaca_system_refresh_cpuidle (self);
+}
+
+/*
+ * Adds the processes using the most CPU and memory, so a runaway process can
+ * be spotted without logging into the box; the processes are only tracked
+ * while the dialog is open.
+ */
+static int
+guaca_system_add_processes (GuacaSystem  *self,
+                            ClutterActor *layout,
+                            int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+
+  if (!priv->proc_top &&
+      !(priv->proc_top = guaca_proc_top_new (REFRESH_INTERVAL_MS)))
+    return row;
+
+  label = mx_label_new_with_text (_("Top CPU:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->top_cpu_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->top_cpu_label, row++, 1);
+
+  label = mx_label_new_with_text (_("Top memory:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->top_rss_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->top_rss_label, row++, 1);
+
+  guaca_system_refresh_processes (self);
+
+  return row;
+}
+
+/*
+ * Adds the scheduler latency of the media-explorer threads; run queue
+ * delays, rather than CPU usage, are the usual cause of playback glitches.
+ */
+static int
+guaca_system_add_sched_stats (GuacaSystem  *self,
+                              ClutterActor *layout,
+                              int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+
+  if (!priv->sched_stats)
+    priv->sched_stats = guaca_sched_stats_new ();
+
+  if (!priv->sched_sub)
+    priv->sched_sub = guaca_sampler_subscribe (REFRESH_INTERVAL_MS,
+                                               guaca_system_sample_sched,
+                                               priv->sched_stats, g_free);
+
+  label = mx_label_new_with_text (_("Scheduling:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->sched_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->sched_label, row++, 1);
+
+  guaca_system_refresh_sched (self);
+
+  return row;
+}
+
+/*
+ * Adds the pressure stall information of the cgroups guacamayo-cgroups set
+ * up, i.e., whether the background work still gets in the way of playback.
+ */
+static int
+guaca_system_add_pressure (GuacaSystem  *self,
+                           ClutterActor *layout,
+                           int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+
+  if (!g_file_test (GUACA_CGROUP_DIR, G_FILE_TEST_IS_DIR))
+    return row;
+
+  if (!priv->pressure_sub)
+    priv->pressure_sub = guaca_sampler_subscribe (REFRESH_INTERVAL_MS,
+                                                  guaca_system_sample_pressure,
+                                                  NULL, g_free);
+
+  label = mx_label_new_with_text (_("Pressure:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->pressure_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->pressure_label, row++, 1);
+
+  guaca_system_refresh_pressure (self);
+
+  return row;
+}
+
+/*
+ * Adds the CPU idle state residency, on boxes with cpuidle; deep states
+ * save heat on fanless boxes, but their exit latency can cause underruns.
+ */
+static int
+guaca_system_add_cpuidle (GuacaSystem  *self,
+                          ClutterActor *layout,
+                          int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+
+  if (!priv->cpuidle)
+    priv->cpuidle = guaca_cpuidle_new ();
+
+  if (!guaca_cpuidle_get_n_states (priv->cpuidle))
+    {
+      guaca_cpuidle_free (priv->cpuidle);
+      priv->cpuidle = NULL;
+      return row;
+    }
+
+  if (!priv->cpuidle_sub)
+    priv->cpuidle_sub = guaca_sampler_subscribe (REFRESH_INTERVAL_MS,
+                                                 guaca_system_sample_cpuidle,
+                                                 priv->cpuidle, g_free);
+
+  label = mx_label_new_with_text (_("CPU idle:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->cpuidle_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->cpuidle_label, row++, 1);
+
+  guaca_system_refresh_cpuidle (self);
+
+  return row;
+}
+
+/*
+ * Adds the busiest interrupt sources; a flaky IR receiver or a network card
+ * in an interrupt storm shows up here as the cause of a laggy remote.
+ */
+static int
+guaca_system_add_irq_stats (GuacaSystem  *self,
+                            ClutterActor *layout,
+                            int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+
+  if (!priv->irq_stats)
+    priv->irq_stats = guaca_irq_stats_new ();
+
+  if (!priv->irq_sub)
+    priv->irq_sub = guaca_sampler_subscribe (REFRESH_INTERVAL_MS,
+                                             guaca_system_sample_irqs,
+                                             priv->irq_stats, g_free);
+
+  label = mx_label_new_with_text (_("Interrupts:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->irq_label = mx_label_new ();
+  mx_table_insert_actor (MX_TABLE (layout), priv->irq_label, row++, 1);
+
+  guaca_system_refresh_irqs (self);
+
+  return row;
+}
+
+/*
+ * Adds the choice of CPU performance profile, on boxes with cpufreq; boxes
+ * that stutter with the default governor can be switched to Playback.
+ */
+static int
+guaca_system_add_cpu_profile (GuacaSystem  *self,
+                              ClutterActor *layout,
+                              int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+  char               *saved = NULL;
+  int                 i;
+
+  if (!g_file_test ("/sys/devices/system/cpu/cpufreq", G_FILE_TEST_IS_DIR))
+    return row;
+
+  priv->profile_idx = -1;
+
+  if (g_file_get_contents (CPU_PROFILE_FILE, &saved, NULL, NULL))
+    {
+      g_strstrip (saved);
+
+      for (i = 0; i < G_N_ELEMENTS (cpu_profiles); i++)
+        if (!strcmp (saved, cpu_profiles[i].name))
+          priv->profile_idx = i;
+
+      g_free (saved);
+    }
+
+  label = mx_label_new_with_text (_("Performance:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+  priv->profile_combo = mx_combo_box_new ();
+
+  for (i = 0; i < G_N_ELEMENTS (cpu_profiles); i++)
+    mx_combo_box_append_text (MX_COMBO_BOX (priv->profile_combo),
+                              _(cpu_profiles[i].label));
+
+  if (priv->profile_idx >= 0)
+    mx_combo_box_set_index (MX_COMBO_BOX (priv->profile_combo),
+                            priv->profile_idx);
+
+  mx_table_insert_actor (MX_TABLE (layout), priv->profile_combo, row++, 1);
+
+  return row;
+}
+
+static int
+read_proc_int (const char *path)
+{
+  char *contents;
+  int   v = -1;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      v = atoi (contents);
+      g_free (contents);
+    }
+
+  return v;
+}
+
+/*
+ * Works out the VM profile in effect from the live settings, rather than
+ * from what guacamayo-vmtune saved, so changes made by other means show as
+ * the Default profile.
+ */
+static int
+guaca_system_get_vm_profile (void)
+{
+  char    *swaps = NULL;
+  gboolean zram;
+  int      swappiness, dirty_ratio, dirty_bg_bytes, i;
+
+  swappiness     = read_proc_int ("/proc/sys/vm/swappiness");
+  dirty_ratio    = read_proc_int ("/proc/sys/vm/dirty_ratio");
+  dirty_bg_bytes = read_proc_int ("/proc/sys/vm/dirty_background_bytes");
+
+  g_file_get_contents ("/proc/swaps", &swaps, NULL, NULL);
+  zram = swaps && strstr (swaps, "/dev/zram");
+  g_free (swaps);
+
+  for (i = 0; i < GUACA_N_VM_PROFILES; i++)
+    {
+      const GuacaVmProfile *p = &guaca_vm_profiles[i];
+
+      if (p->swappiness == swappiness &&
+          p->dirty_ratio == dirty_ratio &&
+          p->dirty_background_bytes == dirty_bg_bytes &&
+          !p->zram_percent == !zram)
+        return i;
+    }
+
+  return 0;
+}
+
+/*
+ * Adds the choice of VM profile; on boxes with 512 MB or less, writeback
+ * bursts while recording and swapping to SD are what stall playback.
+ */
+static int
+guaca_system_add_vm_profile (GuacaSystem  *self,
+                             ClutterActor *layout,
+                             int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  ClutterActor       *label;
+  int                 i;
+
+  priv->vm_idx = guaca_system_get_vm_profile ();
+
+  label = mx_label_new_with_text (_("Memory profile:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+  priv->vm_combo = mx_combo_box_new ();
+
+  for (i = 0; i < GUACA_N_VM_PROFILES; i++)
+    mx_combo_box_append_text (MX_COMBO_BOX (priv->vm_combo),
+                              _(guaca_vm_profiles[i].label));
+
+  mx_combo_box_set_index (MX_COMBO_BOX (priv->vm_combo), priv->vm_idx);
+  mx_table_insert_actor (MX_TABLE (layout), priv->vm_combo, row++, 1);
+
+  return row;
+}
+
+static void
+guaca_system_bench_done_cb (const GuacaBenchResult *result, GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  char               *text;
+
+  text = g_strdup_printf (_("copy %.0f MB/s, triad %.0f MB/s"),
+                          result->copy_mbs, result->triad_mbs);
+  mx_label_set_text (MX_LABEL (priv->bandwidth_label), text);
+  g_free (text);
+
+  text = g_strdup_printf (_("%s, %.0f MB/s"), result->simd, result->simd_mbs);
+  mx_label_set_text (MX_LABEL (priv->simd_label), text);
+  g_free (text);
+
+  /* called from the idle the benchmark added, which is done with it */
+  if (priv->bench)
+    {
+      guaca_bench_free (priv->bench);
+      priv->bench = NULL;
+    }
+}
+
+/*
+ * Adds the memory bandwidth and SIMD throughput, which decide whether the
+ * box can decode high resolution video in software; they are measured
+ * once per boot, in the background.
+ */
+static int
+guaca_system_add_bench (GuacaSystem  *self,
+                        ClutterActor *layout,
+                        int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  GuacaBenchResult    result;
+  ClutterActor       *label;
+
+  label = mx_label_new_with_text (_("Memory bandwidth:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->bandwidth_label = mx_label_new_with_text (_("Measuring..."));
+  mx_table_insert_actor (MX_TABLE (layout), priv->bandwidth_label, row++, 1);
+
+  label = mx_label_new_with_text (_("SIMD:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->simd_label = mx_label_new_with_text (_("Measuring..."));
+  mx_table_insert_actor (MX_TABLE (layout), priv->simd_label, row++, 1);
+
+  if (guaca_bench_lookup (&result))
+    guaca_system_bench_done_cb (&result, self);
+  else if (!priv->bench)
+    priv->bench = guaca_bench_start ((GuacaBenchFunc)
+                                     guaca_system_bench_done_cb, self);
+
+  return row;
+}
+
+static char *
+guaca_system_decoders_text (const GuacaMediaCaps *caps)
+{
+  GString *str = g_string_new (NULL);
+  int      i, j;
+
+  for (i = 0; i < caps->n_decoders; i++)
+    {
+      const GuacaMediaDecoder *dec = &caps->decoders[i];
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      g_string_append_printf (str, "%s:", dec->card);
+
+      for (j = 0; j < dec->n_codecs; j++)
+        g_string_append_printf (str, j ? ", %s %ux%u" : " %s %ux%u",
+                                dec->codecs[j].name,
+                                dec->codecs[j].max_width,
+                                dec->codecs[j].max_height);
+    }
+
+  if (!caps->n_decoders)
+    g_string_append (str, _("None, software decoding only"));
+
+  return g_string_free (str, FALSE);
+}
+
+/*
+ * Lists the refresh rates each display has at its preferred size; without
+ * 24 Hz, films are shown with 3:2 pulldown, and judder.
+ */
+static char *
+guaca_system_displays_text (const GuacaMediaCaps *caps)
+{
+  GString *str = g_string_new (NULL);
+  int      i, j;
+
+  for (i = 0; i < caps->n_displays; i++)
+    {
+      const GuacaMediaDisplay *display = &caps->displays[i];
+      gboolean                 first = TRUE;
+
+      if (i)
+        g_string_append_c (str, '\n');
+
+      g_string_append_printf (str, "%s: %ux%u", display->connector,
+                              display->preferred.width,
+                              display->preferred.height);
+
+      for (j = 0; j < display->n_modes; j++)
+        {
+          const GuacaMediaMode *m = &display->modes[j];
+
+          if (m->width != display->preferred.width ||
+              m->height != display->preferred.height || !m->refresh)
+            continue;
+
+          g_string_append_printf (str, "%s%.2f", first ? " @ " : ", ",
+                                  m->refresh);
+          first = FALSE;
+        }
+
+      if (!first)
+        g_string_append (str, " Hz");
+
+      if (display->n_modes && display->modes[0].refresh &&
+          !guaca_media_display_has_refresh (display, 24.0))
+        g_string_append (str, _(", no 24 Hz mode, films will judder"));
+    }
+
+  if (!caps->n_displays)
+    g_string_append (str, _("None connected"));
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+guaca_system_media_caps_cb (const GuacaMediaCaps *caps, GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  char               *text;
+
+  text = guaca_system_decoders_text (caps);
+  mx_label_set_text (MX_LABEL (priv->decoders_label), text);
+  g_free (text);
+
+  text = guaca_system_displays_text (caps);
+  mx_label_set_text (MX_LABEL (priv->displays_label), text);
+  g_free (text);
+
+  if (priv->media_probe)
+    {
+      guaca_media_probe_free (priv->media_probe);
+      priv->media_probe = NULL;
+    }
+}
+
+/*
+ * Adds the hardware decoders and the display modes, which decide whether
+ * playback works at all, and whether it is smooth; they are probed once
+ * per boot, in the background.
+ */
+static int
+guaca_system_add_media_caps (GuacaSystem  *self,
+                             ClutterActor *layout,
+                             int           row)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  GuacaMediaCaps      caps;
+  ClutterActor       *label;
+
+  label = mx_label_new_with_text (_("Video decoders:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->decoders_label = mx_label_new_with_text (_("Probing..."));
+  mx_table_insert_actor (MX_TABLE (layout), priv->decoders_label, row++, 1);
+
+  label = mx_label_new_with_text (_("Displays:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->displays_label = mx_label_new_with_text (_("Probing..."));
+  mx_table_insert_actor (MX_TABLE (layout), priv->displays_label, row++, 1);
+
+  if (guaca_media_caps_lookup (&caps))
+    guaca_system_media_caps_cb (&caps, self);
+  else if (!priv->media_probe)
+    priv->media_probe =
+      guaca_media_probe_start ((GuacaMediaProbeFunc)
+                               guaca_system_media_caps_cb, self);
+
+  return row;
+}
+
+/*
+ * Adds the startup timeline of this boot, and the times to the first paint
+ * of the previous ones, with their software versions and resident memory
+ * then, so that a release that starts slower, or bigger, stands out.
+ */
+static int
+guaca_system_add_startup (GuacaSystem  *self,
+                          ClutterActor *layout,
+                          int           row)
+{
+  const GuacaStartupTimeline *t = guaca_startup_get_timeline ();
+  const double               *m = t->marks;
+  GuacaStartupTimeline       *history;
+  ClutterActor               *label;
+  GString                    *str;
+  char                       *text;
+  int                         n, i, shown;
+
+  if (!m[GUACA_STARTUP_PAINT] || !m[GUACA_STARTUP_PROCESS])
+    return row;
+
+  text = g_strdup_printf (_("%.1f s to the first frame: kernel %.1f s, "
+                            "system %.1f s, media explorer %.1f s, "
+                            "plugins %.1f s, first paint %.1f s"),
+                          m[GUACA_STARTUP_PAINT],
+                          m[GUACA_STARTUP_INIT],
+                          m[GUACA_STARTUP_PROCESS] - m[GUACA_STARTUP_INIT],
+                          m[GUACA_STARTUP_PLUGIN] - m[GUACA_STARTUP_PROCESS],
+                          m[GUACA_STARTUP_UI] - m[GUACA_STARTUP_PLUGIN],
+                          m[GUACA_STARTUP_PAINT] - m[GUACA_STARTUP_UI]);
+
+  label = mx_label_new_with_text (_("Startup:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (text);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+  g_free (text);
+
+  history = guaca_startup_load_history (&n);
+  str     = g_string_new (NULL);
+
+  /* the most recent first, skipping this boot */
+  for (i = n - 1, shown = 0; i >= 0 && shown < 5; i--)
+    {
+      if (!strcmp (history[i].boot_id, t->boot_id))
+        continue;
+
+      if (history[i].rss_kb)
+        {
+          char *rss = guaca_format_memory (history[i].rss_kb);
+
+          g_string_append_printf (str, _("%s%.1f s, %s resident (%s)"),
+                                  shown ? "\n" : "",
+                                  history[i].marks[GUACA_STARTUP_PAINT],
+                                  rss, history[i].version);
+          g_free (rss);
+        }
+      else
+        g_string_append_printf (str, _("%s%.1f s (%s)"), shown ? "\n" : "",
+                                history[i].marks[GUACA_STARTUP_PAINT],
+                                history[i].version);
+      shown++;
+    }
+
+  if (shown)
+    {
+      label = mx_label_new_with_text (_("Previous boots:"));
+      mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+      label = mx_label_new_with_text (str->str);
+      mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+    }
+
+  g_string_free (str, TRUE);
+  g_free (history);
+
+  return row;
+}
+
+/*
+ * The time a storage test takes; long enough to get past the caches of the
+ * drive, short enough to sit through.
+ */
+#define STORAGE_TEST_MS 10000
+
+static char *
+guaca_system_storage_text (const char               *path,
+                           const GuacaStorageResult *result)
+{
+  char       *name = g_path_get_basename (path);
+  const char *tier;
+  char       *text;
+
+  if (!result)
+    text = g_strdup_printf (_("%s: not tested"), name);
+  else if ((tier = guaca_storage_result_get_tier (result)))
+    text = g_strdup_printf (_("%s: %.1f MB/s, p99 %.0f ms, up to %s"),
+                            name, result->seq_mbs, result->seq_p99_ms, tier);
+  else
+    text = g_strdup_printf (_("%s: %.1f MB/s, p99 %.0f ms, too slow for "
+                              "video"),
+                            name, result->seq_mbs, result->seq_p99_ms);
+
+  g_free (name);
+
+  return text;
+}
+
+static void
+guaca_system_storage_done_cb (const char               *path,
+                              const GuacaStorageResult *result,
+                              const GError             *error,
+                              GuacaSystem              *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  char               *text;
+
+  if (error)
+    {
+      char *name = g_path_get_basename (path);
+
+      text = g_strdup_printf (_("%s: %s"), name, error->message);
+      g_free (name);
+    }
+  else
+    text = guaca_system_storage_text (path, result);
+
+  mx_button_set_label (MX_BUTTON (priv->storage_button), text);
+  g_free (text);
+
+  guaca_storage_test_free (priv->storage_test);
+  priv->storage_test   = NULL;
+  priv->storage_button = NULL;
+}
+
+static void
+guaca_system_storage_clicked_cb (MxButton *button, GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  const char         *path = g_object_get_data (G_OBJECT (button), "path");
+  char               *name, *text;
+
+  /* one at a time, or they would only measure each other */
+  if (priv->storage_test)
+    return;
+
+  name = g_path_get_basename (path);
+  text = g_strdup_printf (_("%s: testing..."), name);
+  mx_button_set_label (button, text);
+  g_free (text);
+  g_free (name);
+
+  priv->storage_button = CLUTTER_ACTOR (button);
+  priv->storage_test =
+    guaca_storage_test_start (path, STORAGE_TEST_MS,
+                              (GuacaStorageTestFunc)
+                              guaca_system_storage_done_cb,
+                              self);
+}
+
+/*
+ * Adds a button per media volume, showing whether it can keep up with
+ * video at the usual bitrates; the test reads the largest files on the
+ * volume, so is started by hand.
+ */
+static int
+guaca_system_add_storage (GuacaSystem  *self,
+                          ClutterActor *layout,
+                          int           row)
+{
+  ClutterActor *label, *button;
+  char        **volumes, **v;
+  int           n;
+
+  volumes = guaca_storage_list_volumes ();
+
+  if (!*volumes)
+    {
+      g_strfreev (volumes);
+      return row;
+    }
+
+  label = mx_label_new_with_text (_("Storage:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+
+  for (v = volumes, n = 0; *v && n < 4; v++, n++)
+    {
+      GuacaStorageResult result;
+      char              *text;
+
+      text = guaca_system_storage_text (*v,
+                                        guaca_storage_test_lookup (*v, &result)
+                                        ? &result : NULL);
+      button = mx_button_new_with_label (text);
+      g_free (text);
+
+      g_object_set_data_full (G_OBJECT (button), "path",
+                              g_strdup (*v), g_free);
+      g_signal_connect (button, "clicked",
+                        G_CALLBACK (guaca_system_storage_clicked_cb), self);
+      mx_table_insert_actor (MX_TABLE (layout), button, row++, 1);
+    }
+
+  g_strfreev (volumes);
+
+  return row;
+}
+
+#ifdef ENABLE_INPUT_LATENCY
+/*
+ * Adds the latency from remote control input to the next paint, as
+ * measured in all the settings dialogs.
+ */
+static int
+guaca_system_add_input_latency (GuacaSystem  *self,
+                                ClutterActor *layout,
+                                int           row)
+{
+  GuacaSystemPrivate   *priv = self->priv;
+  const GuacaHistogram *h;
+  ClutterActor         *label;
+  char                 *text;
+
+  if (!guaca_input_latency_enabled ())
+    return row;
+
+  h = guaca_input_latency_get_histogram (priv->transient_for);
+
+  if (h && h->total)
+    text = g_strdup_printf (_("p50 %.1f ms, p95 %.1f ms, p99 %.1f ms "
+                              "(%" G_GUINT64_FORMAT " inputs)"),
+                            guaca_histogram_percentile (h, 50.0) / 1000.0,
+                            guaca_histogram_percentile (h, 95.0) / 1000.0,
+                            guaca_histogram_percentile (h, 99.0) / 1000.0,
+                            h->total);
+  else
+    text = g_strdup (_("No input recorded yet"));
+
+  label = mx_label_new_with_text (_("Input latency:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (text);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+  g_free (text);
+
+  return row;
+}
+#endif
+
+/*
+ * Builds and shows the dialog; called by the plugin each time it is opened.
+ */
+G_MODULE_EXPORT void
+guaca_system_dialog_open (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv = self->priv;
+  struct SystemInfo  *info = guaca_system_info_get ();
+  ClutterActor       *dialog, *layout, *label, *entry;
+  MxAction           *close;
+  char               *text;
+  int                 row = 0;
+
+  dialog = mx_dialog_new ();
+  mx_stylable_set_style_class (MX_STYLABLE (dialog), "MexInfoBarDialog");
+
+  close = mx_action_new_full ("close", _("Close"),
+                              G_CALLBACK (guaca_system_close_dialog_cb), self);
+  mx_dialog_add_action (MX_DIALOG (dialog), close);
+
+  layout = mx_table_new ();
+  mx_table_set_column_spacing (MX_TABLE (layout), 10);
+  mx_table_set_row_spacing (MX_TABLE (layout), 20);
+  mx_bin_set_child (MX_BIN (dialog), layout);
+
+  label = mx_label_new_with_text (_("System Settings"));
+  mx_stylable_set_style_class (MX_STYLABLE (label), "DialogHeader");
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 0);
+
+  label = mx_label_new_with_text (_("Device name:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  priv->entry = entry = mx_entry_new_with_text (info->hostname);
+  g_free (priv->hostname);
+  priv->hostname = g_strdup (info->hostname);
+
+  mx_table_insert_actor (MX_TABLE (layout), entry, row++, 1);
+
+  label = mx_label_new_with_text (_("Software:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (GUACAMAYO_DISTRO_STRING);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  label = mx_label_new_with_text (_("Processor:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  label = mx_label_new_with_text (info->cpu_model);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  label = mx_label_new_with_text (_("Cores:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  text = g_strdup_printf ("%d", info->cores);
+  label = mx_label_new_with_text (text);
+  g_free (text);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  label = mx_label_new_with_text (_("Memory:"));
+  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
+  text = g_strdup_printf (_("%s (free %s)"),
+                          info->total_memory, info->free_memory);
+  label = mx_label_new_with_text (text);
+  g_free (text);
+  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
+
+  row = guaca_system_add_bench (self, layout, row);
+  row = guaca_system_add_media_caps (self, layout, row);
+  row = guaca_system_add_startup (self, layout, row);
+  row = guaca_system_add_cpu_profile (self, layout, row);
+  row = guaca_system_add_vm_profile (self, layout, row);
+  row = guaca_system_add_self_stats (self, layout, row);
+  row = guaca_system_add_frame_stats (self, layout, row);
+#ifdef ENABLE_INPUT_LATENCY
+  row = guaca_system_add_input_latency (self, layout, row);
+#endif
+  row = guaca_system_add_processes (self, layout, row);
+  row = guaca_system_add_sched_stats (self, layout, row);
+  row = guaca_system_add_irq_stats (self, layout, row);
+  row = guaca_system_add_pressure (self, layout, row);
+  row = guaca_system_add_cpuidle (self, layout, row);
+  row = guaca_system_add_storage (self, layout, row);
+
+  /*
+   * The live rows are updated every second while the dialog is open, on the
+   * sampler wakeups that take their snapshots.
+   */
+  if (!priv->refresh_sub)
+    priv->refresh_sub = guaca_sampler_subscribe_main (REFRESH_INTERVAL_MS,
+                                                      guaca_system_refresh_cb,
+                                                      self);
+
+  mx_dialog_set_transient_parent (MX_DIALOG (dialog), priv->transient_for);
+  g_signal_connect (dialog, "key-press-event",
+                    G_CALLBACK (guaca_system_key_press_cb), self);
+
+  priv->dialog = dialog;
+
+  clutter_actor_show (dialog);
+  mex_push_focus (MX_FOCUSABLE (dialog));
+
+  guaca_system_info_free (info);
+}
+
+/*
+ * Called by the plugin as it is disposed of.
+ */
+G_MODULE_EXPORT void
+guaca_system_dialog_dispose (GuacaSystem *self)
+{
+  guaca_system_stop_refresh (self);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-system-private.h"
+
+#include <sys/wait.h>
+
+static void
+guaca_system_helper_cb (GPid pid, gint status, char *helper)
+{
+  g_spawn_close_pid (pid);
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status))
+    g_warning ("%s failed with status %d", helper, status);
+
+  g_free (helper);
+}
+
+/*
+ * Runs one of the suid setters, which apply and verify the settings
+ * themselves; we only report when they fail.
+ */
+void
+guaca_system_run_helper (const char *helper, const char *arg)
+{
+  GError *error  = NULL;
+  char   *argv[] = { (char *) helper, (char *) arg, NULL };
+  GPid    pid;
+
+  if (!g_spawn_async (NULL, argv, NULL,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                      NULL, NULL, &pid, &error))
+    {
+      g_warning ("Failed to execute %s: %s", helper, error->message);
+      g_clear_error (&error);
+      return;
+    }
+
+  g_child_watch_add (pid, (GChildWatchFunc) guaca_system_helper_cb,
+                     g_strdup (helper));
+}
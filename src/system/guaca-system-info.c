@@ -0,0 +1,195 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-system-info.h"
+#include "guaca-metrics.h"
+
+#include <guacamayo-version.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Formats a memory size given in KB for display.
+ */
+char *
+guaca_format_memory (double m)
+{
+  const char *u = "KB";
+
+  if (m > 1024*1024)
+    {
+      m /= (1024*1024);
+      u = "GB";
+    }
+  else if (m > 1024)
+    {
+      m /= 1024;
+      u = "MB";
+    }
+
+  return g_strdup_printf ("%.2f %s", m, u);
+}
+
+void
+guaca_system_info_free (struct SystemInfo *info)
+{
+  g_free (info->total_memory);
+  g_free (info->free_memory);
+  g_free (info->cpu_model);
+  g_free (info->hostname);
+  g_slice_free (struct SystemInfo, info);
+}
+
+struct SystemInfo *
+guaca_system_info_get (void)
+{
+  struct SystemInfo *info = g_slice_new0 (struct SystemInfo);
+  FILE *f;
+  char buf[LINE_MAX];
+
+  if ((f = fopen ("/proc/meminfo", "r")))
+    {
+      while (fgets(buf, sizeof (buf), f))
+        {
+          if (!strncmp ("MemTotal:", buf, strlen ("MemTotal:")))
+            {
+              guint64 m = strtol (buf+strlen ("MemTotal:"), NULL, 10);
+
+              info->total_memory_kb = m;
+              info->total_memory    = guaca_format_memory (m);
+
+              if (info->free_memory)
+                break;
+            }
+          else if (!strncmp ("MemFree:", buf, strlen ("MemFree:")))
+            {
+              guint64 m = strtol (buf+strlen ("MemFree:"), NULL, 10);
+
+              info->free_memory_kb = m;
+              info->free_memory    = guaca_format_memory (m);
+
+              if (info->total_memory)
+                break;
+            }
+        }
+
+      fclose (f);
+    }
+
+  if ((f = fopen ("/proc/cpuinfo", "r")))
+    {
+      while (fgets(buf, sizeof (buf), f))
+        {
+          if (!strncmp ("processor", buf, strlen ("processor")))
+            {
+              info->cores++;
+            }
+          else if (!info->cpu_model &&
+                   !strncmp ("model name", buf, strlen ("model name")))
+            {
+              char *t;
+              int i;
+
+              struct _subs
+              {
+                const char *match;
+                const char *subst;
+                guint       c_flags;
+                guint       m_flags;
+              } subs[] =
+
+                {
+                  {"\\s*:\\s*(.*)\n*\r*$",    "\\1", 0, 0},
+                  {"cpu",                     "",    G_REGEX_CASELESS, 0},
+                  {"\\s{2,}",                 " ",   0, 0},
+                  {"\\(R\\)",                 "®",   G_REGEX_CASELESS, 0},
+                  {"\\(C\\)",                 "©",   G_REGEX_CASELESS, 0},
+                  {"\\(TM\\)",                "™",   G_REGEX_CASELESS, 0},
+                };
+
+              t = g_strdup (buf + strlen ("model name"));
+              for (i = 0; i < G_N_ELEMENTS(subs); ++i)
+                {
+                  GRegex     *r;
+                  char       *n;
+
+                  r = g_regex_new (subs[i].match, subs[i].c_flags, 0, NULL);
+                  n = g_regex_replace (r, t, -1, 0,
+                                       subs[i].subst, subs[i].m_flags, NULL);
+                  g_regex_unref (r);
+
+                  if (!n)
+                    {
+                      break;
+                    }
+                  else
+                    {
+                      g_free (t);
+                      t = n;
+                    }
+                }
+
+              info->cpu_model = t;
+            }
+        }
+
+      fclose (f);
+    }
+
+  if (!gethostname (buf, sizeof (buf)))
+    {
+      buf[sizeof (buf) - 1] = 0;
+      info->hostname = g_strdup (buf);
+    }
+
+  return info;
+}
+
+/*
+ * GuacaMetricsFunc exporting the system information.
+ */
+void
+guaca_system_info_write_metrics (GString *out, gpointer data)
+{
+  struct SystemInfo *info = guaca_system_info_get ();
+  const char        *labels[] =
+    {
+      "hostname",  info->hostname,
+      "cpu_model", info->cpu_model,
+      "software",  GUACAMAYO_DISTRO_STRING,
+      NULL
+    };
+
+  guaca_metrics_write_info (out, "guacamayo_system_info",
+                            "Static information about the system.", labels);
+  guaca_metrics_write (out, "guacamayo_memory_total_bytes", "gauge",
+                       "Total usable memory.", info->total_memory_kb * 1024.0);
+  guaca_metrics_write (out, "guacamayo_memory_free_bytes", "gauge",
+                       "Free memory.", info->free_memory_kb * 1024.0);
+  guaca_metrics_write (out, "guacamayo_cpu_cores", "gauge",
+                       "Number of processor cores.", info->cores);
+
+  guaca_system_info_free (info);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/* Static system information shown by the System Settings plugin */
+
+#ifndef __GUACA_SYSTEM_INFO_H__
+#define __GUACA_SYSTEM_INFO_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+struct SystemInfo
+{
+  char    *total_memory;
+  char    *free_memory;
+  guint64  total_memory_kb;
+  guint64  free_memory_kb;
+  guint    cores;
+  char    *cpu_model;
+  char    *hostname;
+};
+
+struct SystemInfo *guaca_system_info_get  (void);
+void               guaca_system_info_free (struct SystemInfo *info);
+
+char              *guaca_format_memory    (double kb);
+
+void               guaca_system_info_write_metrics (GString  *out,
+                                                    gpointer  data);
+
+G_END_DECLS
+
+#endif /* __GUACA_SYSTEM_INFO_H__ */
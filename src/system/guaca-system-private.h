@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2010, 2011 Intel Corporation.
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+/*
+ * What the System plugin shares with its dialog module, which is loaded
+ * when the dialog is first opened.
+ */
+
+#ifndef __GUACA_SYSTEM_PRIVATE_H__
+#define __GUACA_SYSTEM_PRIVATE_H__
+
+#include "guaca-system.h"
+#include "guaca-self-stats.h"
+#include "guaca-frame-stats.h"
+#include "guaca-metrics.h"
+#include "guaca-flightrec.h"
+#include "guaca-proc-top.h"
+#include "guaca-sched-stats.h"
+#include "guaca-irq-stats.h"
+#include "guaca-storage-test.h"
+#include "guaca-bench.h"
+#include "guaca-media-caps.h"
+#include "guaca-cpuidle.h"
+#include "guaca-input-latency.h"
+#include "guaca-sampler.h"
+
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+struct _GuacaSystemPrivate
+{
+  ClutterActor *button;
+  ClutterActor *dialog;
+  ClutterActor *transient_for;
+  ClutterActor *entry;
+
+  char         *hostname;
+
+  /*
+   * The resource usage of the media-explorer process the last time the
+   * dialog was opened, and when it was first opened, so we can show trends.
+   */
+  GuacaSelfStats *self_first;
+  GuacaSelfStats *self_last;
+
+  GuacaFrameStats *frame_stats;
+
+  GuacaMetrics    *metrics;
+#ifdef ENABLE_INPUT_LATENCY
+  GuacaInputLatencyExport *input_latency;
+#endif
+
+  GuacaFlightrec  *flightrec;
+
+  /*
+   * Only running while the dialog is shown; the probes run on the sampler
+   * thread, and refresh_sub updates the labels from their snapshots.
+   */
+  GuacaProcTop    *proc_top;
+  ClutterActor    *top_cpu_label;
+  ClutterActor    *top_rss_label;
+  GuacaSchedStats *sched_stats;
+  GuacaSamplerSub *sched_sub;
+  ClutterActor    *sched_label;
+  GuacaIrqStats   *irq_stats;
+  GuacaSamplerSub *irq_sub;
+  ClutterActor    *irq_label;
+  GuacaSamplerSub *pressure_sub;
+  ClutterActor    *pressure_label;
+  GuacaCpuidle    *cpuidle;
+  GuacaSamplerSub *cpuidle_sub;
+  ClutterActor    *cpuidle_label;
+  GuacaSamplerSub *refresh_sub;
+
+  GuacaBench      *bench;
+  ClutterActor    *bandwidth_label;
+  ClutterActor    *simd_label;
+  GuacaMediaProbe *media_probe;
+  ClutterActor    *decoders_label;
+  ClutterActor    *displays_label;
+
+  /* the storage test running, and the button of the volume it tests */
+  GuacaStorageTest *storage_test;
+  ClutterActor     *storage_button;
+
+  ClutterActor    *profile_combo;
+  int              profile_idx;
+  ClutterActor    *vm_combo;
+  int              vm_idx;
+
+  /* the entry points of the dialog module, once it is loaded */
+  void           (*dialog_open)    (GuacaSystem *self);
+  void           (*dialog_dispose) (GuacaSystem *self);
+
+  guint disposed : 1;
+};
+
+/* linked into both the plugin and the dialog module */
+void guaca_system_run_helper     (const char  *helper,
+                                  const char  *arg);
+
+/* in the dialog module */
+void guaca_system_dialog_open    (GuacaSystem *self);
+void guaca_system_dialog_dispose (GuacaSystem *self);
+
+G_END_DECLS
+
+#endif /* __GUACA_SYSTEM_PRIVATE_H__ */
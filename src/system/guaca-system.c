@@ -19,165 +19,21 @@
 #include "config.h"
 #endif
 
-#include "guaca-system.h"
+#include "guaca-system-private.h"
+#include "guaca-system-info.h"
+#include "guaca-sampler.h"
+#include "guaca-flightrec-format.h"
+#include "guaca-startup.h"
+#include "guaca-input-latency.h"
+#include "guaca-dialog-module.h"
 
 #include <guacamayo-version.h>
-#include <limits.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
 
 #include <glib/gi18n-lib.h>
 #include <gmodule.h>
 #include <mex/mex.h>
 #include <mex/mex-info-bar-component.h>
 
-struct SystemInfo
-{
-  char  *total_memory;
-  char  *free_memory;
-  guint  cores;
-  char  *cpu_model;
-  char  *hostname;
-};
-
-free_system_info (struct SystemInfo *info)
-{
-  g_free (info->total_memory);
-  g_free (info->free_memory);
-  g_free (info->cpu_model);
-  g_free (info->hostname);
-  g_slice_free (struct SystemInfo, info);
-}
-
-static struct SystemInfo *
-get_system_info (void)
-{
-  struct SystemInfo *info = g_slice_new0 (struct SystemInfo);
-  FILE *f;
-  char buf[LINE_MAX];
-
-  if ((f = fopen ("/proc/meminfo", "r")))
-    {
-      while (fgets(buf, sizeof (buf), f))
-        {
-          if (!strncmp ("MemTotal:", buf, strlen ("MemTotal:")))
-            {
-              double m  = (double) strtol (buf+strlen ("MemTotal:"), NULL, 10);
-              const char *u = "KB";
-
-              if (m > 1024*1024)
-                {
-                  m /= (1024*1024);
-                  u = "GB";
-                }
-              else if (m > 1024)
-                {
-                  m /= 1024;
-                  u = "MB";
-                }
-
-              info->total_memory = g_strdup_printf ("%.2f %s", m, u);
-
-              if (info->free_memory)
-                break;
-            }
-          else if (!strncmp ("MemFree:", buf, strlen ("MemFree:")))
-            {
-              double m  = (double) strtol (buf+strlen ("MemFree:"), NULL, 10);
-              const char *u = "KB";
-
-              if (m > 1024*1024)
-                {
-                  m /= (1024*1024);
-                  u = "GB";
-                }
-              else if (m > 1024)
-                {
-                  m /= 1024;
-                  u = "MB";
-                }
-
-              info->free_memory = g_strdup_printf ("%.2f %s", m, u);
-
-              if (info->total_memory)
-                break;
-            }
-        }
-
-      fclose (f);
-    }
-
-  if ((f = fopen ("/proc/cpuinfo", "r")))
-    {
-      while (fgets(buf, sizeof (buf), f))
-        {
-          if (!strncmp ("processor", buf, strlen ("processor")))
-            {
-              info->cores++;
-            }
-          else if (!info->cpu_model &&
-                   !strncmp ("model name", buf, strlen ("model name")))
-            {
-              char *t;
-              int i;
-
-              struct _subs
-              {
-                const char *match;
-                const char *subst;
-                guint       c_flags;
-                guint       m_flags;
-              } subs[] =
-
-                {
-                  {"\\s*:\\s*(.*)\n*\r*$",    "\\1", 0, 0},
-                  {"cpu",                     "",    G_REGEX_CASELESS, 0},
-                  {"\\s{2,}",                 " ",   0, 0},
-                  {"\\(R\\)",                 "®",   G_REGEX_CASELESS, 0},
-                  {"\\(C\\)",                 "©",   G_REGEX_CASELESS, 0},
-                  {"\\(TM\\)",                "™",   G_REGEX_CASELESS, 0},
-                };
-
-              t = g_strdup (buf + strlen ("model name"));
-              for (i = 0; i < G_N_ELEMENTS(subs); ++i)
-                {
-                  GRegex     *r;
-                  char       *n;
-
-                  r = g_regex_new (subs[i].match, subs[i].c_flags, 0, NULL);
-                  n = g_regex_replace (r, t, -1, 0,
-                                       subs[i].subst, subs[i].m_flags, NULL);
-                  g_regex_unref (r);
-
-                  if (!n)
-                    {
-                      break;
-                    }
-                  else
-                    {
-                      g_free (t);
-                      t = n;
-                    }
-                }
-
-              info->cpu_model = t;
-            }
-        }
-
-      fclose (f);
-    }
-
-  if (!gethostname (buf, sizeof (buf)))
-    {
-      buf[sizeof (buf) - 1] = 0;
-      info->hostname = g_strdup (buf);
-    }
-
-  return info;
-}
-
 static void mex_info_bar_component_iface_init (MexInfoBarComponentIface *iface);
 static void guaca_system_dispose (GObject *object);
 static void guaca_system_finalize (GObject *object);
@@ -189,18 +45,6 @@ G_DEFINE_TYPE_WITH_CODE (GuacaSystem, guaca_system, G_TYPE_OBJECT,
 #define GUACA_SYSTEM_GET_PRIVATE(o) \
 (G_TYPE_INSTANCE_GET_PRIVATE ((o), GUACA_TYPE_SYSTEM, GuacaSystemPrivate))
 
-struct _GuacaSystemPrivate
-{
-  ClutterActor *button;
-  ClutterActor *dialog;
-  ClutterActor *transient_for;
-  ClutterActor *entry;
-
-  char         *hostname;
-
-  guint disposed : 1;
-};
-
 static void
 guaca_system_class_init (GuacaSystemClass *klass)
 {
@@ -212,10 +56,72 @@ guaca_system_class_init (GuacaSystemClass *klass)
   object_class->finalize     = guaca_system_finalize;
 }
 
+static guint
+env_uint (const char *name, guint def)
+{
+  const char *v = g_getenv (name);
+
+  return v && *v ? (guint) g_ascii_strtoull (v, NULL, 10) : def;
+}
+
+/*
+ * Starts the flight recorder; by default it takes a sample every second
+ * and keeps the last hour, which can be changed with GUACA_FLIGHTREC_INTERVAL
+ * (in ms, 0 disables the recorder) and GUACA_FLIGHTREC_RECORDS. The ring
+ * lives in /var/cache/guacamayo, or the user cache if that is not writable.
+ */
+static void
+guaca_system_start_flightrec (GuacaSystem *self)
+{
+  GuacaSystemPrivate *priv     = self->priv;
+  guint               interval = env_uint ("GUACA_FLIGHTREC_INTERVAL", 1000);
+  guint               records  = env_uint ("GUACA_FLIGHTREC_RECORDS", 3600);
+  char               *path;
+  GError             *error = NULL;
+
+  if (!interval || !records)
+    return;
+
+  if (!(priv->flightrec = guaca_flightrec_new (GUACA_FLIGHTREC_FILE,
+                                               records, interval, NULL)))
+    {
+      path = g_build_filename (g_get_user_cache_dir (),
+                               "guacamayo", "flightrec", NULL);
+
+      if (!(priv->flightrec = guaca_flightrec_new (path, records, interval,
+                                                   &error)))
+        {
+          g_warning ("Failed to start flight recorder: %s", error->message);
+          g_clear_error (&error);
+        }
+
+      g_free (path);
+    }
+}
+
+/*
+ * Places media-explorer, and the background services that compete with it,
+ * into cgroups weighted in favour of playback; see guacamayo-cgroups for the
+ * configuration. This is done once, at startup, and only with GUACA_CGROUPS=1
+ * as it changes the hierarchy of the whole box.
+ */
+static void
+guaca_system_place_cgroups (GuacaSystem *self)
+{
+  if (!env_uint ("GUACA_CGROUPS", 0) ||
+      !g_file_test ("/sys/fs/cgroup/cgroup.controllers", G_FILE_TEST_EXISTS))
+    return;
+
+  guaca_system_run_helper ("guacamayo-cgroups", NULL);
+}
+
 static void
 guaca_system_init (GuacaSystem *self)
 {
   self->priv = GUACA_SYSTEM_GET_PRIVATE (self);
+
+  guaca_system_start_flightrec (self);
+  guaca_system_place_cgroups (self);
 }
 
 static void
@@ -229,6 +135,21 @@ guaca_system_dispose (GObject *object)
 
   priv->disposed = TRUE;
 
+  guaca_metrics_free (priv->metrics);
+  priv->metrics = NULL;
+
+#ifdef ENABLE_INPUT_LATENCY
+  /* only once the metrics thread, which reads it, is gone */
+  guaca_input_latency_export_free (priv->input_latency);
+  priv->input_latency = NULL;
+#endif
+
+  guaca_flightrec_free (priv->flightrec);
+  priv->flightrec = NULL;
+
+  if (priv->dialog_dispose)
+    priv->dialog_dispose (self);
+
   G_OBJECT_CLASS (guaca_system_parent_class)->dispose (object);
 }
 
@@ -240,6 +161,12 @@ guaca_system_finalize (GObject *object)
 
   g_free (priv->hostname);
 
+  if (priv->self_last != priv->self_first)
+    guaca_self_stats_free (priv->self_last);
+  guaca_self_stats_free (priv->self_first);
+
+  guaca_frame_stats_free (priv->frame_stats);
+
   G_OBJECT_CLASS (guaca_system_parent_class)->finalize (object);
 }
 
@@ -255,152 +182,84 @@ guaca_system_get_location_index (MexInfoBarComponent *comp)
   return -1;
 }
 
+/*
+ * The dialog, and the probing behind it, live in a module of their own,
+ * which is only loaded the first time the dialog is opened.
+ */
 static void
-guaca_system_close_cb (void *dialog, GuacaSystem *self)
+guaca_system_activated_cb (MxAction *action, GuacaSystem *self)
 {
   GuacaSystemPrivate *priv = self->priv;
+  gpointer            open, dispose;
 
-  g_print ("%s:%d\n", __FUNCTION__, __LINE__);
+  if (!priv->dialog_open)
+    {
+      if (!guaca_dialog_module_load ("guaca-system-dialog",
+                                     "guaca_system_dialog_open", &open,
+                                     "guaca_system_dialog_dispose", &dispose,
+                                     NULL))
+        return;
+
+      priv->dialog_open    = open;
+      priv->dialog_dispose = dispose;
+    }
 
-  mex_push_focus (MX_FOCUSABLE (priv->button));
+  priv->dialog_open (self);
 }
 
+/*
+ * Exports the system metrics for local scrapers; the socket defaults to
+ * $XDG_RUNTIME_DIR/guacamayo-metrics.sock and can be changed with
+ * GUACA_METRICS_SOCKET, set it to an empty string to disable the export.
+ */
 static void
-guaca_system_dialog_mapped_cb (ClutterActor *dialog,
-                               GParamSpec   *pspec,
-                               GuacaSystem  *self)
+guaca_system_start_metrics (GuacaSystem *self)
 {
   GuacaSystemPrivate *priv = self->priv;
-  ClutterActor       *parent;
+  const char         *env  = g_getenv ("GUACA_METRICS_SOCKET");
+  char               *path;
+  GError             *error = NULL;
 
-  parent = clutter_actor_get_parent (priv->dialog);
-  clutter_actor_remove_child (parent, priv->dialog);
-  priv->dialog = NULL;
-}
-
-static gboolean
-guaca_system_close_dialog_cb (MxAction *unused, GuacaSystem *self)
-{
-  GuacaSystemPrivate *priv = self->priv;
-  const char         *hostname;
+  if (env && !*env)
+    return;
 
-  hostname = mx_entry_get_text (MX_ENTRY (priv->entry));
-  if (hostname && *hostname && g_strcmp0 (hostname, priv->hostname))
+  path = env ? g_strdup (env) : guaca_metrics_default_socket ();
+
+  priv->metrics = guaca_metrics_new (path, 5);
+  guaca_metrics_add_source (priv->metrics,
+                            guaca_system_info_write_metrics, NULL);
+  guaca_metrics_add_source (priv->metrics,
+                            guaca_self_stats_write_metrics, NULL);
+  guaca_metrics_add_source (priv->metrics,
+                            guaca_sampler_write_metrics, NULL);
+  guaca_metrics_add_source (priv->metrics,
+                            guaca_frame_stats_write_metrics,
+                            priv->frame_stats);
+#ifdef ENABLE_INPUT_LATENCY
+  if (guaca_input_latency_enabled ())
     {
-      GError *error = NULL;
-      char   *cmd   = g_strdup_printf ("guacamayo-hostname %s", hostname);
-
-      /*
-       * Hostname changed, try to set.
-       */
-      if (!g_spawn_command_line_async (cmd, &error))
-        {
-          g_warning ("Failed to execute '%s': %", cmd, error->message);
-          g_clear_error (&error);
-        }
-
-      g_free (cmd);
+      priv->input_latency =
+        guaca_input_latency_export_new (priv->transient_for);
+      guaca_metrics_add_source (priv->metrics,
+                                guaca_input_latency_write_metrics,
+                                priv->input_latency);
     }
+#endif
 
-  /*
-   * Hide the dialog, this will trigger the default transition; once it is
-   * no longer visible, destroy it.
-   *
-   * We have to use the mapped property here; MxDialog runs custom animation
-   * using a timeline and the 'visible' property is set well before the
-   * animation finishes.
-   */
-  g_signal_connect (priv->dialog, "notify::mapped",
-                    G_CALLBACK (guaca_system_dialog_mapped_cb), self);
-  clutter_actor_hide (priv->dialog);
-  mex_push_focus (MX_FOCUSABLE (priv->button));
-
-  return FALSE;
-}
-
-static gboolean
-guaca_system_key_press_cb (ClutterActor    *actor,
-                           ClutterKeyEvent *event,
-                           GuacaSystem     *self)
-{
-  if (MEX_KEY_BACK (event->keyval))
+  if (!guaca_metrics_start (priv->metrics, &error))
     {
-      guaca_system_close_dialog_cb (NULL, self);
-      return TRUE;
+      g_warning ("Failed to export metrics on '%s': %s",
+                 path, error->message);
+      g_clear_error (&error);
+      guaca_metrics_free (priv->metrics);
+      priv->metrics = NULL;
+#ifdef ENABLE_INPUT_LATENCY
+      guaca_input_latency_export_free (priv->input_latency);
+      priv->input_latency = NULL;
+#endif
     }
 
-  return FALSE;
-}
-
-static void
-guaca_system_activated_cb (MxAction *action, GuacaSystem *self)
-{
-  GuacaSystemPrivate *priv = self->priv;
-  struct SystemInfo  *info = get_system_info ();
-  ClutterActor       *dialog, *layout, *label, *entry;
-  MxAction           *close;
-  char               *text;
-  int                 row = 0;
-
-  dialog = mx_dialog_new ();
-  mx_stylable_set_style_class (MX_STYLABLE (dialog), "MexInfoBarDialog");
-
-  close = mx_action_new_full ("close", _("Close"),
-                              G_CALLBACK (guaca_system_close_dialog_cb), self);
-  mx_dialog_add_action (MX_DIALOG (dialog), close);
-
-  layout = mx_table_new ();
-  mx_table_set_column_spacing (MX_TABLE (layout), 10);
-  mx_table_set_row_spacing (MX_TABLE (layout), 20);
-  mx_bin_set_child (MX_BIN (dialog), layout);
-
-  label = mx_label_new_with_text (_("System Settings"));
-  mx_stylable_set_style_class (MX_STYLABLE (label), "DialogHeader");
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 0);
-
-  label = mx_label_new_with_text (_("Device name:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  priv->entry = entry = mx_entry_new_with_text (info->hostname);
-  g_free (priv->hostname);
-  priv->hostname = g_strdup (info->hostname);
-
-  mx_table_insert_actor (MX_TABLE (layout), entry, row++, 1);
-
-  label = mx_label_new_with_text (_("Software:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  label = mx_label_new_with_text (GUACAMAYO_DISTRO_STRING);
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
-
-  label = mx_label_new_with_text (_("Processor:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  label = mx_label_new_with_text (info->cpu_model);
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
-
-  label = mx_label_new_with_text (_("Cores:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  text = g_strdup_printf ("%d", info->cores);
-  label = mx_label_new_with_text (text);
-  g_free (text);
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
-
-  label = mx_label_new_with_text (_("Memory:"));
-  mx_table_insert_actor (MX_TABLE (layout), label, row, 0);
-  text = g_strdup_printf (_("%s (free %s)"),
-                          info->total_memory, info->free_memory);
-  label = mx_label_new_with_text (text);
-  g_free (text);
-  mx_table_insert_actor (MX_TABLE (layout), label, row++, 1);
-
-  mx_dialog_set_transient_parent (MX_DIALOG (dialog), priv->transient_for);
-  g_signal_connect (dialog, "key-press-event",
-                    G_CALLBACK (guaca_system_key_press_cb), self);
-
-  priv->dialog = dialog;
-
-  clutter_actor_show (dialog);
-  mex_push_focus (MX_FOCUSABLE (dialog));
-
-  free_system_info (info);
+  g_free (path);
 }
 
 static ClutterActor *
@@ -422,6 +281,22 @@ guaca_system_create_ui (MexInfoBarComponent *comp,
    */
   self->priv->transient_for = transient_for;
 
+  guaca_startup_mark (GUACA_STARTUP_UI);
+  guaca_startup_watch_paint (GUACAMAYO_DISTRO_STRING);
+
+  /*
+   * Frame timing is opt-in, either from the dialog, or for the whole session
+   * by setting GUACA_FRAME_STATS in the environment.
+   */
+  if (!self->priv->frame_stats)
+    self->priv->frame_stats = guaca_frame_stats_new (transient_for);
+
+  if (g_getenv ("GUACA_FRAME_STATS"))
+    guaca_frame_stats_set_enabled (self->priv->frame_stats, TRUE);
+
+  if (!self->priv->metrics)
+    guaca_system_start_metrics (self);
+
   /*
    * Make the button for the Settings dialog.
    */
@@ -466,6 +341,9 @@ mex_info_bar_component_iface_init (MexInfoBarComponentIface *iface)
 static GType
 guaca_system_plugin_get_type (void)
 {
+  /* called by mex as it loads the plugin */
+  guaca_startup_mark (GUACA_STARTUP_PLUGIN);
+
   return GUACA_TYPE_SYSTEM;
 }
 
@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+/*
+ * Virtual memory tuning profiles, shared by the system plugin, which shows
+ * the profile in effect, and guacamayo-vmtune, which applies them.
+ */
+
+#ifndef __GUACA_VM_PROFILE_H__
+#define __GUACA_VM_PROFILE_H__
+
+#ifndef N_
+#define N_(String) (String)
+#endif
+
+#define GUACA_VM_PROFILE_FILE "/etc/guacamayo/vm-profile"
+
+typedef struct
+{
+  const char *name;
+  const char *label;
+
+  /* -1 for the kernel defaults, as saved before the first tuning */
+  int         swappiness;
+  int         dirty_ratio;
+  long        dirty_background_bytes;
+
+  /* size of the zram swap device as a percentage of MemTotal, or 0 */
+  int         zram_percent;
+} GuacaVmProfile;
+
+/*
+ * On small boxes recording to disk makes for large writeback bursts that
+ * stall playback, so writeback starts early and the dirty pages are kept
+ * few; swapping to SD is slow enough to be avoided nearly at any cost,
+ * while swapping to compressed memory is cheaper than dropping page cache.
+ */
+static const GuacaVmProfile guaca_vm_profiles[] =
+  {
+    { "default", N_("Default"),
+      -1, -1, -1, 0 },
+    { "lowmem", N_("Low memory media"),
+      10, 10, 4 * 1024 * 1024, 0 },
+    { "lowmem-zram", N_("Low memory media with zram"),
+      100, 10, 4 * 1024 * 1024, 50 },
+  };
+
+#define GUACA_N_VM_PROFILES \
+  (sizeof (guaca_vm_profiles) / sizeof (guaca_vm_profiles[0]))
+
+#endif /* __GUACA_VM_PROFILE_H__ */
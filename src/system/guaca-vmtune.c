@@ -0,0 +1,551 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sysfs.h"
+#include "guaca-vm-profile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/swap.h>
+
+enum
+{
+  SWAPPINESS = 0,
+  DIRTY_RATIO,
+  DIRTY_BYTES,
+  DIRTY_BACKGROUND_RATIO,
+  DIRTY_BACKGROUND_BYTES,
+  N_SYSCTLS
+};
+
+static const char *sysctls[N_SYSCTLS] =
+  {
+    "swappiness",
+    "dirty_ratio",
+    "dirty_bytes",
+    "dirty_background_ratio",
+    "dirty_background_bytes",
+  };
+
+/*
+ * What we did to the box, kept in GUACA_VM_PROFILE_FILE so the profile can
+ * be re-applied at boot, and undone later.
+ */
+typedef struct
+{
+  char profile[32];
+  int  zram;                            /* the zram swap we set up, or -1 */
+  int  has_defaults;
+  char defaults[N_SYSCTLS][32];         /* from before the first tuning */
+} State;
+
+/* A sysctl write */
+typedef struct
+{
+  int  sysctl;
+  char value[32];
+} Change;
+
+static const char *
+sysctl_path (char *buf, size_t len, int sysctl)
+{
+  return guaca_sysfs_path (buf, len, "/proc/sys/vm/%s", sysctls[sysctl]);
+}
+
+static void
+load_state (State *state)
+{
+  char  path[PATH_MAX];
+  char  line[128];
+  FILE *f;
+  int   i;
+
+  memset (state, 0, sizeof (*state));
+  strcpy (state->profile, "default");
+  state->zram = -1;
+
+  if (!(f = fopen (guaca_sysfs_path (path, sizeof (path),
+                                     GUACA_VM_PROFILE_FILE), "r")))
+    return;
+
+  while (fgets (line, sizeof (line), f))
+    {
+      char *v = strchr (line, '=');
+
+      if (!v)
+        continue;
+
+      *v++ = 0;
+      v[strcspn (v, "\n")] = 0;
+
+      if (!strcmp (line, "profile"))
+        snprintf (state->profile, sizeof (state->profile), "%s", v);
+      else if (!strcmp (line, "zram"))
+        state->zram = atoi (v);
+
+      for (i = 0; i < N_SYSCTLS; i++)
+        if (!strcmp (line, sysctls[i]))
+          {
+            snprintf (state->defaults[i], sizeof (state->defaults[i]), "%s", v);
+            state->has_defaults = 1;
+          }
+    }
+
+  fclose (f);
+}
+
+/*
+ * Writes the state to a temporary file and renames it over the old one, so
+ * a crash or power cut leaves either the old or the new state, never a mix.
+ */
+static int
+save_state (const State *state)
+{
+  char  path[PATH_MAX];
+  char  tmp[PATH_MAX + 8];
+  FILE *f;
+  int   i, fail;
+
+  mkdir (guaca_sysfs_path (path, sizeof (path), "/etc/guacamayo"), 0755);
+
+  guaca_sysfs_path (path, sizeof (path), GUACA_VM_PROFILE_FILE);
+  snprintf (tmp, sizeof (tmp), "%s.new", path);
+
+  if (!(f = fopen (tmp, "w")))
+    {
+      fprintf (stderr, "Failed to save profile: %s\n", strerror (errno));
+      return -1;
+    }
+
+  fprintf (f, "profile=%s\nzram=%d\n", state->profile, state->zram);
+
+  for (i = 0; state->has_defaults && i < N_SYSCTLS; i++)
+    fprintf (f, "%s=%s\n", sysctls[i], state->defaults[i]);
+
+  fail = fflush (f) || fsync (fileno (f));
+  fail = fclose (f) || fail;
+
+  if (fail || rename (tmp, path))
+    {
+      fprintf (stderr, "Failed to save profile: %s\n", strerror (errno));
+      unlink (tmp);
+      return -1;
+    }
+
+  return 0;
+}
+
+static const GuacaVmProfile *
+find_profile (const char *name)
+{
+  int i;
+
+  for (i = 0; i < GUACA_N_VM_PROFILES; i++)
+    if (!strcmp (guaca_vm_profiles[i].name, name))
+      return &guaca_vm_profiles[i];
+
+  return NULL;
+}
+
+/*
+ * Whether the zram device is one of the active swaps.
+ */
+static int
+zram_active (int zram)
+{
+  char path[PATH_MAX];
+  char buf[4096];
+  char dev[32];
+
+  if (zram < 0 ||
+      guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path), "/proc/swaps"),
+                        buf, sizeof (buf)) < 0)
+    return 0;
+
+  snprintf (dev, sizeof (dev), "/dev/zram%d ", zram);
+
+  return strstr (buf, dev) != NULL;
+}
+
+/*
+ * Takes the device out of swap and frees it; returns -1 if it is still in
+ * use as swap, e.g., because its pages did not fit back in memory. The
+ * device not being a swap in the first place is not an error.
+ */
+static int
+zram_teardown (int zram)
+{
+  char path[PATH_MAX];
+  char value[16];
+
+  if (swapoff (guaca_sysfs_path (path, sizeof (path), "/dev/zram%d",
+                                 zram)) < 0 && errno != EINVAL)
+    {
+      fprintf (stderr, "Failed to turn off zram%d swap: %s\n",
+               zram, strerror (errno));
+      return -1;
+    }
+
+  guaca_sysfs_write (guaca_sysfs_path (path, sizeof (path),
+                                       "/sys/block/zram%d/reset", zram), "1");
+
+  snprintf (value, sizeof (value), "%d", zram);
+  guaca_sysfs_write (guaca_sysfs_path (path, sizeof (path),
+                                       "/sys/class/zram-control/hot_remove"),
+                     value);
+
+  return 0;
+}
+
+/*
+ * Writes a swap signature to the device, as mkswap would; there is no need
+ * for the rest of what mkswap does on a device that lives in memory.
+ */
+static int
+zram_mkswap (const char *dev, unsigned long long size)
+{
+  long           page_size = sysconf (_SC_PAGESIZE);
+  unsigned char *header;
+  unsigned int  *info;
+  int            fd, r = -1;
+
+  if (!(header = calloc (1, page_size)))
+    return -1;
+
+  /* version, last_page, nr_badpages after the boot block */
+  info    = (unsigned int *) (header + 1024);
+  info[0] = 1;
+  info[1] = size / page_size - 1;
+  info[2] = 0;
+
+  memcpy (header + page_size - 10, "SWAPSPACE2", 10);
+
+  if ((fd = open (dev, O_WRONLY | O_CLOEXEC)) >= 0)
+    {
+      if (write (fd, header, page_size) == page_size && !fsync (fd))
+        r = 0;
+
+      close (fd);
+    }
+
+  free (header);
+
+  return r;
+}
+
+/*
+ * Sets up a zram swap device of percent of MemTotal, using a new device if
+ * the kernel can hot add them, or zram0 if it is not in use; returns the
+ * number of the device, or -1.
+ */
+static int
+zram_setup (int percent)
+{
+  char               path[PATH_MAX];
+  char               dev[PATH_MAX];
+  char               buf[4096];
+  char               value[32];
+  char              *p;
+  unsigned long      disksize;
+  unsigned long long size;
+  int                zram = -1;
+
+  if (guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                          "/proc/meminfo"),
+                        buf, sizeof (buf)) < 0 ||
+      !(p = strstr (buf, "MemTotal:")))
+    {
+      fprintf (stderr, "Failed to read MemTotal\n");
+      return -1;
+    }
+
+  size = strtoull (p + strlen ("MemTotal:"), NULL, 10) * 1024 * percent / 100;
+
+  if (guaca_sysfs_read (guaca_sysfs_path (path, sizeof (path),
+                                          "/sys/class/zram-control/hot_add"),
+                        buf, sizeof (buf)) > 0)
+    zram = atoi (buf);
+  else if (!guaca_sysfs_read_ulong (guaca_sysfs_path (path, sizeof (path),
+                                                      "/sys/block/zram0/"
+                                                      "disksize"),
+                                    &disksize) && !disksize)
+    zram = 0;
+
+  if (zram < 0)
+    {
+      fprintf (stderr, "No zram device available\n");
+      return -1;
+    }
+
+  /* lz4 is much cheaper than the default lzo on the CPUs we run on */
+  guaca_sysfs_write (guaca_sysfs_path (path, sizeof (path),
+                                       "/sys/block/zram%d/comp_algorithm",
+                                       zram), "lz4");
+
+  snprintf (value, sizeof (value), "%llu", size);
+  guaca_sysfs_path (dev, sizeof (dev), "/dev/zram%d", zram);
+
+  if (guaca_sysfs_write (guaca_sysfs_path (path, sizeof (path),
+                                           "/sys/block/zram%d/disksize", zram),
+                         value) < 0 ||
+      zram_mkswap (dev, size) < 0 ||
+      swapon (dev, SWAP_FLAG_PREFER |
+              ((100 << SWAP_FLAG_PRIO_SHIFT) & SWAP_FLAG_PRIO_MASK)) < 0)
+    {
+      fprintf (stderr, "Failed to set up zram swap: %s\n", strerror (errno));
+      zram_teardown (zram);
+      return -1;
+    }
+
+  printf ("zram%d: %llu MB swap\n", zram, size >> 20);
+
+  return zram;
+}
+
+/*
+ * The kernel keeps either a ratio or a byte count for each dirty limit, and
+ * setting one zeroes the other; returns whichever of the two is in use.
+ */
+static int
+in_use (const char values[][32], int ratio, int bytes)
+{
+  return strcmp (values[bytes], "0") ? bytes : ratio;
+}
+
+/*
+ * Puts the sysctls back to the values apply_changes() found, restoring
+ * whichever member of each pair was in use.
+ */
+static void
+restore_changes (const char old[][32])
+{
+  char path[PATH_MAX];
+  int  restore[] =
+    {
+      SWAPPINESS,
+      in_use (old, DIRTY_RATIO, DIRTY_BYTES),
+      in_use (old, DIRTY_BACKGROUND_RATIO, DIRTY_BACKGROUND_BYTES),
+    };
+  int  i;
+
+  for (i = 0; i < sizeof (restore) / sizeof (restore[0]); i++)
+    guaca_sysfs_write (sysctl_path (path, sizeof (path), restore[i]),
+                       old[restore[i]]);
+}
+
+/*
+ * Makes all the changes, or none of them; if any write fails, all the
+ * sysctls are put back as they were, as a write may have zeroed the other
+ * member of its pair. The values from before are stored in old, for
+ * restore_changes().
+ */
+static int
+apply_changes (Change *changes, int n_changes, char old[][32])
+{
+  char path[PATH_MAX];
+  int  i;
+
+  for (i = 0; i < N_SYSCTLS; i++)
+    if (guaca_sysfs_read (sysctl_path (path, sizeof (path), i),
+                          old[i], sizeof (old[i])) < 0)
+      {
+        fprintf (stderr, "Failed to read %s: %s\n",
+                 sysctls[i], strerror (errno));
+        return -1;
+      }
+
+  for (i = 0; i < n_changes; i++)
+    if (guaca_sysfs_write (sysctl_path (path, sizeof (path),
+                                        changes[i].sysctl),
+                           changes[i].value) < 0)
+      {
+        fprintf (stderr, "Failed to set %s to %s: %s\n",
+                 sysctls[changes[i].sysctl], changes[i].value,
+                 strerror (errno));
+
+        restore_changes (old);
+
+        return -1;
+      }
+
+  return 0;
+}
+
+static void
+add_change (Change *changes, int *n, int sysctl, const char *fmt, long value)
+{
+  changes[*n].sysctl = sysctl;
+  snprintf (changes[*n].value, sizeof (changes[*n].value), fmt, value);
+  (*n)++;
+}
+
+/*
+ * Restores whichever of the ratio and byte count was in use by default.
+ */
+static void
+add_restore (Change *changes, int *n, const State *state,
+             int ratio, int bytes)
+{
+  int sysctl = in_use (state->defaults, ratio, bytes);
+
+  changes[*n].sysctl = sysctl;
+  snprintf (changes[*n].value, sizeof (changes[*n].value), "%s",
+            state->defaults[sysctl]);
+  (*n)++;
+}
+
+static int
+apply_profile (const GuacaVmProfile *profile, State *state)
+{
+  char   path[PATH_MAX];
+  char   old[N_SYSCTLS][32];
+  Change changes[N_SYSCTLS];
+  int    n = 0, i, zram = -1;
+
+  /*
+   * Save the defaults before we first change anything, so the default
+   * profile can put them back.
+   */
+  if (!state->has_defaults)
+    {
+      for (i = 0; i < N_SYSCTLS; i++)
+        if (guaca_sysfs_read (sysctl_path (path, sizeof (path), i),
+                              state->defaults[i],
+                              sizeof (state->defaults[i])) < 0)
+          {
+            fprintf (stderr, "Failed to read %s: %s\n",
+                     sysctls[i], strerror (errno));
+            return -1;
+          }
+
+      state->has_defaults = 1;
+    }
+
+  if (profile->swappiness < 0)
+    {
+      add_restore (changes, &n, state, SWAPPINESS, SWAPPINESS);
+      add_restore (changes, &n, state, DIRTY_RATIO, DIRTY_BYTES);
+      add_restore (changes, &n, state,
+                   DIRTY_BACKGROUND_RATIO, DIRTY_BACKGROUND_BYTES);
+    }
+  else
+    {
+      add_change (changes, &n, SWAPPINESS, "%ld", profile->swappiness);
+      add_change (changes, &n, DIRTY_RATIO, "%ld", profile->dirty_ratio);
+      add_change (changes, &n, DIRTY_BACKGROUND_BYTES, "%ld",
+                  profile->dirty_background_bytes);
+    }
+
+  /*
+   * The zram swap is set up before, and torn down after, the sysctls are
+   * changed, so that a failure leaves the box as it was; if the teardown
+   * fails, the sysctls are put back.
+   */
+  if (profile->zram_percent && !zram_active (state->zram) &&
+      (zram = zram_setup (profile->zram_percent)) < 0)
+    return -1;
+
+  if (apply_changes (changes, n, old) < 0)
+    {
+      if (zram >= 0)
+        zram_teardown (zram);
+
+      return -1;
+    }
+
+  if (zram >= 0)
+    state->zram = zram;
+  else if (!profile->zram_percent && state->zram >= 0)
+    {
+      if (zram_active (state->zram) && zram_teardown (state->zram) < 0)
+        {
+          restore_changes (old);
+          return -1;
+        }
+
+      state->zram = -1;
+    }
+
+  /*
+   * Back at the defaults, the next tuning saves them again, in case they
+   * are changed by other means in the meantime.
+   */
+  if (profile->swappiness < 0)
+    state->has_defaults = 0;
+
+  snprintf (state->profile, sizeof (state->profile), "%s", profile->name);
+
+  printf ("Applied VM profile '%s'\n", profile->name);
+
+  return 0;
+}
+
+/*
+ * VM tuning profile setter for guacamayo system settings mex plugin; applies
+ * the given profile and saves it, or without arguments, re-applies the saved
+ * profile (e.g., at boot).
+ *
+ * This program needs to be installed suid root
+ */
+int
+main (int argc, char **argv)
+{
+  const GuacaVmProfile *profile;
+  State                 state;
+
+  if (argc > 2)
+    return 1;
+
+  guaca_sysfs_init ();
+
+  load_state (&state);
+
+  if (argc == 1)
+    {
+      /* nothing to do after a boot with the kernel defaults */
+      if (!strcmp (state.profile, "default"))
+        return 0;
+
+      /* the zram device of the previous boot is gone */
+      if (!zram_active (state.zram))
+        state.zram = -1;
+    }
+
+  if (!(profile = find_profile (argc == 2 ? argv[1] : state.profile)))
+    {
+      fprintf (stderr, "Unknown profile '%s'\n",
+               argc == 2 ? argv[1] : state.profile);
+      return 1;
+    }
+
+  if (apply_profile (profile, &state) < 0)
+    return 3;
+
+  if (save_state (&state) < 0)
+    return 4;
+
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Times the probes of the System plugin, to see what leaving them on costs;
+ * built with make check, and run by hand, as the numbers only mean
+ * something on the box in question.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-proc-reader.h"
+#include "guaca-proc-top.h"
+#include "guaca-self-stats.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+typedef void (*BenchFunc) (gpointer data);
+
+typedef struct
+{
+  const char *name;
+  const char *arg;
+  const char *description;
+  void      (*run) (const char *arg, guint n_runs);
+} Bench;
+
+static void
+bench_report (const char *what, gint64 total, gint64 best, gint64 worst,
+              guint n_runs)
+{
+  printf ("%-32s %8.1f us mean, %6" G_GINT64_FORMAT " best, %6"
+          G_GINT64_FORMAT " worst, over %u runs\n",
+          what, (double) total / n_runs, best, worst, n_runs);
+}
+
+/*
+ * Calls func n_runs times after a warm up call, and prints the mean, the
+ * best and the worst time of a call.
+ */
+static void
+bench_time (const char *what, BenchFunc func, gpointer data, guint n_runs)
+{
+  gint64 total = 0, best = G_MAXINT64, worst = 0;
+  guint  i;
+
+  func (data);
+
+  for (i = 0; i < n_runs; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      gint64 t;
+
+      func (data);
+
+      t      = g_get_monotonic_time () - start;
+      total += t;
+      best   = MIN (best, t);
+      worst  = MAX (worst, t);
+    }
+
+  bench_report (what, total, best, worst, n_runs);
+}
+
+/*
+ * The self stats read a stat file per thread, so they are timed with the
+ * process running as many threads as media-explorer would.
+ */
+static GMutex   idle_lock;
+static GCond    idle_cond;
+static gboolean idle_done;
+
+static gpointer
+idle_thread (gpointer data)
+{
+  g_mutex_lock (&idle_lock);
+
+  while (!idle_done)
+    g_cond_wait (&idle_cond, &idle_lock);
+
+  g_mutex_unlock (&idle_lock);
+
+  return NULL;
+}
+
+static void
+collect_self_stats (gpointer data)
+{
+  guaca_self_stats_free (guaca_self_stats_collect ());
+}
+
+static void
+bench_self_stats (const char *arg, guint n_runs)
+{
+  guint     n_threads = arg ? atoi (arg) : 24;
+  GThread **threads = g_new0 (GThread *, n_threads);
+  char     *what;
+  guint     i;
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("bench-idle", idle_thread, NULL);
+
+  what = g_strdup_printf ("self-stats, %u threads", n_threads + 1);
+  bench_time (what, collect_self_stats, NULL, n_runs);
+  g_free (what);
+
+  g_mutex_lock (&idle_lock);
+  idle_done = TRUE;
+  g_cond_broadcast (&idle_cond);
+  g_mutex_unlock (&idle_lock);
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_free (threads);
+}
+
+/*
+ * The files the flight recorder samples, and the interrupt counts, as the
+ * typical batch of small procfs and sysfs files.
+ */
+static const char *const proc_files[] =
+  {
+    "/proc/stat",
+    "/proc/meminfo",
+    "/proc/vmstat",
+    "/proc/loadavg",
+    "/proc/interrupts",
+    "/proc/softirqs",
+    "/proc/self/stat",
+    "/sys/class/thermal/thermal_zone0/temp",
+  };
+
+static void
+refresh_proc_reader (gpointer data)
+{
+  guaca_proc_reader_refresh (data);
+}
+
+/*
+ * Refreshes the same files with each backend of the reader, which is
+ * picked through the environment when the reader is created.
+ */
+static void
+bench_proc_reader (const char *arg, guint n_runs)
+{
+  static const char *const backends[] = { "pread", "io_uring" };
+  char  **paths = arg ? g_strsplit (arg, ",", -1) : NULL;
+  char   *saved = g_strdup (g_getenv ("GUACA_PROC_READER"));
+  guint   n_paths, b, i;
+
+  n_paths = paths ? g_strv_length (paths) : G_N_ELEMENTS (proc_files);
+
+  for (b = 0; b < G_N_ELEMENTS (backends); b++)
+    {
+      GuacaProcReader *reader;
+      char            *what;
+      guint            n_files = 0;
+
+      g_setenv ("GUACA_PROC_READER", backends[b], TRUE);
+      reader = guaca_proc_reader_new ();
+
+      if (strcmp (guaca_proc_reader_get_backend (reader), backends[b]))
+        {
+          printf ("%-32s not available\n", backends[b]);
+          guaca_proc_reader_free (reader);
+          continue;
+        }
+
+      for (i = 0; i < n_paths; i++)
+        if (guaca_proc_reader_add (reader,
+                                   paths ? paths[i] : proc_files[i],
+                                   4096) >= 0)
+          n_files++;
+
+      what = g_strdup_printf ("proc-reader, %u files, %s", n_files,
+                              backends[b]);
+      bench_time (what, refresh_proc_reader, reader, n_runs);
+      printf ("%-32s %8u syscalls per refresh\n", "",
+              guaca_proc_reader_get_syscalls (reader));
+
+      g_free (what);
+      guaca_proc_reader_free (reader);
+    }
+
+  if (saved)
+    g_setenv ("GUACA_PROC_READER", saved, TRUE);
+  else
+    g_unsetenv ("GUACA_PROC_READER");
+
+  g_free (saved);
+  g_strfreev (paths);
+}
+
+/*
+ * The process list ticks on the sampler thread, which times each tick;
+ * every tick but the first retires a snapshot in an idle, so the main loop
+ * wakes up once per tick. The first tick, which opens the stat files, is
+ * the warm up.
+ */
+#define PROC_TOP_INTERVAL_MS 10
+
+static void
+bench_proc_top (const char *arg, guint n_runs)
+{
+  guint         n_children = arg ? atoi (arg) : 500;
+  pid_t        *children = g_new0 (pid_t, n_children);
+  GuacaProcTop *top;
+  gint64        total = 0, best = G_MAXINT64, worst = 0;
+  guint         i, n = 0, n_procs = 0;
+  char         *what;
+
+  for (i = 0; i < n_children; i++)
+    {
+      if ((children[i] = fork ()) < 0)
+        {
+          perror ("fork");
+          break;
+        }
+
+      if (!children[i])
+        {
+          pause ();
+          _exit (0);
+        }
+    }
+
+  n_children = i;
+
+  top = guaca_proc_top_new (PROC_TOP_INTERVAL_MS);
+
+  while (top && n < n_runs)
+    {
+      gint64 t;
+
+      if (!g_main_context_iteration (NULL, TRUE))
+        continue;
+
+      if ((t = guaca_proc_top_get_cost (top, &n_procs)) < 0)
+        continue;
+
+      total += t;
+      best   = MIN (best, t);
+      worst  = MAX (worst, t);
+      n++;
+    }
+
+  guaca_proc_top_free (top);
+
+  for (i = 0; i < n_children; i++)
+    {
+      kill (children[i], SIGKILL);
+      waitpid (children[i], NULL, 0);
+    }
+
+  if (n)
+    {
+      what = g_strdup_printf ("proc-top, %u processes", n_procs);
+      bench_report (what, total, best, worst, n);
+      g_free (what);
+    }
+
+  g_free (children);
+}
+
+static const Bench benches[] =
+  {
+    { "self-stats", "THREADS",
+      "guaca_self_stats_collect() with THREADS more threads, 24 by default",
+      bench_self_stats },
+    { "proc-reader", "PATH,...",
+      "one refresh of PATHs, or of eight typical files, with pread and "
+      "io_uring",
+      bench_proc_reader },
+    { "proc-top", "PROCS",
+      "one tick of the process list with PROCS more processes, 500 by "
+      "default",
+      bench_proc_top },
+  };
+
+static void
+usage (const char *argv0)
+{
+  guint i;
+
+  fprintf (stderr,
+           "Usage: %s [-n RUNS] [BENCH [ARG]]\n"
+           "\n"
+           "Times the probes, all of them by default, over RUNS runs, 1000\n"
+           "by default. The benchmarks are:\n"
+           "\n",
+           argv0);
+
+  for (i = 0; i < G_N_ELEMENTS (benches); i++)
+    fprintf (stderr, "  %s [%s]\n    %s\n",
+             benches[i].name, benches[i].arg, benches[i].description);
+}
+
+int
+main (int argc, char **argv)
+{
+  guint n_runs = 1000;
+  guint i;
+  int   c;
+
+  while ((c = getopt (argc, argv, "n:h")) != -1)
+    {
+      switch (c)
+        {
+        case 'n':
+          n_runs = MAX (atoi (optarg), 1);
+          break;
+        default:
+          usage (argv[0]);
+          return 1;
+        }
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (benches); i++)
+    {
+      if (optind < argc && strcmp (argv[optind], benches[i].name))
+        continue;
+
+      benches[i].run (optind + 1 < argc ? argv[optind + 1] : NULL, n_runs);
+
+      if (optind < argc)
+        return 0;
+    }
+
+  if (optind < argc)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  return 0;
+}
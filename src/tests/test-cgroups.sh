@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# Copyright © 2012, sleep(5) ltd.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses>
+#
+
+#
+# Runs guacamayo-cgroups on a fake cgroupfs and /proc; the script itself
+# plays media-explorer, the parent of the helper.
+#
+
+helper=${HELPERDIR:-.}/guacamayo-cgroups
+media_explorer=${MEDIA_EXPLORER:-/usr/bin/media-explorer}
+root=`mktemp -d`
+failed=0
+
+trap 'rm -rf "$root"' EXIT
+
+fail ()
+{
+  echo "FAIL: $*" >&2
+  failed=1
+}
+
+check ()
+{
+  value=`cat "$root/$1"`
+
+  [ "$value" = "$2" ] || fail "$1 is '$value', expected '$2'"
+}
+
+setup ()
+{
+  rm -rf "$root"/*
+
+  cg=$root/sys/fs/cgroup
+
+  mkdir -p "$root/proc/$$" "$root/proc/4242" "$root/run"
+  ln -s "$1" "$root/proc/$$/exe"
+  echo tumblerd > "$root/proc/4242/comm"
+
+  mkdir -p "$cg/guacamayo/media" "$cg/guacamayo/background"
+  echo "cpuset cpu io memory pids" > "$cg/cgroup.controllers"
+  echo "$2" > "$cg/cgroup.subtree_control"
+  : > "$cg/guacamayo/cgroup.subtree_control"
+
+  for g in media background; do
+    for a in cpu.weight io.weight memory.high cgroup.procs; do
+      : > "$cg/guacamayo/$g/$a"
+    done
+  done
+}
+
+export GUACA_HELPER_ROOT="$root"
+
+# anyone else running us is turned away, and nothing is touched
+setup /bin/sh ""
+"$helper" 2>/dev/null && fail "ran for a parent other than media-explorer"
+check sys/fs/cgroup/cgroup.subtree_control ""
+check sys/fs/cgroup/guacamayo/media/cgroup.procs ""
+
+# as is a media-explorer other than the installed one
+setup /tmp/media-explorer ""
+"$helper" 2>/dev/null && fail "ran for a media-explorer elsewhere"
+check sys/fs/cgroup/guacamayo/media/cgroup.procs ""
+
+# without a manager, we enable the controllers at the root
+setup "$media_explorer" ""
+"$helper" > /dev/null || fail "helper failed"
+check sys/fs/cgroup/cgroup.subtree_control "+cpu +io +memory"
+check sys/fs/cgroup/guacamayo/cgroup.subtree_control "+cpu +io +memory"
+check sys/fs/cgroup/guacamayo/media/cgroup.procs "$$"
+check sys/fs/cgroup/guacamayo/media/cpu.weight 500
+check sys/fs/cgroup/guacamayo/background/cgroup.procs 4242
+check sys/fs/cgroup/guacamayo/background/io.weight 20
+
+# with one, the root is left alone and we use what it has enabled
+setup "$media_explorer" "cpu memory pids"
+mkdir "$root/run/systemd" "$root/run/systemd/system"
+"$helper" > /dev/null 2>&1 || fail "helper failed under a manager"
+check sys/fs/cgroup/cgroup.subtree_control "cpu memory pids"
+check sys/fs/cgroup/guacamayo/cgroup.subtree_control "+cpu +memory"
+check sys/fs/cgroup/guacamayo/media/cgroup.procs "$$"
+
+# the weights of the configuration are taken as they are within the range
+# of the kernel, and the configuration is refused otherwise
+setup "$media_explorer" ""
+mkdir -p "$root/etc/guacamayo"
+printf '[media]\ncpu.weight=10000\nio.weight=1\n' \
+  > "$root/etc/guacamayo/cgroups.conf"
+"$helper" > /dev/null || fail "helper failed with weights in range"
+check sys/fs/cgroup/guacamayo/media/cpu.weight 10000
+check sys/fs/cgroup/guacamayo/media/io.weight 1
+
+for w in 0 10001 -5 50x "" 99999999999999999999999; do
+  setup "$media_explorer" ""
+  mkdir -p "$root/etc/guacamayo"
+  printf '[media]\ncpu.weight=%s\n' "$w" > "$root/etc/guacamayo/cgroups.conf"
+  "$helper" > /dev/null 2>&1 && fail "took cpu.weight '$w'"
+  check sys/fs/cgroup/guacamayo/media/cgroup.procs ""
+done
+
+exit $failed
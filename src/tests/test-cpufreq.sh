@@ -0,0 +1,134 @@
+#!/bin/sh
+#
+# Copyright © 2012, sleep(5) ltd.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses>
+#
+
+
+#
+# Runs guacamayo-cpufreq on a fake sysfs: policy0 has a frequency table and
+# the usual governors, policy1 takes any frequency and has the energy
+# performance preferences of intel_pstate.
+#
+
+helper=${HELPERDIR:-.}/guacamayo-cpufreq
+root=`mktemp -d`
+failed=0
+
+trap 'rm -rf "$root"' EXIT
+
+fail ()
+{
+  echo "FAIL: $*" >&2
+  failed=1
+}
+
+check ()
+{
+  value=`cat "$root/$1"`
+
+  [ "$value" = "$2" ] || fail "$1 is '$value', expected '$2'"
+}
+
+policy ()
+{
+  p=$root/sys/devices/system/cpu/cpufreq/$1
+
+  mkdir -p "$p"
+  echo "$2" > "$p/scaling_available_governors"
+  echo 400000 > "$p/cpuinfo_min_freq"
+  echo 2000000 > "$p/cpuinfo_max_freq"
+
+  for a in scaling_governor scaling_min_freq scaling_max_freq; do
+    echo unset > "$p/$a"
+  done
+}
+
+setup ()
+{
+  rm -rf "$root"/*
+  mkdir "$root/etc"
+
+  policy policy0 "conservative ondemand userspace powersave performance schedutil"
+  echo "400000 1000000 1300000 1700000 2000000 " \
+    > "$p/scaling_available_frequencies"
+
+  policy policy1 "performance powersave"
+  echo "default performance balance_performance balance_power power" \
+    > "$p/energy_performance_available_preferences"
+  echo unset > "$p/energy_performance_preference"
+}
+
+cpufreq=sys/devices/system/cpu/cpufreq
+
+export GUACA_HELPER_ROOT="$root"
+
+# each profile applies, and is saved; the minimum of playback is half way
+# up the range, snapped up to the table where there is one
+setup
+"$helper" playback > /dev/null || fail "playback failed"
+check $cpufreq/policy0/scaling_governor performance
+check $cpufreq/policy0/scaling_min_freq 1300000
+check $cpufreq/policy0/scaling_max_freq 2000000
+check $cpufreq/policy1/scaling_governor performance
+check $cpufreq/policy1/scaling_min_freq 1200000
+check $cpufreq/policy1/energy_performance_preference performance
+check etc/guacamayo/cpu-profile playback
+
+"$helper" balanced > /dev/null || fail "balanced failed"
+check $cpufreq/policy0/scaling_governor schedutil
+check $cpufreq/policy0/scaling_min_freq 400000
+check $cpufreq/policy1/scaling_governor powersave
+check $cpufreq/policy1/scaling_min_freq 400000
+check $cpufreq/policy1/energy_performance_preference balance_performance
+check etc/guacamayo/cpu-profile balanced
+
+"$helper" powersave > /dev/null || fail "powersave failed"
+check $cpufreq/policy0/scaling_governor conservative
+check $cpufreq/policy1/scaling_governor powersave
+check $cpufreq/policy1/energy_performance_preference power
+check etc/guacamayo/cpu-profile powersave
+
+# a cap left behind is lifted
+echo 800000 > "$root/$cpufreq/policy0/scaling_max_freq"
+"$helper" powersave > /dev/null || fail "powersave failed"
+check $cpufreq/policy0/scaling_max_freq 2000000
+
+# without the governors of the profile the policy is left alone, and the
+# failure is reported
+setup
+policy policy1 "userspace"
+"$helper" powersave > /dev/null 2>&1 && fail "applied without a governor"
+check $cpufreq/policy1/scaling_governor unset
+check $cpufreq/policy0/scaling_governor conservative
+
+# an unknown profile is rejected, and not saved
+setup
+"$helper" turbo 2>/dev/null && fail "applied an unknown profile"
+check $cpufreq/policy0/scaling_governor unset
+[ -e "$root/etc/guacamayo/cpu-profile" ] && fail "saved an unknown profile"
+
+# without arguments, the saved profile is applied again, if any
+setup
+"$helper" || fail "failed without a saved profile"
+check $cpufreq/policy0/scaling_governor unset
+
+mkdir "$root/etc/guacamayo"
+echo balanced > "$root/etc/guacamayo/cpu-profile"
+"$helper" > /dev/null || fail "failed to apply the saved profile"
+check $cpufreq/policy0/scaling_governor schedutil
+check $cpufreq/policy1/energy_performance_preference balance_performance
+check etc/guacamayo/cpu-profile balanced
+
+exit $failed
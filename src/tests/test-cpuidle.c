@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Samples the idle states of a fake sysfs, through GUACA_PROBE_ROOT.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-cpuidle.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define CPU_DIR "sys/devices/system/cpu"
+
+typedef struct
+{
+  char *root;
+} Fixture;
+
+/*
+ * Writes the file in place, rather than replacing it, as the counters are
+ * kept open between samples.
+ */
+static void
+write_file (Fixture *f, const char *name, const void *contents, gsize len)
+{
+  char *path = g_build_filename (f->root, name, NULL);
+  char *dir  = g_path_get_dirname (path);
+  FILE *file;
+
+  g_assert_cmpint (g_mkdir_with_parents (dir, 0755), ==, 0);
+  g_assert ((file = fopen (path, "w")));
+  g_assert_cmpuint (fwrite (contents, 1, len, file), ==, len);
+  fclose (file);
+
+  g_free (dir);
+  g_free (path);
+}
+
+static void
+write_attr (Fixture *f, guint cpu, guint state, const char *attr,
+            const char *value)
+{
+  char *name = g_strdup_printf (CPU_DIR "/cpu%u/cpuidle/state%u/%s",
+                                cpu, state, attr);
+
+  write_file (f, name, value, strlen (value));
+  g_free (name);
+}
+
+static void
+write_counters (Fixture *f, guint cpu, guint state, guint64 time,
+                guint64 usage)
+{
+  char buf[24];
+
+  g_snprintf (buf, sizeof (buf), "%" G_GUINT64_FORMAT "\n", time);
+  write_attr (f, cpu, state, "time", buf);
+  g_snprintf (buf, sizeof (buf), "%" G_GUINT64_FORMAT "\n", usage);
+  write_attr (f, cpu, state, "usage", buf);
+}
+
+static void
+write_qos (Fixture *f, gint32 value)
+{
+  write_file (f, "dev/cpu_dma_latency", &value, sizeof (value));
+}
+
+static void
+fixture_setup (Fixture *f, gconstpointer data)
+{
+  f->root = g_dir_make_tmp ("guaca-cpuidle-XXXXXX", NULL);
+  g_assert (f->root);
+
+  g_setenv ("GUACA_PROBE_ROOT", f->root, TRUE);
+}
+
+/*
+ * Two CPUs with a polling and a WFI state, a third without cpuidle, and
+ * the entries next to the CPUs that are not CPUs.
+ */
+static void
+fixture_setup_tree (Fixture *f, gconstpointer data)
+{
+  guint cpu;
+
+  fixture_setup (f, data);
+
+  for (cpu = 0; cpu < 2; cpu++)
+    {
+      write_attr (f, cpu, 0, "name", "POLL\n");
+      write_attr (f, cpu, 0, "latency", "0\n");
+      write_attr (f, cpu, 1, "name", "WFI\n");
+      write_attr (f, cpu, 1, "latency", "1\n");
+      write_counters (f, cpu, 0, 1000, 10);
+      write_counters (f, cpu, 1, 500000, 2000);
+    }
+
+  write_file (f, CPU_DIR "/cpu2/online", "1\n", 2);
+  write_file (f, CPU_DIR "/cpuidle/current_driver", "psci_idle\n", 10);
+  write_file (f, CPU_DIR "/cpufreq/boost", "0\n", 2);
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer data)
+{
+  char *argv[] = { "rm", "-rf", f->root, NULL };
+
+  g_assert (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+                          NULL, NULL, NULL, NULL, NULL, NULL));
+
+  g_unsetenv ("GUACA_PROBE_ROOT");
+
+  g_free (f->root);
+}
+
+/* without cpuidle there are no states, nor a limit */
+static void
+test_empty (Fixture *f, gconstpointer data)
+{
+  GuacaCpuidle      *idle = guaca_cpuidle_new ();
+  GuacaCpuidleState  states[4];
+
+  guaca_cpuidle_sample (idle);
+  guaca_cpuidle_sample (idle);
+
+  g_assert_cmpuint (guaca_cpuidle_get_n_states (idle), ==, 0);
+  g_assert_cmpuint (guaca_cpuidle_get_states (idle, states, 4), ==, 0);
+  g_assert_cmpint (guaca_cpuidle_get_qos_latency (idle), ==, -1);
+
+  guaca_cpuidle_free (idle);
+}
+
+/*
+ * The residencies are over the time between the samples, which the test
+ * can only bound; hence the ranges.
+ */
+static void
+test_residency (Fixture *f, gconstpointer data)
+{
+  GuacaCpuidle      *idle = guaca_cpuidle_new ();
+  GuacaCpuidleState  states[4];
+  gint64             t0, t1, t2, t3;
+  double             min, max;
+  guint              cpu;
+
+  g_assert_cmpuint (guaca_cpuidle_get_n_states (idle), ==, 2);
+
+  t0 = g_get_monotonic_time ();
+  guaca_cpuidle_sample (idle);
+  t1 = g_get_monotonic_time ();
+
+  /* no rates from a single sample */
+  g_assert_cmpuint (guaca_cpuidle_get_states (idle, states, 4), ==, 0);
+
+  g_usleep (100000);
+
+  /* 10 ms in POLL and 40 ms in WFI on each CPU */
+  for (cpu = 0; cpu < 2; cpu++)
+    {
+      write_counters (f, cpu, 0, 1000 + 10000, 10 + 5);
+      write_counters (f, cpu, 1, 500000 + 40000, 2000 + 20);
+    }
+
+  t2 = g_get_monotonic_time ();
+  guaca_cpuidle_sample (idle);
+  t3 = g_get_monotonic_time ();
+
+  g_assert_cmpuint (guaca_cpuidle_get_states (idle, states, 4), ==, 2);
+
+  g_assert_cmpstr (states[0].name, ==, "POLL");
+  g_assert_cmpuint (states[0].latency, ==, 0);
+  g_assert_cmpstr (states[1].name, ==, "WFI");
+  g_assert_cmpuint (states[1].latency, ==, 1);
+
+  /* summed over the two CPUs with cpuidle, and not the third */
+  min = 100.0 * 2 * 40000 / (2.0 * (t3 - t0));
+  max = 100.0 * 2 * 40000 / (2.0 * (t2 - t1));
+  g_assert_cmpfloat (states[1].residency, >=, min);
+  g_assert_cmpfloat (states[1].residency, <=, max);
+
+  min = 2 * 20 * (double) G_USEC_PER_SEC / (t3 - t0);
+  max = 2 * 20 * (double) G_USEC_PER_SEC / (t2 - t1);
+  g_assert_cmpfloat (states[1].rate, >=, min);
+  g_assert_cmpfloat (states[1].rate, <=, max);
+
+  g_assert_cmpfloat (ABS (states[1].residency - 4 * states[0].residency),
+                     <, 1e-9);
+  g_assert_cmpfloat (ABS (states[1].rate - 4 * states[0].rate), <, 1e-9);
+
+  /* a CPU that went offline and back does not count for that sample */
+  write_counters (f, 1, 1, 0, 0);
+  guaca_cpuidle_sample (idle);
+  g_assert_cmpuint (guaca_cpuidle_get_states (idle, states, 4), ==, 2);
+  g_assert_cmpfloat (states[1].residency, ==, 0.0);
+
+  guaca_cpuidle_free (idle);
+}
+
+static void
+test_qos (Fixture *f, gconstpointer data)
+{
+  GuacaCpuidle *idle;
+
+  /* the file is opened when the sampler is created */
+  write_qos (f, 20);
+  idle = guaca_cpuidle_new ();
+
+  guaca_cpuidle_sample (idle);
+  g_assert_cmpint (guaca_cpuidle_get_qos_latency (idle), ==, 20);
+
+  /* the default is no limit */
+  write_qos (f, 2000000000);
+  guaca_cpuidle_sample (idle);
+  g_assert_cmpint (guaca_cpuidle_get_qos_latency (idle), ==, -1);
+
+  guaca_cpuidle_free (idle);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/cpuidle/empty", Fixture, NULL,
+              fixture_setup, test_empty, fixture_teardown);
+  g_test_add ("/cpuidle/residency", Fixture, NULL,
+              fixture_setup_tree, test_residency, fixture_teardown);
+  g_test_add ("/cpuidle/qos", Fixture, NULL,
+              fixture_setup_tree, test_qos, fixture_teardown);
+
+  return g_test_run ();
+}
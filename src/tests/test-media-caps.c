@@ -0,0 +1,294 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Runs the media probe on a fake /dev and /sys/class/drm, through
+ * GUACA_PROBE_ROOT.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-media-caps.h"
+
+#include <string.h>
+
+typedef struct
+{
+  char      *root;
+  GMainLoop *loop;
+  gboolean   done;
+} Fixture;
+
+/*
+ * An EDID preferring 1080p60, with a CEA extension listing 1080p24 and
+ * 1080p60 as video codes and 1080p50 and 1080i50 as detailed timings.
+ */
+static void
+make_edid (guint8 *edid)
+{
+  static const guint8 header[]  = { 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0 };
+  /* 148.5 MHz, 1920 + 280 by 1080 + 45 */
+  static const guint8 p60[18]   = { 0x02, 0x3a, 0x80, 0x18, 0x71,
+                                    0x38, 0x2d, 0x40 };
+  /* 148.5 MHz, 1920 + 720 by 1080 + 45 */
+  static const guint8 p50[18]   = { 0x02, 0x3a, 0x80, 0xd0, 0x72,
+                                    0x38, 0x2d, 0x40 };
+  /* 74.25 MHz, 1920 + 720 by 540 + 22 per field, interlaced */
+  static const guint8 i50[18]   = { 0x01, 0x1d, 0x80, 0xd0, 0x72,
+                                    0x1c, 0x16, 0x20,
+                                    [17] = 0x9e };
+  /* a video data block, of VIC 32 and the native VIC 16 */
+  static const guint8 svds[]    = { 0x42, 32, 128 + 16 };
+  guint8             *cea       = edid + 128;
+
+  memset (edid, 0, 256);
+
+  memcpy (edid, header, sizeof (header));
+  memcpy (edid + 54, p60, sizeof (p60));
+  edid[126] = 1;
+
+  cea[0] = 0x02;
+  cea[1] = 3;
+  cea[2] = 4 + sizeof (svds);
+  memcpy (cea + 4, svds, sizeof (svds));
+  memcpy (cea + cea[2], p50, sizeof (p50));
+  memcpy (cea + cea[2] + 18, i50, sizeof (i50));
+}
+
+static void
+add_file (Fixture *f, const char *name, const char *contents, gssize len)
+{
+  char *path = g_build_filename (f->root, name, NULL);
+  char *dir  = g_path_get_dirname (path);
+
+  g_assert_cmpint (g_mkdir_with_parents (dir, 0755), ==, 0);
+  g_assert (g_file_set_contents (path, contents, len, NULL));
+
+  g_free (dir);
+  g_free (path);
+}
+
+static void
+fixture_setup (Fixture *f, gconstpointer data)
+{
+  f->root = g_dir_make_tmp ("guaca-media-caps-XXXXXX", NULL);
+  g_assert (f->root);
+
+  g_setenv ("GUACA_PROBE_ROOT", f->root, TRUE);
+}
+
+/*
+ * The tree with two connected displays, one with an EDID and one without,
+ * a disconnected one, and a video node that is not a V4L2 device.
+ */
+static void
+fixture_setup_tree (Fixture *f, gconstpointer data)
+{
+  guint8 edid[256];
+
+  fixture_setup (f, data);
+
+  make_edid (edid);
+
+  add_file (f, "dev/video0", "", 0);
+  add_file (f, "sys/class/drm/card0/dev", "226:0\n", -1);
+  add_file (f, "sys/class/drm/card0-HDMI-A-1/status", "connected\n", -1);
+  add_file (f, "sys/class/drm/card0-HDMI-A-1/edid",
+            (const char *) edid, sizeof (edid));
+  add_file (f, "sys/class/drm/card0-Composite-1/status", "connected\n", -1);
+  add_file (f, "sys/class/drm/card0-Composite-1/edid", "", 0);
+  add_file (f, "sys/class/drm/card0-Composite-1/modes",
+            "720x576i\n720x480i\n", -1);
+  add_file (f, "sys/class/drm/card0-DP-1/status", "disconnected\n", -1);
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer data)
+{
+  char *argv[] = { "rm", "-rf", f->root, NULL };
+
+  g_assert (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+                          NULL, NULL, NULL, NULL, NULL, NULL));
+
+  g_unsetenv ("GUACA_PROBE_ROOT");
+
+  if (f->loop)
+    g_main_loop_unref (f->loop);
+
+  g_free (f->root);
+}
+
+static const GuacaMediaDisplay *
+find_display (const GuacaMediaCaps *caps, const char *connector)
+{
+  int i;
+
+  for (i = 0; i < caps->n_displays; i++)
+    if (!strcmp (caps->displays[i].connector, connector))
+      return &caps->displays[i];
+
+  return NULL;
+}
+
+static void
+check_tree (const GuacaMediaCaps *caps)
+{
+  const GuacaMediaDisplay *hdmi, *composite;
+  int                      i, n_interlaced = 0;
+
+  g_assert_cmpint (caps->n_decoders, ==, 0);
+  g_assert_cmpint (caps->n_displays, ==, 2);
+
+  g_assert ((hdmi = find_display (caps, "HDMI-A-1")));
+  g_assert ((composite = find_display (caps, "Composite-1")));
+  g_assert (!find_display (caps, "DP-1"));
+
+  /* the VIC 16 duplicates the preferred timing */
+  g_assert_cmpint (hdmi->n_modes, ==, 4);
+  g_assert_cmpuint (hdmi->preferred.width, ==, 1920);
+  g_assert_cmpuint (hdmi->preferred.height, ==, 1080);
+  g_assert_cmpfloat (ABS (hdmi->preferred.refresh - 60.0), <, 0.01);
+
+  g_assert (guaca_media_display_has_refresh (hdmi, 24.0));
+  g_assert (guaca_media_display_has_refresh (hdmi, 23.976));
+  g_assert (guaca_media_display_has_refresh (hdmi, 50.0));
+  g_assert (!guaca_media_display_has_refresh (hdmi, 25.0));
+
+  /* the interlaced timing has the lines of a frame at the field rate */
+  for (i = 0; i < hdmi->n_modes; i++)
+    {
+      g_assert_cmpfloat (hdmi->modes[i].refresh, <, 61.0);
+
+      if (ABS (hdmi->modes[i].refresh - 74250000.0 / (2640 * 562)) < 0.001)
+        {
+          g_assert_cmpuint (hdmi->modes[i].height, ==, 1080);
+          n_interlaced++;
+        }
+    }
+
+  g_assert_cmpint (n_interlaced, ==, 1);
+
+  /* the sizes only, from the modes file */
+  g_assert_cmpint (composite->n_modes, ==, 2);
+  g_assert_cmpuint (composite->preferred.width, ==, 720);
+  g_assert_cmpuint (composite->preferred.height, ==, 576);
+  g_assert_cmpfloat (composite->preferred.refresh, ==, 0.0);
+  g_assert (!guaca_media_display_has_refresh (composite, 50.0));
+}
+
+/* a tree without any devices finds nothing, and does not fail */
+static void
+test_empty (Fixture *f, gconstpointer data)
+{
+  GuacaMediaCaps caps;
+
+  memset (&caps, 0xff, sizeof (caps));
+  guaca_media_caps_probe (&caps);
+
+  g_assert_cmpint (caps.n_decoders, ==, 0);
+  g_assert_cmpint (caps.n_displays, ==, 0);
+}
+
+static void
+test_displays (Fixture *f, gconstpointer data)
+{
+  GuacaMediaCaps caps;
+
+  guaca_media_caps_probe (&caps);
+  check_tree (&caps);
+}
+
+/* the results of probing a fake tree are not cached */
+static void
+test_no_cache (Fixture *f, gconstpointer data)
+{
+  GuacaMediaCaps caps;
+
+  g_assert (!guaca_media_caps_lookup (&caps));
+}
+
+static void
+probe_done_cb (const GuacaMediaCaps *caps, gpointer data)
+{
+  Fixture *f = data;
+
+  check_tree (caps);
+
+  f->done = TRUE;
+  g_main_loop_quit (f->loop);
+}
+
+static void
+test_async (Fixture *f, gconstpointer data)
+{
+  GuacaMediaProbe *probe;
+
+  f->loop = g_main_loop_new (NULL, FALSE);
+  probe   = guaca_media_probe_start (probe_done_cb, f);
+
+  g_main_loop_run (f->loop);
+  g_assert (f->done);
+
+  guaca_media_probe_free (probe);
+}
+
+/* a probe freed before it reports does not report afterwards */
+static void
+test_free_early (Fixture *f, gconstpointer data)
+{
+  GuacaMediaProbe *probe;
+
+  probe = guaca_media_probe_start (probe_done_cb, f);
+  guaca_media_probe_free (probe);
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  g_assert (!f->done);
+
+  /* the probe frees itself once done, without calling back either */
+  g_usleep (G_USEC_PER_SEC / 10);
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  g_assert (!f->done);
+}
+
+int
+main (int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  g_thread_init (NULL);
+#endif
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/media-caps/empty", Fixture, NULL,
+              fixture_setup, test_empty, fixture_teardown);
+  g_test_add ("/media-caps/displays", Fixture, NULL,
+              fixture_setup_tree, test_displays, fixture_teardown);
+  g_test_add ("/media-caps/no-cache", Fixture, NULL,
+              fixture_setup_tree, test_no_cache, fixture_teardown);
+  g_test_add ("/media-caps/async", Fixture, NULL,
+              fixture_setup_tree, test_async, fixture_teardown);
+  g_test_add ("/media-caps/free-early", Fixture, NULL,
+              fixture_setup_tree, test_free_early, fixture_teardown);
+
+  return g_test_run ();
+}
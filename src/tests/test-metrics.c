@@ -0,0 +1,229 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Runs the metrics server on a socket in a temporary directory and scrapes
+ * it as a local client would.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-metrics.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+typedef struct
+{
+  char         *dir;
+  char         *path;
+  GuacaMetrics *metrics;
+} Fixture;
+
+static void
+write_test_metrics (GString *out, gpointer data)
+{
+  guaca_metrics_write (out, "guacamayo_test", "gauge", "A test metric.", 42);
+}
+
+static void
+fixture_setup (Fixture *f, gconstpointer data)
+{
+  f->dir = g_dir_make_tmp ("guaca-metrics-XXXXXX", NULL);
+  g_assert (f->dir);
+
+  f->path = g_build_filename (f->dir, "metrics.sock", NULL);
+
+  f->metrics = guaca_metrics_new (f->path, 5);
+  guaca_metrics_add_source (f->metrics, write_test_metrics, NULL);
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer data)
+{
+  guaca_metrics_free (f->metrics);
+
+  g_unlink (f->path);
+  g_rmdir (f->dir);
+
+  g_free (f->path);
+  g_free (f->dir);
+}
+
+static void
+start (Fixture *f)
+{
+  GError *error = NULL;
+
+  guaca_metrics_start (f->metrics, &error);
+  g_assert_no_error (error);
+}
+
+/*
+ * Connects to the server and returns all it sends; the request is sent
+ * first, if any, and with shut_down the client closes its end right away.
+ */
+static char *
+fetch (Fixture *f, const char *request, gboolean shut_down)
+{
+  GSocket        *client;
+  GSocketAddress *address;
+  GString        *reply = g_string_new (NULL);
+  GError         *error = NULL;
+  char            buf[1024];
+  gssize          r;
+
+  client  = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                          G_SOCKET_PROTOCOL_DEFAULT, &error);
+  g_assert_no_error (error);
+
+  address = g_unix_socket_address_new (f->path);
+  g_socket_connect (client, address, NULL, &error);
+  g_assert_no_error (error);
+
+  if (request)
+    g_assert_cmpint (g_socket_send (client, request, strlen (request),
+                                    NULL, NULL), ==, strlen (request));
+
+  if (shut_down)
+    g_socket_shutdown (client, FALSE, TRUE, NULL);
+
+  while ((r = g_socket_receive (client, buf, sizeof (buf), NULL, NULL)) > 0)
+    g_string_append_len (reply, buf, r);
+
+  g_object_unref (address);
+  g_object_unref (client);
+
+  return g_string_free (reply, FALSE);
+}
+
+static void
+test_http (Fixture *f, gconstpointer data)
+{
+  char *reply;
+
+  start (f);
+  reply = fetch (f, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n", FALSE);
+
+  g_assert (g_str_has_prefix (reply, "HTTP/1.0 200 OK\r\n"));
+  g_assert (strstr (reply, "\r\n\r\n# HELP guacamayo_test A test metric.\n"));
+  g_assert (strstr (reply, "\nguacamayo_test 42\n"));
+
+  g_free (reply);
+}
+
+/* a client that sends nothing gets the text once the request times out */
+static void
+test_raw (Fixture *f, gconstpointer data)
+{
+  char *reply;
+
+  start (f);
+  reply = fetch (f, NULL, FALSE);
+
+  g_assert (g_str_has_prefix (reply, "# HELP guacamayo_test"));
+  g_assert (strstr (reply, "\nguacamayo_test 42\n"));
+
+  g_free (reply);
+}
+
+/* nor does one that closes its end without sending anything */
+static void
+test_closed (Fixture *f, gconstpointer data)
+{
+  char *reply;
+
+  start (f);
+  reply = fetch (f, NULL, TRUE);
+
+  g_assert (g_str_has_prefix (reply, "# HELP guacamayo_test"));
+
+  g_free (reply);
+}
+
+/* the socket left behind by a previous run is replaced */
+static void
+test_stale_socket (Fixture *f, gconstpointer data)
+{
+  GSocket        *stale;
+  GSocketAddress *address;
+  char           *reply;
+
+  stale   = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                          G_SOCKET_PROTOCOL_DEFAULT, NULL);
+  address = g_unix_socket_address_new (f->path);
+  g_assert (g_socket_bind (stale, address, FALSE, NULL));
+  g_socket_close (stale, NULL);
+  g_object_unref (address);
+  g_object_unref (stale);
+
+  g_assert (g_file_test (f->path, G_FILE_TEST_EXISTS));
+
+  start (f);
+  reply = fetch (f, NULL, TRUE);
+
+  g_assert (strstr (reply, "\nguacamayo_test 42\n"));
+
+  g_free (reply);
+}
+
+/* but anything that is not a socket is left alone */
+static void
+test_not_socket (Fixture *f, gconstpointer data)
+{
+  GError *error = NULL;
+  char   *contents;
+
+  g_assert (g_file_set_contents (f->path, "precious", -1, NULL));
+
+  g_assert (!guaca_metrics_start (f->metrics, &error));
+  g_assert (error);
+  g_clear_error (&error);
+
+  g_assert (g_file_get_contents (f->path, &contents, NULL, NULL));
+  g_assert_cmpstr (contents, ==, "precious");
+
+  g_free (contents);
+}
+
+int
+main (int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION (2, 36, 0)
+  g_type_init ();
+#endif
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/metrics/http", Fixture, NULL,
+              fixture_setup, test_http, fixture_teardown);
+  g_test_add ("/metrics/raw", Fixture, NULL,
+              fixture_setup, test_raw, fixture_teardown);
+  g_test_add ("/metrics/closed", Fixture, NULL,
+              fixture_setup, test_closed, fixture_teardown);
+  g_test_add ("/metrics/stale-socket", Fixture, NULL,
+              fixture_setup, test_stale_socket, fixture_teardown);
+  g_test_add ("/metrics/not-socket", Fixture, NULL,
+              fixture_setup, test_not_socket, fixture_teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Runs a few probes on the sampler and counts how often its thread wakes
+ * up, against how often the probes run.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-sampler.h"
+
+/*
+ * A probe counting its runs; its snapshots are the run count, and count
+ * their frees.
+ */
+typedef struct
+{
+  guint interval_ms;
+  guint runs;
+  guint freed;
+
+  /* of the main loop subscription reading the snapshots */
+  GuacaSamplerSub *sub;
+  GThread         *main_thread;
+  guint            seen;
+  guint            stale;
+  guint            off_main;
+} Probe;
+
+static Probe *freeing;
+
+static gpointer
+probe_run (gpointer data)
+{
+  Probe *probe = data;
+  guint *snapshot = g_new (guint, 1);
+
+  *snapshot = __atomic_add_fetch (&probe->runs, 1, __ATOMIC_RELAXED);
+
+  return snapshot;
+}
+
+static void
+probe_snapshot_free (gpointer snapshot)
+{
+  freeing->freed++;
+  g_free (snapshot);
+}
+
+static void
+probe_main (gpointer data)
+{
+  Probe       *probe = data;
+  const guint *snapshot = guaca_sampler_peek (probe->sub);
+
+  if (g_thread_self () != probe->main_thread)
+    probe->off_main++;
+
+  /* the probe ran on the same wakeup, just before */
+  if (!snapshot ||
+      *snapshot != __atomic_load_n (&probe->runs, __ATOMIC_RELAXED))
+    probe->stale++;
+
+  probe->seen++;
+}
+
+static gboolean
+quit_cb (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return FALSE;
+}
+
+static void
+run_main_loop (guint ms)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  g_timeout_add (ms, quit_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+}
+
+/*
+ * Probes at 100, 200 and 300 ms run on the same wakeups, so the thread
+ * wakes up as often as the fastest one runs: about 13 times in 1.25 s,
+ * rather than the 23 or so of a timer each.
+ */
+static void
+test_coalesce (void)
+{
+  Probe            probes[3] = { { 100 }, { 200 }, { 300 } };
+  GuacaSamplerSub *subs[3];
+  guint64          before, wakeups;
+  guint            i, runs = 0;
+
+  before = guaca_sampler_get_wakeups ();
+
+  for (i = 0; i < G_N_ELEMENTS (probes); i++)
+    subs[i] = guaca_sampler_subscribe (probes[i].interval_ms, probe_run,
+                                       &probes[i], NULL);
+
+  run_main_loop (1250);
+
+  for (i = 0; i < G_N_ELEMENTS (probes); i++)
+    guaca_sampler_unsubscribe (subs[i]);
+
+  wakeups = guaca_sampler_get_wakeups () - before;
+
+  for (i = 0; i < G_N_ELEMENTS (probes); i++)
+    runs += probes[i].runs;
+
+  g_test_message ("%" G_GUINT64_FORMAT " wakeups for %u probe runs "
+                  "(%u, %u and %u)", wakeups, runs, probes[0].runs,
+                  probes[1].runs, probes[2].runs);
+
+  /* every wakeup runs the 100 ms probe, and all of them start together */
+  g_assert_cmpuint (wakeups, ==, probes[0].runs);
+  g_assert_cmpuint (wakeups, >=, 11);
+  g_assert_cmpuint (wakeups, <=, 14);
+
+  g_assert_cmpuint (probes[1].runs, <=, (probes[0].runs + 1) / 2);
+  g_assert_cmpuint (probes[2].runs, <=, (probes[0].runs + 2) / 3);
+  g_assert_cmpuint (runs, >=, 20);
+
+  /* the thread is gone with the last subscription */
+  before = guaca_sampler_get_wakeups ();
+  g_usleep (350 * 1000);
+  g_assert_cmpuint (guaca_sampler_get_wakeups (), ==, before);
+}
+
+/*
+ * Every snapshot is freed, the replaced ones from the main loop and the
+ * last one on unsubscribing.
+ */
+static void
+test_snapshots (void)
+{
+  Probe            probe = { 100 };
+  GuacaSamplerSub *sub;
+  const guint     *snapshot;
+
+  freeing = &probe;
+
+  sub = guaca_sampler_subscribe (probe.interval_ms, probe_run, &probe,
+                                 probe_snapshot_free);
+
+  run_main_loop (450);
+
+  g_assert ((snapshot = guaca_sampler_peek (sub)));
+  g_assert_cmpuint (*snapshot, ==, probe.runs);
+  g_assert_cmpuint (probe.runs, >=, 3);
+
+  guaca_sampler_unsubscribe (sub);
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  g_assert_cmpuint (probe.freed, ==, probe.runs);
+
+  freeing = NULL;
+}
+
+/*
+ * A main loop subscription runs on the main loop, right after the probes
+ * of the wakeup, and does not wake the thread up on its own.
+ */
+static void
+test_main (void)
+{
+  Probe            probe = { 200 };
+  GuacaSamplerSub *sub;
+  guint64          before, wakeups;
+
+  probe.main_thread = g_thread_self ();
+
+  before = guaca_sampler_get_wakeups ();
+
+  probe.sub = guaca_sampler_subscribe (probe.interval_ms, probe_run, &probe,
+                                       NULL);
+  sub = guaca_sampler_subscribe_main (probe.interval_ms, probe_main, &probe);
+
+  run_main_loop (1050);
+
+  guaca_sampler_unsubscribe (sub);
+  guaca_sampler_unsubscribe (probe.sub);
+
+  wakeups = guaca_sampler_get_wakeups () - before;
+
+  g_assert_cmpuint (probe.seen, >=, 4);
+  g_assert_cmpuint (probe.seen, <=, probe.runs);
+  g_assert_cmpuint (probe.stale, ==, 0);
+  g_assert_cmpuint (probe.off_main, ==, 0);
+  g_assert_cmpuint (wakeups, ==, probe.runs);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/sampler/coalesce", test_coalesce);
+  g_test_add_func ("/sampler/snapshots", test_snapshots);
+  g_test_add_func ("/sampler/main", test_main);
+
+  return g_test_run ();
+}
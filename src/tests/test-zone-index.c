@@ -0,0 +1,384 @@
+/*
+ * Copyright © 2012, sleep(5) ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses>
+ */
+
+
+/*
+ * Checks the ISO 6709 parser, and the nearest zone queries of the index
+ * against a linear search over the zones of the system zone.tab.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "guaca-zone-index.h"
+
+#include <math.h>
+#include <string.h>
+
+#define ZONE_TAB   "/usr/share/zoneinfo/zone.tab"
+#define N_MATCHES  5
+#define N_QUERIES  2000
+
+#define EARTH_RADIUS_KM 6371.0
+
+typedef struct
+{
+  char    *contents;
+  TzEntry *entries;
+  guint    n_entries;
+} Fixture;
+
+/*
+ * Loads the zones, keeping only the fields the index looks at; the fields
+ * are split in place, so the zone names point into the contents.
+ */
+static void
+fixture_setup (Fixture *f, gconstpointer data)
+{
+  char  *line, *next;
+  guint  n_lines = 1;
+
+  if (!g_file_get_contents (ZONE_TAB, &f->contents, NULL, NULL))
+    return;
+
+  for (line = f->contents; (line = strchr (line, '\n')); line++)
+    n_lines++;
+
+  f->entries = g_new0 (TzEntry, n_lines);
+
+  for (line = f->contents; line; line = next)
+    {
+      TzEntry *entry = &f->entries[f->n_entries];
+      char    *coords, *zone, *end;
+
+      if ((next = strchr (line, '\n')))
+        *next++ = 0;
+
+      if (*line == '#' || !(coords = strchr (line, '\t')))
+        continue;
+
+      *coords++ = 0;
+
+      if (!(zone = strchr (coords, '\t')))
+        continue;
+
+      *zone++ = 0;
+
+      if ((end = strchr (zone, '\t')))
+        *end = 0;
+
+      if (!guaca_zone_parse_iso6709 (coords, &entry->latitude,
+                                     &entry->longitude))
+        continue;
+
+      entry->country = line;
+      entry->zone    = zone;
+      f->n_entries++;
+    }
+}
+
+static void
+fixture_teardown (Fixture *f, gconstpointer data)
+{
+  g_free (f->entries);
+  g_free (f->contents);
+}
+
+static double
+distance (double lat1, double lon1, double lat2, double lon2)
+{
+  double phi1 = lat1 * G_PI / 180.0, phi2 = lat2 * G_PI / 180.0;
+  double dphi = phi2 - phi1;
+  double dlam = (lon2 - lon1) * G_PI / 180.0;
+  double a    = sin (dphi / 2) * sin (dphi / 2) +
+                cos (phi1) * cos (phi2) * sin (dlam / 2) * sin (dlam / 2);
+
+  return 2.0 * EARTH_RADIUS_KM * asin (MIN (1.0, sqrt (a)));
+}
+
+/*
+ * The n nearest entries, by insertion into a sorted array, using the
+ * haversine formula rather than the chords the index works with.
+ */
+static guint
+nearest_linear (const TzEntry *entries, guint n_entries,
+                double latitude, double longitude,
+                guint *matches, double *distances, guint n_matches)
+{
+  guint i, j, n = 0;
+
+  for (i = 0; i < n_entries; i++)
+    {
+      double d = distance (latitude, longitude,
+                           entries[i].latitude, entries[i].longitude);
+
+      if (n == n_matches && d >= distances[n - 1])
+        continue;
+
+      if (n < n_matches)
+        n++;
+
+      for (j = n - 1; j > 0 && distances[j - 1] > d; j--)
+        {
+          matches[j]   = matches[j - 1];
+          distances[j] = distances[j - 1];
+        }
+
+      matches[j]   = i;
+      distances[j] = d;
+    }
+
+  return n;
+}
+
+/*
+ * The index keeps single precision vectors, so it may order two zones at
+ * nearly the same distance either way; the distances have to agree, and
+ * the zones wherever the distances are told apart.
+ */
+static void
+check_nearest (const TzEntry *entries, guint n_entries, GuacaZoneIndex *index,
+               double latitude, double longitude)
+{
+  guint  matches[N_MATCHES], expected[N_MATCHES];
+  double distances[N_MATCHES], expected_distances[N_MATCHES];
+  guint  i, n;
+
+  n = guaca_zone_index_nearest (index, latitude, longitude,
+                                matches, distances, N_MATCHES);
+
+  g_assert_cmpuint (n, ==, nearest_linear (entries, n_entries,
+                                           latitude, longitude,
+                                           expected, expected_distances,
+                                           N_MATCHES));
+
+  for (i = 0; i < n; i++)
+    {
+      g_assert_cmpfloat (fabs (distances[i] - expected_distances[i]), <, 0.5);
+
+      if ((i == 0 || expected_distances[i] - expected_distances[i - 1] > 0.5) &&
+          (i == n - 1 || expected_distances[i + 1] - expected_distances[i] > 0.5))
+        g_assert_cmpuint (matches[i], ==, expected[i]);
+    }
+}
+
+static void
+test_parse (void)
+{
+  double lat, lon;
+
+  /* Europe/London, +513030-0000731 */
+  g_assert (guaca_zone_parse_iso6709 ("+513030-0000731", &lat, &lon));
+  g_assert_cmpfloat (fabs (lat - (51 + 30 / 60.0 + 30 / 3600.0)), <, 1e-9);
+  g_assert_cmpfloat (fabs (lon + (7 / 60.0 + 31 / 3600.0)), <, 1e-9);
+
+  /* Pacific/Fiji, -1808+17825 */
+  g_assert (guaca_zone_parse_iso6709 ("-1808+17825", &lat, &lon));
+  g_assert_cmpfloat (fabs (lat + (18 + 8 / 60.0)), <, 1e-9);
+  g_assert_cmpfloat (fabs (lon - (178 + 25 / 60.0)), <, 1e-9);
+
+  /* the forms can be mixed */
+  g_assert (guaca_zone_parse_iso6709 ("-9000+1800000", &lat, &lon));
+  g_assert_cmpfloat (lat, ==, -90.0);
+  g_assert_cmpfloat (lon, ==, 180.0);
+
+  /* missing signs */
+  g_assert (!guaca_zone_parse_iso6709 ("5130-00007", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+513000007", &lat, &lon));
+
+  /* wrong numbers of digits */
+  g_assert (!guaca_zone_parse_iso6709 ("+513-00007", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+51303-00007", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130-0007", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130-000073", &lat, &lon));
+
+  /* truncated, or trailing junk */
+  g_assert (!guaca_zone_parse_iso6709 ("", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130-", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130-00007 ", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+5130-00007+", &lat, &lon));
+  g_assert (!guaca_zone_parse_iso6709 ("+51x0-00007", &lat, &lon));
+}
+
+/*
+ * A few zones either side of the date line and around the poles, where
+ * the order is wrong if the index compares latitudes and longitudes.
+ */
+static void
+test_wrap (void)
+{
+  static const TzEntry entries[] = {
+    { .latitude =   0.0, .longitude =  179.0 },
+    { .latitude =   0.0, .longitude = -179.0 },
+    { .latitude =   0.0, .longitude =  170.0 },
+    { .latitude =  89.0, .longitude =    0.0 },
+    { .latitude =  89.0, .longitude =  180.0 },
+    { .latitude =  80.0, .longitude =   90.0 },
+    { .latitude = -89.0, .longitude =  -90.0 },
+    { .latitude = -85.0, .longitude =   90.0 },
+  };
+  GuacaZoneIndex *index = guaca_zone_index_new (entries,
+                                                G_N_ELEMENTS (entries));
+  guint           matches[3];
+  double          distances[3];
+
+  g_assert_cmpuint (guaca_zone_index_nearest (index, 0.0, -179.9,
+                                              matches, distances, 3), ==, 3);
+  g_assert_cmpuint (matches[0], ==, 1);
+  g_assert_cmpuint (matches[1], ==, 0);
+  g_assert_cmpuint (matches[2], ==, 2);
+  g_assert_cmpfloat (fabs (distances[0] - 0.9 * G_PI * EARTH_RADIUS_KM / 180),
+                     <, 0.5);
+
+  /* across the pole, 1.5 degrees away, rather than the one at 80N */
+  g_assert_cmpuint (guaca_zone_index_nearest (index, 89.5, 180.0,
+                                              matches, distances, 3), ==, 3);
+  g_assert_cmpuint (matches[0], ==, 4);
+  g_assert_cmpuint (matches[1], ==, 3);
+  g_assert_cmpuint (matches[2], ==, 5);
+
+  /* at the pole the longitude does not matter */
+  g_assert_cmpuint (guaca_zone_index_nearest (index, -90.0, 123.0,
+                                              matches, distances, 2), ==, 2);
+  g_assert_cmpuint (matches[0], ==, 6);
+  g_assert_cmpuint (matches[1], ==, 7);
+  g_assert_cmpfloat (fabs (distances[0] - G_PI * EARTH_RADIUS_KM / 180),
+                     <, 0.5);
+
+  /* nothing asked for */
+  g_assert_cmpuint (guaca_zone_index_nearest (index, 0.0, 0.0, matches,
+                                              NULL, 0), ==, 0);
+
+  guaca_zone_index_free (index);
+
+  /* fewer zones than asked for */
+  index = guaca_zone_index_new (entries, 2);
+  g_assert_cmpuint (guaca_zone_index_nearest (index, 0.0, 0.0,
+                                              matches, distances, 3), ==, 2);
+  guaca_zone_index_free (index);
+}
+
+static void
+test_nearest (Fixture *f, gconstpointer data)
+{
+  static const double points[][2] = {
+    {   0.0,  180.0 }, {   0.0, -180.0 }, { -16.0,  179.9 },
+    { -16.0, -179.9 }, {  65.0,  179.99 }, {  65.0, -179.99 },
+    {  51.5,    0.0 }, {  90.0,    0.0 }, {  90.0,   90.0 },
+    { -90.0,    0.0 }, { -90.0, -135.0 }, {  89.9, -179.9 },
+    { -89.9,  179.9 }, { -77.8,  166.7 },
+  };
+  GuacaZoneIndex *index;
+  GRand          *rand;
+  guint           i;
+
+  if (!f->n_entries)
+    {
+      g_test_message ("no zones in " ZONE_TAB);
+      return;
+    }
+
+  index = guaca_zone_index_new (f->entries, f->n_entries);
+
+  for (i = 0; i < G_N_ELEMENTS (points); i++)
+    check_nearest (f->entries, f->n_entries, index,
+                   points[i][0], points[i][1]);
+
+  /* uniform over the sphere, rather than over the latitudes */
+  rand = g_rand_new_with_seed (6709);
+
+  for (i = 0; i < N_QUERIES; i++)
+    check_nearest (f->entries, f->n_entries, index,
+                   asin (g_rand_double_range (rand, -1.0, 1.0)) * 180 / G_PI,
+                   g_rand_double_range (rand, -180.0, 180.0));
+
+  g_rand_free (rand);
+  guaca_zone_index_free (index);
+}
+
+static void
+test_perf (Fixture *f, gconstpointer data)
+{
+  GuacaZoneIndex *index;
+  GTimer         *timer;
+  GRand          *rand;
+  guint           matches[N_MATCHES];
+  double          distances[N_MATCHES];
+  double          elapsed;
+  guint           i, runs = 100, queries = 100000;
+
+  if (!g_test_perf () || !f->n_entries)
+    return;
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < runs; i++)
+    guaca_zone_index_free (guaca_zone_index_new (f->entries, f->n_entries));
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_minimized_result (elapsed * 1e6 / runs,
+                           "index of %u zones built in %.1f us",
+                           f->n_entries, elapsed * 1e6 / runs);
+
+  index = guaca_zone_index_new (f->entries, f->n_entries);
+  rand  = g_rand_new_with_seed (6709);
+
+  g_timer_start (timer);
+
+  for (i = 0; i < queries; i++)
+    guaca_zone_index_nearest (index,
+                              g_rand_double_range (rand, -90.0, 90.0),
+                              g_rand_double_range (rand, -180.0, 180.0),
+                              matches, distances, N_MATCHES);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_minimized_result (elapsed * 1e6 / queries,
+                           "%u nearest zones found in %.2f us",
+                           N_MATCHES, elapsed * 1e6 / queries);
+
+  g_timer_start (timer);
+
+  for (i = 0; i < queries / 10; i++)
+    nearest_linear (f->entries, f->n_entries,
+                    g_rand_double_range (rand, -90.0, 90.0),
+                    g_rand_double_range (rand, -180.0, 180.0),
+                    matches, distances, N_MATCHES);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_message ("against %.2f us for a linear search",
+                  elapsed * 1e6 / (queries / 10));
+
+  g_rand_free (rand);
+  g_timer_destroy (timer);
+  guaca_zone_index_free (index);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/zone-index/parse", test_parse);
+  g_test_add_func ("/zone-index/wrap", test_wrap);
+  g_test_add ("/zone-index/nearest", Fixture, NULL,
+              fixture_setup, test_nearest, fixture_teardown);
+  g_test_add ("/zone-index/perf", Fixture, NULL,
+              fixture_setup, test_perf, fixture_teardown);
+
+  return g_test_run ();
+}